@@ -0,0 +1,465 @@
+#include "BVH.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+namespace
+{
+	// Number of buckets used when evaluating the SAH
+	const int BinCount = 16;
+
+	// Largest leaf we'll accept when splitting isn't worth it
+	const unsigned int MaxSAHLeafSize = 16;
+
+	// Past this depth we stop trusting the SAH and split at the
+	// median, which keeps the tree shallow enough for StackSize
+	const int MaxSAHDepth = 64;
+	const int StackSize = 128;
+
+	float Axis(const XMFLOAT3& v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+}
+
+BVH::BVH(unsigned int maxLeafSize)
+	: maxLeafSize(maxLeafSize < 1 ? 1 : maxLeafSize),
+	refitStamp(1)
+{
+}
+
+// --------------------------------------------------------
+// Rebuilds the whole tree from scratch
+//
+// itemBounds - world space box of each item, indexed by item
+// --------------------------------------------------------
+void BVH::Build(const std::vector<AABB>& itemBounds)
+{
+	items = itemBounds;
+	unsigned int count = (unsigned int)items.size();
+
+	nodes.clear();
+	nodes.reserve(count > 0 ? count * 2 : 1);
+	dirtyLeaves.clear();
+
+	buildItems.resize(count);
+	itemIndices.resize(count);
+	itemLeaf.assign(count, -1);
+	for (unsigned int i = 0; i < count; i++)
+		buildItems[i] = { items[i], Bounds::Center(items[i]), i };
+
+	if (count > 0)
+		BuildRecursive(0, count, -1, 0);
+
+	// Leaves reference items through itemIndices from here on
+	for (unsigned int i = 0; i < count; i++)
+		itemIndices[i] = buildItems[i].Index;
+	buildItems.clear();
+	buildItems.shrink_to_fit();
+
+	leafStamp.assign(nodes.size(), 0);
+}
+
+// --------------------------------------------------------
+// Builds the subtree for itemIndices[first, first + count)
+// and returns the index of its root node
+//
+// Works on buildItems, and records leaves in itemLeaf
+// --------------------------------------------------------
+int BVH::BuildRecursive(unsigned int first, unsigned int count, int parent, int depth)
+{
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back({});
+
+	// Bounds of the items and of their centers
+	AABB bounds = Bounds::Empty();
+	AABB centerBounds = Bounds::Empty();
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		bounds = Bounds::Merge(bounds, buildItems[i].Bounds);
+		centerBounds = Bounds::Merge(centerBounds, buildItems[i].Center);
+	}
+
+	BVHNode node = {};
+	node.Bounds = bounds;
+	node.Parent = parent;
+	node.Left = -1;
+	node.Right = -1;
+	node.First = first;
+	node.Count = count;
+
+	if (count <= maxLeafSize)
+	{
+		nodes[nodeIndex] = node;
+		for (unsigned int i = first; i < first + count; i++)
+			itemLeaf[buildItems[i].Index] = nodeIndex;
+		return nodeIndex;
+	}
+
+	// Split along the axis where the centers are most spread out
+	float extent[3] = {
+		centerBounds.Max.x - centerBounds.Min.x,
+		centerBounds.Max.y - centerBounds.Min.y,
+		centerBounds.Max.z - centerBounds.Min.z };
+	int axis = 0;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	// Stays at first unless the SAH picks a split
+	unsigned int mid = first;
+	if (extent[axis] > 0 && depth < MaxSAHDepth)
+	{
+		// Drop each item into a bin based on its center
+		unsigned int binCounts[BinCount] = {};
+		AABB binBounds[BinCount];
+		for (int b = 0; b < BinCount; b++)
+			binBounds[b] = Bounds::Empty();
+
+		float axisMin = Axis(centerBounds.Min, axis);
+		float scale = BinCount / extent[axis];
+		auto binOf = [&](const BuildItem& item)
+			{
+				int b = (int)((Axis(item.Center, axis) - axisMin) * scale);
+				return b < BinCount ? b : BinCount - 1;
+			};
+
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			int b = binOf(buildItems[i]);
+			binCounts[b]++;
+			binBounds[b] = Bounds::Merge(binBounds[b], buildItems[i].Bounds);
+		}
+
+		// Sweep from the right to get the cost of everything past each split
+		float rightArea[BinCount] = {};
+		unsigned int rightCount[BinCount] = {};
+		AABB accum = Bounds::Empty();
+		unsigned int accumCount = 0;
+		for (int b = BinCount - 1; b > 0; b--)
+		{
+			accum = Bounds::Merge(accum, binBounds[b]);
+			accumCount += binCounts[b];
+			rightArea[b] = Bounds::SurfaceArea(accum);
+			rightCount[b] = accumCount;
+		}
+
+		// Then from the left to find the cheapest split
+		float bestCost = FLT_MAX;
+		int bestSplit = -1;
+		accum = Bounds::Empty();
+		accumCount = 0;
+		for (int b = 0; b < BinCount - 1; b++)
+		{
+			accum = Bounds::Merge(accum, binBounds[b]);
+			accumCount += binCounts[b];
+			if (accumCount == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			float cost = accumCount * Bounds::SurfaceArea(accum) + rightCount[b + 1] * rightArea[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		// Is a leaf cheaper than splitting?
+		float leafCost = count * Bounds::SurfaceArea(bounds);
+		if (count <= MaxSAHLeafSize && (bestSplit < 0 || bestCost >= leafCost))
+		{
+			nodes[nodeIndex] = node;
+			for (unsigned int i = first; i < first + count; i++)
+				itemLeaf[buildItems[i].Index] = nodeIndex;
+			return nodeIndex;
+		}
+
+		if (bestSplit >= 0)
+		{
+			BuildItem* split = std::partition(
+				buildItems.data() + first,
+				buildItems.data() + first + count,
+				[&](const BuildItem& item) { return binOf(item) <= bestSplit; });
+			mid = (unsigned int)(split - buildItems.data());
+		}
+	}
+
+	// Fall back to a median split along the axis if the SAH
+	// wasn't used or couldn't separate anything (e.g. many
+	// items with the same center)
+	if (mid == first || mid == first + count)
+	{
+		mid = first + count / 2;
+		std::nth_element(
+			buildItems.begin() + first,
+			buildItems.begin() + mid,
+			buildItems.begin() + first + count,
+			[&](const BuildItem& a, const BuildItem& b) { return Axis(a.Center, axis) < Axis(b.Center, axis); });
+	}
+
+	node.Count = 0;
+	nodes[nodeIndex] = node;
+
+	// Note: nodes may reallocate during these calls, so
+	// don't hold references across them
+	int left = BuildRecursive(first, mid - first, nodeIndex, depth + 1);
+	int right = BuildRecursive(mid, first + count - mid, nodeIndex, depth + 1);
+	nodes[nodeIndex].Left = left;
+	nodes[nodeIndex].Right = right;
+	return nodeIndex;
+}
+
+// --------------------------------------------------------
+// Changes the bounds of a single item - the tree itself
+// isn't updated until Refit() is called
+// --------------------------------------------------------
+void BVH::UpdateItem(unsigned int item, const AABB& bounds)
+{
+	if (item >= items.size())
+		return;
+
+	items[item] = bounds;
+
+	int leaf = itemLeaf[item];
+	if (leafStamp[leaf] != refitStamp)
+	{
+		leafStamp[leaf] = refitStamp;
+		dirtyLeaves.push_back(leaf);
+	}
+}
+
+// --------------------------------------------------------
+// Updates the bounds of every node above an item that has
+// changed since the last refit.  Each walk stops as soon as
+// a node's bounds come out the same as before.
+// --------------------------------------------------------
+void BVH::Refit()
+{
+	for (int leaf : dirtyLeaves)
+	{
+		nodes[leaf].Bounds = LeafBounds(nodes[leaf]);
+
+		int n = nodes[leaf].Parent;
+		while (n >= 0)
+		{
+			BVHNode& node = nodes[n];
+			AABB merged = Bounds::Merge(nodes[node.Left].Bounds, nodes[node.Right].Bounds);
+			if (Bounds::Equal(merged, node.Bounds))
+				break;
+
+			node.Bounds = merged;
+			n = node.Parent;
+		}
+	}
+
+	dirtyLeaves.clear();
+	refitStamp++;
+}
+
+AABB BVH::LeafBounds(const BVHNode& node) const
+{
+	AABB bounds = Bounds::Empty();
+	for (unsigned int i = node.First; i < node.First + node.Count; i++)
+		bounds = Bounds::Merge(bounds, items[itemIndices[i]]);
+	return bounds;
+}
+
+// --------------------------------------------------------
+// Adds every item below the given node, without any tests
+// --------------------------------------------------------
+void BVH::CollectItems(int node, std::vector<unsigned int>& results) const
+{
+	int stack[StackSize];
+	int top = 0;
+	stack[top++] = node;
+	while (top > 0)
+	{
+		const BVHNode& n = nodes[stack[--top]];
+		if (n.Count > 0)
+		{
+			results.insert(results.end(), itemIndices.begin() + n.First, itemIndices.begin() + n.First + n.Count);
+			continue;
+		}
+		stack[top++] = n.Left;
+		stack[top++] = n.Right;
+	}
+}
+
+// --------------------------------------------------------
+// Finds all items whose boxes are at least partially inside
+// the frustum.  Subtrees entirely inside are added without
+// testing their children.
+// --------------------------------------------------------
+void BVH::QueryFrustum(const Frustum& frustum, std::vector<unsigned int>& results) const
+{
+	if (nodes.empty())
+		return;
+
+	int stack[StackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		int index = stack[--top];
+		const BVHNode& n = nodes[index];
+
+		Bounds::Containment c = Bounds::TestFrustum(n.Bounds, frustum);
+		if (c == Bounds::Containment::Outside)
+			continue;
+
+		if (c == Bounds::Containment::Inside)
+		{
+			CollectItems(index, results);
+			continue;
+		}
+
+		if (n.Count > 0)
+		{
+			for (unsigned int i = n.First; i < n.First + n.Count; i++)
+			{
+				unsigned int item = itemIndices[i];
+				if (Bounds::TestFrustum(items[item], frustum) != Bounds::Containment::Outside)
+					results.push_back(item);
+			}
+			continue;
+		}
+
+		stack[top++] = n.Left;
+		stack[top++] = n.Right;
+	}
+}
+
+// --------------------------------------------------------
+// Finds all items whose boxes overlap the given box
+// --------------------------------------------------------
+void BVH::QueryAABB(const AABB& box, std::vector<unsigned int>& results) const
+{
+	if (nodes.empty())
+		return;
+
+	int stack[StackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BVHNode& n = nodes[stack[--top]];
+		if (!Bounds::Overlaps(n.Bounds, box))
+			continue;
+
+		if (n.Count > 0)
+		{
+			for (unsigned int i = n.First; i < n.First + n.Count; i++)
+			{
+				unsigned int item = itemIndices[i];
+				if (Bounds::Overlaps(items[item], box))
+					results.push_back(item);
+			}
+			continue;
+		}
+
+		stack[top++] = n.Left;
+		stack[top++] = n.Right;
+	}
+}
+
+// --------------------------------------------------------
+// Finds all items whose boxes overlap the given sphere
+// --------------------------------------------------------
+void BVH::QuerySphere(const XMFLOAT3& center, float radius, std::vector<unsigned int>& results) const
+{
+	if (nodes.empty())
+		return;
+
+	int stack[StackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BVHNode& n = nodes[stack[--top]];
+		if (!Bounds::OverlapsSphere(n.Bounds, center, radius))
+			continue;
+
+		if (n.Count > 0)
+		{
+			for (unsigned int i = n.First; i < n.First + n.Count; i++)
+			{
+				unsigned int item = itemIndices[i];
+				if (Bounds::OverlapsSphere(items[item], center, radius))
+					results.push_back(item);
+			}
+			continue;
+		}
+
+		stack[top++] = n.Left;
+		stack[top++] = n.Right;
+	}
+}
+
+// --------------------------------------------------------
+// Finds the item whose box is hit first along the ray
+//
+// ray         - Origin and (not necessarily normalized) direction
+// maxDistance - Ignore hits further than this, in units of direction
+// hitDistance - Optional, receives the distance to the hit
+//
+// Returns the item index, or -1 if nothing was hit
+// --------------------------------------------------------
+int BVH::RayCast(const Ray& ray, float maxDistance, float* hitDistance) const
+{
+	if (nodes.empty())
+		return -1;
+
+	XMFLOAT3 invDir(
+		1.0f / ray.Direction.x,
+		1.0f / ray.Direction.y,
+		1.0f / ray.Direction.z);
+
+	int bestItem = -1;
+	float bestT = maxDistance;
+
+	float t = 0;
+	if (!Bounds::IntersectRay(nodes[0].Bounds, ray, invDir, bestT, t))
+		return -1;
+
+	int stack[StackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BVHNode& n = nodes[stack[--top]];
+
+		if (n.Count > 0)
+		{
+			for (unsigned int i = n.First; i < n.First + n.Count; i++)
+			{
+				unsigned int item = itemIndices[i];
+				if (Bounds::IntersectRay(items[item], ray, invDir, bestT, t) && t < bestT)
+				{
+					bestT = t;
+					bestItem = (int)item;
+				}
+			}
+			continue;
+		}
+
+		// Visit the closer child first so bestT shrinks sooner
+		float tLeft = 0, tRight = 0;
+		bool hitLeft = Bounds::IntersectRay(nodes[n.Left].Bounds, ray, invDir, bestT, tLeft);
+		bool hitRight = Bounds::IntersectRay(nodes[n.Right].Bounds, ray, invDir, bestT, tRight);
+		if (hitLeft && hitRight)
+		{
+			if (tLeft < tRight)
+			{
+				stack[top++] = n.Right;
+				stack[top++] = n.Left;
+			}
+			else
+			{
+				stack[top++] = n.Left;
+				stack[top++] = n.Right;
+			}
+		}
+		else if (hitLeft) stack[top++] = n.Left;
+		else if (hitRight) stack[top++] = n.Right;
+	}
+
+	if (hitDistance && bestItem >= 0)
+		*hitDistance = bestT;
+	return bestItem;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "Bounds.h"
+#include <vector>
+
+// --------------------------------------------------------
+// A single node of the BVH
+// - Leaves have Count > 0 and reference Count items starting
+//   at First in the item index list
+// - Interior nodes have Count == 0 and two children
+// --------------------------------------------------------
+struct BVHNode
+{
+	AABB Bounds;
+	int Left;
+	int Right;
+	int Parent;
+	unsigned int First;
+	unsigned int Count;
+};
+
+// --------------------------------------------------------
+// Bounding volume hierarchy over a set of world space boxes
+// (one per entity, identified by their index)
+//
+// - Built top down with a binned surface area heuristic
+// - When items move, call UpdateItem() for each of them and
+//   then Refit(), which only walks the paths above those items
+// - Refitting keeps the tree valid but not optimal, so call
+//   Build() again after large changes
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class BVH
+{
+public:
+	BVH(unsigned int maxLeafSize = 4);
+
+	void Build(const std::vector<AABB>& itemBounds);
+	void UpdateItem(unsigned int item, const AABB& bounds);
+	void Refit();
+
+	// Queries - results are appended to the output list
+	void QueryFrustum(const Frustum& frustum, std::vector<unsigned int>& results) const;
+	void QueryAABB(const AABB& box, std::vector<unsigned int>& results) const;
+	void QuerySphere(const DirectX::XMFLOAT3& center, float radius, std::vector<unsigned int>& results) const;
+
+	// Closest item whose box is hit by the ray, or -1
+	int RayCast(const Ray& ray, float maxDistance, float* hitDistance = 0) const;
+
+	unsigned int GetItemCount() const { return (unsigned int)items.size(); }
+	unsigned int GetNodeCount() const { return (unsigned int)nodes.size(); }
+	const AABB& GetItemBounds(unsigned int item) const { return items[item]; }
+
+private:
+	int BuildRecursive(unsigned int first, unsigned int count, int parent, int depth);
+	void CollectItems(int node, std::vector<unsigned int>& results) const;
+	AABB LeafBounds(const BVHNode& node) const;
+
+	unsigned int maxLeafSize;
+
+	std::vector<BVHNode> nodes;
+	std::vector<AABB> items;					// World bounds per item
+
+	// Items are partitioned as packed copies during a build, so
+	// each level of the build is a linear pass over memory
+	struct BuildItem
+	{
+		AABB Bounds;
+		DirectX::XMFLOAT3 Center;
+		unsigned int Index;
+	};
+	std::vector<BuildItem> buildItems;
+	std::vector<unsigned int> itemIndices;		// Leaf ranges index into this
+	std::vector<int> itemLeaf;					// Which leaf holds each item
+	std::vector<int> dirtyLeaves;				// Leaves touched since the last Refit()
+	std::vector<unsigned int> leafStamp;		// Avoids listing a leaf twice
+	unsigned int refitStamp;
+};
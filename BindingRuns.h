@@ -0,0 +1,33 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// --------------------------------------------------------
+// Resources resolved to shader registers, grouped so that
+// each run of consecutive slots is bound with a single call
+// --------------------------------------------------------
+struct BindingRun
+{
+	unsigned int FirstSlot;
+	unsigned int Count;
+	unsigned int Offset;	// Into the matching table
+};
+
+// Sorts (slot, resource) pairs and splits them into runs
+// of consecutive slots, backed by one flat table
+template<typename T>
+void BuildBindingRuns(std::vector<std::pair<unsigned int, T*>>& bound, std::vector<T*>& table, std::vector<BindingRun>& runs)
+{
+	std::sort(bound.begin(), bound.end());
+
+	table.clear();
+	runs.clear();
+	for (auto& b : bound)
+	{
+		if (runs.empty() || runs.back().FirstSlot + runs.back().Count != b.first)
+			runs.push_back({ b.first, 0, (unsigned int)table.size() });
+		runs.back().Count++;
+		table.push_back(b.second);
+	}
+}
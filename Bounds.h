@@ -0,0 +1,188 @@
+#pragma once
+#include <DirectXMath.h>
+#include <cfloat>
+#include <cmath>
+
+// --------------------------------------------------------
+// Simple bounding volume types used for culling and picking
+// - Plain floats (no XMVECTOR) so they can be stored in
+//   large arrays without alignment concerns
+// --------------------------------------------------------
+struct AABB
+{
+	DirectX::XMFLOAT3 Min;
+	DirectX::XMFLOAT3 Max;
+};
+
+struct Ray
+{
+	DirectX::XMFLOAT3 Origin;
+	DirectX::XMFLOAT3 Direction;
+};
+
+// Planes are (normal, d) with normals pointing into the frustum
+struct Frustum
+{
+	DirectX::XMFLOAT4 Planes[6];
+};
+
+namespace Bounds
+{
+	// An "inside out" box that any Merge() will overwrite
+	inline AABB Empty()
+	{
+		return { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	}
+
+	inline AABB Merge(const AABB& a, const AABB& b)
+	{
+		return {
+			{ fminf(a.Min.x, b.Min.x), fminf(a.Min.y, b.Min.y), fminf(a.Min.z, b.Min.z) },
+			{ fmaxf(a.Max.x, b.Max.x), fmaxf(a.Max.y, b.Max.y), fmaxf(a.Max.z, b.Max.z) } };
+	}
+
+	inline AABB Merge(const AABB& a, const DirectX::XMFLOAT3& p)
+	{
+		return {
+			{ fminf(a.Min.x, p.x), fminf(a.Min.y, p.y), fminf(a.Min.z, p.z) },
+			{ fmaxf(a.Max.x, p.x), fmaxf(a.Max.y, p.y), fmaxf(a.Max.z, p.z) } };
+	}
+
+	inline bool Equal(const AABB& a, const AABB& b)
+	{
+		return
+			a.Min.x == b.Min.x && a.Min.y == b.Min.y && a.Min.z == b.Min.z &&
+			a.Max.x == b.Max.x && a.Max.y == b.Max.y && a.Max.z == b.Max.z;
+	}
+
+	inline DirectX::XMFLOAT3 Center(const AABB& a)
+	{
+		return { (a.Min.x + a.Max.x) * 0.5f, (a.Min.y + a.Max.y) * 0.5f, (a.Min.z + a.Max.z) * 0.5f };
+	}
+
+	inline float SurfaceArea(const AABB& a)
+	{
+		float x = a.Max.x - a.Min.x;
+		float y = a.Max.y - a.Min.y;
+		float z = a.Max.z - a.Min.z;
+		if (x < 0 || y < 0 || z < 0) return 0.0f;
+		return 2.0f * (x * y + y * z + z * x);
+	}
+
+	inline bool Overlaps(const AABB& a, const AABB& b)
+	{
+		return
+			a.Min.x <= b.Max.x && a.Max.x >= b.Min.x &&
+			a.Min.y <= b.Max.y && a.Max.y >= b.Min.y &&
+			a.Min.z <= b.Max.z && a.Max.z >= b.Min.z;
+	}
+
+	inline bool OverlapsSphere(const AABB& a, const DirectX::XMFLOAT3& center, float radius)
+	{
+		// Distance from the sphere center to the closest point on the box
+		float dx = fmaxf(fmaxf(a.Min.x - center.x, 0.0f), center.x - a.Max.x);
+		float dy = fmaxf(fmaxf(a.Min.y - center.y, 0.0f), center.y - a.Max.y);
+		float dz = fmaxf(fmaxf(a.Min.z - center.z, 0.0f), center.z - a.Max.z);
+		return dx * dx + dy * dy + dz * dz <= radius * radius;
+	}
+
+	// Result of testing a box against a frustum
+	enum class Containment { Outside, Intersects, Inside };
+
+	inline Containment TestFrustum(const AABB& a, const Frustum& f)
+	{
+		Containment result = Containment::Inside;
+		for (int i = 0; i < 6; i++)
+		{
+			const DirectX::XMFLOAT4& p = f.Planes[i];
+
+			// Corner furthest along the plane normal ("positive vertex")
+			float px = p.x >= 0 ? a.Max.x : a.Min.x;
+			float py = p.y >= 0 ? a.Max.y : a.Min.y;
+			float pz = p.z >= 0 ? a.Max.z : a.Min.z;
+			if (p.x * px + p.y * py + p.z * pz + p.w < 0)
+				return Containment::Outside;
+
+			// Corner furthest against the normal ("negative vertex")
+			float nx = p.x >= 0 ? a.Min.x : a.Max.x;
+			float ny = p.y >= 0 ? a.Min.y : a.Max.y;
+			float nz = p.z >= 0 ? a.Min.z : a.Max.z;
+			if (p.x * nx + p.y * ny + p.z * nz + p.w < 0)
+				result = Containment::Intersects;
+		}
+		return result;
+	}
+
+	// Slab test - invDir is 1/direction, precomputed once per ray
+	// Returns true if the box is hit between 0 and tMax, and the entry distance
+	inline bool IntersectRay(const AABB& a, const Ray& r, const DirectX::XMFLOAT3& invDir, float tMax, float& tHit)
+	{
+		float tx1 = (a.Min.x - r.Origin.x) * invDir.x;
+		float tx2 = (a.Max.x - r.Origin.x) * invDir.x;
+		float tNear = fminf(tx1, tx2);
+		float tFar = fmaxf(tx1, tx2);
+
+		float ty1 = (a.Min.y - r.Origin.y) * invDir.y;
+		float ty2 = (a.Max.y - r.Origin.y) * invDir.y;
+		tNear = fmaxf(tNear, fminf(ty1, ty2));
+		tFar = fminf(tFar, fmaxf(ty1, ty2));
+
+		float tz1 = (a.Min.z - r.Origin.z) * invDir.z;
+		float tz2 = (a.Max.z - r.Origin.z) * invDir.z;
+		tNear = fmaxf(tNear, fminf(tz1, tz2));
+		tFar = fminf(tFar, fmaxf(tz1, tz2));
+
+		tNear = fmaxf(tNear, 0.0f);
+		tHit = tNear;
+		return tNear <= tFar && tNear <= tMax;
+	}
+
+	// Transforms a local space box into a (still axis aligned) world
+	// space box - see Arvo, "Transforming Axis-Aligned Bounding Boxes"
+	inline AABB Transform(const AABB& local, const DirectX::XMFLOAT4X4& m)
+	{
+		float minIn[3] = { local.Min.x, local.Min.y, local.Min.z };
+		float maxIn[3] = { local.Max.x, local.Max.y, local.Max.z };
+		float minOut[3] = { m._41, m._42, m._43 };
+		float maxOut[3] = { m._41, m._42, m._43 };
+
+		for (int col = 0; col < 3; col++)
+		{
+			for (int row = 0; row < 3; row++)
+			{
+				float e = m.m[row][col];
+				float a = e * minIn[row];
+				float b = e * maxIn[row];
+				minOut[col] += fminf(a, b);
+				maxOut[col] += fmaxf(a, b);
+			}
+		}
+
+		return { { minOut[0], minOut[1], minOut[2] }, { maxOut[0], maxOut[1], maxOut[2] } };
+	}
+
+	// Extracts the six planes of a (row vector, D3D style)
+	// view * projection matrix - Gribb & Hartmann
+	inline Frustum FrustumFromViewProjection(const DirectX::XMFLOAT4X4& vp)
+	{
+		Frustum f;
+		f.Planes[0] = { vp._14 + vp._11, vp._24 + vp._21, vp._34 + vp._31, vp._44 + vp._41 }; // Left
+		f.Planes[1] = { vp._14 - vp._11, vp._24 - vp._21, vp._34 - vp._31, vp._44 - vp._41 }; // Right
+		f.Planes[2] = { vp._14 + vp._12, vp._24 + vp._22, vp._34 + vp._32, vp._44 + vp._42 }; // Bottom
+		f.Planes[3] = { vp._14 - vp._12, vp._24 - vp._22, vp._34 - vp._32, vp._44 - vp._42 }; // Top
+		f.Planes[4] = { vp._13, vp._23, vp._33, vp._43 };                                     // Near (z >= 0)
+		f.Planes[5] = { vp._14 - vp._13, vp._24 - vp._23, vp._34 - vp._33, vp._44 - vp._43 }; // Far
+
+		// Normalize so distances are in world units
+		for (int i = 0; i < 6; i++)
+		{
+			DirectX::XMFLOAT4& p = f.Planes[i];
+			float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+			if (len > 0)
+			{
+				p.x /= len; p.y /= len; p.z /= len; p.w /= len;
+			}
+		}
+		return f;
+	}
+}
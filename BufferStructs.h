@@ -2,10 +2,14 @@
 #include <d3d11.h> 
 #include <DirectXMath.h>
 
-struct VertexShaderData
+// Constant buffer structs are generated from the shaders
+// themselves - see ShaderBuffers.h
+
+// Per-instance data for InstancedVS/ShadowInstancedVS
+// - Must match the _PER_INSTANCE inputs in ShaderStructs.hlsli
+struct InstanceData
 {
     DirectX::XMFLOAT4X4 world;
-    DirectX::XMFLOAT4X4 view;
-    DirectX::XMFLOAT4X4 projection;
-    DirectX::XMFLOAT4 colorTint;
-};
\ No newline at end of file
+    DirectX::XMFLOAT4X4 worldInvTrans;
+    DirectX::XMUINT2 lightRange;
+};
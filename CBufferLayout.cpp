@@ -0,0 +1,202 @@
+#include "CBufferLayout.h"
+#include <algorithm>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Raw values of the D3D_SHADER_VARIABLE_CLASS
+	// and D3D_SHADER_VARIABLE_TYPE values used here
+	const uint16_t ClassScalar = 0;
+	const uint16_t ClassVector = 1;
+	const uint16_t ClassMatrixRows = 2;
+	const uint16_t ClassMatrixColumns = 3;
+	const uint16_t ClassStruct = 5;
+
+	const uint16_t TypeBool = 1;
+	const uint16_t TypeInt = 2;
+	const uint16_t TypeFloat = 3;
+	const uint16_t TypeUInt = 19;
+
+	// --------------------------------------------------------
+	// The C++ type of one element of a variable, and its size,
+	// or false if there isn't an obvious one
+	// - HLSL bools are 4 bytes, so they become ints
+	// - Structs are assumed to have a C++ type of the same
+	//   name, and an element size that fills whole registers
+	// --------------------------------------------------------
+	bool ElementType(const DXBCVariable& var, std::string* type, unsigned int* size)
+	{
+		unsigned int count = var.Elements > 0 ? var.Elements : 1;
+
+		if (var.Class == ClassStruct)
+		{
+			if (var.TypeName.empty() || var.Size % count != 0 || (var.Size / count) % 16 != 0)
+				return false;
+			*type = var.TypeName;
+			*size = var.Size / count;
+			return true;
+		}
+
+		const char* scalar;
+		const char* vector;
+		switch (var.Type)
+		{
+		case TypeFloat: scalar = "float"; vector = "DirectX::XMFLOAT"; break;
+		case TypeInt:
+		case TypeBool: scalar = "int"; vector = "DirectX::XMINT"; break;
+		case TypeUInt: scalar = "unsigned int"; vector = "DirectX::XMUINT"; break;
+		default: return false;
+		}
+
+		if (var.Class == ClassScalar)
+		{
+			*type = scalar;
+			*size = 4;
+		}
+		else if (var.Class == ClassVector && var.Columns >= 2 && var.Columns <= 4)
+		{
+			*type = vector + std::to_string(var.Columns);
+			*size = 4 * var.Columns;
+		}
+		else if ((var.Class == ClassMatrixRows || var.Class == ClassMatrixColumns) &&
+			var.Type == TypeFloat && var.Rows == 4 && var.Columns == 4)
+		{
+			*type = "DirectX::XMFLOAT4X4";
+			*size = 64;
+		}
+		else
+			return false;
+
+		// Array elements each start a new register, so only
+		// those filling whole registers line up with C++
+		return var.Elements == 0 || *size % 16 == 0;
+	}
+
+	const DXBCVariable* FindVariable(const DXBCConstantBuffer& buffer, const char* name)
+	{
+		for (auto& v : buffer.Variables)
+			if (v.Name == name)
+				return &v;
+		return 0;
+	}
+
+	void GenerateStruct(const CBufferStructSource& source, std::string& out)
+	{
+		const DXBCConstantBuffer& cb = *source.Buffer;
+		const std::string& name = source.StructName;
+
+		// Layout order, which needn't be declaration order
+		std::vector<const DXBCVariable*> vars;
+		for (auto& v : cb.Variables)
+			vars.push_back(&v);
+		std::sort(vars.begin(), vars.end(), [](const DXBCVariable* a, const DXBCVariable* b) { return a->StartOffset < b->StartOffset; });
+
+		out += "// " + cb.Name + " in " + source.ShaderName + "\n";
+		out += "inline constexpr CBufferField " + name + "Fields[] =\n{\n";
+		for (auto v : vars)
+			out += "\t{ \"" + v->Name + "\", " + std::to_string(v->StartOffset) + ", " + std::to_string(v->Size) + " },\n";
+		out += "};\n\n";
+
+		// Members, with explicit padding wherever HLSL's
+		// packing rules moved a variable to the next register
+		out += "struct " + name + "\n{\n";
+		unsigned int at = 0;
+		unsigned int pads = 0;
+		for (auto v : vars)
+		{
+			if (v->StartOffset > at)
+				out += "\tfloat pad" + std::to_string(pads++) + "[" + std::to_string((v->StartOffset - at) / 4) + "];\n";
+
+			std::string type;
+			unsigned int size;
+			if (ElementType(*v, &type, &size))
+			{
+				out += "\t" + type + " " + v->Name;
+				if (v->Elements > 0)
+					out += "[" + std::to_string(v->Elements) + "]";
+				out += ";\n";
+			}
+			else
+			{
+				out += "\tunsigned char " + v->Name + "[" + std::to_string(v->Size) + "];";
+				out += "\t// No matching C++ type" + (v->TypeName.empty() ? std::string() : " for " + v->TypeName) + "\n";
+			}
+			at = v->StartOffset + v->Size;
+		}
+		if (cb.Size > at)
+			out += "\tfloat pad" + std::to_string(pads++) + "[" + std::to_string((cb.Size - at) / 4) + "];\n";
+
+		out += "\n\tstatic constexpr CBufferLayout Layout = { \"" + cb.Name + "\", " + std::to_string(cb.Size) + ", " +
+			name + "Fields, " + std::to_string(vars.size()) + " };\n";
+		out += "};\n";
+
+		// Keep the struct honest against its own layout
+		out += "static_assert(sizeof(" + name + ") == " + std::to_string(cb.Size) + ", \"" + name + " size\");\n";
+		for (auto v : vars)
+		{
+			out += "static_assert(offsetof(" + name + ", " + v->Name + ") == " + std::to_string(v->StartOffset) +
+				" && sizeof(" + name + "::" + v->Name + ") == " + std::to_string(v->Size) + ", \"" + name + "::" + v->Name + "\");\n";
+		}
+		out += "\n";
+	}
+}
+
+// --------------------------------------------------------
+// Compares names, offsets and sizes - types aren't
+// checked, since the struct may well use its own
+// --------------------------------------------------------
+std::string FindCBufferMismatches(const CBufferLayout& layout, const DXBCConstantBuffer& buffer)
+{
+	std::string prefix = buffer.Name + ": ";
+	std::string mismatches;
+
+	if (layout.Size != buffer.Size)
+		mismatches += prefix + "size is " + std::to_string(buffer.Size) + " in the shader but " + std::to_string(layout.Size) + " in C++\n";
+
+	for (unsigned int i = 0; i < layout.FieldCount; i++)
+	{
+		const CBufferField& f = layout.Fields[i];
+		const DXBCVariable* var = FindVariable(buffer, f.Name);
+		if (!var)
+			mismatches += prefix + "'" + f.Name + "' isn't in the shader\n";
+		else if (var->StartOffset != f.Offset || var->Size != f.Size)
+		{
+			mismatches += prefix + "'" + f.Name + "' is " + std::to_string(var->Size) + " bytes at " + std::to_string(var->StartOffset) +
+				" in the shader but " + std::to_string(f.Size) + " bytes at " + std::to_string(f.Offset) + " in C++\n";
+		}
+	}
+
+	for (auto& v : buffer.Variables)
+	{
+		bool found = false;
+		for (unsigned int i = 0; i < layout.FieldCount && !found; i++)
+			found = v.Name == layout.Fields[i].Name;
+		if (!found)
+			mismatches += prefix + "'" + v.Name + "' isn't in the C++ struct\n";
+	}
+
+	return mismatches;
+}
+
+std::string GenerateCBufferStructs(const std::vector<CBufferStructSource>& sources, const std::vector<std::string>& includes)
+{
+	std::string out =
+		"#pragma once\n\n"
+		"// --------------------------------------------------------\n"
+		"// Generated by GenerateCBufferStructs() from the compiled\n"
+		"// shaders - don't edit by hand.  Debug builds check these\n"
+		"// at start up, and write out a fresh copy if they differ.\n"
+		"// --------------------------------------------------------\n\n"
+		"#include <cstddef>\n"
+		"#include <DirectXMath.h>\n"
+		"#include \"CBufferLayout.h\"\n";
+	for (auto& i : includes)
+		out += "#include \"" + i + "\"\n";
+	out += "\n";
+
+	for (auto& s : sources)
+		GenerateStruct(s, out);
+
+	return out;
+}
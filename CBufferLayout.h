@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "DXBCReflection.h"
+
+// --------------------------------------------------------
+// The layout of a C++ struct that mirrors a shader's
+// cbuffer, so the two can be checked against each other
+// at load time.  Written out, along with the struct
+// itself, by GenerateCBufferStructs() - see ShaderBuffers.h
+// --------------------------------------------------------
+struct CBufferField
+{
+	const char* Name;
+	unsigned int Offset;
+	unsigned int Size;
+};
+
+struct CBufferLayout
+{
+	const char* BufferName;		// The cbuffer's name in the shader
+	unsigned int Size;
+	const CBufferField* Fields;
+	unsigned int FieldCount;
+};
+
+// A cbuffer to generate a struct for, and what to call it
+struct CBufferStructSource
+{
+	std::string StructName;
+	std::string ShaderName;		// Only used in comments
+	const DXBCConstantBuffer* Buffer;
+};
+
+// Every difference between the struct and the reflected
+// cbuffer, one per line - empty if they match exactly
+std::string FindCBufferMismatches(const CBufferLayout& layout, const DXBCConstantBuffer& buffer);
+
+// A complete header with one struct (and its layout) per
+// source.  Struct-typed members use the C++ type of the same
+// name, so the headers declaring those must be included.
+std::string GenerateCBufferStructs(const std::vector<CBufferStructSource>& sources, const std::vector<std::string>& includes);
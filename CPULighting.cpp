@@ -0,0 +1,286 @@
+#include "CPULighting.h"
+#include <cmath>
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const float Pi = 3.14159265359f;
+
+	// --- SCALAR ---
+
+	XMFLOAT3 Add(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z); }
+	XMFLOAT3 Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+	XMFLOAT3 Mul(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x * b.x, a.y * b.y, a.z * b.z); }
+	XMFLOAT3 Scale(const XMFLOAT3& a, float s) { return XMFLOAT3(a.x * s, a.y * s, a.z * s); }
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	float Saturate(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+
+	XMFLOAT3 Normalize(const XMFLOAT3& v)
+	{
+		return Scale(v, 1.0f / sqrtf(Dot(v, v)));
+	}
+
+	// --- 8 WIDE ---
+
+	// 8 floats, as two SSE registers
+	struct Float8
+	{
+		__m128 Lo, Hi;
+	};
+
+	Float8 Splat(float v) { return { _mm_set1_ps(v), _mm_set1_ps(v) }; }
+	Float8 Load(const float* p) { return { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+	void Store(float* p, const Float8& v) { _mm_storeu_ps(p, v.Lo); _mm_storeu_ps(p + 4, v.Hi); }
+
+	Float8 operator+(const Float8& a, const Float8& b) { return { _mm_add_ps(a.Lo, b.Lo), _mm_add_ps(a.Hi, b.Hi) }; }
+	Float8 operator-(const Float8& a, const Float8& b) { return { _mm_sub_ps(a.Lo, b.Lo), _mm_sub_ps(a.Hi, b.Hi) }; }
+	Float8 operator*(const Float8& a, const Float8& b) { return { _mm_mul_ps(a.Lo, b.Lo), _mm_mul_ps(a.Hi, b.Hi) }; }
+	Float8 operator/(const Float8& a, const Float8& b) { return { _mm_div_ps(a.Lo, b.Lo), _mm_div_ps(a.Hi, b.Hi) }; }
+	Float8 Max(const Float8& a, const Float8& b) { return { _mm_max_ps(a.Lo, b.Lo), _mm_max_ps(a.Hi, b.Hi) }; }
+	Float8 Min(const Float8& a, const Float8& b) { return { _mm_min_ps(a.Lo, b.Lo), _mm_min_ps(a.Hi, b.Hi) }; }
+	Float8 Sqrt(const Float8& a) { return { _mm_sqrt_ps(a.Lo), _mm_sqrt_ps(a.Hi) }; }
+	Float8 Saturate(const Float8& a) { return Min(Max(a, Splat(0.0f)), Splat(1.0f)); }
+
+	struct Vector8
+	{
+		Float8 X, Y, Z;
+	};
+
+	Vector8 Splat(const XMFLOAT3& v) { return { Splat(v.x), Splat(v.y), Splat(v.z) }; }
+	Vector8 operator+(const Vector8& a, const Vector8& b) { return { a.X + b.X, a.Y + b.Y, a.Z + b.Z }; }
+	Vector8 operator-(const Vector8& a, const Vector8& b) { return { a.X - b.X, a.Y - b.Y, a.Z - b.Z }; }
+	Vector8 operator*(const Vector8& a, const Vector8& b) { return { a.X * b.X, a.Y * b.Y, a.Z * b.Z }; }
+	Vector8 operator*(const Vector8& a, const Float8& s) { return { a.X * s, a.Y * s, a.Z * s }; }
+	Float8 Dot(const Vector8& a, const Vector8& b) { return a.X * b.X + a.Y * b.Y + a.Z * b.Z; }
+
+	Vector8 Normalize(const Vector8& v)
+	{
+		return v * (Splat(1.0f) / Sqrt(Dot(v, v)));
+	}
+
+	// A batch, loaded once for every light
+	struct Surface8
+	{
+		Vector8 Normal;
+		Vector8 Position;
+		Vector8 ViewDir;
+		Float8 Roughness;
+		Float8 Metalness;
+		Vector8 SurfaceColor;
+		Vector8 SpecularColor;
+
+		// Per sample parts of D_GGX() and G_SchlickGGX()
+		Float8 A2;
+		Float8 K;
+		Float8 GView;
+	};
+
+	// The BRDF and everything after it in CalculateDirectionalLight()
+	// and CalculatePointLight(), up to the light's own scale
+	Vector8 ShadeSurface(const Surface8& s, const Vector8& lightDir)
+	{
+		// MicrofacetBRDF()
+		Vector8 h = Normalize(s.ViewDir + lightDir);
+
+		Float8 NdotH = Saturate(Dot(s.Normal, h));
+		Float8 denomToSquare = NdotH * NdotH * (s.A2 - Splat(1.0f)) + Splat(1.0f);
+		Float8 D = s.A2 / (Splat(Pi) * denomToSquare * denomToSquare);
+
+		Float8 fresnel = Splat(1.0f) - Saturate(Dot(s.ViewDir, h));
+		Float8 fresnel5 = fresnel * fresnel * fresnel * fresnel * fresnel;
+		Vector8 F = s.SpecularColor + (Splat(XMFLOAT3(1, 1, 1)) - s.SpecularColor) * fresnel5;
+
+		Float8 NdotL = Dot(s.Normal, lightDir);
+		Float8 GLight = Splat(1.0f) / (Saturate(NdotL) * (Splat(1.0f) - s.K) + s.K);
+		Float8 G = s.GView * GLight;
+
+		Vector8 specular = F * (D * G * Splat(0.25f) * Max(NdotL, Splat(0.0f)));
+
+		// CalculateDiffuse() and DiffuseEnergyConserve(), which is
+		// given the specular result (not F) by the HLSL
+		Float8 diffuse = Saturate(NdotL);
+		Float8 notMetal = Splat(1.0f) - s.Metalness;
+		Vector8 balanced = (Splat(XMFLOAT3(1, 1, 1)) - specular) * (diffuse * notMetal);
+
+		return balanced * s.SurfaceColor + specular;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ SCALAR REFERENCE -----------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+float CPULighting::D_GGX(const XMFLOAT3& n, const XMFLOAT3& h, float roughness)
+{
+	float NdotH = Saturate(Dot(n, h));
+	float NdotH2 = NdotH * NdotH;
+	float a = roughness * roughness;
+	float a2 = a * a > MinRoughness ? a * a : MinRoughness;
+
+	float denomToSquare = NdotH2 * (a2 - 1) + 1;
+	return a2 / (Pi * denomToSquare * denomToSquare);
+}
+
+XMFLOAT3 CPULighting::F_Schlick(const XMFLOAT3& v, const XMFLOAT3& h, const XMFLOAT3& f0)
+{
+	float VdotH = Saturate(Dot(v, h));
+	float f = powf(1 - VdotH, 5);
+	return XMFLOAT3(
+		f0.x + (1 - f0.x) * f,
+		f0.y + (1 - f0.y) * f,
+		f0.z + (1 - f0.z) * f);
+}
+
+float CPULighting::G_SchlickGGX(const XMFLOAT3& n, const XMFLOAT3& v, float roughness)
+{
+	float k = powf(roughness + 1, 2) / 8.0f;
+	float NdotV = Saturate(Dot(n, v));
+	return 1 / (NdotV * (1 - k) + k);
+}
+
+XMFLOAT3 CPULighting::MicrofacetBRDF(const XMFLOAT3& n, const XMFLOAT3& l, const XMFLOAT3& v, float roughness, const XMFLOAT3& f0, XMFLOAT3* F_out)
+{
+	XMFLOAT3 h = Normalize(Add(v, l));
+
+	float D = D_GGX(n, h, roughness);
+	XMFLOAT3 F = F_Schlick(v, h, f0);
+	float G = G_SchlickGGX(n, v, roughness) * G_SchlickGGX(n, l, roughness);
+
+	if (F_out)
+		*F_out = F;
+
+	XMFLOAT3 specularResult = Scale(F, D * G / 4);
+	float NdotL = Dot(n, l);
+	return Scale(specularResult, NdotL > 0 ? NdotL : 0);
+}
+
+float CPULighting::Attenuate(const Light& light, const XMFLOAT3& worldPos)
+{
+	XMFLOAT3 toLight = Sub(light.Position, worldPos);
+	float dist = sqrtf(Dot(toLight, toLight));
+	float att = Saturate(1.0f - (dist * dist / (light.Range * light.Range)));
+	return att * att;
+}
+
+XMFLOAT3 CPULighting::CalculateDirectionalLight(const Light& light, const XMFLOAT3& normal, const XMFLOAT3& worldPos, const XMFLOAT3& camPos, float roughness, float metalness, const XMFLOAT3& surfaceColor, const XMFLOAT3& specularColor)
+{
+	XMFLOAT3 lightDir = Normalize(Scale(light.Direction, -1));
+	XMFLOAT3 viewDir = Normalize(Sub(camPos, worldPos));
+
+	float diffuse = Saturate(Dot(normal, lightDir));
+	XMFLOAT3 F;
+	XMFLOAT3 specular = MicrofacetBRDF(normal, lightDir, viewDir, roughness, specularColor, &F);
+
+	XMFLOAT3 balancedDiffuse = Scale(Sub(XMFLOAT3(1, 1, 1), specular), diffuse * (1 - metalness));
+	return Scale(Mul(Add(Mul(balancedDiffuse, surfaceColor), specular), light.Color), light.Intensity);
+}
+
+XMFLOAT3 CPULighting::CalculatePointLight(const Light& light, const XMFLOAT3& normal, const XMFLOAT3& worldPos, const XMFLOAT3& camPos, float roughness, float metalness, const XMFLOAT3& surfaceColor, const XMFLOAT3& specularColor)
+{
+	XMFLOAT3 lightDir = Normalize(Sub(light.Position, worldPos));
+	XMFLOAT3 viewDir = Normalize(Sub(camPos, worldPos));
+
+	float attenuation = Attenuate(light, worldPos);
+	float diffuse = Saturate(Dot(normal, lightDir));
+	XMFLOAT3 F;
+	XMFLOAT3 specular = MicrofacetBRDF(normal, lightDir, viewDir, roughness, specularColor, &F);
+
+	XMFLOAT3 balancedDiffuse = Scale(Sub(XMFLOAT3(1, 1, 1), specular), diffuse * (1 - metalness));
+	return Scale(Mul(Add(Mul(balancedDiffuse, surfaceColor), specular), light.Color), attenuation * light.Intensity);
+}
+
+XMFLOAT3 CPULighting::CalculateSpotLight(const Light& light, const XMFLOAT3& normal, const XMFLOAT3& worldPos, const XMFLOAT3& camPos, float roughness, float metalness, const XMFLOAT3& surfaceColor, const XMFLOAT3& specularColor)
+{
+	XMFLOAT3 lightDir = Normalize(Sub(light.Position, worldPos));
+	float penumbra = powf(Saturate(-Dot(lightDir, light.Direction)), light.SpotFalloff);
+
+	return Scale(CalculatePointLight(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor), penumbra);
+}
+
+XMFLOAT3 CPULighting::CalculateLight(const Light& light, const XMFLOAT3& normal, const XMFLOAT3& worldPos, const XMFLOAT3& camPos, float roughness, float metalness, const XMFLOAT3& surfaceColor, const XMFLOAT3& specularColor)
+{
+	switch (light.Type)
+	{
+	case LIGHT_TYPE_DIRECTIONAL: return CalculateDirectionalLight(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	case LIGHT_TYPE_POINT: return CalculatePointLight(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	case LIGHT_TYPE_SPOT: return CalculateSpotLight(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	}
+	return XMFLOAT3(0, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ BATCHES --------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+// --------------------------------------------------------
+// Everything that doesn't depend on the light (the view
+// direction, and the roughness terms) is worked out once,
+// then each light is added to all 8 samples at a time
+//
+// - The spot falloff is a power the light chooses, so that
+//   one is done a lane at a time
+// --------------------------------------------------------
+void CPULighting::AddLights(const Light* lights, unsigned int lightCount, const XMFLOAT3& camPos, const SampleBatch& samples, ColorBatch& color)
+{
+	Surface8 s;
+	s.Normal = { Load(samples.NormalX), Load(samples.NormalY), Load(samples.NormalZ) };
+	s.Position = { Load(samples.PositionX), Load(samples.PositionY), Load(samples.PositionZ) };
+	s.ViewDir = Normalize(Splat(camPos) - s.Position);
+	s.Roughness = Load(samples.Roughness);
+	s.Metalness = Load(samples.Metalness);
+	s.SurfaceColor = { Load(samples.SurfaceR), Load(samples.SurfaceG), Load(samples.SurfaceB) };
+	s.SpecularColor = { Load(samples.SpecularR), Load(samples.SpecularG), Load(samples.SpecularB) };
+
+	Float8 a = s.Roughness * s.Roughness;
+	s.A2 = Max(a * a, Splat(MinRoughness));
+	Float8 r1 = s.Roughness + Splat(1.0f);
+	s.K = r1 * r1 / Splat(8.0f);
+	s.GView = Splat(1.0f) / (Saturate(Dot(s.Normal, s.ViewDir)) * (Splat(1.0f) - s.K) + s.K);
+
+	Vector8 total = { Load(color.R), Load(color.G), Load(color.B) };
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		const Light& light = lights[i];
+		Vector8 lightColor = Splat(XMFLOAT3(
+			light.Color.x * light.Intensity,
+			light.Color.y * light.Intensity,
+			light.Color.z * light.Intensity));
+
+		if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		{
+			Vector8 lightDir = Splat(Normalize(Scale(light.Direction, -1)));
+			total = total + ShadeSurface(s, lightDir) * lightColor;
+			continue;
+		}
+		if (light.Type != LIGHT_TYPE_POINT && light.Type != LIGHT_TYPE_SPOT)
+			continue;
+
+		Vector8 toLight = Splat(light.Position) - s.Position;
+		Float8 dist2 = Dot(toLight, toLight);
+		Float8 dist = Sqrt(dist2);
+		Vector8 lightDir = toLight * (Splat(1.0f) / dist);
+
+		// Attenuate(), from the distance squared as the HLSL has it
+		Float8 att = Saturate(Splat(1.0f) - dist * dist / Splat(light.Range * light.Range));
+		Float8 scale = att * att;
+
+		if (light.Type == LIGHT_TYPE_SPOT)
+		{
+			float cosines[BatchSize];
+			Store(cosines, Saturate(Splat(0.0f) - Dot(lightDir, Splat(light.Direction))));
+			for (int lane = 0; lane < BatchSize; lane++)
+				cosines[lane] = powf(cosines[lane], light.SpotFalloff);
+			scale = scale * Load(cosines);
+		}
+
+		total = total + ShadeSurface(s, lightDir) * (lightColor * scale);
+	}
+
+	Store(color.R, total.X);
+	Store(color.G, total.Y);
+	Store(color.B, total.Z);
+}
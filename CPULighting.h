@@ -0,0 +1,65 @@
+#pragma once
+#include "Light.h"
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Lighting.hlsli's lighting math, on the CPU
+//
+// - The scalar functions follow the HLSL line for line, and
+//   are the reference the batched ones are checked against
+// - Batches shade 8 samples at a time with SSE (two groups
+//   of 4 lanes), laid out as structures of arrays
+// - Shadows and ambient aren't included, as in the HLSL
+//
+// Has no graphics API dependencies, so it can be used for
+// light baking, or checking the shader's math headless
+// --------------------------------------------------------
+namespace CPULighting
+{
+	// Same as Lighting.hlsli
+	const float MinRoughness = 0.0000001f;
+	const float F0NonMetal = 0.04f;
+
+	// --- SCALAR REFERENCE ---
+
+	float D_GGX(const DirectX::XMFLOAT3& n, const DirectX::XMFLOAT3& h, float roughness);
+	DirectX::XMFLOAT3 F_Schlick(const DirectX::XMFLOAT3& v, const DirectX::XMFLOAT3& h, const DirectX::XMFLOAT3& f0);
+	float G_SchlickGGX(const DirectX::XMFLOAT3& n, const DirectX::XMFLOAT3& v, float roughness);
+	DirectX::XMFLOAT3 MicrofacetBRDF(
+		const DirectX::XMFLOAT3& n, const DirectX::XMFLOAT3& l, const DirectX::XMFLOAT3& v,
+		float roughness, const DirectX::XMFLOAT3& f0, DirectX::XMFLOAT3* F_out);
+	float Attenuate(const Light& light, const DirectX::XMFLOAT3& worldPos);
+
+	// Normals must be normalized, and colors are linear
+	DirectX::XMFLOAT3 CalculateDirectionalLight(const Light& light, const DirectX::XMFLOAT3& normal, const DirectX::XMFLOAT3& worldPos, const DirectX::XMFLOAT3& camPos, float roughness, float metalness, const DirectX::XMFLOAT3& surfaceColor, const DirectX::XMFLOAT3& specularColor);
+	DirectX::XMFLOAT3 CalculatePointLight(const Light& light, const DirectX::XMFLOAT3& normal, const DirectX::XMFLOAT3& worldPos, const DirectX::XMFLOAT3& camPos, float roughness, float metalness, const DirectX::XMFLOAT3& surfaceColor, const DirectX::XMFLOAT3& specularColor);
+	DirectX::XMFLOAT3 CalculateSpotLight(const Light& light, const DirectX::XMFLOAT3& normal, const DirectX::XMFLOAT3& worldPos, const DirectX::XMFLOAT3& camPos, float roughness, float metalness, const DirectX::XMFLOAT3& surfaceColor, const DirectX::XMFLOAT3& specularColor);
+
+	// Whichever of the above the light's type calls for
+	DirectX::XMFLOAT3 CalculateLight(const Light& light, const DirectX::XMFLOAT3& normal, const DirectX::XMFLOAT3& worldPos, const DirectX::XMFLOAT3& camPos, float roughness, float metalness, const DirectX::XMFLOAT3& surfaceColor, const DirectX::XMFLOAT3& specularColor);
+
+	// --- BATCHES ---
+
+	const int BatchSize = 8;
+
+	// What the pixel shader knows about each sample before
+	// its light loop
+	struct SampleBatch
+	{
+		float NormalX[BatchSize], NormalY[BatchSize], NormalZ[BatchSize];
+		float PositionX[BatchSize], PositionY[BatchSize], PositionZ[BatchSize];
+		float Roughness[BatchSize];
+		float Metalness[BatchSize];
+		float SurfaceR[BatchSize], SurfaceG[BatchSize], SurfaceB[BatchSize];
+		float SpecularR[BatchSize], SpecularG[BatchSize], SpecularB[BatchSize];
+	};
+
+	struct ColorBatch
+	{
+		float R[BatchSize], G[BatchSize], B[BatchSize];
+	};
+
+	// Adds the lights' contributions to each sample's color -
+	// the same as summing CalculateLight() for every light
+	void AddLights(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT3& camPos, const SampleBatch& samples, ColorBatch& color);
+}
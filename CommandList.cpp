@@ -0,0 +1,271 @@
+#include "CommandList.h"
+#include "ConstantBufferRing.h"
+#include "FrameStats.h"
+#include "PipelineState.h"
+#include <cstring>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// What follows the header of each command (those with
+	// arrays or data have them straight after the header)
+	struct VertexBufferCommand { ID3D11Buffer* Buffer; UINT Stride; UINT Offset; };
+	struct IndexBufferCommand { ID3D11Buffer* Buffer; DXGI_FORMAT Format; UINT Offset; };
+	struct ConstantBufferCommand { ID3D11Buffer* Buffer; UINT FirstConstant; UINT NumConstants; };
+	struct ConstantsCommand { UINT Size; UINT Unused; };
+	struct DrawIndexedCommand { UINT IndexCount; UINT StartIndex; INT BaseVertex; UINT Unused; };
+	struct DrawInstancedCommand { UINT IndexCount; UINT InstanceCount; UINT StartIndex; INT BaseVertex; UINT StartInstance; UINT Unused; };
+
+	template<typename T>
+	T Read(const uint8_t* at)
+	{
+		T value;
+		memcpy(&value, at, sizeof(T));
+		return value;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ BACKENDS -------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+D3D11CommandBackend::D3D11CommandBackend(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<ConstantBufferRing> ring) :
+	context(context),
+	ring(ring)
+{
+}
+
+bool D3D11CommandBackend::UploadConstants(const void* data, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants)
+{
+	if (ring && ring->IsValid() && ring->Upload(data, size, firstConstant, numConstants))
+	{
+		*buffer = ring->GetBuffer();
+		return true;
+	}
+
+	// Out of ring space (or no ring at all)
+	UINT bufferSize = (size + 15) / 16 * 16;
+	Microsoft::WRL::ComPtr<ID3D11Buffer>& fallback = fallbackBuffers[bufferSize];
+	if (!fallback)
+	{
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		context->GetDevice(device.GetAddressOf());
+
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = bufferSize;
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (FAILED(device->CreateBuffer(&desc, 0, fallback.GetAddressOf())))
+			return false;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(fallback.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, data, size);
+	context->Unmap(fallback.Get(), 0);
+	FrameStats::BufferUploads++;
+	FrameStats::BufferBytesUploaded += size;
+
+	*buffer = fallback.Get();
+	*firstConstant = 0;
+	*numConstants = 0;
+	return true;
+}
+
+void D3D11CommandBackend::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	context->DrawIndexed(indexCount, startIndex, baseVertex);
+	FrameStats::DrawCalls++;
+}
+
+void D3D11CommandBackend::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+	FrameStats::DrawCalls++;
+}
+
+bool NullCommandBackend::UploadConstants(const void*, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants)
+{
+	*buffer = 0;
+	*firstConstant = 0;
+	*numConstants = (size + 255) / 256 * 16;
+	bytesUploaded += size;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ RECORDING ------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+void CommandList::Reset()
+{
+	words.clear();
+	commandCount = 0;
+	drawCount = 0;
+}
+
+uint8_t* CommandList::Append(CommandType type, uint8_t stage, uint8_t slot, uint8_t count, size_t payloadBytes)
+{
+	size_t size = 1 + (payloadBytes + 7) / 8;
+	size_t start = words.size();
+	words.resize(start + size);
+
+	CommandHeader header = { type, stage, slot, count, (uint32_t)size };
+	uint8_t* at = (uint8_t*)&words[start];
+	memcpy(at, &header, sizeof(header));
+
+	commandCount++;
+	return at + sizeof(CommandHeader);
+}
+
+void CommandList::SetPipeline(const PipelineState* pipeline)
+{
+	uint8_t* at = Append(CommandSetPipeline, 0, 0, 0, sizeof(pipeline));
+	memcpy(at, &pipeline, sizeof(pipeline));
+}
+
+void CommandList::SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset)
+{
+	VertexBufferCommand c = { buffer, stride, offset };
+	memcpy(Append(CommandSetVertexBuffer, 0, (uint8_t)slot, 1, sizeof(c)), &c, sizeof(c));
+}
+
+void CommandList::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	IndexBufferCommand c = { buffer, format, offset };
+	memcpy(Append(CommandSetIndexBuffer, 0, 0, 0, sizeof(c)), &c, sizeof(c));
+}
+
+void CommandList::SetConstantBuffer(ShaderStage stage, UINT slot, ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants)
+{
+	ConstantBufferCommand c = { buffer, firstConstant, numConstants };
+	memcpy(Append(CommandSetConstantBuffer, (uint8_t)stage, (uint8_t)slot, 1, sizeof(c)), &c, sizeof(c));
+}
+
+void CommandList::SetConstants(ShaderStage stage, UINT slot, const void* data, UINT size)
+{
+	ConstantsCommand c = { size, 0 };
+	uint8_t* at = Append(CommandSetConstants, (uint8_t)stage, (uint8_t)slot, 1, sizeof(c) + size);
+	memcpy(at, &c, sizeof(c));
+	memcpy(at + sizeof(c), data, size);
+}
+
+void CommandList::SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	memcpy(Append(CommandSetShaderResources, (uint8_t)stage, (uint8_t)slot, (uint8_t)count, count * sizeof(views[0])), views, count * sizeof(views[0]));
+}
+
+void CommandList::SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	memcpy(Append(CommandSetSamplers, (uint8_t)stage, (uint8_t)slot, (uint8_t)count, count * sizeof(samplers[0])), samplers, count * sizeof(samplers[0]));
+}
+
+void CommandList::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	DrawIndexedCommand c = { indexCount, startIndex, baseVertex, 0 };
+	memcpy(Append(CommandDrawIndexed, 0, 0, 0, sizeof(c)), &c, sizeof(c));
+	drawCount++;
+}
+
+void CommandList::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	DrawInstancedCommand c = { indexCount, instanceCount, startIndex, baseVertex, startInstance, 0 };
+	memcpy(Append(CommandDrawIndexedInstanced, 0, 0, 0, sizeof(c)), &c, sizeof(c));
+	drawCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ REPLAY ---------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+// --------------------------------------------------------
+// State goes through the cache, so whatever a list repeats
+// (every draw in a chunk naming its pipeline, say) is
+// dropped there, just as it is when drawing directly
+// --------------------------------------------------------
+void CommandList::Replay(StateCache* states, ICommandBackend* backend) const
+{
+	const uint8_t* at = (const uint8_t*)words.data();
+	const uint8_t* end = at + words.size() * sizeof(uint64_t);
+
+	while (at < end)
+	{
+		CommandHeader header = Read<CommandHeader>(at);
+		const uint8_t* payload = at + sizeof(CommandHeader);
+		ShaderStage stage = (ShaderStage)header.Stage;
+
+		switch (header.Type)
+		{
+		case CommandSetPipeline:
+			states->SetPipeline(Read<const PipelineState*>(payload));
+			break;
+
+		case CommandSetVertexBuffer:
+		{
+			VertexBufferCommand c = Read<VertexBufferCommand>(payload);
+			states->SetVertexBuffers(header.Slot, 1, &c.Buffer, &c.Stride, &c.Offset);
+			break;
+		}
+
+		case CommandSetIndexBuffer:
+		{
+			IndexBufferCommand c = Read<IndexBufferCommand>(payload);
+			states->SetIndexBuffer(c.Buffer, c.Format, c.Offset);
+			break;
+		}
+
+		case CommandSetConstantBuffer:
+		{
+			// A plain bind has no constant range
+			ConstantBufferCommand c = Read<ConstantBufferCommand>(payload);
+			if (c.NumConstants > 0)
+				states->SetConstantBuffers(stage, header.Slot, 1, &c.Buffer, &c.FirstConstant, &c.NumConstants);
+			else
+				states->SetConstantBuffers(stage, header.Slot, 1, &c.Buffer);
+			break;
+		}
+
+		case CommandSetConstants:
+		{
+			ConstantsCommand c = Read<ConstantsCommand>(payload);
+			ID3D11Buffer* buffer;
+			UINT first, count;
+			if (!backend->UploadConstants(payload + sizeof(c), c.Size, &buffer, &first, &count))
+				break;
+
+			if (count > 0)
+				states->SetConstantBuffers(stage, header.Slot, 1, &buffer, &first, &count);
+			else
+				states->SetConstantBuffers(stage, header.Slot, 1, &buffer);
+			break;
+		}
+
+		case CommandSetShaderResources:
+			states->SetShaderResources(stage, header.Slot, header.Count, (ID3D11ShaderResourceView* const*)payload);
+			break;
+
+		case CommandSetSamplers:
+			states->SetSamplers(stage, header.Slot, header.Count, (ID3D11SamplerState* const*)payload);
+			break;
+
+		case CommandDrawIndexed:
+		{
+			DrawIndexedCommand c = Read<DrawIndexedCommand>(payload);
+			backend->DrawIndexed(c.IndexCount, c.StartIndex, c.BaseVertex);
+			break;
+		}
+
+		case CommandDrawIndexedInstanced:
+		{
+			DrawInstancedCommand c = Read<DrawInstancedCommand>(payload);
+			backend->DrawIndexedInstanced(c.IndexCount, c.InstanceCount, c.StartIndex, c.BaseVertex, c.StartInstance);
+			break;
+		}
+		}
+
+		at += header.Size * sizeof(uint64_t);
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "StateCache.h"
+
+struct PipelineState;
+class ConstantBufferRing;
+
+// --------------------------------------------------------
+// Where a command list's constants and draws go when it's
+// replayed - its state changes go through a StateCache
+//
+// - The D3D11 version below uses the immediate context and
+//   the constant buffer ring; the null one only counts, so
+//   recording can be timed (and tested) without a GPU
+// --------------------------------------------------------
+class ICommandBackend
+{
+public:
+	virtual ~ICommandBackend() = default;
+
+	// Copies constants to memory the GPU can read, returning
+	// where they ended up - numConstants is zero for a plain
+	// (non-offset) bind of the whole buffer
+	virtual bool UploadConstants(const void* data, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants) = 0;
+
+	virtual void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) = 0;
+	virtual void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) = 0;
+};
+
+// Constants go to the ring when it has room, and otherwise to
+// a dynamic buffer of the backend's own, discarded each time
+class D3D11CommandBackend : public ICommandBackend
+{
+public:
+	D3D11CommandBackend(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<ConstantBufferRing> ring);
+
+	bool UploadConstants(const void* data, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants) override;
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	std::shared_ptr<ConstantBufferRing> ring;
+
+	// One per size, in 16 byte steps
+	std::unordered_map<UINT, Microsoft::WRL::ComPtr<ID3D11Buffer>> fallbackBuffers;
+};
+
+class NullCommandBackend : public ICommandBackend
+{
+public:
+	bool UploadConstants(const void* data, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants) override;
+	void DrawIndexed(UINT, UINT, INT) override { draws++; }
+	void DrawIndexedInstanced(UINT, UINT, UINT, INT, UINT) override { draws++; }
+
+	uint64_t GetDraws() const { return draws; }
+	uint64_t GetBytesUploaded() const { return bytesUploaded; }
+
+private:
+	uint64_t draws = 0;
+	uint64_t bytesUploaded = 0;
+};
+
+// --------------------------------------------------------
+// Draws recorded into memory, to be replayed later on the
+// thread that owns the context
+//
+// - Recording doesn't touch the graphics API at all, so any
+//   number of lists can be recorded at once on different
+//   threads (one list per thread)
+// - Commands are packed back to back in 8 byte words: a
+//   small header, then the command's values.  Constants are
+//   copied in, and only uploaded when replayed
+// - Anything referenced (pipelines, buffers, views) must
+//   outlive the replay - the list holds no references
+// - Replaying lists one after another is the same as having
+//   recorded them all into one, so chunks of a draw list can
+//   be recorded separately and then replayed in order
+// --------------------------------------------------------
+class CommandList
+{
+public:
+	// Empties the list, but keeps its memory for next time
+	void Reset();
+
+	void SetPipeline(const PipelineState* pipeline);
+	void SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset);
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+
+	// An existing buffer (or a slice of one, in constants)
+	void SetConstantBuffer(ShaderStage stage, UINT slot, ID3D11Buffer* buffer, UINT firstConstant = 0, UINT numConstants = 0);
+	// New data, uploaded to the backend's memory at replay
+	void SetConstants(ShaderStage stage, UINT slot, const void* data, UINT size);
+
+	void SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views);
+	void SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers);
+
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex);
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance);
+
+	void Replay(StateCache* states, ICommandBackend* backend) const;
+
+	size_t GetSizeInBytes() const { return words.size() * sizeof(uint64_t); }
+	unsigned int GetCommandCount() const { return commandCount; }
+	unsigned int GetDrawCount() const { return drawCount; }
+
+private:
+	enum CommandType : uint8_t
+	{
+		CommandSetPipeline,
+		CommandSetVertexBuffer,
+		CommandSetIndexBuffer,
+		CommandSetConstantBuffer,
+		CommandSetConstants,
+		CommandSetShaderResources,
+		CommandSetSamplers,
+		CommandDrawIndexed,
+		CommandDrawIndexedInstanced,
+	};
+
+	// Starts every command - Size is the whole command
+	// (header included) in words, so the next one follows
+	struct CommandHeader
+	{
+		CommandType Type;
+		uint8_t Stage;
+		uint8_t Slot;
+		uint8_t Count;
+		uint32_t Size;
+	};
+
+	// Room for a command with payloadBytes after its header,
+	// which is filled in - the rest is written by the caller
+	uint8_t* Append(CommandType type, uint8_t stage, uint8_t slot, uint8_t count, size_t payloadBytes);
+
+	std::vector<uint64_t> words;
+	unsigned int commandCount = 0;
+	unsigned int drawCount = 0;
+};
@@ -0,0 +1,50 @@
+#include "ConstantBufferRing.h"
+#include "FrameStats.h"
+#include <cstring>
+
+ConstantBufferRing::ConstantBufferRing(
+	Microsoft::WRL::ComPtr<ID3D11Device> device,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	unsigned int capacity) :
+	context(context),
+	allocator(capacity)
+{
+	// Binding with an offset, and mapping a constant buffer
+	// without discarding it, are both optional in 11.1
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting ||
+		!options.MapNoOverwriteOnDynamicConstantBuffer)
+		return;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = allocator.GetCapacity();
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	device->CreateBuffer(&desc, 0, buffer.GetAddressOf());
+}
+
+bool ConstantBufferRing::Upload(const void* data, unsigned int size, UINT* firstConstant, UINT* numConstants)
+{
+	if (!buffer)
+		return false;
+
+	RingAllocator::Allocation slice;
+	if (!allocator.Allocate(size, &slice))
+		return false;
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	D3D11_MAP mapType = slice.Discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+	if (FAILED(context->Map(buffer.Get(), 0, mapType, 0, &mapped)))
+		return false;
+
+	memcpy((unsigned char*)mapped.pData + slice.Offset, data, size);
+	context->Unmap(buffer.Get(), 0);
+	FrameStats::BufferUploads++;
+	FrameStats::BufferBytesUploaded += size;
+
+	*firstConstant = slice.Offset / 16;
+	*numConstants = slice.Size / 16;
+	return true;
+}
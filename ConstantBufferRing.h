@@ -0,0 +1,42 @@
+#pragma once
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include "RingAllocator.h"
+
+// --------------------------------------------------------
+// One large dynamic constant buffer that draws upload their
+// constants into, instead of each shader updating its own
+// default-usage buffers
+//
+// - The first upload of a frame maps with WRITE_DISCARD and
+//   the rest with WRITE_NO_OVERWRITE, so the driver never
+//   has to copy or version the buffer per draw
+// - Slices are 256 byte aligned and bound with a constant
+//   offset (XXSetConstantBuffers1), which needs D3D 11.1 -
+//   check IsValid() before using the ring
+// --------------------------------------------------------
+class ConstantBufferRing
+{
+public:
+	ConstantBufferRing(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		unsigned int capacity = 8 * 1024 * 1024);
+
+	bool IsValid() const { return buffer != 0; }
+
+	void BeginFrame() { allocator.BeginFrame(); }
+
+	// Copies data into a new slice, returning its location in
+	// constants (16 bytes each), ready for XXSetConstantBuffers1
+	bool Upload(const void* data, unsigned int size, UINT* firstConstant, UINT* numConstants);
+
+	ID3D11Buffer* GetBuffer() const { return buffer.Get(); }
+	unsigned int GetEpoch() const { return allocator.GetEpoch(); }
+	const RingAllocator& GetAllocator() const { return allocator; }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
+	RingAllocator allocator;
+};
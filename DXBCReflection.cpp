@@ -0,0 +1,263 @@
+#include "DXBCReflection.h"
+#include <cstring>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// --------------------------------------------------------
+	// A bounds checked view of one chunk of the container -
+	// every read fails rather than running off the end
+	// --------------------------------------------------------
+	struct Chunk
+	{
+		const unsigned char* Data = 0;
+		size_t Size = 0;
+
+		bool Read32(size_t offset, uint32_t* value) const
+		{
+			if (offset > Size || Size - offset < 4) return false;
+			memcpy(value, Data + offset, 4);
+			return true;
+		}
+
+		bool Read16(size_t offset, uint16_t* value) const
+		{
+			if (offset > Size || Size - offset < 2) return false;
+			memcpy(value, Data + offset, 2);
+			return true;
+		}
+
+		bool Read8(size_t offset, uint8_t* value) const
+		{
+			if (offset >= Size) return false;
+			*value = Data[offset];
+			return true;
+		}
+
+		// Strings are null terminated, and must end inside the chunk
+		bool ReadString(size_t offset, std::string* str) const
+		{
+			if (offset >= Size) return false;
+			const void* end = memchr(Data + offset, 0, Size - offset);
+			if (!end) return false;
+			str->assign((const char*)(Data + offset), (const char*)end);
+			return true;
+		}
+
+		// Whether count entries of the given size fit at offset
+		bool Fits(size_t offset, size_t count, size_t stride) const
+		{
+			return offset <= Size && (stride == 0 || count <= (Size - offset) / stride);
+		}
+	};
+
+	// --------------------------------------------------------
+	// Finds a chunk by its four character code
+	//
+	// Container layout:
+	//  "DXBC", 16 byte checksum, version, total size,
+	//  chunk count, then one offset per chunk.  Each chunk is
+	//  a four character code and a size, then its data.
+	// --------------------------------------------------------
+	bool FindChunk(const void* data, size_t size, const char* fourCC, Chunk* chunk)
+	{
+		Chunk container = { (const unsigned char*)data, size };
+
+		uint32_t totalSize, chunkCount;
+		if (!data || size < 32 || memcmp(data, "DXBC", 4) != 0 ||
+			!container.Read32(24, &totalSize) ||
+			!container.Read32(28, &chunkCount) ||
+			totalSize > size)
+			return false;
+
+		container.Size = totalSize;
+		if (!container.Fits(32, chunkCount, 4))
+			return false;
+
+		for (uint32_t i = 0; i < chunkCount; i++)
+		{
+			uint32_t offset, chunkSize;
+			if (!container.Read32(32 + i * 4, &offset) ||
+				!container.Read32((size_t)offset + 4, &chunkSize) ||
+				!container.Fits((size_t)offset + 8, chunkSize, 1))
+				return false;
+
+			if (memcmp(container.Data + offset, fourCC, 4) == 0)
+			{
+				chunk->Data = container.Data + offset + 8;
+				chunk->Size = chunkSize;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// --------------------------------------------------------
+	// Reads a variable's type description - the part shared
+	// by every shader model, plus the type's name, which
+	// shader model 5 adds after 16 unused bytes
+	// --------------------------------------------------------
+	bool ReadType(const Chunk& rdef, uint32_t offset, bool hasName, DXBCVariable* var)
+	{
+		uint32_t nameOffset;
+		return
+			rdef.Read16(offset + 0, &var->Class) &&
+			rdef.Read16(offset + 2, &var->Type) &&
+			rdef.Read16(offset + 4, &var->Rows) &&
+			rdef.Read16(offset + 6, &var->Columns) &&
+			rdef.Read16(offset + 8, &var->Elements) &&
+			(!hasName || (rdef.Read32((size_t)offset + 32, &nameOffset) && rdef.ReadString(nameOffset, &var->TypeName)));
+	}
+
+	// --------------------------------------------------------
+	// Reads the resource definitions (RDEF) chunk
+	//
+	// Header: cbuffer count & offset, binding count & offset,
+	// then the target version.  Shader model 5 adds 16 bytes
+	// to each variable, and 5.1 adds a register space and id
+	// to each binding - everything else is in the same place.
+	// --------------------------------------------------------
+	bool ParseResources(const Chunk& rdef, DXBCReflection* reflection)
+	{
+		uint32_t cbCount, cbOffset, bindCount, bindOffset;
+		uint8_t minor, major;
+		if (!rdef.Read32(0, &cbCount) ||
+			!rdef.Read32(4, &cbOffset) ||
+			!rdef.Read32(8, &bindCount) ||
+			!rdef.Read32(12, &bindOffset) ||
+			!rdef.Read8(16, &minor) ||
+			!rdef.Read8(17, &major))
+			return false;
+
+		const size_t cbStride = 24;
+		const size_t bindStride = (major > 5 || (major == 5 && minor >= 1)) ? 40 : 32;
+		const size_t varStride = major >= 5 ? 40 : 24;
+		if (!rdef.Fits(cbOffset, cbCount, cbStride) || !rdef.Fits(bindOffset, bindCount, bindStride))
+			return false;
+
+		// Bound resources
+		reflection->Resources.resize(bindCount);
+		for (uint32_t r = 0; r < bindCount; r++)
+		{
+			size_t at = bindOffset + r * bindStride;
+			DXBCResource& res = reflection->Resources[r];
+
+			uint32_t nameOffset;
+			if (!rdef.Read32(at + 0, &nameOffset) ||
+				!rdef.ReadString(nameOffset, &res.Name) ||
+				!rdef.Read32(at + 4, &res.Type) ||
+				!rdef.Read32(at + 20, &res.BindPoint) ||
+				!rdef.Read32(at + 24, &res.BindCount))
+				return false;
+		}
+
+		// Constant buffers and their variables
+		reflection->ConstantBuffers.resize(cbCount);
+		for (uint32_t b = 0; b < cbCount; b++)
+		{
+			size_t at = cbOffset + b * cbStride;
+			DXBCConstantBuffer& cb = reflection->ConstantBuffers[b];
+
+			uint32_t nameOffset, varCount, varOffset;
+			if (!rdef.Read32(at + 0, &nameOffset) ||
+				!rdef.ReadString(nameOffset, &cb.Name) ||
+				!rdef.Read32(at + 4, &varCount) ||
+				!rdef.Read32(at + 8, &varOffset) ||
+				!rdef.Read32(at + 12, &cb.Size) ||
+				!rdef.Read32(at + 20, &cb.Type) ||
+				!rdef.Fits(varOffset, varCount, varStride))
+				return false;
+
+			// Bound under the same name, like D3DReflect's
+			// GetResourceBindingDescByName()
+			cb.BindPoint = 0;
+			for (auto& res : reflection->Resources)
+			{
+				if (res.Name == cb.Name)
+				{
+					cb.BindPoint = res.BindPoint;
+					break;
+				}
+			}
+
+			cb.Variables.resize(varCount);
+			for (uint32_t v = 0; v < varCount; v++)
+			{
+				size_t varAt = varOffset + v * varStride;
+				DXBCVariable& var = cb.Variables[v];
+
+				uint32_t varNameOffset, typeOffset;
+				if (!rdef.Read32(varAt + 0, &varNameOffset) ||
+					!rdef.ReadString(varNameOffset, &var.Name) ||
+					!rdef.Read32(varAt + 4, &var.StartOffset) ||
+					!rdef.Read32(varAt + 8, &var.Size) ||
+					!rdef.Read32(varAt + 16, &typeOffset) ||
+					!ReadType(rdef, typeOffset, major >= 5, &var))
+					return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+// --------------------------------------------------------
+// Reads the constant buffers, resources and (if there is
+// one) the input signature of a compiled shader
+// --------------------------------------------------------
+bool ParseDXBC(const void* data, size_t size, DXBCReflection* reflection)
+{
+	*reflection = {};
+
+	Chunk rdef;
+	if (!FindChunk(data, size, "RDEF", &rdef) || !ParseResources(rdef, reflection))
+		return false;
+
+	// Compute shaders and the like have no inputs to read
+	Chunk isgn;
+	if (FindChunk(data, size, "ISGN", &isgn) || FindChunk(data, size, "ISG1", &isgn))
+		return ParseDXBCInputs(data, size, &reflection->Inputs);
+
+	return true;
+}
+
+// --------------------------------------------------------
+// Reads only the input signature (ISGN, or ISG1 from
+// shader model 5.1 on, which adds a stream index before
+// and a min precision after each element)
+// --------------------------------------------------------
+bool ParseDXBCInputs(const void* data, size_t size, std::vector<DXBCInputElement>* inputs)
+{
+	inputs->clear();
+
+	Chunk chunk;
+	size_t stride, first;
+	if (FindChunk(data, size, "ISGN", &chunk)) { stride = 24; first = 0; }
+	else if (FindChunk(data, size, "ISG1", &chunk)) { stride = 32; first = 4; }
+	else return false;
+
+	uint32_t count;
+	if (!chunk.Read32(0, &count) || !chunk.Fits(8, count, stride))
+		return false;
+
+	inputs->resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		size_t at = 8 + i * stride + first;
+		DXBCInputElement& e = (*inputs)[i];
+
+		uint32_t nameOffset;
+		if (!chunk.Read32(at + 0, &nameOffset) ||
+			!chunk.ReadString(nameOffset, &e.SemanticName) ||
+			!chunk.Read32(at + 4, &e.SemanticIndex) ||
+			!chunk.Read32(at + 8, &e.SystemValue) ||
+			!chunk.Read32(at + 12, &e.ComponentType) ||
+			!chunk.Read32(at + 16, &e.Register) ||
+			!chunk.Read8(at + 20, &e.Mask))
+			return false;
+	}
+
+	return true;
+}
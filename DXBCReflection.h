@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Reads what SimpleShader needs straight out of a compiled
+// (DXBC) shader, instead of going through D3DReflect
+//
+// - RDEF chunk: constant buffers, their variables and the
+//   bound resources (cbuffers, textures, samplers, ...)
+// - ISGN / ISG1 chunk: the input signature, for building a
+//   vertex shader's input layout
+//
+// Enum-like fields hold the raw values the compiler wrote,
+// which are the same as the matching D3D enums (noted on
+// each), so they can be cast straight across.
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer.  DXIL (shader model 6)
+// containers have no RDEF chunk and are rejected.
+// --------------------------------------------------------
+
+struct DXBCVariable
+{
+	std::string Name;
+	uint32_t StartOffset;
+	uint32_t Size;
+	uint16_t Class;			// D3D_SHADER_VARIABLE_CLASS
+	uint16_t Type;			// D3D_SHADER_VARIABLE_TYPE
+	uint16_t Rows;
+	uint16_t Columns;
+	uint16_t Elements;		// Zero if not an array
+	std::string TypeName;	// Shader model 5 and up, like "float4" or "Light"
+};
+
+struct DXBCConstantBuffer
+{
+	std::string Name;
+	uint32_t Type;			// D3D_CBUFFER_TYPE
+	uint32_t Size;
+	uint32_t BindPoint;		// From the resource of the same name
+	std::vector<DXBCVariable> Variables;
+};
+
+struct DXBCResource
+{
+	std::string Name;
+	uint32_t Type;			// D3D_SHADER_INPUT_TYPE
+	uint32_t BindPoint;
+	uint32_t BindCount;
+};
+
+struct DXBCInputElement
+{
+	std::string SemanticName;
+	uint32_t SemanticIndex;
+	uint32_t Register;
+	uint32_t SystemValue;	// D3D_NAME
+	uint32_t ComponentType;	// D3D_REGISTER_COMPONENT_TYPE
+	uint8_t Mask;
+};
+
+struct DXBCReflection
+{
+	std::vector<DXBCConstantBuffer> ConstantBuffers;
+	std::vector<DXBCResource> Resources;
+	std::vector<DXBCInputElement> Inputs;
+};
+
+// Both return false on anything malformed or missing,
+// and never read outside of [data, data + size)
+bool ParseDXBC(const void* data, size_t size, DXBCReflection* reflection);
+bool ParseDXBCInputs(const void* data, size_t size, std::vector<DXBCInputElement>* inputs);
@@ -0,0 +1,95 @@
+#include "Lighting.hlsli"
+
+// --------------------------------------------------------
+// The deferred path's lighting pass - drawn as one full
+// screen triangle, lighting each pixel of the G-buffer
+// (see GBufferPS.hlsl) with the lights in its screen tile
+// (see LightTiles.h)
+// --------------------------------------------------------
+
+Texture2D GBufferAlbedo : register(t0);
+Texture2D GBufferNormal : register(t1);
+Texture2D GBufferMaterial : register(t2);
+Texture2D GBufferDepth : register(t3);
+
+// Each tile's offset and count in the list of light indices
+Buffer<uint2> TileRanges : register(t4);
+Buffer<uint> TileLightIndices : register(t5);
+StructuredBuffer<Light> Lights : register(t6);
+
+// The sky's image based lighting (see SkyLighting.h)
+TextureCube SkySpecular : register(t7);
+Texture2D SkyBRDFLookup : register(t8);
+SamplerState ClampSampler : register(s0);
+
+cbuffer PerFrame : register(b0)
+{
+    float3 ambientColor;
+    float3 cameraPosition;
+    
+    // A pixel is at cameraPosition + (forward + x * right +
+    // y * up) * its view depth, with x and y its position on
+    // screen from -1 to 1 (y up)
+    float3 viewRayForward;
+    float3 viewRayRight;
+    float3 viewRayUp;
+    
+    float2 screenSize;
+    uint tileSize;
+    uint tilesX;
+    
+    // Mips in SkySpecular - none turns sky reflections off
+    float skySpecularMips;
+    
+    // The sky's diffuse light - all zero turns it off
+    float4 skyIrradiance[7];
+};
+
+float4 main(float4 position : SV_POSITION) : SV_TARGET
+{
+    int3 pixel = int3(position.xy, 0);
+    float depth = GBufferDepth.Load(pixel).r;
+    
+    // Nothing was drawn here - the sky fills it in
+    if (depth <= 0.0f)
+        discard;
+    
+    float4 albedo = GBufferAlbedo.Load(pixel);
+    float3 normal = normalize(GBufferNormal.Load(pixel).xyz);
+    float2 material = GBufferMaterial.Load(pixel).rg;
+    float roughness = material.r;
+    float metalness = material.g;
+    
+    float2 screen = position.xy / screenSize * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f);
+    float3 worldPos = cameraPosition + (viewRayForward + screen.x * viewRayRight + screen.y * viewRayUp) * depth;
+    
+    // The same as PixelShader.hlsl from here on
+    float3 surfaceColor = pow(albedo.rgb, 2.2f);
+    float3 specularColor = lerp(F0_NON_METAL, surfaceColor, metalness);
+    float shadowAmount = albedo.a;
+    
+    // Ambient light is diffuse, which metals don't reflect
+    float3 ambient = ambientColor + SkyIrradiance(skyIrradiance, normal);
+    float3 totalLight = ambient * surfaceColor * (1.0f - metalness);
+    if (skySpecularMips > 0)
+        totalLight += SplitSumSpecular(SkySpecular, SkyBRDFLookup, ClampSampler, normal, normalize(cameraPosition - worldPos), roughness, specularColor, skySpecularMips);
+    
+    uint2 tile = uint2(position.xy) / tileSize;
+    uint2 range = TileRanges[tile.x + tile.y * tilesX];
+    for (uint i = 0; i < range.y; i++)
+    {
+        Light light = Lights[TileLightIndices[range.x + i]];
+        
+        if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+        {
+            float3 dirLight = CalculateDirectionalLight(light, normal, worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+            totalLight += (dirLight * shadowAmount);
+        }
+        else if (light.Type == LIGHT_TYPE_POINT)
+            totalLight += CalculatePointLight(light, normal, worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+        else if (light.Type == LIGHT_TYPE_SPOT)
+            totalLight += CalculateSpotLight(light, normal, worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+    }
+    
+    return float4(pow(totalLight, 1.0f / 2.2f), 1);
+}
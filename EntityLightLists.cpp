@@ -0,0 +1,282 @@
+#include "EntityLightLists.h"
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <thread>
+
+using namespace DirectX;
+
+EntityLightLists::EntityLightLists(std::shared_ptr<WorkerPool> pool)
+	: pool(pool)
+{
+	if (!this->pool)
+	{
+		unsigned int threads = std::thread::hardware_concurrency();
+		this->pool = std::make_shared<WorkerPool>(threads < 8 ? threads : 8);
+	}
+	threadCount = this->pool->GetThreadCount();
+}
+
+unsigned int EntityLightLists::GetMaxLightsPerEntity() const
+{
+	unsigned int most = 0;
+	for (auto& r : ranges)
+		if (r.Count > most)
+			most = r.Count;
+	return most;
+}
+
+// --------------------------------------------------------
+// Whether a light can light anything in a box
+//
+// - Directional lights reach everything
+// - Point lights fade to nothing at their range
+// - Spot lights too, and are also zero behind the plane
+//   they face (their falloff is a power of the cosine, so
+//   the cone only truly reaches zero at 90 degrees)
+//
+// ReachMask() is the same test, and rounds the same way
+// --------------------------------------------------------
+bool EntityLightLists::Reaches(const Light& light, const AABB& box)
+{
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		return true;
+	if (!(light.Range > 0.0f))
+		return false;
+
+	if (!Bounds::OverlapsSphere(box, light.Position, light.Range))
+		return false;
+
+	if (light.Type == LIGHT_TYPE_SPOT)
+	{
+		// Corner furthest along the light's direction
+		const XMFLOAT3& c = light.Position;
+		const XMFLOAT3& d = light.Direction;
+		float ahead =
+			(d.x >= 0 ? box.Max.x : box.Min.x) * d.x - c.x * d.x +
+			(d.y >= 0 ? box.Max.y : box.Min.y) * d.y - c.y * d.y +
+			(d.z >= 0 ? box.Max.z : box.Min.z) * d.z - c.z * d.z;
+		if (ahead < 0)
+			return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Reaches(), for four lights at once
+//
+// - The corner furthest along a direction is the larger of
+//   its products with the box's min and max, on each axis
+// - Directional lights are centered anywhere, with an
+//   infinite radius
+// --------------------------------------------------------
+int EntityLightLists::ReachMask(const LightGroup& g, const AABB& box)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 minX = _mm_set1_ps(box.Min.x), maxX = _mm_set1_ps(box.Max.x);
+	__m128 minY = _mm_set1_ps(box.Min.y), maxY = _mm_set1_ps(box.Max.y);
+	__m128 minZ = _mm_set1_ps(box.Min.z), maxZ = _mm_set1_ps(box.Max.z);
+
+	__m128 x = _mm_load_ps(g.X);
+	__m128 y = _mm_load_ps(g.Y);
+	__m128 z = _mm_load_ps(g.Z);
+	__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_sub_ps(x, maxX));
+	__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_sub_ps(y, maxY));
+	__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), zero), _mm_sub_ps(z, maxZ));
+	__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	__m128 inRange = _mm_cmple_ps(distSq, _mm_load_ps(g.RadiusSq));
+
+	__m128 dirX = _mm_load_ps(g.DirX);
+	__m128 dirY = _mm_load_ps(g.DirY);
+	__m128 dirZ = _mm_load_ps(g.DirZ);
+	__m128 ahead = _mm_max_ps(_mm_mul_ps(maxX, dirX), _mm_mul_ps(minX, dirX));
+	ahead = _mm_sub_ps(ahead, _mm_load_ps(g.XDirX));
+	ahead = _mm_add_ps(ahead, _mm_max_ps(_mm_mul_ps(maxY, dirY), _mm_mul_ps(minY, dirY)));
+	ahead = _mm_sub_ps(ahead, _mm_load_ps(g.YDirY));
+	ahead = _mm_add_ps(ahead, _mm_max_ps(_mm_mul_ps(maxZ, dirZ), _mm_mul_ps(minZ, dirZ)));
+	ahead = _mm_sub_ps(ahead, _mm_load_ps(g.ZDirZ));
+	__m128 inFront = _mm_cmpge_ps(ahead, zero);
+
+	return _mm_movemask_ps(_mm_and_ps(inRange, inFront));
+}
+
+// --------------------------------------------------------
+// Lays the lights out in groups of four, padded with lights
+// that reach nothing
+// --------------------------------------------------------
+void EntityLightLists::SetupLights(const Light* lights, unsigned int lightCount)
+{
+	lightGroups.resize((lightCount + 3) / 4);
+	for (unsigned int i = 0; i < (unsigned int)lightGroups.size() * 4; i++)
+	{
+		LightGroup& g = lightGroups[i / 4];
+		unsigned int lane = i % 4;
+		g.Index[lane] = i;
+
+		XMFLOAT3 center(0, 0, 0);
+		XMFLOAT3 dir(0, 0, 0);
+		float radiusSq = -1.0f;
+		if (i < lightCount)
+		{
+			const Light& light = lights[i];
+			if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+				radiusSq = INFINITY;
+			else if (light.Range > 0.0f)
+			{
+				center = light.Position;
+				radiusSq = light.Range * light.Range;
+				if (light.Type == LIGHT_TYPE_SPOT)
+					dir = light.Direction;
+			}
+		}
+
+		g.X[lane] = center.x;
+		g.Y[lane] = center.y;
+		g.Z[lane] = center.z;
+		g.RadiusSq[lane] = radiusSq;
+		g.DirX[lane] = dir.x;
+		g.DirY[lane] = dir.y;
+		g.DirZ[lane] = dir.z;
+		g.XDirX[lane] = center.x * dir.x;
+		g.YDirY[lane] = center.y * dir.y;
+		g.ZDirZ[lane] = center.z * dir.z;
+	}
+}
+
+// --------------------------------------------------------
+// Splits the blocks among the pool's threads, each of which
+// makes the lists for its own entities, then joins those up
+// in order
+// --------------------------------------------------------
+void EntityLightLists::Build(const Light* lights, unsigned int lightCount, const AABB* bounds, unsigned int entityCount)
+{
+	SetupLights(lights, lightCount);
+	ranges.resize(entityCount);
+	lightIndices.clear();
+	if (entityCount == 0)
+		return;
+
+	unsigned int blocks = (entityCount + BlockSize - 1) / BlockSize;
+	unsigned int workers = threadCount < blocks ? threadCount : blocks;
+	unsigned int perWorker = (blocks + workers - 1) / workers;
+	if (work.size() < workers)
+		work.resize(workers);
+
+	pool->Run(workers, [&](size_t i)
+		{
+			unsigned int start = (unsigned int)i * perWorker;
+			unsigned int end = start + perWorker < blocks ? start + perWorker : blocks;
+			if (start < end)
+				BuildBlocks(bounds, entityCount, start, end, work[i]);
+		});
+
+	// Each thread's offsets start from zero
+	size_t total = 0;
+	for (unsigned int i = 0; i < workers && i * perWorker < blocks; i++)
+		total += work[i].Indices.size();
+	lightIndices.resize(total);
+
+	uint32_t offset = 0;
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		unsigned int start = i * perWorker;
+		unsigned int end = start + perWorker < blocks ? start + perWorker : blocks;
+		if (start >= end)
+			break;
+
+		unsigned int endEntity = end * BlockSize < entityCount ? end * BlockSize : entityCount;
+		for (unsigned int e = start * BlockSize; e < endEntity; e++)
+			ranges[e].Offset += offset;
+
+		const std::vector<uint32_t>& indices = work[i].Indices;
+		if (!indices.empty())
+			memcpy(&lightIndices[offset], indices.data(), indices.size() * sizeof(uint32_t));
+		offset += (uint32_t)indices.size();
+	}
+}
+
+// --------------------------------------------------------
+// Makes the lists for a range of blocks: the lights that
+// reach each block's box are packed into groups of their
+// own, which its entities are then tested against
+//
+// - Anything reaching an entity reaches the box around its
+//   block too (rounding included, as the box is only ever
+//   further out), so nothing is lost
+// --------------------------------------------------------
+void EntityLightLists::BuildBlocks(const AABB* bounds, unsigned int entityCount, unsigned int firstBlock, unsigned int endBlock, BlockWork& w)
+{
+	w.Indices.clear();
+
+	for (unsigned int b = firstBlock; b < endBlock; b++)
+	{
+		unsigned int first = b * BlockSize;
+		unsigned int end = first + BlockSize < entityCount ? first + BlockSize : entityCount;
+
+		AABB blockBox = Bounds::Empty();
+		for (unsigned int e = first; e < end; e++)
+			blockBox = Bounds::Merge(blockBox, bounds[e]);
+
+		// Pack the lights that reach the block, keeping them in
+		// order, and pad out the last group
+		unsigned int candidates = 0;
+		w.Candidates.resize(lightGroups.size());
+		for (const LightGroup& g : lightGroups)
+		{
+			int mask = ReachMask(g, blockBox);
+			for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1)
+			{
+				if ((mask & 1) == 0)
+					continue;
+
+				LightGroup& c = w.Candidates[candidates / 4];
+				unsigned int to = candidates % 4;
+				c.X[to] = g.X[lane];
+				c.Y[to] = g.Y[lane];
+				c.Z[to] = g.Z[lane];
+				c.RadiusSq[to] = g.RadiusSq[lane];
+				c.DirX[to] = g.DirX[lane];
+				c.DirY[to] = g.DirY[lane];
+				c.DirZ[to] = g.DirZ[lane];
+				c.XDirX[to] = g.XDirX[lane];
+				c.YDirY[to] = g.YDirY[lane];
+				c.ZDirZ[to] = g.ZDirZ[lane];
+				c.Index[to] = g.Index[lane];
+				candidates++;
+			}
+		}
+		for (unsigned int pad = candidates; pad % 4 != 0; pad++)
+			w.Candidates[pad / 4].RadiusSq[pad % 4] = -1.0f;
+		unsigned int groups = (candidates + 3) / 4;
+
+		for (unsigned int e = first; e < end; e++)
+		{
+			uint32_t offset = (uint32_t)w.Indices.size();
+			for (unsigned int i = 0; i < groups; i++)
+			{
+				const LightGroup& c = w.Candidates[i];
+				int mask = ReachMask(c, bounds[e]);
+				for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1)
+					if (mask & 1)
+						w.Indices.push_back(c.Index[lane]);
+			}
+			ranges[e] = { offset, (uint32_t)w.Indices.size() - offset };
+		}
+	}
+}
+
+void EntityLightLists::BuildReference(const Light* lights, unsigned int lightCount, const AABB* bounds, unsigned int entityCount)
+{
+	ranges.resize(entityCount);
+	lightIndices.clear();
+
+	for (unsigned int e = 0; e < entityCount; e++)
+	{
+		uint32_t offset = (uint32_t)lightIndices.size();
+		for (unsigned int l = 0; l < lightCount; l++)
+			if (Reaches(lights[l], bounds[e]))
+				lightIndices.push_back(l);
+
+		ranges[e] = { offset, (uint32_t)lightIndices.size() - offset };
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Bounds.h"
+#include "Light.h"
+#include "WorkerPool.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------
+// Per entity light lists, picked on the CPU
+//
+// - Each entity's world space box is tested against every
+//   light's sphere of influence (and, for spot lights, the
+//   half space their cone can reach), and gets the list of
+//   lights that pass
+// - Entities are taken in blocks: lights are first tested
+//   against a block's box, and only those that reach it are
+//   tested against its entities.  Both tests run on 4 lights
+//   at a time with SSE, from lights laid out as arrays
+// - Blocks are split across threads.  The lists are the
+//   same whatever the thread count, and the same as
+//   BuildReference() makes by testing every light against
+//   every entity
+//
+// The other way of picking lights, next to LightClusters -
+// a draw (or instance) only needs its offset and count
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class EntityLightLists
+{
+public:
+	// Where an entity's lights are in GetLightIndices()
+	struct Range
+	{
+		uint32_t Offset;
+		uint32_t Count;
+	};
+
+	// Entities per block, for the first round of tests
+	static const unsigned int BlockSize = 32;
+
+	// Without a pool, makes its own of up to 8 threads
+	EntityLightLists(std::shared_ptr<WorkerPool> pool = 0);
+
+	void Build(const Light* lights, unsigned int lightCount, const AABB* bounds, unsigned int entityCount);
+
+	// Single threaded, and one light and entity at a time -
+	// for checking Build() against
+	void BuildReference(const Light* lights, unsigned int lightCount, const AABB* bounds, unsigned int entityCount);
+
+	// One range per entity, in the order they were given, and
+	// each list in light order
+	const std::vector<Range>& GetRanges() const { return ranges; }
+	const std::vector<uint32_t>& GetLightIndices() const { return lightIndices; }
+	unsigned int GetMaxLightsPerEntity() const;
+
+	// Whether a light can light anything in a box - the test
+	// both builds make
+	static bool Reaches(const Light& light, const AABB& box);
+
+private:
+	// Four lights, as arrays - anything but spot lights has no
+	// direction, so always passes the half space test, and
+	// padding has a negative squared radius, so never passes
+	struct alignas(16) LightGroup
+	{
+		float X[4], Y[4], Z[4];
+		float RadiusSq[4];
+		float DirX[4], DirY[4], DirZ[4];
+		float XDirX[4], YDirY[4], ZDirZ[4];		// Position * direction, per axis
+		uint32_t Index[4];
+	};
+
+	// What each thread collects for its blocks - kept from
+	// frame to frame, so the vectors don't need to grow again
+	struct BlockWork
+	{
+		std::vector<LightGroup> Candidates;		// Lights that reach the block
+		std::vector<uint32_t> Indices;			// Every entity's lists, back to back
+	};
+
+	// Bit i is set if the group's light i reaches the box
+	static int ReachMask(const LightGroup& group, const AABB& box);
+
+	void SetupLights(const Light* lights, unsigned int lightCount);
+	void BuildBlocks(const AABB* bounds, unsigned int entityCount, unsigned int firstBlock, unsigned int endBlock, BlockWork& work);
+
+	std::shared_ptr<WorkerPool> pool;
+	unsigned int threadCount;
+
+	std::vector<LightGroup> lightGroups;
+	std::vector<BlockWork> work;
+
+	std::vector<Range> ranges;
+	std::vector<uint32_t> lightIndices;
+};
@@ -0,0 +1,236 @@
+#include "FrameStats.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <vector>
+
+namespace FrameStats
+{
+	// Annonymous namespace to hold variables
+	// only accessible in this file
+	namespace
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		struct FrameRecord
+		{
+			float PhaseMs[PhaseCount];
+			float FrameMs;
+			unsigned int DrawCalls;
+			unsigned int BufferUploads;
+			unsigned int BufferBytesUploaded;
+			unsigned int BufferUploadsSkipped;
+			unsigned int ShaderBinds;
+			unsigned int StateCallsIssued;
+			unsigned int StateCallsFiltered;
+			unsigned int Allocations;
+			unsigned int Entities;
+			unsigned int Lights;
+		};
+
+		const char* phaseNames[PhaseCount] =
+		{
+			"update", "ui", "culling", "lights", "batching", "shadows", "main", "post", "present"
+		};
+
+		Clock::time_point frameStart;
+		Clock::time_point phaseStart[PhaseCount];
+		float phaseMs[PhaseCount] = {};
+		unsigned long long allocationsAtStart = 0;
+		FrameRecord last = {};
+
+		std::string recordPath;
+		unsigned int recordTarget = 0;
+		std::vector<FrameRecord> recorded;
+
+		void WriteCSV()
+		{
+			std::ofstream csv(recordPath);
+			if (!csv.is_open())
+				return;
+
+			csv << "frame,entities,lights,frame_ms";
+			for (int p = 0; p < PhaseCount; p++)
+				csv << "," << phaseNames[p] << "_ms";
+			csv << ",draw_calls,buffer_uploads,buffer_bytes,buffer_uploads_skipped,shader_binds,state_calls,state_calls_filtered,allocations\n";
+
+			for (size_t i = 0; i < recorded.size(); i++)
+			{
+				const FrameRecord& r = recorded[i];
+				csv << i << "," << r.Entities << "," << r.Lights << "," << r.FrameMs;
+				for (int p = 0; p < PhaseCount; p++)
+					csv << "," << r.PhaseMs[p];
+				csv << "," << r.DrawCalls << "," << r.BufferUploads << "," << r.BufferBytesUploaded << "," << r.BufferUploadsSkipped;
+				csv << "," << r.ShaderBinds << "," << r.StateCallsIssued << "," << r.StateCallsFiltered << "," << r.Allocations << "\n";
+			}
+		}
+	}
+}
+
+void FrameStats::BeginFrame()
+{
+	frameStart = Clock::now();
+	for (int p = 0; p < PhaseCount; p++)
+		phaseMs[p] = 0.0f;
+
+	DrawCalls = 0;
+	BufferUploads = 0;
+	BufferBytesUploaded = 0;
+	BufferUploadsSkipped = 0;
+	ShaderBinds = 0;
+	StateCallsIssued = 0;
+	StateCallsFiltered = 0;
+	allocationsAtStart = Allocations.load();
+}
+
+void FrameStats::EndFrame(unsigned int entityCount, unsigned int lightCount)
+{
+	FrameRecord r = {};
+	for (int p = 0; p < PhaseCount; p++)
+		r.PhaseMs[p] = phaseMs[p];
+	r.FrameMs = std::chrono::duration<float, std::milli>(Clock::now() - frameStart).count();
+	r.DrawCalls = DrawCalls;
+	r.BufferUploads = BufferUploads;
+	r.BufferBytesUploaded = BufferBytesUploaded;
+	r.BufferUploadsSkipped = BufferUploadsSkipped;
+	r.ShaderBinds = ShaderBinds;
+	r.StateCallsIssued = StateCallsIssued;
+	r.StateCallsFiltered = StateCallsFiltered;
+	r.Allocations = (unsigned int)(Allocations.load() - allocationsAtStart);
+	r.Entities = entityCount;
+	r.Lights = lightCount;
+	last = r;
+
+	if (recordTarget > 0)
+	{
+		recorded.push_back(r);
+		if (recorded.size() >= recordTarget)
+		{
+			WriteCSV();
+			recordTarget = 0;
+		}
+	}
+}
+
+// Phases can be entered more than once per frame - time adds up
+void FrameStats::BeginPhase(Phase phase) { phaseStart[phase] = Clock::now(); }
+void FrameStats::EndPhase(Phase phase)
+{
+	phaseMs[phase] += std::chrono::duration<float, std::milli>(Clock::now() - phaseStart[phase]).count();
+}
+
+const char* FrameStats::GetPhaseName(Phase phase) { return phaseNames[phase]; }
+float FrameStats::GetPhaseMs(Phase phase) { return last.PhaseMs[phase]; }
+float FrameStats::GetFrameMs() { return last.FrameMs; }
+unsigned int FrameStats::GetDrawCalls() { return last.DrawCalls; }
+unsigned int FrameStats::GetBufferUploads() { return last.BufferUploads; }
+unsigned int FrameStats::GetBufferBytesUploaded() { return last.BufferBytesUploaded; }
+unsigned int FrameStats::GetBufferUploadsSkipped() { return last.BufferUploadsSkipped; }
+unsigned int FrameStats::GetShaderBinds() { return last.ShaderBinds; }
+unsigned int FrameStats::GetStateCallsIssued() { return last.StateCallsIssued; }
+unsigned int FrameStats::GetStateCallsFiltered() { return last.StateCallsFiltered; }
+unsigned int FrameStats::GetAllocations() { return last.Allocations; }
+
+void FrameStats::StartRecording(const std::string& csvPath, unsigned int frameCount)
+{
+	recordPath = csvPath;
+	recordTarget = frameCount;
+	recorded.clear();
+	recorded.reserve(frameCount);
+}
+
+bool FrameStats::IsRecording() { return recordTarget > 0; }
+unsigned int FrameStats::GetRecordedFrames() { return (unsigned int)recorded.size(); }
+
+// --------------------------------------------------------
+// Global allocation counting
+// - Replacing these is enough to see every new/delete in
+//   the program, including those inside the standard library
+// - The nothrow and aligned forms are replaced too, so types
+//   like XMFLOAT4X4A and anything alignas() are counted
+// --------------------------------------------------------
+void* operator new(size_t size)
+{
+	FrameStats::Allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	FrameStats::Allocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+// Aligned memory has to go back to its own free function
+// on Windows, and aligned_alloc() wants whole multiples of
+// the alignment
+static void* AlignedAlloc(size_t size, std::align_val_t alignment)
+{
+	size_t align = (size_t)alignment;
+	size_t rounded = (size ? size + align - 1 : align) / align * align;
+#ifdef _WIN32
+	return _aligned_malloc(rounded, align);
+#else
+	return aligned_alloc(align, rounded);
+#endif
+}
+
+static void AlignedFree(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	FrameStats::Allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = AlignedAlloc(size, alignment))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	FrameStats::Allocations.fetch_add(1, std::memory_order_relaxed);
+	return AlignedAlloc(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, alignment, tag);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// --------------------------------------------------------
+// Per-frame CPU cost tracking
+//
+// - Phases are timed by the game, with BeginPhase() and
+//   EndPhase() around each part of Update() and Draw()
+// - Counters are bumped by the code doing the work: Mesh
+//   for draws, SimpleShader & co. for buffer uploads and
+//   shader binds, StateCache for context calls, and a
+//   global operator new for allocations
+// - A number of frames can be recorded and written to a CSV
+//   file, to compare runs before and after a change
+// --------------------------------------------------------
+namespace FrameStats
+{
+	enum Phase
+	{
+		PhaseUpdate,
+		PhaseUI,
+		PhaseCulling,
+		PhaseLights,
+		PhaseBatching,
+		PhaseShadows,
+		PhaseMain,
+		PhasePost,
+		PhasePresent,
+		PhaseCount
+	};
+
+	// --- GLOBAL VARS ---
+
+	// Reset at the start of every frame
+	inline unsigned int DrawCalls = 0;
+	inline unsigned int BufferUploads = 0;	// Constant & dynamic buffer writes
+	inline unsigned int BufferBytesUploaded = 0;
+	inline unsigned int BufferUploadsSkipped = 0;	// Constant buffers that hadn't changed
+	inline unsigned int ShaderBinds = 0;
+	inline unsigned int StateCallsIssued = 0;	// Context state calls that reached D3D
+	inline unsigned int StateCallsFiltered = 0;	// ...and those the state cache dropped
+
+	// Running total - can be bumped from any thread
+	inline std::atomic<unsigned long long> Allocations = 0;
+
+	// --- FUNCTIONS ---
+
+	void BeginFrame();
+	void EndFrame(unsigned int entityCount, unsigned int lightCount);
+
+	void BeginPhase(Phase phase);
+	void EndPhase(Phase phase);
+
+	// Results of the last finished frame
+	const char* GetPhaseName(Phase phase);
+	float GetPhaseMs(Phase phase);
+	float GetFrameMs();
+	unsigned int GetDrawCalls();
+	unsigned int GetBufferUploads();
+	unsigned int GetBufferBytesUploaded();
+	unsigned int GetBufferUploadsSkipped();
+	unsigned int GetShaderBinds();
+	unsigned int GetStateCallsIssued();
+	unsigned int GetStateCallsFiltered();
+	unsigned int GetAllocations();
+
+	// Records the next frameCount frames, then writes them out
+	void StartRecording(const std::string& csvPath, unsigned int frameCount);
+	bool IsRecording();
+	unsigned int GetRecordedFrames();
+}
@@ -0,0 +1,63 @@
+#include "ShaderStructs.hlsli"
+#include "Lighting.hlsli"
+
+// --------------------------------------------------------
+// The deferred path's geometry pass - writes out what
+// PixelShader.hlsl knows about a pixel before its light
+// loop, for DeferredLightingPS.hlsl to light
+//
+// - Textures, samplers and PerMaterial are laid out as in
+//   PixelShader.hlsl, so materials bind to it the same way
+// - Every map is read, as in the full PixelShader
+// --------------------------------------------------------
+
+SamplerState BasicSampler : register(s0);
+Texture2D Albedo : register(t0);
+Texture2D NormalMap : register(t1);
+Texture2D RoughnessMap : register(t2);
+Texture2D MetalnessMap : register(t3);
+SamplerComparisonState ShadowSampler : register(s1);
+Texture2D ShadowMap : register(t4);
+
+cbuffer PerFrame : register(b0)
+{
+    float2 shadowMapSize;
+    
+    // View depth is a dot with the world position
+    float4 viewDepth;
+};
+
+cbuffer PerMaterial : register(b1)
+{
+    float4 colorTint;
+    float roughness;
+    float2 uvScale;
+    float2 uvOffset;
+};
+
+struct GBuffer
+{
+    float4 albedo : SV_TARGET0;     // Tinted albedo (not yet linear), and how lit by the shadow casting light
+    float4 normal : SV_TARGET1;     // World space
+    float2 material : SV_TARGET2;   // Roughness, metalness
+    float depth : SV_TARGET3;       // View depth - zero is cleared to, for nothing drawn
+};
+
+GBuffer main(VertexToPixel input)
+{
+    input.normal = normalize(input.normal);
+    input.uv = input.uv * uvScale + uvOffset;
+    
+    float2 shadowUV = input.shadowPos.xy / input.shadowPos.w * 0.5f + 0.5f;
+    shadowUV.y = 1.0f - shadowUV.y;
+    float depthFromLight = input.shadowPos.z / input.shadowPos.w;
+    
+    GBuffer output;
+    output.albedo.rgb = Albedo.Sample(BasicSampler, input.uv).rgb * colorTint.rgb;
+    output.albedo.a = PCFSample(ShadowMap, ShadowSampler, shadowUV, depthFromLight, 1.0f / shadowMapSize, 5);
+    output.normal = float4(NormalMapping(NormalMap, BasicSampler, input.uv, input.normal, input.tangent), 0.0f);
+    output.material.r = RoughnessMap.Sample(BasicSampler, input.uv).r;
+    output.material.g = MetalnessMap.Sample(BasicSampler, input.uv).r;
+    output.depth = dot(float4(input.worldPos, 1.0f), viewDepth);
+    return output;
+}
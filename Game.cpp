@@ -10,6 +10,18 @@
 #include <DirectXMath.h>
 #include "SimpleShader.h"
 #include "Material.h"
+#include "SceneFile.h"
+#include "FrameStats.h"
+#include "ShaderCache.h"
+#include "ShaderBuffers.h"
+#include "ShaderVariantCache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
 
 // Needed for a helper function to load pre-compiled shader files
 #pragma comment(lib, "d3dcompiler.lib")
@@ -38,6 +50,12 @@ void Game::Initialize()
 	// geometry to draw and some simple camera matrices.
 	//  - You'll be expanding and/or replacing these later
 	//LoadShaders();
+	constantRing = std::make_shared<ConstantBufferRing>(Graphics::Device, Graphics::Context);
+	constantRingOn = constantRing->IsValid();
+	if (constantRingOn)
+		ISimpleShader::UploadRing = constantRing;
+	commandBackend = std::make_shared<D3D11CommandBackend>(Graphics::Context, constantRing);
+
 	CreateGeometry();
 	GenerateLights();
 
@@ -49,7 +67,7 @@ void Game::Initialize()
 		// Tell the input assembler (IA) stage of the pipeline what kind of
 		// geometric primitives (points, lines or triangles) we want to draw.  
 		// Essentially: "What kind of shape should the GPU draw with our vertices?"
-		Graphics::Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		Graphics::States->SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	}
 
 	cameras.push_back(std::make_shared<Camera>(
@@ -107,6 +125,10 @@ Game::~Game()
 	ImGui_ImplDX11_Shutdown();
 	ImGui_ImplWin32_Shutdown();
 	ImGui::DestroyContext();
+
+	// Shaders share these, so let go of them explicitly
+	ISimpleShader::UploadRing.reset();
+	ISimpleShader::MetadataCache.reset();
 }
 
 Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Game::LoadTexture(const std::wstring& path)
@@ -130,38 +152,97 @@ PBRTexture Game::LoadPBRMaterial(
 	return tex;
 }
 
+// --------------------------------------------------------
+// Adds a shader to be created by LoadQueuedShaders(), and
+// reserves the spot its load time is recorded in
+// --------------------------------------------------------
+template<typename T>
+void Game::QueueShader(std::vector<std::function<void()>>& jobs, std::shared_ptr<T>* shader, const std::wstring& file)
+{
+	size_t index = shaderLoads.size();
+	shaderLoads.push_back({ WideToNarrow(file), 0.0f, false, 0 });
+
+	jobs.push_back([this, shader, file, index]()
+	{
+		*shader = std::make_shared<T>(Graphics::Device, Graphics::Context, FixPath(file).c_str());
+		shaderLoads[index].Ms = (*shader)->GetLoadMs();
+		shaderLoads[index].Cached = (*shader)->WasMetadataCached();
+		shaderLoads[index].MetadataBytes = (*shader)->GetMetadataBytes();
+	});
+}
+
+// --------------------------------------------------------
+// Runs the queued shader loads across worker threads
+// - Creating shaders and buffers on the device is free
+//   threaded, and SimpleShader's constructors only query
+//   the context for its 11.1 interface
+// --------------------------------------------------------
+void Game::LoadQueuedShaders(std::vector<std::function<void()>>& jobs)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::atomic<size_t> next = 0;
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < jobs.size(); i = next++)
+			jobs[i]();
+	};
+
+	unsigned int threadCount = std::thread::hardware_concurrency();
+	if (threadCount > jobs.size()) threadCount = (unsigned int)jobs.size();
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threadCount; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto& w : workers)
+		w.join();
+	jobs.clear();
+
+	auto end = std::chrono::high_resolution_clock::now();
+	shaderStartupMs += std::chrono::duration<float, std::milli>(end - start).count();
+}
+
 // --------------------------------------------------------
 // Creates the geometry we're going to draw
 // --------------------------------------------------------
 void Game::CreateGeometry()
 {
-	// Create some temporary variables to represent colors
-	// - Not necessary, just makes things more readable
-	XMFLOAT4 red = XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f);
-	XMFLOAT4 green = XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f);
-	XMFLOAT4 blue = XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f);
-	XMFLOAT4 yellow = XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f);
-	XMFLOAT4 purple = XMFLOAT4(0.5f, 0.0f, 0.5f, 1.0f);
-	XMFLOAT4 none = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-
-	std::shared_ptr<SimpleVertexShader> vs = std::make_shared<SimpleVertexShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"VertexShader.cso").c_str());
-	std::shared_ptr<SimplePixelShader> ps = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"PixelShader.cso").c_str());
-	std::shared_ptr<SimplePixelShader> normalps = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"DebugNormalsPS.cso").c_str());
-	std::shared_ptr<SimplePixelShader> uvps = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"DebugUVsPS.cso").c_str());
-	std::shared_ptr<SimplePixelShader> custom = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"CustomPS.cso").c_str());
-	std::shared_ptr<SimplePixelShader> combined = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"CombinationPS.cso").c_str());
-	std::shared_ptr<SimpleVertexShader> skyVS = std::make_shared<SimpleVertexShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"SkyVS.cso").c_str());
-	std::shared_ptr<SimplePixelShader> skyPS = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"SkyPS.cso").c_str());
-	shadowVS = std::make_shared<SimpleVertexShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"ShadowVS.cso").c_str());
+	// Shader reflection data is cached between runs
+	shaderCache = std::make_shared<ShaderCache>();
+	shaderCache->Load(FixPath("ShaderCache.bin"));
+	ISimpleShader::MetadataCache = shaderCache;
+
+	std::shared_ptr<SimpleVertexShader> vs;
+	std::shared_ptr<SimpleVertexShader> skyVS;
+	std::shared_ptr<SimplePixelShader> skyPS;
+	std::vector<std::function<void()>> shaderJobs;
+	QueueShader(shaderJobs, &vs, L"VertexShader.cso");
+	QueueShader(shaderJobs, &skyVS, L"SkyVS.cso");
+	QueueShader(shaderJobs, &skyPS, L"SkyPS.cso");
+	QueueShader(shaderJobs, &shadowVS, L"ShadowVS.cso");
+	QueueShader(shaderJobs, &instancedVS, L"InstancedVS.cso");
+	QueueShader(shaderJobs, &shadowInstancedVS, L"ShadowInstancedVS.cso");
+	QueueShader(shaderJobs, &fullscreenVS, L"FullscreenVS.cso");
+	QueueShader(shaderJobs, &blurPS, L"BlurPS.cso");
+	QueueShader(shaderJobs, &pixelizePS, L"PixelizePS.cso");
+	QueueShader(shaderJobs, &copyPS, L"CopyPS.cso");
+	QueueShader(shaderJobs, &gbufferPS, L"GBufferPS.cso");
+	QueueShader(shaderJobs, &deferredLightingPS, L"DeferredLightingPS.cso");
+	LoadQueuedShaders(shaderJobs);
+
+	instanceBatcher = std::make_shared<InstanceBatcher>();
+	unsigned int workerThreads = std::thread::hardware_concurrency();
+	workerPool = std::make_shared<WorkerPool>(workerThreads < 8 ? workerThreads : 8);
+	occlusionCuller = std::make_shared<OcclusionCuller>(256, 128, workerPool);
+	lightClusters = std::make_shared<LightClusters>(16, 9, 24, workerPool);
+	entityLightLists = std::make_shared<EntityLightLists>(workerPool);
+	lightTiles = std::make_shared<LightTiles>();
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+	for (int i = 0; i < StatsQueryCount; i++)
+		Graphics::Device->CreateQuery(&queryDesc, statsQueries[i].GetAddressOf());
 
 	// Sampler Loading 
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState;
@@ -183,50 +264,10 @@ void Game::CreateGeometry()
 	samplerDesc.BorderColor[2] = 1.0f;
 	samplerDesc.BorderColor[3] = 1.0f;
 
-	Graphics::Device->CreateSamplerState(&samplerDesc, samplerState.GetAddressOf());
-
-	// Mesh Loading
-	std::shared_ptr<Mesh> cubeMesh = std::make_shared<Mesh>("Cube", FixPath("../../Assets/Models/cube.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> cylinderMesh = std::make_shared<Mesh>("Cylinder", FixPath("../../Assets/Models/cylinder.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> helixMesh = std::make_shared<Mesh>("Helix", FixPath("../../Assets/Models/helix.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> sphereMesh = std::make_shared<Mesh>("Sphere", FixPath("../../Assets/Models/sphere.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> torusMesh = std::make_shared<Mesh>("Torus", FixPath("../../Assets/Models/torus.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quadMesh = std::make_shared<Mesh>("Quad", FixPath("../../Assets/Models/quad.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quad2sidedMesh = std::make_shared<Mesh>("Double-Sided Quad", FixPath("../../Assets/Models/quad_double_sided.obj").c_str(), Graphics::Device);
-
-	std::shared_ptr<Mesh> cubeMeshNormal = std::make_shared<Mesh>("Cube", FixPath("../../Assets/Models/cube.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> cylinderMeshNormal = std::make_shared<Mesh>("Cylinder", FixPath("../../Assets/Models/cylinder.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> helixMeshNormal = std::make_shared<Mesh>("Helix", FixPath("../../Assets/Models/helix.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> sphereMeshNormal = std::make_shared<Mesh>("Sphere", FixPath("../../Assets/Models/sphere.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> torusMeshNormal = std::make_shared<Mesh>("Torus", FixPath("../../Assets/Models/torus.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quadMeshNormal = std::make_shared<Mesh>("Quad", FixPath("../../Assets/Models/quad.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quad2sidedMeshNormal = std::make_shared<Mesh>("Double-Sided Quad", FixPath("../../Assets/Models/quad_double_sided.obj").c_str(), Graphics::Device);
-
-	std::shared_ptr<Mesh> cubeMeshUV = std::make_shared<Mesh>("Cube", FixPath("../../Assets/Models/cube.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> cylinderMeshUV = std::make_shared<Mesh>("Cylinder", FixPath("../../Assets/Models/cylinder.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> helixMeshUV = std::make_shared<Mesh>("Helix", FixPath("../../Assets/Models/helix.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> sphereMeshUV = std::make_shared<Mesh>("Sphere", FixPath("../../Assets/Models/sphere.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> torusMeshUV = std::make_shared<Mesh>("Torus", FixPath("../../Assets/Models/torus.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quadMeshUV = std::make_shared<Mesh>("Quad", FixPath("../../Assets/Models/quad.obj").c_str(), Graphics::Device);
-	std::shared_ptr<Mesh> quad2sidedMeshUV = std::make_shared<Mesh>("Double-Sided Quad", FixPath("../../Assets/Models/quad_double_sided.obj").c_str(), Graphics::Device);
-
-	std::shared_ptr<Mesh> floor = std::make_shared<Mesh>("Cube", FixPath("../../Assets/Models/cube.obj").c_str(), Graphics::Device);
-
-	meshes.insert(meshes.end(), {
-		cubeMesh, cylinderMesh, helixMesh, sphereMesh, torusMesh, quadMesh, quad2sidedMesh,
-		cubeMeshNormal, cylinderMeshNormal, helixMeshNormal, sphereMeshNormal, torusMeshNormal, quadMeshNormal, quad2sidedMeshNormal,
-		cubeMeshUV, cylinderMeshUV, helixMeshUV, sphereMeshUV, torusMeshUV, quadMeshUV, quad2sidedMeshUV
-		});
-
-	// Texture Loading
-	const std::wstring& basePath = L"../../Assets/Textures/";
-	PBRTexture bambooTexture = LoadPBRMaterial(basePath, L"Bamboo001A_1K-PNG");
-	PBRTexture chipTexture = LoadPBRMaterial(basePath, L"Chip005_1K-PNG");
-	PBRTexture metalPlateTexture = LoadPBRMaterial(basePath, L"MetalPlates006_1K-PNG");
-	PBRTexture rockTexture = LoadPBRMaterial(basePath, L"Rock051_1K-PNG");
-	PBRTexture woodTexture = LoadPBRMaterial(basePath, L"Wood023_4K-PNG");
-
-	// Sky
+	samplerState = Graphics::Pipelines->GetSamplerState(samplerDesc);
+
+	// Sky (with its own cube, so it doesn't depend on the scene)
+	std::shared_ptr<Mesh> skyMesh = std::make_shared<Mesh>("Cube", FixPath("../../Assets/Models/cube.obj").c_str(), Graphics::Device);
 	sky = std::make_shared<Sky>(
 		FixPath(L"../../Assets/Skies/Clouds Pink/right.png").c_str(),
 		FixPath(L"../../Assets/Skies/Clouds Pink/left.png").c_str(),
@@ -234,128 +275,32 @@ void Game::CreateGeometry()
 		FixPath(L"../../Assets/Skies/Clouds Pink/down.png").c_str(),
 		FixPath(L"../../Assets/Skies/Clouds Pink/front.png").c_str(),
 		FixPath(L"../../Assets/Skies/Clouds Pink/back.png").c_str(),
-		cubeMesh,
+		skyMesh,
 		skyVS,
 		skyPS,
 		samplerState);
 
-	// Material Loading
-	std::shared_ptr<Material> normalMat = std::make_shared<Material>(none, vs, normalps);
-	std::shared_ptr<Material> uvMat = std::make_shared<Material>(none, vs, uvps);
-	std::shared_ptr<Material> customMat = std::make_shared<Material>(none, vs, custom);
-
-	std::shared_ptr<Material> bamboo = std::make_shared<Material>(none, vs, ps);
-	bamboo->AddSampler("BasicSampler", samplerState);
-	bamboo->AddTextureSRV("Albedo", bambooTexture.Albedo);
-	bamboo->AddTextureSRV("NormalMap", bambooTexture.Normal);
-	bamboo->AddTextureSRV("RoughnessMap", bambooTexture.Roughness);
-	bamboo->AddTextureSRV("MetalnessMap", bambooTexture.Metallic);
-
-	std::shared_ptr<Material> chip = std::make_shared<Material>(none, vs, ps);
-	chip->AddSampler("BasicSampler", samplerState);
-	chip->AddTextureSRV("Albedo", chipTexture.Albedo);
-	chip->AddTextureSRV("NormalMap", chipTexture.Normal);
-	chip->AddTextureSRV("RoughnessMap", chipTexture.Roughness);
-	chip->AddTextureSRV("MetalnessMap", chipTexture.Metallic);
-
-	std::shared_ptr<Material> metalPlate = std::make_shared<Material>(none, vs, ps);
-	metalPlate->AddSampler("BasicSampler", samplerState);
-	metalPlate->AddTextureSRV("Albedo", metalPlateTexture.Albedo);
-	metalPlate->AddTextureSRV("NormalMap", metalPlateTexture.Normal);
-	metalPlate->AddTextureSRV("RoughnessMap", metalPlateTexture.Roughness);
-	metalPlate->AddTextureSRV("MetalnessMap", metalPlateTexture.Metallic);
-
-	std::shared_ptr<Material> rock = std::make_shared<Material>(none, vs, ps);
-	rock->AddSampler("BasicSampler", samplerState);
-	rock->AddTextureSRV("Albedo", rockTexture.Albedo);
-	rock->AddTextureSRV("NormalMap", rockTexture.Normal);
-	rock->AddTextureSRV("RoughnessMap", rockTexture.Roughness);
-	rock->AddTextureSRV("MetalnessMap", rockTexture.Metallic);
-
-	std::shared_ptr<Material> wood = std::make_shared<Material>(none, vs, ps);
-	wood->AddSampler("BasicSampler", samplerState);
-	wood->AddTextureSRV("Albedo", woodTexture.Albedo);
-	wood->AddTextureSRV("NormalMap", woodTexture.Normal);
-	wood->AddTextureSRV("RoughnessMap", woodTexture.Roughness);
-	wood->AddTextureSRV("MetalnessMap", woodTexture.Metallic);
-
-	materials.insert(materials.end(), { bamboo, chip, metalPlate, rock, normalMat, uvMat, customMat });
-
-	//mat1->AddTextureSRV("SurfaceTexture", woodTexture);
-	//mat1->AddTextureSRV("NormalMap", woodTextureNormal);
-	//mat1->AddSampler("BasicSampler", samplerState);
-	//mat2->AddTextureSRV("SurfaceTexture", rockyTexture);
-	//mat2->AddTextureSRV("NormalMap", rockyTextureNormal);
-	//mat2->AddSampler("BasicSampler", samplerState);
-	//mat3->AddTextureSRV("TextureA", woodTexture);
-	//mat3->AddTextureSRV("TextureB", stainDecal);
-	//mat3->AddSampler("BasicSampler", samplerState);
-				
-
-	entities.push_back(std::make_shared<Game_Entity>(cubeMesh, chip));
-	entities.push_back(std::make_shared<Game_Entity>(cylinderMesh, metalPlate));
-	entities.push_back(std::make_shared<Game_Entity>(helixMesh, rock));
-	entities.push_back(std::make_shared<Game_Entity>(sphereMesh, bamboo));
-	entities.push_back(std::make_shared<Game_Entity>(torusMesh, rock));
-	entities.push_back(std::make_shared<Game_Entity>(quadMesh, chip));
-	entities.push_back(std::make_shared<Game_Entity>(quad2sidedMesh, bamboo));
-
-	entities.push_back(std::make_shared<Game_Entity>(cubeMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(cylinderMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(helixMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(sphereMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(torusMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(quadMeshNormal, normalMat));
-	entities.push_back(std::make_shared<Game_Entity>(quad2sidedMeshNormal, normalMat));
-
-	entities.push_back(std::make_shared<Game_Entity>(cubeMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(cylinderMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(helixMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(sphereMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(torusMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(quadMeshUV, uvMat));
-	entities.push_back(std::make_shared<Game_Entity>(quad2sidedMeshUV, uvMat));
-
-	entities.push_back(std::make_shared<Game_Entity>(floor, wood));
-	entities[21]->GetTransform()->MoveAbsolute(-5, -8, 15);
-	entities[21]->GetTransform()->SetScale(50, 1, 50);
-
-	entities[0]->GetTransform()->MoveAbsolute(-9, 0, 0);
-	entities[1]->GetTransform()->MoveAbsolute(-6, 0, 0);
-	entities[2]->GetTransform()->MoveAbsolute(-3, 0, 0);
-	entities[3]->GetTransform()->MoveAbsolute(0, 0, 0);
-	entities[4]->GetTransform()->MoveAbsolute(3, 0, 0);
-	entities[5]->GetTransform()->MoveAbsolute(6, 0, 0);
-	entities[6]->GetTransform()->MoveAbsolute(9, 0, 0);
-	entities[7]->GetTransform()->MoveAbsolute(-9, 10, 0);
-	entities[8]->GetTransform()->MoveAbsolute(-6, 10, 0);
-	entities[9]->GetTransform()->MoveAbsolute(-3, 10, 0);
-	entities[10]->GetTransform()->MoveAbsolute(0, 10, 0);
-	entities[11]->GetTransform()->MoveAbsolute(3, 10, 0);
-	entities[12]->GetTransform()->MoveAbsolute(6, 10, 0);
-	entities[13]->GetTransform()->MoveAbsolute(9, 10, 0);
-	entities[14]->GetTransform()->MoveAbsolute(-9, 5, 0);
-	entities[15]->GetTransform()->MoveAbsolute(-6, 5, 0);
-	entities[16]->GetTransform()->MoveAbsolute(-3, 5, 0);
-	entities[17]->GetTransform()->MoveAbsolute(0, 5, 0);
-	entities[18]->GetTransform()->MoveAbsolute(3, 5, 0);
-	entities[19]->GetTransform()->MoveAbsolute(6, 5, 0);
-	entities[20]->GetTransform()->MoveAbsolute(9, 5, 0);
+	skyLighting = std::make_shared<SkyLighting>();
+	skyIrradiance = std::make_shared<SkyIrradiance>();
+	BuildSkyLighting();
 
-	ambientColor = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	// Meshes, materials and entities all come from the scene file
+	LoadScene("../../Assets/Scenes/Default.scene", "Default.sceneb", vs, samplerState);
 
-	//Post Processing 
-	fullscreenVS = std::make_shared<SimpleVertexShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"FullscreenVS.cso").c_str());
-	blurPS = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"BlurPS.cso").c_str());
+	baseEntityCount = entities.size();
+	RebuildSceneBVH();
+
+	ambientColor = XMFLOAT3(0.0f, 0.0f, 0.0f);
 
-	pixelizePS = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"PixelizePS.cso").c_str());
+	// Every shader is loaded by now
+	if (shaderCache->IsDirty())
+		shaderCache->Save(FixPath("ShaderCache.bin"));
 
-	copyPS = std::make_shared<SimplePixelShader>(
-		Graphics::Device, Graphics::Context, FixPath(L"CopyPS.cso").c_str());
+#if defined(DEBUG) | defined(_DEBUG)
+	CheckShaderBuffers(vs);
+#endif
 
+	//Post Processing 
 	PostProcessingReSize();
 
 	// Sampler state for post processing
@@ -365,12 +310,99 @@ void Game::CreateGeometry()
 	ppSampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
 	ppSampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
 	ppSampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-	Graphics::Device->CreateSamplerState(&ppSampDesc, ppSampler.GetAddressOf());
+	ppSampler = Graphics::Pipelines->GetSamplerState(ppSampDesc);
+}
+
+// --------------------------------------------------------
+// Points every material using PixelShader.hlsl at the variant
+// for its textures and this frame's lights and shadows
+// - Nothing changes most frames, so that's checked first
+// - With variants off, they all get the full uber shader
+// --------------------------------------------------------
+void Game::UpdateShaderVariants()
+{
+	if (!pixelShaderVariants)
+		return;
+
+	ShaderVariantKey frameKey;
+	frameKey.Features = shadowsOn ? ShaderFeatureShadows : 0;
+	frameKey.PCFTaps = pcfTaps;
+	for (unsigned int i = 0; i < lightManager.GetCount(); i++)
+		frameKey.LightTypes |= 1 << lightManager.GetLights()[i].Type;
+
+	if (!variantsDirty && frameKey == appliedVariantKey)
+		return;
+	appliedVariantKey = frameKey;
+	variantsDirty = false;
+
+	for (auto& m : variantMaterials)
+	{
+		ShaderVariantKey key = frameKey;
+		key.Features |= m->GetVariantFeatures();
+
+		std::shared_ptr<SimplePixelShader> ps = shaderVariantsOn ?
+			pixelShaderVariants->GetVariant(key) :
+			pixelShaderVariants->GetFallback();
+		if (ps != m->GetPixelShader())
+			m->SetPixelShader(ps);
+	}
+}
+
+// --------------------------------------------------------
+// Checks the structs in ShaderBuffers.h against the shaders
+// they were generated from.  If anything changed, an updated
+// header is written next to the executable, to be copied
+// over the old one.
+// --------------------------------------------------------
+void Game::CheckShaderBuffers(std::shared_ptr<SimpleVertexShader> vs)
+{
+	std::shared_ptr<SimplePixelShader> ps = std::make_shared<SimplePixelShader>(
+		Graphics::Device, Graphics::Context, FixPath(L"PixelShader.cso").c_str());
+
+	struct Generated
+	{
+		const CBufferLayout& Layout;
+		const char* StructName;
+		ISimpleShader* Shader;
+		const char* ShaderName;
+	};
+	Generated structs[] =
+	{
+		{ VertexShaderPerFrame::Layout, "VertexShaderPerFrame", vs.get(), "VertexShader.cso" },
+		{ VertexShaderPerObject::Layout, "VertexShaderPerObject", vs.get(), "VertexShader.cso" },
+		{ PixelShaderPerFrame::Layout, "PixelShaderPerFrame", ps.get(), "PixelShader.cso" },
+		{ PixelShaderPerMaterial::Layout, "PixelShaderPerMaterial", ps.get(), "PixelShader.cso" },
+	};
+
+	std::string mismatches;
+	std::vector<CBufferStructSource> sources;
+	for (auto& s : structs)
+	{
+		const DXBCConstantBuffer* buffer = 0;
+		for (auto& cb : s.Shader->GetReflection().ConstantBuffers)
+			if (cb.Name == s.Layout.BufferName)
+				buffer = &cb;
+
+		if (!buffer)
+		{
+			mismatches += std::string(s.Layout.BufferName) + ": not in " + s.ShaderName + "\n";
+			continue;
+		}
+		mismatches += FindCBufferMismatches(s.Layout, *buffer);
+		sources.push_back({ s.StructName, s.ShaderName, buffer });
+	}
+
+	if (mismatches.empty())
+		return;
+
+	std::string path = FixPath("ShaderBuffers.h");
+	std::ofstream(path) << GenerateCBufferStructs(sources, { "Light.h" });
+	printf("ShaderBuffers.h doesn't match the shaders:\n%sAn updated copy was written to %s\n", mismatches.c_str(), path.c_str());
 }
 
 void Game::GenerateLights()
 {
-	lights.clear();
+	lightManager.Clear();
 
 	// Directional light
 	Light dir1 = {};
@@ -378,21 +410,21 @@ void Game::GenerateLights()
 	dir1.Direction = XMFLOAT3(1, -1, 0);
 	dir1.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
 	dir1.Intensity = 1.0f;
-	lights.push_back(dir1);
+	lightManager.Add(dir1);
 	
 	//Light dir2 = {};
 	//dir2.Type = LIGHT_TYPE_DIRECTIONAL;
 	//dir2.Direction = XMFLOAT3(1, 1, 0);
 	//dir2.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
 	//dir2.Intensity = 1.0f;
-	//lights.push_back(dir2);
+	//lightManager.Add(dir2);
 	//
 	//Light dir3 = {};
 	//dir3.Type = LIGHT_TYPE_DIRECTIONAL;
 	//dir3.Direction = XMFLOAT3(0, 0, 1);
 	//dir3.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
 	//dir3.Intensity = 1.0f;
-	//lights.push_back(dir3);
+	//lightManager.Add(dir3);
 	
 	// Point light
 	Light point1 = {};
@@ -401,7 +433,7 @@ void Game::GenerateLights()
 	point1.Color = XMFLOAT3(1, 0, 0);
 	point1.Intensity = 2.0f;
 	point1.Range = 10.0f;
-	lights.push_back(point1);
+	lightManager.Add(point1);
 	
 	// Spot light 
 	Light spot1 = {};
@@ -412,7 +444,7 @@ void Game::GenerateLights()
 	spot1.Intensity = 5.0f;
 	spot1.Range = 5.0f;
 	spot1.SpotFalloff = 1.0f;
-	lights.push_back(spot1);
+	lightManager.Add(spot1);
 
 }
 
@@ -421,7 +453,6 @@ void Game::GenerateShadows()
 	shadowDSV.Reset();
 	shadowSRV.Reset();
 	shadowSampler.Reset();
-	shadowRasterizer.Reset();
 
 	// Create the actual texture that will be the shadow map
 	D3D11_TEXTURE2D_DESC shadowDesc = {};
@@ -460,13 +491,18 @@ void Game::GenerateShadows()
 		&srvDesc,
 		shadowSRV.GetAddressOf());
 
-	D3D11_RASTERIZER_DESC shadowRastDesc = {};
-	shadowRastDesc.FillMode = D3D11_FILL_SOLID;
-	shadowRastDesc.CullMode = D3D11_CULL_BACK;
-	shadowRastDesc.DepthClipEnable = true;
-	shadowRastDesc.DepthBias = 1000; // Min. precision units, not world units!
-	shadowRastDesc.SlopeScaledDepthBias = 1.0f; // Bias more based on slope
-	Graphics::Device->CreateRasterizerState(&shadowRastDesc, &shadowRasterizer);
+	// Depth only, so no pixel shader - the instanced version
+	// differs only in its vertex shader and input layout
+	PipelineDesc shadowPipelineDesc = PipelineDesc::Defaults();
+	shadowPipelineDesc.VertexShader = shadowVS->GetDirectXShader().Get();
+	shadowPipelineDesc.InputLayout = shadowVS->GetInputLayout().Get();
+	shadowPipelineDesc.Rasterizer.DepthBias = 1000; // Min. precision units, not world units!
+	shadowPipelineDesc.Rasterizer.SlopeScaledDepthBias = 1.0f; // Bias more based on slope
+	shadowPipeline = Graphics::Pipelines->GetPipeline(shadowPipelineDesc);
+
+	shadowPipelineDesc.VertexShader = shadowInstancedVS->GetDirectXShader().Get();
+	shadowPipelineDesc.InputLayout = shadowInstancedVS->GetInputLayout().Get();
+	shadowInstancedPipeline = Graphics::Pipelines->GetPipeline(shadowPipelineDesc);
 
 	D3D11_SAMPLER_DESC shadowSampDesc = {};
 	shadowSampDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_MIP_LINEAR;
@@ -475,7 +511,7 @@ void Game::GenerateShadows()
 	shadowSampDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;
 	shadowSampDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;
 	shadowSampDesc.BorderColor[0] = 1.0f; // Only need the first component
-	Graphics::Device->CreateSamplerState(&shadowSampDesc, &shadowSampler);
+	shadowSampler = Graphics::Pipelines->GetSamplerState(shadowSampDesc);
 
 	shadowView = std::make_shared<DirectX::XMFLOAT4X4>();
 	shadowProjection = std::make_shared<DirectX::XMFLOAT4X4>();
@@ -494,9 +530,8 @@ void Game::GenerateShadows()
 void Game::RenderShadowMap()
 {
 	ID3D11RenderTargetView* nullRTV = nullptr;
-	Graphics::Context->OMSetRenderTargets(1, &nullRTV, shadowDSV.Get());
+	Graphics::States->SetRenderTargets(1, &nullRTV, shadowDSV.Get());
 	Graphics::Context->ClearDepthStencilView(shadowDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
-	Graphics::Context->PSSetShader(0, 0, 0);
 
 	D3D11_VIEWPORT viewport = {};
 	viewport.Width = (float)shadowMapResolution;
@@ -504,27 +539,732 @@ void Game::RenderShadowMap()
 	viewport.MaxDepth = 1.0f;
 	Graphics::Context->RSSetViewports(1, &viewport);
 
-	Graphics::Context->RSSetState(shadowRasterizer.Get());
-
-	shadowVS->SetShader();
-	shadowVS->SetMatrix4x4("view",*shadowView);
-	shadowVS->SetMatrix4x4("projection", *shadowProjection);
-	Graphics::Context->PSSetShader(0, 0, 0);
-
-	for (auto& entity : entities) {
-		shadowVS->SetMatrix4x4("world", entity->GetTransform()->GetWorldMatrix());
-		shadowVS->CopyAllBufferData();
-		entity->GetMesh()->Draw(Graphics::Context.Get());
+	// The vertex shaders' SetShader() calls below only add
+	// their constant buffers to what the pipeline binds
+	shadowDrawCalls = 0;
+	if (instancingOn)
+	{
+		// One draw per mesh, regardless of material
+		Graphics::States->SetPipeline(shadowInstancedPipeline);
+		shadowInstancedVS->SetShader();
+		shadowInstancedVS->SetMatrix4x4("view", *shadowView);
+		shadowInstancedVS->SetMatrix4x4("projection", *shadowProjection);
+		shadowInstancedVS->CopyAllBufferData();
+
+		// Every entity, even when the main pass is culled
+		for (auto& batch : instanceBatcher->GetShadowBatches())
+		{
+			instanceBatcher->DrawBatch(Graphics::Context.Get(), batch);
+			shadowDrawCalls++;
+		}
+	}
+	else
+	{
+		Graphics::States->SetPipeline(shadowPipeline);
+		shadowVS->SetShader();
+		shadowVS->SetMatrix4x4("view", *shadowView);
+		shadowVS->SetMatrix4x4("projection", *shadowProjection);
+
+		for (auto& entity : entities) {
+			shadowVS->SetMatrix4x4("world", entity->GetTransform()->GetWorldMatrix());
+			shadowVS->CopyAllBufferData();
+			entity->GetMesh()->Draw(Graphics::Context.Get());
+			shadowDrawCalls++;
+		}
 	}
 
-	Graphics::Context->RSSetState(nullptr);
+	Graphics::States->SetRasterizerState(nullptr);
 	viewport.Width = (float)Window::Width();
 	viewport.Height = (float)Window::Height();
 	Graphics::Context->RSSetViewports(1, &viewport);
-	Graphics::Context->OMSetRenderTargets(1, Graphics::BackBufferRTV.GetAddressOf(),
+	Graphics::States->SetRenderTargets(1, Graphics::BackBufferRTV.GetAddressOf(),
 		Graphics::DepthBufferDSV.Get());
 }
 
+// --------------------------------------------------------
+// Adds (or removes) a generated block of entities on top of
+// the loaded scene, for measuring how per-entity costs scale
+// - Meshes and materials are picked at random from the first
+//   few of the scene's, along with extra random point lights
+// - The same seed and settings always give the same scene
+// --------------------------------------------------------
+void Game::SetStressScene(bool enabled)
+{
+	// Nothing to pick from - just put the scene back
+	if (meshes.empty() || materials.empty())
+		enabled = false;
+
+	entities.resize(baseEntityCount);
+	stressBasePositions.clear();
+	stressMovingCount = 0;
+	stressSceneOn = enabled;
+
+	// Only the stress scene's own lights - any others may have
+	// been changed in the UI
+	for (LightHandle handle : stressLights)
+		lightManager.Remove(handle);
+	stressLights.clear();
+
+	if (enabled)
+	{
+		std::mt19937 rng(stressSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		int meshCount = stressMeshVariety < 1 ? 1 : stressMeshVariety;
+		int materialCount = stressMaterialVariety < 1 ? 1 : stressMaterialVariety;
+		if (meshCount > (int)meshes.size()) meshCount = (int)meshes.size();
+		if (materialCount > (int)materials.size()) materialCount = (int)materials.size();
+
+		// Roughly cube shaped block above the floor
+		int side = (int)ceil(cbrt((float)stressEntityCount));
+		float spacing = 1.5f;
+		float halfWidth = side * spacing * 0.5f;
+
+		entities.reserve(baseEntityCount + stressEntityCount);
+		stressBasePositions.reserve(stressEntityCount);
+		for (int i = 0; i < stressEntityCount; i++)
+		{
+			int x = i % side;
+			int y = (i / side) % side;
+			int z = i / (side * side);
+
+			std::shared_ptr<Game_Entity> e = std::make_shared<Game_Entity>(
+				meshes[rng() % meshCount],
+				materials[rng() % materialCount]);
+
+			XMFLOAT3 pos(x * spacing - halfWidth, y * spacing - 7.0f, z * spacing + 20.0f);
+			e->GetTransform()->SetPosition(pos);
+			e->GetTransform()->SetRotation(0, unit(rng) * XM_2PI, 0);
+			e->GetTransform()->SetScale(0.5f, 0.5f, 0.5f);
+			entities.push_back(e);
+			stressBasePositions.push_back(pos);
+		}
+
+		for (int i = 0; i < stressLightCount; i++)
+		{
+			Light point = {};
+			point.Type = LIGHT_TYPE_POINT;
+			point.Position = XMFLOAT3(
+				(unit(rng) - 0.5f) * side * spacing,
+				unit(rng) * side * spacing - 7.0f,
+				unit(rng) * side * spacing + 20.0f);
+			point.Color = XMFLOAT3(unit(rng), unit(rng), unit(rng));
+			point.Intensity = 1.0f + unit(rng) * 2.0f;
+			point.Range = 5.0f + unit(rng) * 10.0f;
+			stressLights.push_back(lightManager.Add(point));
+		}
+
+		stressMovingCount = (int)(stressEntityCount * stressMovingPercent / 100.0f);
+	}
+
+	RebuildSceneBVH();
+}
+
+// --------------------------------------------------------
+// Loads the meshes, materials and entities of a scene
+// - The text scene is cooked to binary (next to the .exe)
+//   whenever the binary is missing or older than the text
+// - The binary is then memory mapped and walked once to
+//   create everything
+// --------------------------------------------------------
+void Game::LoadScene(
+	const std::string& textPath,
+	const std::string& cookedPath,
+	std::shared_ptr<SimpleVertexShader> vs,
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::string text = FixPath(textPath);
+	std::string cooked = FixPath(cookedPath);
+	std::error_code error;
+	bool haveText = std::filesystem::exists(text, error);
+	bool haveCooked = std::filesystem::exists(cooked, error);
+	if (haveText && (!haveCooked ||
+		std::filesystem::last_write_time(text, error) > std::filesystem::last_write_time(cooked, error)))
+	{
+		if (!CookScene(ParseSceneText(text), cooked))
+			throw std::runtime_error("Error writing cooked scene: " + cooked);
+	}
+
+	// A file cooked by an older version is cooked again
+	SceneFile scene;
+	bool opened = scene.Open(cooked);
+	if (!opened && haveText && CookScene(ParseSceneText(text), cooked))
+		opened = scene.Open(cooked);
+	if (!opened)
+		throw std::runtime_error("Error loading scene: " + cooked);
+
+	// Meshes
+	meshes.clear();
+	const SceneFileMesh* sceneMeshes = scene.GetMeshes();
+	for (uint32_t i = 0; i < scene.GetMeshCount(); i++)
+	{
+		meshes.push_back(std::make_shared<Mesh>(
+			scene.GetString(sceneMeshes[i].Name),
+			FixPath(scene.GetString(sceneMeshes[i].Path)).c_str(),
+			Graphics::Device));
+	}
+
+	// Every pixel shader the materials use, loaded all at once
+	std::unordered_map<std::string, std::shared_ptr<SimplePixelShader>> pixelShaders;
+	std::vector<std::function<void()>> shaderJobs;
+	const SceneFileMaterial* sceneMaterials = scene.GetMaterials();
+	for (uint32_t i = 0; i < scene.GetMaterialCount(); i++)
+	{
+		std::string psName = scene.GetString(sceneMaterials[i].PixelShader);
+		if (!pixelShaders.count(psName))
+			QueueShader(shaderJobs, &pixelShaders[psName], NarrowToWide(psName) + L".cso");
+	}
+	LoadQueuedShaders(shaderJobs);
+
+	// The uber shader's variants fall back to its default build
+	pixelShaderVariants.reset();
+	variantMaterials.clear();
+	variantsDirty = true;
+	if (pixelShaders.count("PixelShader"))
+	{
+		pixelShaderVariants = std::make_shared<ShaderVariantCache>(
+			Graphics::Device, Graphics::Context, FixPath(L"../../PixelShader.hlsl"), pixelShaders["PixelShader"]);
+	}
+
+	// Materials, sharing shaders and textures between them
+	std::unordered_map<std::string, PBRTexture> textureSets;
+	allMaterials.clear();
+	materials.clear();
+	namedMaterials.clear();
+	for (uint32_t i = 0; i < scene.GetMaterialCount(); i++)
+	{
+		const SceneFileMaterial& m = sceneMaterials[i];
+
+		std::string psName = scene.GetString(m.PixelShader);
+		std::shared_ptr<SimplePixelShader> ps = pixelShaders[psName];
+
+		std::shared_ptr<Material> mat = std::make_shared<Material>(
+			XMFLOAT4(m.ColorTint[0], m.ColorTint[1], m.ColorTint[2], m.ColorTint[3]),
+			vs, ps, m.Roughness);
+
+		std::string textureSet = scene.GetString(m.TextureSet);
+		if (!textureSet.empty())
+		{
+			if (!textureSets.count(textureSet))
+				textureSets[textureSet] = LoadPBRMaterial(L"../../Assets/Textures/", NarrowToWide(textureSet));
+			PBRTexture& tex = textureSets[textureSet];
+
+			mat->AddSampler("BasicSampler", sampler);
+			mat->AddTextureSRV("Albedo", tex.Albedo);
+			mat->AddTextureSRV("NormalMap", tex.Normal);
+			mat->AddTextureSRV("RoughnessMap", tex.Roughness);
+			mat->AddTextureSRV("MetalnessMap", tex.Metallic);
+		}
+
+		allMaterials.push_back(mat);
+		if (!m.Unlisted)
+			materials.push_back(mat);
+		namedMaterials[scene.GetString(m.Name)] = mat;
+		if (psName == "PixelShader")
+			variantMaterials.push_back(mat);
+	}
+
+	// Entities - parallel arrays straight out of the file
+	uint32_t count = scene.GetEntityCount();
+	const uint32_t* entityMeshes = scene.GetEntityMeshes();
+	const uint32_t* entityMaterials = scene.GetEntityMaterials();
+	const XMFLOAT3* positions = scene.GetPositions();
+	const XMFLOAT3* rotations = scene.GetRotations();
+	const XMFLOAT3* scales = scene.GetScales();
+
+	entities.clear();
+	entities.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		std::shared_ptr<Game_Entity> e = std::make_shared<Game_Entity>(meshes[entityMeshes[i]], allMaterials[entityMaterials[i]]);
+		std::shared_ptr<Transform> t = e->GetTransform();
+		t->SetPosition(positions[i]);
+		t->SetRotation(rotations[i]);
+		t->SetScale(scales[i]);
+		entities.push_back(e);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	sceneLoadMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+// --------------------------------------------------------
+// Builds the scene BVH from scratch - needed whenever
+// entities are added or removed
+// --------------------------------------------------------
+void Game::RebuildSceneBVH()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<AABB> bounds(entities.size());
+	for (size_t i = 0; i < entities.size(); i++)
+		bounds[i] = entities[i]->GetWorldBounds();
+	sceneBVH.Build(bounds);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	bvhBuildMs = std::chrono::duration<float, std::milli>(end - start).count();
+	selectedEntity = -1;
+}
+
+// --------------------------------------------------------
+// Tells the BVH an entity has moved - the tree itself is
+// only updated by the Refit() at the end of Update()
+// --------------------------------------------------------
+void Game::UpdateEntityBounds(unsigned int index)
+{
+	sceneBVH.UpdateItem(index, entities[index]->GetWorldBounds());
+}
+
+// --------------------------------------------------------
+// Finds the entities the active camera can see - those in
+// its frustum (if enabled) that aren't hidden behind large
+// occluders (if enabled)
+// --------------------------------------------------------
+void Game::CullEntities()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	XMFLOAT4X4 view = activeCamera->GetViewMatrix();
+	XMFLOAT4X4 proj = activeCamera->GetProjectionMatrix();
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj)));
+
+	visibleItems.clear();
+	if (frustumCullingOn)
+	{
+		sceneBVH.QueryFrustum(Bounds::FrustumFromViewProjection(viewProj), visibleItems);
+
+		// Keep the original entity order, so draw order is stable
+		std::sort(visibleItems.begin(), visibleItems.end());
+	}
+	else
+	{
+		for (unsigned int i = 0; i < (unsigned int)entities.size(); i++)
+			visibleItems.push_back(i);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	bvhCullMs = std::chrono::duration<float, std::milli>(end - start).count();
+
+	if (occlusionCullingOn)
+		CullOccludedEntities(viewProj);
+
+	visibleEntities.clear();
+	for (unsigned int i : visibleItems)
+		visibleEntities.push_back(entities[i]);
+}
+
+// --------------------------------------------------------
+// Removes entities hidden behind the biggest visible ones
+// from the visible list
+// --------------------------------------------------------
+void Game::CullOccludedEntities(const XMFLOAT4X4& viewProj)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Anything big enough becomes an occluder, and is always drawn
+	occlusionCuller->BeginFrame(viewProj);
+	occluderCount = 0;
+	candidateItems.clear();
+	candidateBounds.clear();
+	for (unsigned int i : visibleItems)
+	{
+		const AABB& box = sceneBVH.GetItemBounds(i);
+		float extent = box.Max.x - box.Min.x;
+		if (box.Max.y - box.Min.y > extent) extent = box.Max.y - box.Min.y;
+		if (box.Max.z - box.Min.z > extent) extent = box.Max.z - box.Min.z;
+
+		if (extent >= occluderMinSize && occluderCount < (unsigned int)maxOccluders)
+		{
+			std::shared_ptr<Mesh> mesh = entities[i]->GetMesh();
+			occlusionCuller->AddOccluder(
+				mesh->GetPositions().data(),
+				mesh->GetIndices().data(),
+				(unsigned int)mesh->GetIndices().size(),
+				entities[i]->GetTransform()->GetWorldMatrix());
+			occluderCount++;
+		}
+		else
+		{
+			candidateItems.push_back(i);
+			candidateBounds.push_back(box);
+		}
+	}
+
+	if (occluderCount > 0 && !candidateItems.empty())
+	{
+		occlusionCuller->Rasterize();
+
+		candidateVisible.resize(candidateItems.size());
+		occlusionCuller->TestVisibility(candidateBounds.data(), (unsigned int)candidateBounds.size(), candidateVisible.data());
+
+		// Compact the visible list, keeping its order
+		unsigned int kept = 0;
+		unsigned int next = 0;
+		for (unsigned int i : visibleItems)
+		{
+			if (next < candidateItems.size() && candidateItems[next] == i)
+			{
+				if (candidateVisible[next++])
+					visibleItems[kept++] = i;
+			}
+			else
+			{
+				visibleItems[kept++] = i; // Occluder
+			}
+		}
+		occludedCount = (unsigned int)visibleItems.size() - kept;
+		visibleItems.resize(kept);
+	}
+	else
+	{
+		occludedCount = 0;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	occlusionMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+void Game::UploadLights()
+{
+	UploadShaderBuffer(lightBuffer, lightSRV, lightCapacity, DXGI_FORMAT_UNKNOWN, lightManager.GetLights(), lightManager.GetCount(), sizeof(Light));
+}
+
+// --------------------------------------------------------
+// Finds the lights reaching each cluster of the active
+// camera's frustum (or each entity about to be drawn), and
+// uploads the lists along with what the pixel shader needs
+// to find a pixel's cluster
+// - Per entity lists leave each entity with its range, so
+//   this has to happen before instance data is packed
+// --------------------------------------------------------
+void Game::BuildLightLists(const std::vector<std::shared_ptr<Game_Entity>>& drawList)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	XMFLOAT4X4 view = activeCamera->GetViewMatrix();
+	XMFLOAT4X4 proj = activeCamera->GetProjectionMatrix();
+
+	const LightClusters::Range* ranges;
+	const uint32_t* indices;
+	unsigned int rangeCount;
+	unsigned int indexCount;
+	if (lightListMode == LightListsPerCluster)
+	{
+		lightClusters->Build(lightManager.GetLights(), lightManager.GetCount(), view, proj);
+		ranges = lightClusters->GetRanges().data();
+		indices = lightClusters->GetLightIndices().data();
+		rangeCount = lightClusters->GetClusterCount();
+		indexCount = (unsigned int)lightClusters->GetLightIndices().size();
+
+		clusterTileScale = XMFLOAT2(
+			lightClusters->GetTilesX() / (float)Window::Width(),
+			lightClusters->GetTilesY() / (float)Window::Height());
+		clusterDepthScale = XMFLOAT2(lightClusters->GetSliceScale(), lightClusters->GetSliceBias());
+		clusterCounts = XMUINT3(lightClusters->GetTilesX(), lightClusters->GetTilesY(), lightClusters->GetSlices());
+	}
+	else if (lightListMode == LightListsPerEntity)
+	{
+		entityLightBounds.resize(drawList.size());
+		for (size_t i = 0; i < drawList.size(); i++)
+			entityLightBounds[i] = drawList[i]->GetWorldBounds();
+
+		entityLightLists->Build(lightManager.GetLights(), lightManager.GetCount(), entityLightBounds.data(), (unsigned int)drawList.size());
+		const std::vector<EntityLightLists::Range>& entityRanges = entityLightLists->GetRanges();
+		for (size_t i = 0; i < drawList.size(); i++)
+			drawList[i]->SetLightRange(XMUINT2(entityRanges[i].Offset, entityRanges[i].Count));
+
+		// Each draw brings its own range, and no clusters
+		// tells the pixel shader to use it
+		ranges = 0;
+		indices = entityLightLists->GetLightIndices().data();
+		rangeCount = 0;
+		indexCount = (unsigned int)entityLightLists->GetLightIndices().size();
+
+		clusterTileScale = XMFLOAT2(0.0f, 0.0f);
+		clusterDepthScale = XMFLOAT2(0.0f, 0.0f);
+		clusterCounts = XMUINT3(0, 0, 0);
+	}
+	else
+	{
+		// One cluster, which every pixel lands in
+		unclusteredRanges.assign(1, { 0, lightManager.GetCount() });
+		unclusteredIndices.resize(lightManager.GetCount());
+		for (uint32_t i = 0; i < lightManager.GetCount(); i++)
+			unclusteredIndices[i] = i;
+
+		ranges = unclusteredRanges.data();
+		indices = unclusteredIndices.data();
+		rangeCount = 1;
+		indexCount = (unsigned int)unclusteredIndices.size();
+
+		clusterTileScale = XMFLOAT2(0.0f, 0.0f);
+		clusterDepthScale = XMFLOAT2(0.0f, 0.0f);
+		clusterCounts = XMUINT3(1, 1, 1);
+	}
+
+	if (rangeCount > 0)
+		UploadShaderBuffer(clusterRangeBuffer, clusterRangeSRV, clusterRangeCapacity, DXGI_FORMAT_R32G32_UINT, ranges, rangeCount, sizeof(LightClusters::Range));
+	UploadShaderBuffer(clusterIndexBuffer, clusterIndexSRV, clusterIndexCapacity, DXGI_FORMAT_R32_UINT, indices, indexCount, sizeof(uint32_t));
+
+	auto end = std::chrono::high_resolution_clock::now();
+	lightListMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+// --------------------------------------------------------
+// Reads the sky's faces back from the GPU, then loads its
+// image based lighting from disk - or works it out and
+// saves it, if the sky or the settings have changed
+// --------------------------------------------------------
+void Game::BuildSkyLighting()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> cube;
+	sky->GetSkyTexture()->GetResource(resource.GetAddressOf());
+	resource.As(&cube);
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	cube->GetDesc(&desc);
+	if (desc.Format != DXGI_FORMAT_R8G8B8A8_UNORM || desc.Width != desc.Height)
+	{
+		printf("Sky lighting needs square RGBA8 faces - the sky won't be reflected\n");
+		return;
+	}
+
+	// Mip 0 of each face, into a texture the CPU can read
+	D3D11_TEXTURE2D_DESC stagingDesc = desc;
+	stagingDesc.MipLevels = 1;
+	stagingDesc.Usage = D3D11_USAGE_STAGING;
+	stagingDesc.BindFlags = 0;
+	stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDesc.MiscFlags = 0;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> staging;
+	if (FAILED(Graphics::Device->CreateTexture2D(&stagingDesc, 0, staging.GetAddressOf())))
+		return;
+	for (unsigned int face = 0; face < 6; face++)
+		Graphics::Context->CopySubresourceRegion(staging.Get(), face, 0, 0, 0, cube.Get(), D3D11CalcSubresource(0, face, desc.MipLevels), 0);
+
+	const uint8_t* faces[6] = {};
+	D3D11_MAPPED_SUBRESOURCE mapped[6] = {};
+	unsigned int mappedCount = 0;
+	for (; mappedCount < 6; mappedCount++)
+	{
+		if (FAILED(Graphics::Context->Map(staging.Get(), mappedCount, D3D11_MAP_READ, 0, &mapped[mappedCount])))
+			break;
+		faces[mappedCount] = (const uint8_t*)mapped[mappedCount].pData;
+	}
+	if (mappedCount == 6)
+	{
+		skyLighting->SetSource(faces, desc.Width, mapped[0].RowPitch);
+
+		auto projectStart = std::chrono::high_resolution_clock::now();
+		skyIrradiance->Project(faces, desc.Width, mapped[0].RowPitch);
+		memcpy(skyIrradianceConstants, skyIrradiance->GetShaderConstants(), sizeof(skyIrradianceConstants));
+		auto projectEnd = std::chrono::high_resolution_clock::now();
+		skyIrradianceMs = std::chrono::duration<float, std::milli>(projectEnd - projectStart).count();
+	}
+	for (unsigned int face = 0; face < mappedCount; face++)
+		Graphics::Context->Unmap(staging.Get(), face);
+	if (mappedCount < 6)
+		return;
+
+	SkyLighting::Settings settings;
+	std::string cachePath = FixPath("SkyLighting.bin");
+	skyLightingCached = skyLighting->Load(cachePath, settings);
+	if (!skyLightingCached)
+	{
+		skyLighting->Build(settings);
+		skyLighting->Save(cachePath);
+	}
+
+	// The specular cube, every face's mips in turn
+	unsigned int mips = skyLighting->GetSpecularMips();
+	D3D11_TEXTURE2D_DESC specularDesc = {};
+	specularDesc.Width = settings.SpecularSize;
+	specularDesc.Height = settings.SpecularSize;
+	specularDesc.MipLevels = mips;
+	specularDesc.ArraySize = 6;
+	specularDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	specularDesc.SampleDesc.Count = 1;
+	specularDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	specularDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	specularDesc.MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE;
+
+	std::vector<D3D11_SUBRESOURCE_DATA> specularData(6 * mips);
+	for (unsigned int face = 0; face < 6; face++)
+	{
+		for (unsigned int mip = 0; mip < mips; mip++)
+		{
+			D3D11_SUBRESOURCE_DATA& data = specularData[face * mips + mip];
+			data.pSysMem = &skyLighting->GetSpecular()[skyLighting->GetSpecularOffset(face, mip)];
+			data.SysMemPitch = (settings.SpecularSize >> mip) * 4 * sizeof(uint16_t);
+		}
+	}
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> specularTexture;
+	Graphics::Device->CreateTexture2D(&specularDesc, specularData.data(), specularTexture.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC specularSRVDesc = {};
+	specularSRVDesc.Format = specularDesc.Format;
+	specularSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+	specularSRVDesc.TextureCube.MipLevels = mips;
+	specularSRVDesc.TextureCube.MostDetailedMip = 0;
+	Graphics::Device->CreateShaderResourceView(specularTexture.Get(), &specularSRVDesc, skySpecularSRV.ReleaseAndGetAddressOf());
+
+	// The BRDF lookup
+	D3D11_TEXTURE2D_DESC lookupDesc = {};
+	lookupDesc.Width = settings.LookupSize;
+	lookupDesc.Height = settings.LookupSize;
+	lookupDesc.MipLevels = 1;
+	lookupDesc.ArraySize = 1;
+	lookupDesc.Format = DXGI_FORMAT_R16G16_FLOAT;
+	lookupDesc.SampleDesc.Count = 1;
+	lookupDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	lookupDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA lookupData = {};
+	lookupData.pSysMem = skyLighting->GetLookup().data();
+	lookupData.SysMemPitch = settings.LookupSize * 2 * sizeof(uint16_t);
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> lookupTexture;
+	Graphics::Device->CreateTexture2D(&lookupDesc, &lookupData, lookupTexture.GetAddressOf());
+	Graphics::Device->CreateShaderResourceView(lookupTexture.Get(), 0, skyLookupSRV.ReleaseAndGetAddressOf());
+
+	auto end = std::chrono::high_resolution_clock::now();
+	skyLightingMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+// Zero turns the shaders' sky reflections off
+float Game::GetSkySpecularMips() const
+{
+	return skyReflectionsOn && skySpecularSRV ? (float)skyLighting->GetSpecularMips() : 0.0f;
+}
+
+// All zero turns the shaders' sky ambient off
+const XMFLOAT4* Game::GetSkyIrradiance() const
+{
+	static const XMFLOAT4 none[7] = {};
+	return skyAmbientOn ? skyIrradianceConstants : none;
+}
+
+// --------------------------------------------------------
+// Bins the lights into screen tiles for the deferred path's
+// lighting pass, and uploads the lists
+// --------------------------------------------------------
+void Game::BuildLightTiles()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	lightTiles->Build(
+		lightManager.GetLights(),
+		lightManager.GetCount(),
+		activeCamera->GetViewMatrix(),
+		activeCamera->GetProjectionMatrix(),
+		(unsigned int)Window::Width(),
+		(unsigned int)Window::Height());
+
+	UploadShaderBuffer(tileRangeBuffer, tileRangeSRV, tileRangeCapacity, DXGI_FORMAT_R32G32_UINT, lightTiles->GetRanges().data(), lightTiles->GetTileCount(), sizeof(LightTiles::Range));
+	UploadShaderBuffer(tileIndexBuffer, tileIndexSRV, tileIndexCapacity, DXGI_FORMAT_R32_UINT, lightTiles->GetLightIndices().data(), (unsigned int)lightTiles->GetLightIndices().size(), sizeof(uint32_t));
+
+	auto end = std::chrono::high_resolution_clock::now();
+	lightTileMs = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+// --------------------------------------------------------
+// Copies a frame's data to a dynamic buffer the pixel shader
+// reads - through a typed view, or as a structured buffer
+// when the format is unknown.  The buffer (and its view)
+// are recreated at twice the size when it's full, and only
+// the given elements are copied.
+// --------------------------------------------------------
+bool Game::UploadShaderBuffer(
+	Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv,
+	unsigned int& capacity,
+	DXGI_FORMAT format,
+	const void* data,
+	unsigned int count,
+	unsigned int stride)
+{
+	if (!buffer || count > capacity)
+	{
+		unsigned int newCapacity = capacity > 0 ? capacity : 256;
+		while (newCapacity < count)
+			newCapacity *= 2;
+
+		D3D11_BUFFER_DESC desc = {};
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.ByteWidth = stride * newCapacity;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (format == DXGI_FORMAT_UNKNOWN)
+		{
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			desc.StructureByteStride = stride;
+		}
+
+		buffer.Reset();
+		srv.Reset();
+		capacity = 0;
+		if (FAILED(Graphics::Device->CreateBuffer(&desc, 0, buffer.GetAddressOf())))
+			return false;
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = newCapacity;
+		if (FAILED(Graphics::Device->CreateShaderResourceView(buffer.Get(), &srvDesc, srv.GetAddressOf())))
+		{
+			buffer.Reset();
+			return false;
+		}
+		capacity = newCapacity;
+	}
+
+	if (count == 0)
+		return true;
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(Graphics::Context->Map(buffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, data, stride * count);
+	Graphics::Context->Unmap(buffer.Get(), 0);
+	FrameStats::BufferUploads++;
+	FrameStats::BufferBytesUploaded += stride * count;
+	return true;
+}
+
+// --------------------------------------------------------
+// Casts a ray from the active camera through the given pixel
+// and returns the index of the closest entity hit, or -1
+// - Tests against the entities' boxes, not their triangles
+// --------------------------------------------------------
+int Game::PickEntity(int mouseX, int mouseY, float* hitDistance)
+{
+	XMFLOAT4X4 view = activeCamera->GetViewMatrix();
+	XMFLOAT4X4 proj = activeCamera->GetProjectionMatrix();
+	XMMATRIX invViewProj = XMMatrixInverse(0,
+		XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj)));
+
+	// Pixel to normalized device coordinates
+	float x = 2.0f * mouseX / Window::Width() - 1.0f;
+	float y = 1.0f - 2.0f * mouseY / Window::Height();
+
+	// Unproject points on the near and far planes
+	XMVECTOR nearPoint = XMVector3TransformCoord(XMVectorSet(x, y, 0.0f, 1.0f), invViewProj);
+	XMVECTOR farPoint = XMVector3TransformCoord(XMVectorSet(x, y, 1.0f, 1.0f), invViewProj);
+	XMVECTOR dir = XMVectorSubtract(farPoint, nearPoint);
+
+	Ray ray;
+	XMStoreFloat3(&ray.Origin, nearPoint);
+	XMStoreFloat3(&ray.Direction, XMVector3Normalize(dir));
+	return sceneBVH.RayCast(ray, XMVectorGetX(XMVector3Length(dir)), hitDistance);
+}
 void Game::PostProcessingReSize()
 {
 	blurSRV.Reset();
@@ -534,10 +1274,22 @@ void Game::PostProcessingReSize()
 
 	CreateRenderTarget(blurRTV, blurSRV);
 	CreateRenderTarget(pixelizeRTV, pixelizeSRV);
+
+	// The deferred path's G-buffer
+	const DXGI_FORMAT gbufferFormats[GBufferCount] =
+	{
+		DXGI_FORMAT_R8G8B8A8_UNORM,
+		DXGI_FORMAT_R16G16B16A16_FLOAT,
+		DXGI_FORMAT_R8G8_UNORM,
+		DXGI_FORMAT_R32_FLOAT
+	};
+	for (unsigned int i = 0; i < GBufferCount; i++)
+		CreateRenderTarget(gbufferRTVs[i], gbufferSRVs[i], gbufferFormats[i]);
 }
 
 void Game::CreateRenderTarget(Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv,
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv)
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv,
+	DXGI_FORMAT format)
 {
 	rtv.Reset();
 	srv.Reset();
@@ -548,7 +1300,7 @@ void Game::CreateRenderTarget(Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rt
 	textureDesc.ArraySize = 1;
 	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
 	textureDesc.CPUAccessFlags = 0;
-	textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	textureDesc.Format = format;
 	textureDesc.MipLevels = 1;
 	textureDesc.MiscFlags = 0;
 	textureDesc.SampleDesc.Count = 1;
@@ -597,6 +1349,9 @@ void Game::OnResize()
 // --------------------------------------------------------
 void Game::Update(float deltaTime, float totalTime)
 {
+	FrameStats::BeginFrame();
+	FrameStats::BeginPhase(FrameStats::PhaseUpdate);
+
 	static float time = 0.0f;
 	time += deltaTime;
 
@@ -615,19 +1370,48 @@ void Game::Update(float deltaTime, float totalTime)
 
 	float angle = time * 5.0f;
 	entities[0]->GetTransform()->SetRotation(0, angle, 0);
+	UpdateEntityBounds(0);
+
+	// Moving part of the stress scene
+	for (int i = 0; i < stressMovingCount; i++)
+	{
+		XMFLOAT3 pos = stressBasePositions[i];
+		pos.y += sin(time * 2.0f + i) * 0.5f;
 
+		unsigned int index = (unsigned int)baseEntityCount + i;
+		entities[index]->GetTransform()->SetPosition(pos);
+		UpdateEntityBounds(index);
+	}
+	FrameStats::EndPhase(FrameStats::PhaseUpdate);
+
+	FrameStats::BeginPhase(FrameStats::PhaseUI);
 	ImGuiUpdate(deltaTime);
 	BuildUI();
+	FrameStats::EndPhase(FrameStats::PhaseUI);
+
+	FrameStats::BeginPhase(FrameStats::PhaseUpdate);
+
+	// Apply this frame's movement to the BVH
+	auto refitStart = std::chrono::high_resolution_clock::now();
+	sceneBVH.Refit();
+	auto refitEnd = std::chrono::high_resolution_clock::now();
+	bvhRefitMs = std::chrono::duration<float, std::milli>(refitEnd - refitStart).count();
 
 	activeCamera = GetActiveCamera();
 	if (activeCamera)
 	{
 		activeCamera->Update(deltaTime);
+
+		// Click to select an entity (ImGui has the mouse when it's over a window)
+		if (Input::MouseLeftPress())
+			selectedEntity = PickEntity(Input::GetMouseX(), Input::GetMouseY(), &selectedDistance);
 	}
 
 	// Example input checking: Quit if the escape key is pressed
 	if (Input::KeyDown(VK_ESCAPE))
 		Window::Quit();
+
+	FrameStats::EndPhase(FrameStats::PhaseUpdate);
 }
 
 void Game::ImGuiUpdate(float deltaTime)
@@ -714,6 +1498,7 @@ void Game::BuildUI()
 				if (ImGui::DragFloat3(("Position##" + std::to_string(i)).c_str(), &position.x, 0.1f))
 				{
 					entities[i]->GetTransform()->SetPosition(position);
+					UpdateEntityBounds(i);
 				}
 
 				// Rotation
@@ -721,6 +1506,7 @@ void Game::BuildUI()
 				if (ImGui::DragFloat3(("Rotation##" + std::to_string(i)).c_str(), &rotation.x, 1.0f))
 				{
 					entities[i]->GetTransform()->SetRotation(rotation);
+					UpdateEntityBounds(i);
 				}
 
 				// Scale
@@ -728,6 +1514,7 @@ void Game::BuildUI()
 				if (ImGui::DragFloat3(("Scale##" + std::to_string(i)).c_str(), &scale.x, 0.1f))
 				{
 					entities[i]->GetTransform()->SetScale(scale);
+					UpdateEntityBounds(i);
 				}
 			}
 		}
@@ -774,35 +1561,248 @@ void Game::BuildUI()
 	if (ImGui::CollapsingHeader("Lights"))
 	{
 		ImGui::ColorEdit3("Ambient Color", &ambientColor.x);
+		ImGui::Checkbox("Sky Reflections", &skyReflectionsOn);
+		ImGui::Text("Sky lighting: %.1f ms at start up (%s)", skyLightingMs, skyLightingCached ? "from disk" : "built");
+		ImGui::Checkbox("Sky Ambient", &skyAmbientOn);
+		ImGui::Text("Sky ambient projection: %.1f ms", skyIrradianceMs);
 
-		for (int i = 0; i < lights.size(); i++)
+		ImGui::Text("Count: %u", lightManager.GetCount());
+		if (ImGui::Button("Add Point Light"))
 		{
-			ImGui::PushID(i);
-			if (ImGui::CollapsingHeader(("Light " + std::to_string(i)).c_str()))
+			Light point = {};
+			point.Type = LIGHT_TYPE_POINT;
+			point.Position = activeCamera->GetTransform().GetPosition();
+			point.Color = XMFLOAT3(1, 1, 1);
+			point.Intensity = 1.0f;
+			point.Range = 10.0f;
+			lightManager.Add(point);
+		}
+
+		// Named by handle, so a light keeps its name (and its
+		// header stays open) when others are removed
+		LightHandle removed;
+		for (unsigned int i = 0; i < lightManager.GetCount(); i++)
+		{
+			LightHandle handle = lightManager.GetHandle(i);
+			Light& light = lightManager.GetLights()[i];
+
+			ImGui::PushID((int)handle.Slot);
+			if (ImGui::CollapsingHeader(("Light " + std::to_string(handle.Slot)).c_str()))
 			{
-				ImGui::Combo("Type", &lights[i].Type, "Directional\0Point\0Spot\0");
+				ImGui::Combo("Type", &light.Type, "Directional\0Point\0Spot\0");
 
-				ImGui::ColorEdit3("Color", &lights[i].Color.x);
-				ImGui::DragFloat("Intensity", &lights[i].Intensity, 0.1f, 0.0f, 10.0f);
+				ImGui::ColorEdit3("Color", &light.Color.x);
+				ImGui::DragFloat("Intensity", &light.Intensity, 0.1f, 0.0f, 10.0f);
 
-				if (lights[i].Type != LIGHT_TYPE_DIRECTIONAL)
+				if (light.Type != LIGHT_TYPE_DIRECTIONAL)
 				{
-					ImGui::DragFloat3("Position", &lights[i].Position.x, 0.1f);
-					ImGui::DragFloat("Range", &lights[i].Range, 0.1f, 0.0f, 100.0f);
+					ImGui::DragFloat3("Position", &light.Position.x, 0.1f);
+					ImGui::DragFloat("Range", &light.Range, 0.1f, 0.0f, 100.0f);
 				}
 
-				if (lights[i].Type != LIGHT_TYPE_POINT)
+				if (light.Type != LIGHT_TYPE_POINT)
 				{
-					ImGui::DragFloat3("Direction", &lights[i].Direction.x, 0.1f);
+					ImGui::DragFloat3("Direction", &light.Direction.x, 0.1f);
 				}
 
-				if (lights[i].Type == LIGHT_TYPE_SPOT)
+				if (light.Type == LIGHT_TYPE_SPOT)
 				{
-					ImGui::DragFloat("Fall Off", &lights[i].SpotFalloff, 0.01f, 0.0f, XM_PI);
+					ImGui::DragFloat("Fall Off", &light.SpotFalloff, 0.01f, 0.0f, XM_PI);
 				}
+
+				if (ImGui::Button("Remove"))
+					removed = handle;
 			}
 			ImGui::PopID();
 		}
+		lightManager.Remove(removed);
+	}
+
+	if (ImGui::CollapsingHeader("Rendering Stats", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		ImGui::Text("Entities: %d", (int)entities.size());
+		ImGui::Text("Scene load: %.2f ms", sceneLoadMs);
+		ImGui::Text("Main pass draw calls: %u", drawCalls);
+		ImGui::Text("Shadow pass draw calls: %u", shadowDrawCalls);
+		ImGui::Checkbox("Hardware Instancing", &instancingOn);
+		if (!instancingOn)
+		{
+			ImGui::Checkbox("Record Draws On Threads", &recordedDrawsOn);
+			if (recordedDrawsOn)
+			{
+				ImGui::SliderInt("Threads (0 = all)", &recordThreads, 0, 2 * std::thread::hardware_concurrency());
+				ImGui::Text("Record: %.2f ms in %u chunks", recordMs, recordedChunks);
+				ImGui::Text("Replay: %.2f ms", replayMs);
+				ImGui::Text("Command lists: %.1f KB", recordedBytes / 1024.0f);
+			}
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Stress Scene"))
+	{
+		ImGui::InputInt("Entities", &stressEntityCount, 1000, 10000);
+		if (stressEntityCount < 0) stressEntityCount = 0;
+		ImGui::SliderInt("Mesh Variety", &stressMeshVariety, 1, (int)meshes.size());
+		ImGui::SliderInt("Material Variety", &stressMaterialVariety, 1, (int)materials.size());
+		ImGui::SliderInt("Extra Lights", &stressLightCount, 0, 10000);
+		ImGui::SliderFloat("Moving %", &stressMovingPercent, 0.0f, 100.0f);
+		ImGui::InputInt("Seed", &stressSeed);
+
+		bool stress = stressSceneOn;
+		if (ImGui::Checkbox("Stress Scene On", &stress))
+			SetStressScene(stress);
+		ImGui::SameLine();
+		if (ImGui::Button("Regenerate"))
+			SetStressScene(true);
+	}
+
+	if (ImGui::CollapsingHeader("Frame Stats"))
+	{
+		ImGui::Text("Frame: %.3f ms", FrameStats::GetFrameMs());
+		for (int p = 0; p < FrameStats::PhaseCount; p++)
+		{
+			FrameStats::Phase phase = (FrameStats::Phase)p;
+			ImGui::Text("  %-10s %.3f ms", FrameStats::GetPhaseName(phase), FrameStats::GetPhaseMs(phase));
+		}
+		ImGui::Text("Draw calls: %u", FrameStats::GetDrawCalls());
+		ImGui::Text("Buffer uploads: %u (%.1f KB)", FrameStats::GetBufferUploads(), FrameStats::GetBufferBytesUploaded() / 1024.0f);
+		ImGui::Text("Unchanged buffers skipped: %u", FrameStats::GetBufferUploadsSkipped());
+		ImGui::Text("Shader binds: %u", FrameStats::GetShaderBinds());
+		ImGui::Text("State calls: %u (%u filtered)", FrameStats::GetStateCallsIssued(), FrameStats::GetStateCallsFiltered());
+		ImGui::Text("Allocations: %u", FrameStats::GetAllocations());
+
+		ImGui::InputInt("Frames", &recordFrameCount);
+		if (recordFrameCount < 1) recordFrameCount = 1;
+		if (FrameStats::IsRecording())
+			ImGui::Text("Recording... %u / %d", FrameStats::GetRecordedFrames(), recordFrameCount);
+		else if (ImGui::Button("Record to FrameStats.csv"))
+			FrameStats::StartRecording(FixPath("FrameStats.csv"), recordFrameCount);
+	}
+
+	if (ImGui::CollapsingHeader("Constant Buffer Ring"))
+	{
+		if (!constantRing->IsValid())
+		{
+			ImGui::Text("Not supported - needs D3D 11.1 constant buffer offsets");
+		}
+		else
+		{
+			if (ImGui::Checkbox("Upload Through Ring", &constantRingOn))
+				ISimpleShader::UploadRing = constantRingOn ? constantRing : nullptr;
+
+			const RingAllocator& ring = constantRing->GetAllocator();
+			ImGui::Text("Used: %.1f / %.1f KB", ring.GetLastFrameUsed() / 1024.0f, ring.GetCapacity() / 1024.0f);
+			ImGui::Text("Peak: %.1f KB", ring.GetPeakUsed() / 1024.0f);
+			ImGui::Text("Slices: %u", ring.GetLastFrameAllocations());
+			ImGui::Text("Overflows: %u", ring.GetLastFrameOverflows());
+		}
+	}
+
+	if (ImGui::CollapsingHeader("State Cache"))
+	{
+		bool filtering = Graphics::States->GetFilteringEnabled();
+		if (ImGui::Checkbox("Filter Redundant Calls", &filtering))
+			Graphics::States->SetFilteringEnabled(filtering);
+
+		unsigned int issued = FrameStats::GetStateCallsIssued();
+		unsigned int filtered = FrameStats::GetStateCallsFiltered();
+		ImGui::Text("Issued: %u", issued);
+		ImGui::Text("Filtered: %u (%.0f%%)", filtered, issued + filtered > 0 ? 100.0f * filtered / (issued + filtered) : 0.0f);
+
+		ImGui::Separator();
+		ImGui::Text("Pipelines: %d", (int)Graphics::Pipelines->GetPipelineCount());
+		ImGui::Text("State objects: %d", (int)Graphics::Pipelines->GetStateObjectCount());
+		ImGui::Text("Reused: %d", (int)Graphics::Pipelines->GetHits());
+	}
+
+	if (pixelShaderVariants && ImGui::CollapsingHeader("Shader Variants"))
+	{
+		if (ImGui::Checkbox("Use Variants", &shaderVariantsOn))
+			variantsDirty = true;
+		if (shaderVariantsOn)
+		{
+			ImGui::Checkbox("Shadows", &shadowsOn);
+			if (shadowsOn && ImGui::SliderInt("PCF Taps", &pcfTaps, 1, ShaderMaxPCFTaps))
+				pcfTaps |= 1;
+		}
+
+		auto& variants = pixelShaderVariants->GetVariants();
+		ImGui::Text("Compiled: %d, %.1f ms total", (int)variants.size(), pixelShaderVariants->GetTotalCompileMs());
+		for (auto& v : variants)
+			ImGui::Text("%s: %.1f ms%s", v.second.Description.c_str(), v.second.CompileMs, v.second.Compiled ? "" : " (fallback)");
+	}
+
+	if (ImGui::CollapsingHeader("Shader Startup"))
+	{
+		ImGui::Text("Total: %.2f ms on %u threads", shaderStartupMs, std::thread::hardware_concurrency());
+		ImGui::Text("Cache: %d entries, %u hits, %u misses",
+			(int)shaderCache->GetEntryCount(), shaderCache->GetHits(), shaderCache->GetMisses());
+		for (auto& s : shaderLoads)
+			ImGui::Text("%s: %.2f ms (%s), %d byte metadata", s.Name.c_str(), s.Ms, s.Cached ? "cached" : "reflected", (int)s.MetadataBytes);
+	}
+
+	if (ImGui::CollapsingHeader("Scene BVH"))
+	{
+		ImGui::Text("Nodes: %u", sceneBVH.GetNodeCount());
+		ImGui::Text("Build: %.3f ms", bvhBuildMs);
+		ImGui::Text("Refit: %.3f ms", bvhRefitMs);
+		ImGui::Checkbox("Frustum Culling", &frustumCullingOn);
+		if (frustumCullingOn)
+			ImGui::Text("Cull: %.3f ms", bvhCullMs);
+		if (frustumCullingOn || occlusionCullingOn)
+			ImGui::Text("Visible entities: %d", (int)visibleEntities.size());
+
+		if (selectedEntity >= 0)
+			ImGui::Text("Selected: Entity %d (%s) at %.2f", selectedEntity + 1, entities[selectedEntity]->GetMesh()->GetName(), selectedDistance);
+		else
+			ImGui::Text("Selected: none (left click an entity)");
+
+		if (ImGui::Button("Rebuild BVH"))
+			RebuildSceneBVH();
+	}
+
+	if (ImGui::CollapsingHeader("Occlusion Culling"))
+	{
+		ImGui::Checkbox("Enabled", &occlusionCullingOn);
+		ImGui::SliderFloat("Min Occluder Size", &occluderMinSize, 1.0f, 50.0f);
+		ImGui::SliderInt("Max Occluders", &maxOccluders, 0, 64);
+		if (occlusionCullingOn)
+		{
+			ImGui::Text("Occluders: %u (%u triangles)", occluderCount, occlusionCuller->GetTriangleCount());
+			ImGui::Text("Hidden entities: %u", occludedCount);
+			ImGui::Text("Raster + test: %.3f ms", occlusionMs);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Light Lists"))
+	{
+		ImGui::Combo("Lists", &lightListMode, "Per Cluster\0Per Entity\0Off (Every Light)\0");
+		if (lightListMode == LightListsPerCluster)
+		{
+			ImGui::Text("Grid: %u x %u x %u", lightClusters->GetTilesX(), lightClusters->GetTilesY(), lightClusters->GetSlices());
+			ImGui::Text("Light indices: %u", (unsigned int)lightClusters->GetLightIndices().size());
+			ImGui::Text("Most in a cluster: %u of %u", lightClusters->GetMaxLightsPerCluster(), lightManager.GetCount());
+		}
+		else if (lightListMode == LightListsPerEntity)
+		{
+			ImGui::Text("Light indices: %u", (unsigned int)entityLightLists->GetLightIndices().size());
+			ImGui::Text("Most on an entity: %u of %u", entityLightLists->GetMaxLightsPerEntity(), lightManager.GetCount());
+		}
+		ImGui::Text("Build + upload: %.3f ms", lightListMs);
+	}
+
+	if (ImGui::CollapsingHeader("Render Path"))
+	{
+		ImGui::Combo("Path", &renderPath, "Forward\0Deferred\0");
+		if (renderPath == RenderPathDeferred)
+		{
+			ImGui::Text("Tiles: %u x %u (%u pixels)", lightTiles->GetTilesX(), lightTiles->GetTilesY(), lightTiles->GetTileSize());
+			ImGui::Text("Light indices: %u", (unsigned int)lightTiles->GetLightIndices().size());
+			ImGui::Text("Most in a tile: %u of %u", lightTiles->GetMaxLightsPerTile(), lightManager.GetCount());
+			ImGui::Text("Bin + upload: %.3f ms", lightTileMs);
+			ImGui::Text("G-buffer pixel shaders: %llu", (unsigned long long)psInvocations[StatsGBuffer]);
+		}
+		ImGui::Text("Lit pixel shaders: %llu", (unsigned long long)psInvocations[StatsLit]);
 	}
 
 	if (ImGui::CollapsingHeader("Post Processing"))
@@ -830,40 +1830,109 @@ void Game::Draw(float deltaTime, float totalTime)
 	// - These things should happen ONCE PER FRAME
 	// - At the beginning of Game::Draw() before drawing *anything*
 	{
+		frameIndex++;
+		if (ISimpleShader::UploadRing)
+			ISimpleShader::UploadRing->BeginFrame();
+
+		// ImGui sets state straight on the context, so the
+		// cache can't trust anything it saw last frame
+		Graphics::States->Invalidate();
+		ReadStatsQueries();
+
 		// Clear the back buffer (erase what's on screen) and depth buffer
 		const float color[4] = { 0.4f, 0.6f, 0.75f, 0.0f };
 		Graphics::Context->ClearRenderTargetView(Graphics::BackBufferRTV.Get(),	color);
 		Graphics::Context->ClearDepthStencilView(Graphics::DepthBufferDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
 	}
-	RenderShadowMap();
+
+	// Only the main pass is culled - shadow casters can be
+	// off screen (or hidden) and still cast into view
+	FrameStats::BeginPhase(FrameStats::PhaseCulling);
+	bool culling = frustumCullingOn || occlusionCullingOn;
+	if (culling)
+		CullEntities();
+	const std::vector<std::shared_ptr<Game_Entity>>& drawList = culling ? visibleEntities : entities;
+	FrameStats::EndPhase(FrameStats::PhaseCulling);
+
+	// Light lists first, as per entity ones are packed
+	// into the instance data
+	FrameStats::BeginPhase(FrameStats::PhaseLights);
+	UploadLights();
+	XMFLOAT4X4 view = activeCamera->GetViewMatrix();
+	viewDepthRow = XMFLOAT4(view._13, view._23, view._33, view._43);
+	if (renderPath == RenderPathDeferred)
+		BuildLightTiles();
+	else
+		BuildLightLists(drawList);
+	FrameStats::EndPhase(FrameStats::PhaseLights);
+
+	// Group and upload this frame's instance data before
+	// either pass needs it
+	FrameStats::BeginPhase(FrameStats::PhaseBatching);
+	if (instancingOn)
+	{
+		// Shadows still need the culled entities
+		if (culling)
+			instanceBatcher->Build(entities, visibleItems);
+		else
+			instanceBatcher->Build(entities);
+	}
+	FrameStats::EndPhase(FrameStats::PhaseBatching);
+
+	// Only variants without shadows can skip the shadow map
+	UpdateShaderVariants();
+	FrameStats::BeginPhase(FrameStats::PhaseShadows);
+	if (shadowsOn || !shaderVariantsOn)
+		RenderShadowMap();
+	FrameStats::EndPhase(FrameStats::PhaseShadows);
+
+	FrameStats::BeginPhase(FrameStats::PhaseMain);
 
 	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 	Graphics::Context->ClearRenderTargetView(blurRTV.Get(), clearColor);
-	Graphics::Context->OMSetRenderTargets(1, blurRTV.GetAddressOf(), Graphics::DepthBufferDSV.Get());
+	Graphics::States->SetRenderTargets(1, blurRTV.GetAddressOf(), Graphics::DepthBufferDSV.Get());
 	
-	for (auto& e : entities)
+	drawCalls = 0;
+	if (renderPath == RenderPathDeferred)
+		DrawDeferred(drawList);
+	else if (instancingOn)
 	{
-		std::shared_ptr<SimpleVertexShader> vs = e->GetMaterial()->GetVertexShader();
-		std::shared_ptr<SimplePixelShader> ps = e->GetMaterial()->GetPixelShader();
-		ps->SetShaderResourceView("ShadowMap", shadowSRV);
-		ps->SetSamplerState("ShadowSampler", shadowSampler);
-		ps->SetFloat2("shadowMapSize", XMFLOAT2(static_cast<float>(shadowMapResolution), static_cast<float>(shadowMapResolution)));;
+		BeginStatsQuery(StatsLit);
 
-		vs->SetMatrix4x4("shadowView", *shadowView);
-		vs->SetMatrix4x4("shadowProjection", *shadowProjection);
-
-
-		ps->SetFloat3("ambientColor", ambientColor);
-		ps->SetInt("lightCount", (int)lights.size());
-		ps->SetData("lights", &lights[0], sizeof(Light) * (int)lights.size());
-		e->Draw(activeCamera);
+		// One draw per (mesh, material) pair
+		for (auto& batch : instanceBatcher->GetBatches())
+		{
+			SetPerFrameShaderData(instancedVS, batch.material->GetPixelShader());
+			batch.material->PrepareMaterialInstanced(instancedVS);
+			instanceBatcher->DrawBatch(Graphics::Context.Get(), batch);
+			drawCalls++;
+		}
 
+		EndStatsQuery(StatsLit);
+	}
+	else
+	{
+		BeginStatsQuery(StatsLit);
+		if (!recordedDrawsOn || !RecordMainPass(drawList))
+		{
+			for (auto& e : drawList)
+			{
+				SetPerFrameShaderData(e->GetMaterial()->GetVertexShader(), e->GetMaterial()->GetPixelShader());
+				e->Draw();
+				drawCalls++;
+			}
+		}
+		EndStatsQuery(StatsLit);
 	}
 	sky->Draw(activeCamera);
+	drawCalls++;
+	FrameStats::EndPhase(FrameStats::PhaseMain);
+
+	FrameStats::BeginPhase(FrameStats::PhasePost);
 
 	ID3D11RenderTargetView* nullRTV = nullptr;
 	ID3D11DepthStencilView* nullDSV = nullptr;
-	Graphics::Context->OMSetRenderTargets(1, &nullRTV, nullDSV);
+	Graphics::States->SetRenderTargets(1, &nullRTV, nullDSV);
 	fullscreenVS->SetShader();
 
 	ID3D11ShaderResourceView* currentSRV = blurSRV.Get();
@@ -871,10 +1940,10 @@ void Game::Draw(float deltaTime, float totalTime)
 	if (pixelizeOn)
 	{
 		Graphics::Context->ClearRenderTargetView(pixelizeRTV.Get(), clearColor);
-		Graphics::Context->OMSetRenderTargets(1, pixelizeRTV.GetAddressOf(), nullptr);
+		Graphics::States->SetRenderTargets(1, pixelizeRTV.GetAddressOf(), nullptr);
 
 		ID3D11ShaderResourceView* nullSRV = nullptr;
-		Graphics::Context->PSSetShaderResources(0, 1, &nullSRV);
+		Graphics::States->SetShaderResources(StagePixel, 0, 1, &nullSRV);
 
 		pixelizePS->SetShader();
 		pixelizePS->SetShaderResourceView("Pixels", currentSRV);
@@ -890,20 +1959,21 @@ void Game::Draw(float deltaTime, float totalTime)
 		pixelizePS->CopyAllBufferData();
 
 		Graphics::Context->Draw(3, 0);
+		FrameStats::DrawCalls++;
 
 		currentSRV = pixelizeSRV.Get();
 
-		Graphics::Context->PSSetShaderResources(0, 1, &nullSRV);
-		Graphics::Context->OMSetRenderTargets(1, &nullRTV, nullptr);
+		Graphics::States->SetShaderResources(StagePixel, 0, 1, &nullSRV);
+		Graphics::States->SetRenderTargets(1, &nullRTV, nullptr);
 	}
 
 	if (blurOn)
 	{
 		Graphics::Context->ClearRenderTargetView(blurRTV.Get(), clearColor);
-		Graphics::Context->OMSetRenderTargets(1, blurRTV.GetAddressOf(), nullptr);
+		Graphics::States->SetRenderTargets(1, blurRTV.GetAddressOf(), nullptr);
 
 		ID3D11ShaderResourceView* nullSRV = nullptr;
-		Graphics::Context->PSSetShaderResources(0, 1, &nullSRV);
+		Graphics::States->SetShaderResources(StagePixel, 0, 1, &nullSRV);
 
 		blurPS->SetShader();
 		blurPS->SetShaderResourceView("Pixels", currentSRV);
@@ -915,14 +1985,15 @@ void Game::Draw(float deltaTime, float totalTime)
 		blurPS->CopyAllBufferData();
 
 		Graphics::Context->Draw(3, 0);
+		FrameStats::DrawCalls++;
 
 		currentSRV = blurSRV.Get();
 
-		Graphics::Context->PSSetShaderResources(0, 1, &nullSRV);
-		Graphics::Context->OMSetRenderTargets(1, &nullRTV, nullptr);
+		Graphics::States->SetShaderResources(StagePixel, 0, 1, &nullSRV);
+		Graphics::States->SetRenderTargets(1, &nullRTV, nullptr);
 	}
 
-	Graphics::Context->OMSetRenderTargets(1, Graphics::BackBufferRTV.GetAddressOf(), nullptr);
+	Graphics::States->SetRenderTargets(1, Graphics::BackBufferRTV.GetAddressOf(), nullptr);
 	fullscreenVS->SetShader();
 
 	if (pixelizeOn)
@@ -945,9 +2016,10 @@ void Game::Draw(float deltaTime, float totalTime)
 	}
 
 	Graphics::Context->Draw(3, 0);
+	FrameStats::DrawCalls++;
 
 	ID3D11ShaderResourceView* nullSRVs[16] = {};
-	Graphics::Context->PSSetShaderResources(0, 16, nullSRVs);
+	Graphics::States->SetShaderResources(StagePixel, 0, 16, nullSRVs);
 
 	// Frame END
 	// - These should happen exactly ONCE PER FRAME
@@ -957,16 +2029,290 @@ void Game::Draw(float deltaTime, float totalTime)
 		bool vsync = Graphics::VsyncState();
 		ImGui::Render(); // Turns this frames UI into renderable triangles
 		ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData()); // Draws it to the screen
+		FrameStats::EndPhase(FrameStats::PhasePost);
+
+		FrameStats::BeginPhase(FrameStats::PhasePresent);
 		Graphics::SwapChain->Present(
 			vsync ? 1 : 0,
 			vsync ? 0 : DXGI_PRESENT_ALLOW_TEARING);
+		FrameStats::EndPhase(FrameStats::PhasePresent);
 
 		// Re-bind back buffer and depth buffer after presenting
-		Graphics::Context->OMSetRenderTargets(
+		Graphics::States->SetRenderTargets(
 			1,
 			Graphics::BackBufferRTV.GetAddressOf(),
 			Graphics::DepthBufferDSV.Get());
 	}
+
+	FrameStats::EndFrame((unsigned int)entities.size(), lightManager.GetCount());
+}
+
+// --------------------------------------------------------
+// The deferred path's main pass: the draw list goes into the
+// G-buffer (instanced or not), then one full screen triangle
+// lights every pixel that was drawn to
+// - Leaves the usual main pass target and depth bound, for
+//   the sky
+// --------------------------------------------------------
+void Game::DrawDeferred(const std::vector<std::shared_ptr<Game_Entity>>& drawList)
+{
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	ID3D11RenderTargetView* targets[GBufferCount];
+	for (unsigned int i = 0; i < GBufferCount; i++)
+	{
+		Graphics::Context->ClearRenderTargetView(gbufferRTVs[i].Get(), clearColor);
+		targets[i] = gbufferRTVs[i].Get();
+	}
+	Graphics::States->SetRenderTargets(GBufferCount, targets, Graphics::DepthBufferDSV.Get());
+
+	BeginStatsQuery(StatsGBuffer);
+	if (instancingOn)
+	{
+		for (auto& batch : instanceBatcher->GetBatches())
+		{
+			SetPerFrameShaderData(instancedVS, gbufferPS);
+			batch.material->PrepareGBufferInstanced(instancedVS, gbufferPS);
+			instanceBatcher->DrawBatch(Graphics::Context.Get(), batch);
+			drawCalls++;
+		}
+	}
+	else
+	{
+		for (auto& e : drawList)
+		{
+			SetPerFrameShaderData(e->GetMaterial()->GetVertexShader(), gbufferPS);
+			e->DrawGBuffer(gbufferPS);
+			drawCalls++;
+		}
+	}
+	EndStatsQuery(StatsGBuffer);
+
+	Graphics::States->SetRenderTargets(1, blurRTV.GetAddressOf(), nullptr);
+	fullscreenVS->SetShader();
+	deferredLightingPS->SetShader();
+	deferredLightingPS->SetShaderResourceView("GBufferAlbedo", gbufferSRVs[0]);
+	deferredLightingPS->SetShaderResourceView("GBufferNormal", gbufferSRVs[1]);
+	deferredLightingPS->SetShaderResourceView("GBufferMaterial", gbufferSRVs[2]);
+	deferredLightingPS->SetShaderResourceView("GBufferDepth", gbufferSRVs[3]);
+	deferredLightingPS->SetShaderResourceView("TileRanges", tileRangeSRV);
+	deferredLightingPS->SetShaderResourceView("TileLightIndices", tileIndexSRV);
+	deferredLightingPS->SetShaderResourceView("Lights", lightSRV);
+	deferredLightingPS->SetShaderResourceView("SkySpecular", skySpecularSRV);
+	deferredLightingPS->SetShaderResourceView("SkyBRDFLookup", skyLookupSRV);
+	deferredLightingPS->SetSamplerState("ClampSampler", ppSampler);
+
+	// A pixel's direction from the camera, from the view's
+	// axes and the projection's scale and offset
+	XMFLOAT4X4 view = activeCamera->GetViewMatrix();
+	XMFLOAT4X4 proj = activeCamera->GetProjectionMatrix();
+	XMFLOAT3 right(view._11 / proj._11, view._21 / proj._11, view._31 / proj._11);
+	XMFLOAT3 up(view._12 / proj._22, view._22 / proj._22, view._32 / proj._22);
+	XMFLOAT3 forward(
+		view._13 - right.x * proj._31 - up.x * proj._32,
+		view._23 - right.y * proj._31 - up.y * proj._32,
+		view._33 - right.z * proj._31 - up.z * proj._32);
+
+	deferredLightingPS->SetFloat3("ambientColor", ambientColor);
+	deferredLightingPS->SetFloat3("cameraPosition", activeCamera->GetTransform().GetPosition());
+	deferredLightingPS->SetFloat3("viewRayForward", forward);
+	deferredLightingPS->SetFloat3("viewRayRight", right);
+	deferredLightingPS->SetFloat3("viewRayUp", up);
+	deferredLightingPS->SetFloat2("screenSize", XMFLOAT2((float)Window::Width(), (float)Window::Height()));
+	deferredLightingPS->SetInt("tileSize", lightTiles->GetTileSize());
+	deferredLightingPS->SetInt("tilesX", lightTiles->GetTilesX());
+	deferredLightingPS->SetFloat("skySpecularMips", GetSkySpecularMips());
+	deferredLightingPS->SetData("skyIrradiance", GetSkyIrradiance(), sizeof(skyIrradianceConstants));
+	deferredLightingPS->CopyAllBufferData();
+
+	BeginStatsQuery(StatsLit);
+	Graphics::Context->Draw(3, 0);
+	EndStatsQuery(StatsLit);
+	FrameStats::DrawCalls++;
+	drawCalls++;
+
+	// Unbound, as the G-buffer is drawn to again next frame
+	ID3D11ShaderResourceView* nullSRVs[GBufferCount] = {};
+	Graphics::States->SetShaderResources(StagePixel, 0, GBufferCount, nullSRVs);
+	Graphics::States->SetRenderTargets(1, blurRTV.GetAddressOf(), Graphics::DepthBufferDSV.Get());
+}
+
+// --------------------------------------------------------
+// Pipeline statistics queries - one is only started again
+// once its last results are read, so reading never waits
+// on the GPU
+// --------------------------------------------------------
+void Game::BeginStatsQuery(int query)
+{
+	if (!statsQueries[query] || statsQueryPending[query])
+		return;
+
+	Graphics::Context->Begin(statsQueries[query].Get());
+	statsQueryActive[query] = true;
+}
+
+void Game::EndStatsQuery(int query)
+{
+	if (!statsQueryActive[query])
+		return;
+
+	Graphics::Context->End(statsQueries[query].Get());
+	statsQueryActive[query] = false;
+	statsQueryPending[query] = true;
+}
+
+void Game::ReadStatsQueries()
+{
+	for (int i = 0; i < StatsQueryCount; i++)
+	{
+		if (!statsQueryPending[i])
+			continue;
+
+		D3D11_QUERY_DATA_PIPELINE_STATISTICS stats = {};
+		if (Graphics::Context->GetData(statsQueries[i].Get(), &stats, sizeof(stats), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+		{
+			psInvocations[i] = stats.PSInvocations;
+			statsQueryPending[i] = false;
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Draws the main pass by recording it into command lists on
+// the record pool's threads, one chunk of the draw list
+// each, and then replaying those in order on this thread
+// - Per-frame and per-material data needs the context, so
+//   it's all uploaded here first (every entity's material is
+//   one of the scene's materials, listed or not)
+// - False if that couldn't be done, before anything's drawn
+// --------------------------------------------------------
+bool Game::RecordMainPass(const std::vector<std::shared_ptr<Game_Entity>>& drawList)
+{
+	for (auto& m : allMaterials)
+	{
+		if (!m->CanRecord())
+			return false;
+		SetPerFrameShaderData(m->GetVertexShader(), m->GetPixelShader());
+		if (!m->PrepareRecording())
+			return false;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	unsigned int threadCount = recordThreads > 0 ? recordThreads : std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+	if (!recordPool || recordPool->GetThreadCount() != threadCount)
+		recordPool = std::make_unique<WorkerPool>(threadCount);
+
+	// Small chunks aren't worth a thread
+	const size_t minChunkSize = 256;
+	size_t chunkSize = (drawList.size() + threadCount - 1) / threadCount;
+	if (chunkSize < minChunkSize) chunkSize = minChunkSize;
+	size_t chunkCount = (drawList.size() + chunkSize - 1) / chunkSize;
+	if (commandLists.size() < chunkCount)
+		commandLists.resize(chunkCount);
+
+	auto record = [&](size_t chunk)
+	{
+		CommandList& list = commandLists[chunk];
+		list.Reset();
+
+		size_t begin = chunk * chunkSize;
+		size_t end = begin + chunkSize < drawList.size() ? begin + chunkSize : drawList.size();
+		const Game_Entity* previous = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			drawList[i]->Record(list, previous);
+			previous = drawList[i].get();
+		}
+	};
+
+	recordPool->Run(chunkCount, record);
+
+	auto recorded = std::chrono::high_resolution_clock::now();
+
+	recordedBytes = 0;
+	for (size_t c = 0; c < chunkCount; c++)
+	{
+		commandLists[c].Replay(Graphics::States.get(), commandBackend.get());
+		drawCalls += commandLists[c].GetDrawCount();
+		recordedBytes += commandLists[c].GetSizeInBytes();
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	recordMs = std::chrono::duration<float, std::milli>(recorded - start).count();
+	replayMs = std::chrono::duration<float, std::milli>(end - recorded).count();
+	recordedChunks = (unsigned int)chunkCount;
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets the camera, shadow and lighting data that every
+// object in the main pass needs, regardless of its material
+//
+// - This lives in each shader's PerFrame constant buffer,
+//   so it's only written once per frame for each shader
+// --------------------------------------------------------
+void Game::SetPerFrameShaderData(std::shared_ptr<SimpleVertexShader> vs, std::shared_ptr<SimplePixelShader> ps)
+{
+	ps->SetShaderResourceView("ShadowMap", shadowSRV);
+	ps->SetSamplerState("ShadowSampler", shadowSampler);
+	ps->SetShaderResourceView("ClusterRanges", clusterRangeSRV);
+	ps->SetShaderResourceView("LightIndices", clusterIndexSRV);
+	ps->SetShaderResourceView("Lights", lightSRV);
+	ps->SetShaderResourceView("SkySpecular", skySpecularSRV);
+	ps->SetShaderResourceView("SkyBRDFLookup", skyLookupSRV);
+	ps->SetSamplerState("ClampSampler", ppSampler);
+
+	PerFrameVars& vsVars = GetPerFrameVars(vs.get());
+	if (vsVars.FrameSet != frameIndex)
+	{
+		vsVars.FrameSet = frameIndex;
+		vs->SetMatrix4x4(vsVars.View, activeCamera->GetViewMatrix());
+		vs->SetMatrix4x4(vsVars.Projection, activeCamera->GetProjectionMatrix());
+		vs->SetMatrix4x4(vsVars.ShadowView, *shadowView);
+		vs->SetMatrix4x4(vsVars.ShadowProjection, *shadowProjection);
+	}
+
+	PerFrameVars& psVars = GetPerFrameVars(ps.get());
+	if (psVars.FrameSet != frameIndex)
+	{
+		psVars.FrameSet = frameIndex;
+		ps->SetFloat3(psVars.CameraPosition, activeCamera->GetTransform().GetPosition());
+		ps->SetFloat2(psVars.ShadowMapSize, XMFLOAT2(static_cast<float>(shadowMapResolution), static_cast<float>(shadowMapResolution)));
+		ps->SetFloat3(psVars.AmbientColor, ambientColor);
+		ps->SetFloat4(psVars.ViewDepth, viewDepthRow);
+		ps->SetFloat2(psVars.ClusterTileScale, clusterTileScale);
+		ps->SetFloat2(psVars.ClusterDepthScale, clusterDepthScale);
+		ps->SetData(psVars.ClusterCounts, &clusterCounts, sizeof(clusterCounts));
+		ps->SetFloat(psVars.SkySpecularMips, GetSkySpecularMips());
+		ps->SetData(psVars.SkyIrradiance, GetSkyIrradiance(), sizeof(skyIrradianceConstants));
+	}
+}
+
+Game::PerFrameVars& Game::GetPerFrameVars(ISimpleShader* shader)
+{
+	auto it = perFrameVars.find(shader);
+	if (it != perFrameVars.end())
+		return it->second;
+
+	// Names that don't exist in this shader stage
+	// just give invalid handles, which are ignored
+	PerFrameVars vars;
+	vars.View = shader->GetVariableHandle("view");
+	vars.Projection = shader->GetVariableHandle("projection");
+	vars.CameraPosition = shader->GetVariableHandle("cameraPosition");
+	vars.ShadowView = shader->GetVariableHandle("shadowView");
+	vars.ShadowProjection = shader->GetVariableHandle("shadowProjection");
+	vars.ShadowMapSize = shader->GetVariableHandle("shadowMapSize");
+	vars.AmbientColor = shader->GetVariableHandle("ambientColor");
+	vars.ViewDepth = shader->GetVariableHandle("viewDepth");
+	vars.ClusterTileScale = shader->GetVariableHandle("clusterTileScale");
+	vars.ClusterDepthScale = shader->GetVariableHandle("clusterDepthScale");
+	vars.ClusterCounts = shader->GetVariableHandle("clusterCounts");
+	vars.SkySpecularMips = shader->GetVariableHandle("skySpecularMips");
+	vars.SkyIrradiance = shader->GetVariableHandle("skyIrradiance");
+	return perFrameVars.emplace(shader, vars).first->second;
 }
 
 std::shared_ptr<Camera> Game::GetActiveCamera() const
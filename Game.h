@@ -6,11 +6,28 @@
 #include "BufferStructs.h"
 #include "Game_Entity.h"
 #include "Camera.h"
+#include <functional>
 #include <memory>
+#include <unordered_map>
 #include "WICTextureLoader.h" 
 #include "Light.h"
 #include "Sky.h"
 #include "PBRTexture.h"
+#include "InstanceBatcher.h"
+#include "BVH.h"
+#include "OcclusionCuller.h"
+#include "LightClusters.h"
+#include "EntityLightLists.h"
+#include "LightTiles.h"
+#include "SkyIrradiance.h"
+#include "SkyLighting.h"
+#include "LightManager.h"
+#include "ConstantBufferRing.h"
+#include "ShaderVariant.h"
+#include "WorkerPool.h"
+
+class ShaderCache;
+class ShaderVariantCache;
 
 class Game
 {
@@ -35,11 +52,47 @@ private:
 	// Initialization helper methods - feel free to customize, combine, remove, etc.
 	//void LoadShaders();
 	void CreateGeometry();
+	template<typename T>
+	void QueueShader(std::vector<std::function<void()>>& jobs, std::shared_ptr<T>* shader, const std::wstring& file);
+	void LoadQueuedShaders(std::vector<std::function<void()>>& jobs);
+	void CheckShaderBuffers(std::shared_ptr<SimpleVertexShader> vs);
+	void UpdateShaderVariants();
+	void LoadScene(
+		const std::string& textPath,
+		const std::string& cookedPath,
+		std::shared_ptr<SimpleVertexShader> vs,
+		Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler);
 	void GenerateLights();
 	void GenerateShadows();
 	void RenderShadowMap();
+	void UploadLights();
+	void BuildLightLists(const std::vector<std::shared_ptr<Game_Entity>>& drawList);
+	void BuildLightTiles();
+	void BuildSkyLighting();
+	float GetSkySpecularMips() const;
+	const DirectX::XMFLOAT4* GetSkyIrradiance() const;
+	void DrawDeferred(const std::vector<std::shared_ptr<Game_Entity>>& drawList);
+	void BeginStatsQuery(int query);
+	void EndStatsQuery(int query);
+	void ReadStatsQueries();
+	bool UploadShaderBuffer(
+		Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv,
+		unsigned int& capacity,
+		DXGI_FORMAT format,
+		const void* data,
+		unsigned int count,
+		unsigned int stride);
 	void PostProcessingReSize();
-	void CreateRenderTarget(Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv, Microsoft::WRL::ComPtr <ID3D11ShaderResourceView>& srv);
+	void CreateRenderTarget(Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv, Microsoft::WRL::ComPtr <ID3D11ShaderResourceView>& srv, DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM);
+	void SetStressScene(bool enabled);
+	void RebuildSceneBVH();
+	void UpdateEntityBounds(unsigned int index);
+	void CullEntities();
+	void CullOccludedEntities(const DirectX::XMFLOAT4X4& viewProj);
+	int PickEntity(int mouseX, int mouseY, float* hitDistance);
+	void SetPerFrameShaderData(std::shared_ptr<SimpleVertexShader> vs, std::shared_ptr<SimplePixelShader> ps);
+	bool RecordMainPass(const std::vector<std::shared_ptr<Game_Entity>>& drawList);
 	void ImGuiUpdate(float deltaTime);
 	void BuildUI();
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> LoadTexture(const std::wstring& path);
@@ -64,6 +117,7 @@ private:
 	std::shared_ptr<Camera> activeCamera;
 	int activeCameraIndex = 0;
 	std::shared_ptr<Camera> GetActiveCamera() const;
+	DirectX::XMFLOAT4 viewDepthRow;	// The view matrix's z column, taken each frame for both render paths
 
 	std::shared_ptr<Mesh> triangle;
 	std::shared_ptr<Mesh> square;
@@ -73,15 +127,48 @@ private:
 
 	std::vector<std::shared_ptr<Mesh>> meshes;
 	std::vector<std::shared_ptr<Game_Entity>> entities;
-	std::vector<std::shared_ptr<Material>> materials;
-	std::vector<Light> lights;
+	std::vector<std::shared_ptr<Material>> allMaterials;	// Every one in the scene file, in order
+	std::vector<std::shared_ptr<Material>> materials;		// Those listed in the UI and the stress scene
+	std::unordered_map<std::string, std::shared_ptr<Material>> namedMaterials;
+	float sceneLoadMs = 0.0f;
 	DirectX::XMFLOAT3 ambientColor;
 
+	// Every light, packed - uploaded once a frame to a
+	// structured buffer the pixel shader reads
+	LightManager lightManager;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> lightBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> lightSRV;
+	unsigned int lightCapacity = 0;
+
+	// Variables set by SetPerFrameShaderData(), resolved
+	// the first time each shader is seen
+	struct PerFrameVars
+	{
+		unsigned int FrameSet = 0;	// Last frame this shader's data was set
+		SimpleShaderVariableHandle View;
+		SimpleShaderVariableHandle Projection;
+		SimpleShaderVariableHandle CameraPosition;
+		SimpleShaderVariableHandle ShadowView;
+		SimpleShaderVariableHandle ShadowProjection;
+		SimpleShaderVariableHandle ShadowMapSize;
+		SimpleShaderVariableHandle AmbientColor;
+		SimpleShaderVariableHandle ViewDepth;
+		SimpleShaderVariableHandle ClusterTileScale;
+		SimpleShaderVariableHandle ClusterDepthScale;
+		SimpleShaderVariableHandle ClusterCounts;
+		SimpleShaderVariableHandle SkySpecularMips;
+		SimpleShaderVariableHandle SkyIrradiance;
+	};
+	std::unordered_map<const ISimpleShader*, PerFrameVars> perFrameVars;
+	PerFrameVars& GetPerFrameVars(ISimpleShader* shader);
+	unsigned int frameIndex = 0;
+
 	const UINT shadowMapResolution = 2048;
 	Microsoft::WRL::ComPtr<ID3D11Texture2D> shadowTexture;
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> shadowDSV;
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> shadowSRV;
-	Microsoft::WRL::ComPtr<ID3D11RasterizerState> shadowRasterizer;
+	const PipelineState* shadowPipeline = 0;
+	const PipelineState* shadowInstancedPipeline = 0;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> shadowSampler;
 	DirectX::XMFLOAT4X4 lightViewMatrix;
 	DirectX::XMFLOAT4X4 lightProjectionMatrix;
@@ -89,6 +176,173 @@ private:
 	std::shared_ptr<DirectX::XMFLOAT4X4> shadowProjection;
 	std::shared_ptr<SimpleVertexShader> shadowVS;
 
+	// Variants of PixelShader.hlsl, picked for each material
+	// using it from its textures, the lights in the scene and
+	// the shadow settings (see UpdateShaderVariants())
+	std::shared_ptr<ShaderVariantCache> pixelShaderVariants;
+	std::vector<std::shared_ptr<Material>> variantMaterials;
+	ShaderVariantKey appliedVariantKey;
+	bool variantsDirty = true;
+	bool shaderVariantsOn = true;
+	bool shadowsOn = true;
+	int pcfTaps = 5;
+
+	// Instancing
+	std::shared_ptr<InstanceBatcher> instanceBatcher;
+	std::shared_ptr<SimpleVertexShader> instancedVS;
+	std::shared_ptr<SimpleVertexShader> shadowInstancedVS;
+	bool instancingOn = true;
+	unsigned int drawCalls = 0;
+	unsigned int shadowDrawCalls = 0;
+
+	// Non-instanced main pass recorded on worker threads, one
+	// command list per chunk of the draw list, then replayed
+	bool recordedDrawsOn = false;
+	int recordThreads = 0;		// 0 for one per hardware thread
+	std::unique_ptr<WorkerPool> recordPool;	// Remade when recordThreads changes
+	std::vector<CommandList> commandLists;
+	std::shared_ptr<D3D11CommandBackend> commandBackend;
+	unsigned int recordedChunks = 0;
+	size_t recordedBytes = 0;
+	float recordMs = 0.0f;
+	float replayMs = 0.0f;
+
+	// Stress scene - a seeded, procedurally generated block of
+	// entities (and lights) added on top of the loaded scene
+	size_t baseEntityCount = 0;
+	int stressEntityCount = 50000;
+	int stressMeshVariety = 1;			// How many of the scene's meshes to pick from
+	int stressMaterialVariety = 1;		// How many of the scene's materials to pick from
+	int stressLightCount = 0;			// Extra point lights
+	float stressMovingPercent = 0.0f;	// Entities that bob up and down every frame
+	int stressSeed = 1;
+	bool stressSceneOn = false;
+	std::vector<DirectX::XMFLOAT3> stressBasePositions;
+	std::vector<LightHandle> stressLights;	// Removed again with the stress scene
+	int stressMovingCount = 0;
+
+	// Frame stats recording
+	int recordFrameCount = 300;
+
+	// Scene BVH over entity world bounds, for culling and picking
+	// - Entity indices are the item indices
+	BVH sceneBVH;
+	bool frustumCullingOn = true;
+	std::vector<unsigned int> visibleItems;
+	std::vector<std::shared_ptr<Game_Entity>> visibleEntities;
+	int selectedEntity = -1;
+	float selectedDistance = 0.0f;
+	float bvhBuildMs = 0.0f;
+	float bvhRefitMs = 0.0f;
+	float bvhCullMs = 0.0f;
+
+	// Threads kept around for the CPU work done every frame
+	// (occlusion culling, light lists), shared between them
+	std::shared_ptr<WorkerPool> workerPool;
+
+	// Software occlusion culling of the main pass
+	// - Large entities are drawn into a small CPU depth buffer,
+	//   and anything completely behind them is skipped
+	std::shared_ptr<OcclusionCuller> occlusionCuller;
+	bool occlusionCullingOn = true;
+	float occluderMinSize = 8.0f;		// Smallest box extent that counts as an occluder
+	int maxOccluders = 16;
+	std::vector<unsigned int> candidateItems;
+	std::vector<AABB> candidateBounds;
+	std::vector<unsigned char> candidateVisible;
+	unsigned int occluderCount = 0;
+	unsigned int occludedCount = 0;
+	float occlusionMs = 0.0f;
+
+	// Lists of the lights each pixel loops over, either
+	// - Per cluster: the view frustum is cut into a grid of
+	//   clusters, each with a list of the lights reaching it
+	// - Per entity: each drawn entity gets a list of the lights
+	//   reaching its box, which goes along with its draw
+	// - Off: there's one cluster holding every light
+	enum LightListMode { LightListsPerCluster, LightListsPerEntity, LightListsOff };
+	int lightListMode = LightListsPerCluster;
+	std::shared_ptr<LightClusters> lightClusters;
+	std::shared_ptr<EntityLightLists> entityLightLists;
+	std::vector<AABB> entityLightBounds;
+	std::vector<LightClusters::Range> unclusteredRanges;
+	std::vector<uint32_t> unclusteredIndices;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> clusterRangeBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> clusterRangeSRV;
+	unsigned int clusterRangeCapacity = 0;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> clusterIndexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> clusterIndexSRV;
+	unsigned int clusterIndexCapacity = 0;
+	DirectX::XMFLOAT2 clusterTileScale;
+	DirectX::XMFLOAT2 clusterDepthScale;
+	DirectX::XMUINT3 clusterCounts;
+	float lightListMs = 0.0f;
+
+	// Split sum image based lighting from the sky (see
+	// SkyLighting.h) - worked out once at start up, or loaded
+	// from disk if the sky hasn't changed
+	std::shared_ptr<SkyLighting> skyLighting;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> skySpecularSRV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> skyLookupSRV;
+	bool skyReflectionsOn = true;
+	bool skyLightingCached = false;
+	float skyLightingMs = 0.0f;
+
+	// The sky's diffuse light, as spherical harmonics (see
+	// SkyIrradiance.h) packed for the shaders
+	std::shared_ptr<SkyIrradiance> skyIrradiance;
+	DirectX::XMFLOAT4 skyIrradianceConstants[7] = {};
+	bool skyAmbientOn = true;
+	float skyIrradianceMs = 0.0f;
+
+	// Deferred shading - a G-buffer pass writes out each
+	// pixel's surface, then one full screen pass lights it
+	// with the lights in its screen tile (see LightTiles.h)
+	enum RenderPath { RenderPathForward, RenderPathDeferred };
+	int renderPath = RenderPathForward;
+	static const unsigned int GBufferCount = 4;		// Albedo + shadow, normal, roughness + metalness, view depth
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> gbufferRTVs[GBufferCount];
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> gbufferSRVs[GBufferCount];
+	std::shared_ptr<SimplePixelShader> gbufferPS;
+	std::shared_ptr<SimplePixelShader> deferredLightingPS;
+	std::shared_ptr<LightTiles> lightTiles;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> tileRangeBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> tileRangeSRV;
+	unsigned int tileRangeCapacity = 0;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> tileIndexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> tileIndexSRV;
+	unsigned int tileIndexCapacity = 0;
+	float lightTileMs = 0.0f;
+
+	// Pixel shader invocations, from pipeline statistics
+	// queries read back once the GPU is done with them
+	// - Lit: the shader that loops over lights (the forward
+	//   main pass, or the deferred lighting pass)
+	// - G-buffer: the deferred geometry pass, which doesn't
+	enum StatsQuery { StatsLit, StatsGBuffer, StatsQueryCount };
+	Microsoft::WRL::ComPtr<ID3D11Query> statsQueries[StatsQueryCount];
+	bool statsQueryPending[StatsQueryCount] = {};
+	bool statsQueryActive[StatsQueryCount] = {};
+	UINT64 psInvocations[StatsQueryCount] = {};
+
+	// Shared dynamic ring that shaders upload constants into,
+	// when the driver supports it (see ISimpleShader::UploadRing)
+	std::shared_ptr<ConstantBufferRing> constantRing;
+	bool constantRingOn = true;
+
+	// Reflection data of every shader, kept between runs (see
+	// ISimpleShader::MetadataCache), and what loading cost
+	struct ShaderLoad
+	{
+		std::string Name;
+		float Ms;			// Measured on the loading thread
+		bool Cached;		// Reflection came from the cache
+		size_t MetadataBytes;
+	};
+	std::shared_ptr<ShaderCache> shaderCache;
+	std::vector<ShaderLoad> shaderLoads;
+	float shaderStartupMs = 0.0f;	// Wall time, all threads
+
 	//Post Processing Fields
 	std::shared_ptr<SimplePixelShader> blurPS;
 	std::shared_ptr<SimpleVertexShader> fullscreenVS;
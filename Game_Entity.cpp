@@ -23,13 +23,30 @@ void Game_Entity::SetMesh(std::shared_ptr<Mesh> mesh)
     this->mesh = mesh;
 }
 
-void Game_Entity::Draw(std::shared_ptr<Camera> camera)
+void Game_Entity::Draw()
 {
     //Graphics::Context->VSSetConstantBuffers(0, 1, vsConstantBuffer.GetAddressOf());
-    material.get()->PrepareMaterial(transform, camera);
+    material.get()->PrepareMaterial(transform, lightRange);
     mesh->Draw(Graphics::Context.Get());
 }
 
+void Game_Entity::DrawGBuffer(std::shared_ptr<SimplePixelShader> gbufferPS)
+{
+	material->PrepareGBuffer(transform, gbufferPS);
+	mesh->Draw(Graphics::Context.Get());
+}
+
+void Game_Entity::Record(CommandList& list, const Game_Entity* previous)
+{
+	material->RecordDraw(list, *transform, lightRange, previous && previous->material == material);
+	mesh->Record(list, previous && previous->mesh == mesh);
+}
+
+AABB Game_Entity::GetWorldBounds()
+{
+    return Bounds::Transform(mesh->GetBounds(), transform->GetWorldMatrix());
+}
+
 std::shared_ptr<Material> Game_Entity::GetMaterial()
 {
     return material;
@@ -17,10 +17,27 @@ public:
 
 	void setMaterial(std::shared_ptr<Material> _material);
 	void SetMesh(std::shared_ptr<Mesh> mesh);
-	void Draw(std::shared_ptr<Camera> camera);
+	void Draw();
+
+	// Draw(), into the deferred path's G-buffer
+	void DrawGBuffer(std::shared_ptr<SimplePixelShader> gbufferPS);
+
+	// Draw(), into a command list instead (see Material::RecordDraw)
+	// - previous is the entity recorded just before this one, if any
+	void Record(CommandList& list, const Game_Entity* previous);
+
+	// World space box around the mesh, using the current transform
+	AABB GetWorldBounds();
+
+	// Where this entity's lights are in the per entity light
+	// lists (see EntityLightLists.h) - set every frame while
+	// they're in use, and sent along with each draw
+	DirectX::XMUINT2 GetLightRange() const { return lightRange; }
+	void SetLightRange(DirectX::XMUINT2 range) { lightRange = range; }
 
 private:
 	std::shared_ptr<Transform> transform;
 	std::shared_ptr<Mesh> mesh;
+	DirectX::XMUINT2 lightRange = DirectX::XMUINT2(0, 0);
 };
 
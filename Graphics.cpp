@@ -121,6 +121,10 @@ HRESULT Graphics::Initialize(unsigned int windowWidth, unsigned int windowHeight
 		Context.GetAddressOf());	// Pointer to our Device Context pointer
 	if (FAILED(hr)) return hr;
 
+	// Everything else sets state through the cache
+	States = std::make_shared<StateCache>(std::make_shared<D3D11StateSink>(Context));
+	Pipelines = std::make_shared<PipelineCache>(Device);
+
 	// We're set up
 	apiInitialized = true;
 
@@ -151,6 +155,8 @@ HRESULT Graphics::Initialize(unsigned int windowWidth, unsigned int windowHeight
 // --------------------------------------------------------
 void Graphics::ShutDown()
 {
+	States.reset();
+	Pipelines.reset();
 }
 
 
@@ -221,7 +227,7 @@ void Graphics::ResizeBuffers(unsigned int width, unsigned int height)
 
 	// Bind the views to the pipeline, so rendering properly 
 	// uses their underlying textures
-	Context->OMSetRenderTargets(
+	States->SetRenderTargets(
 		1,
 		BackBufferRTV.GetAddressOf(), // This requires a pointer to a pointer (an array of pointers), so we get the address of the pointer
 		DepthBufferDSV.Get());
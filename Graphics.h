@@ -4,6 +4,10 @@
 #include <d3d11.h>
 #include <string>
 #include <wrl/client.h>
+#include <memory>
+
+#include "StateCache.h"
+#include "PipelineState.h"
 
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
@@ -17,6 +21,14 @@ namespace Graphics
 	inline Microsoft::WRL::ComPtr<ID3D11DeviceContext> Context;
 	inline Microsoft::WRL::ComPtr<IDXGISwapChain> SwapChain;
 
+	// Filters redundant state calls - set state through
+	// this rather than the context whenever possible
+	inline std::shared_ptr<StateCache> States;
+
+	// One of each rasterizer, depth, blend and sampler state
+	// (and pipeline) - create them through this
+	inline std::shared_ptr<PipelineCache> Pipelines;
+
 	// Rendering buffers
 	inline Microsoft::WRL::ComPtr<ID3D11RenderTargetView> BackBufferRTV;
 	inline Microsoft::WRL::ComPtr<ID3D11DepthStencilView> DepthBufferDSV;
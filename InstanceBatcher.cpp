@@ -0,0 +1,143 @@
+#include "InstanceBatcher.h"
+#include "Graphics.h"
+#include "FrameStats.h"
+#include <algorithm>
+
+InstanceBatcher::InstanceBatcher(unsigned int initialCapacity)
+	: capacity(0)
+{
+	EnsureCapacity(initialCapacity);
+}
+
+// --------------------------------------------------------
+// Makes sure the instance buffer can hold at least the
+// given number of instances, growing it by doubling
+// --------------------------------------------------------
+void InstanceBatcher::EnsureCapacity(unsigned int instanceCount)
+{
+	if (instanceBuffer && instanceCount <= capacity)
+		return;
+
+	unsigned int newCapacity = capacity > 0 ? capacity : 1;
+	while (newCapacity < instanceCount)
+		newCapacity *= 2;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = sizeof(InstanceData) * newCapacity;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	instanceBuffer.Reset();
+	Graphics::Device->CreateBuffer(&desc, 0, instanceBuffer.GetAddressOf());
+	capacity = newCapacity;
+}
+
+void InstanceBatcher::Build(const std::vector<std::shared_ptr<Game_Entity>>& entities)
+{
+	sorted.clear();
+	for (auto& e : entities)
+		sorted.push_back({ e.get(), true });
+	BuildSorted();
+}
+
+void InstanceBatcher::Build(const std::vector<std::shared_ptr<Game_Entity>>& entities, const std::vector<unsigned int>& visibleItems)
+{
+	sorted.clear();
+	size_t next = 0;
+	for (unsigned int i = 0; i < (unsigned int)entities.size(); i++)
+	{
+		bool visible = next < visibleItems.size() && visibleItems[next] == i;
+		if (visible)
+			next++;
+		sorted.push_back({ entities[i].get(), visible });
+	}
+	BuildSorted();
+}
+
+// --------------------------------------------------------
+// Sorts the entities by mesh, then visible ones first, then
+// material, packs their matrices in that order and uploads
+// them in one Map()
+//
+// Since the sort is by mesh first, all instances of a mesh
+// are contiguous, so neighbouring main pass batches with the
+// same mesh are merged into one shadow pass batch - which
+// also picks up the mesh's hidden instances after them
+// --------------------------------------------------------
+void InstanceBatcher::BuildSorted()
+{
+	instances.clear();
+	batches.clear();
+	shadowBatches.clear();
+
+	std::sort(sorted.begin(), sorted.end(), [](const SortItem& a, const SortItem& b)
+		{
+			Mesh* meshA = a.Entity->GetMesh().get();
+			Mesh* meshB = b.Entity->GetMesh().get();
+			if (meshA != meshB)
+				return meshA < meshB;
+			if (a.Visible != b.Visible)
+				return a.Visible;
+			return a.Entity->GetMaterial().get() < b.Entity->GetMaterial().get();
+		});
+
+	for (const SortItem& item : sorted)
+	{
+		Game_Entity* e = item.Entity;
+		std::shared_ptr<Transform> transform = e->GetTransform();
+		InstanceData data;
+		data.world = transform->GetWorldMatrix();
+		data.worldInvTrans = transform->GetWorldInverseTransposeMatrix();
+		data.lightRange = e->GetLightRange();
+
+		Mesh* mesh = e->GetMesh().get();
+		Material* material = e->GetMaterial().get();
+		unsigned int index = (unsigned int)instances.size();
+		instances.push_back(data);
+
+		// Same mesh & material as the last batch?  Just extend it
+		if (item.Visible)
+		{
+			if (!batches.empty() && batches.back().mesh == mesh && batches.back().material == material)
+				batches.back().instanceCount++;
+			else
+				batches.push_back({ mesh, material, index, 1 });
+		}
+
+		if (!shadowBatches.empty() && shadowBatches.back().mesh == mesh)
+			shadowBatches.back().instanceCount++;
+		else
+			shadowBatches.push_back({ mesh, nullptr, index, 1 });
+	}
+
+	if (instances.empty())
+		return;
+
+	// Upload everything at once
+	EnsureCapacity((unsigned int)instances.size());
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (SUCCEEDED(Graphics::Context->Map(instanceBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		memcpy(mapped.pData, instances.data(), sizeof(InstanceData) * instances.size());
+		Graphics::Context->Unmap(instanceBuffer.Get(), 0);
+		FrameStats::BufferUploads++;
+		FrameStats::BufferBytesUploaded += (unsigned int)(sizeof(InstanceData) * instances.size());
+	}
+}
+
+// --------------------------------------------------------
+// Issues the instanced draw for a single batch - shaders
+// and materials must already be set
+// --------------------------------------------------------
+void InstanceBatcher::DrawBatch(ID3D11DeviceContext* context, const InstanceBatch& batch)
+{
+	batch.mesh->DrawInstanced(
+		context,
+		instanceBuffer.Get(),
+		sizeof(InstanceData),
+		batch.instanceCount,
+		batch.startInstance);
+}
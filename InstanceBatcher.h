@@ -0,0 +1,71 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <memory>
+#include <vector>
+#include "BufferStructs.h"
+#include "Game_Entity.h"
+
+// --------------------------------------------------------
+// A run of instances in the instance buffer that share
+// the same mesh (and material, for the main pass)
+// --------------------------------------------------------
+struct InstanceBatch
+{
+	Mesh* mesh;
+	Material* material;
+	unsigned int startInstance;
+	unsigned int instanceCount;
+};
+
+// --------------------------------------------------------
+// Groups entities by (Mesh, Material) and packs their world
+// matrices into one dynamic per-instance vertex buffer, so
+// each group can go out as a single DrawIndexedInstanced()
+//
+// When culling, every entity still casts shadows, so one
+// buffer holds them all - the main pass batches just cover
+// the visible ones
+// --------------------------------------------------------
+class InstanceBatcher
+{
+public:
+	InstanceBatcher(unsigned int initialCapacity = 1024);
+
+	// Every entity in both the main and shadow pass batches
+	void Build(const std::vector<std::shared_ptr<Game_Entity>>& entities);
+
+	// Every entity in the shadow pass batches, but only the
+	// visible ones (sorted indices into entities) in the main
+	// pass batches
+	void Build(const std::vector<std::shared_ptr<Game_Entity>>& entities, const std::vector<unsigned int>& visibleItems);
+
+	// Batches for the main pass, split by mesh and material
+	const std::vector<InstanceBatch>& GetBatches() const { return batches; }
+
+	// Batches for the shadow pass, which only care about the mesh
+	const std::vector<InstanceBatch>& GetShadowBatches() const { return shadowBatches; }
+
+	void DrawBatch(ID3D11DeviceContext* context, const InstanceBatch& batch);
+
+	unsigned int GetInstanceCount() const { return (unsigned int)instances.size(); }
+
+private:
+	struct SortItem
+	{
+		Game_Entity* Entity;
+		bool Visible;
+	};
+
+	void BuildSorted();
+	void EnsureCapacity(unsigned int instanceCount);
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> instanceBuffer;
+	unsigned int capacity;
+
+	// Reused every frame to avoid per-frame allocations
+	std::vector<SortItem> sorted;
+	std::vector<InstanceData> instances;
+	std::vector<InstanceBatch> batches;
+	std::vector<InstanceBatch> shadowBatches;
+};
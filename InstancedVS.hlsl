@@ -0,0 +1,35 @@
+#include "ShaderStructs.hlsli"
+
+cbuffer PerFrame : register(b0)
+{
+    matrix view;
+    matrix projection;
+    
+    matrix shadowView;
+    matrix shadowProjection;
+};
+
+// --------------------------------------------------------
+// Instanced version of VertexShader.hlsl
+// 
+// - World matrices come from the per-instance vertex buffer
+//   instead of the constant buffer
+// - Per-instance matrices are read row by row, so they are
+//   multiplied on the right (row vector) unlike the cbuffer ones
+// --------------------------------------------------------
+VertexToPixel main(VertexShaderInput_Instanced input)
+{
+    VertexToPixel output;
+    
+    float4 worldPos = mul(float4(input.localPosition, 1.0f), input.world);
+    output.screenPosition = mul(projection, mul(view, worldPos));
+
+    output.uv = input.uv;
+    output.normal = normalize(mul(input.normal, (float3x3) input.worldInvTrans));
+    output.tangent = normalize(mul(input.tangent, (float3x3) input.world));
+    output.worldPos = worldPos.xyz;
+	
+    output.shadowPos = mul(shadowProjection, mul(shadowView, worldPos));
+    output.lightRange = input.lightRange;
+    return output;
+}
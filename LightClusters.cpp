@@ -0,0 +1,351 @@
+#include "LightClusters.h"
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// How far (in tiles or slices) the ranges of clusters a
+	// light could reach are widened on each side - far more
+	// than the rounding error in finding them
+	const float IndexPadding = 1.0f / 64.0f;
+
+	// Rounds down to an index in [0, count), NaN included
+	unsigned int ClampIndex(float v, unsigned int count)
+	{
+		if (!(v >= 0.0f))
+			return 0;
+		if (v >= (float)count)
+			return count - 1;
+		return (unsigned int)v;
+	}
+}
+
+LightClusters::LightClusters(unsigned int tilesX, unsigned int tilesY, unsigned int slices, std::shared_ptr<WorkerPool> pool)
+	: tilesX(0), tilesY(0), slices(0), pool(pool)
+{
+	if (!this->pool)
+	{
+		unsigned int threads = std::thread::hardware_concurrency();
+		this->pool = std::make_shared<WorkerPool>(threads < 8 ? threads : 8);
+	}
+	threadCount = this->pool->GetThreadCount();
+
+	Resize(tilesX, tilesY, slices);
+}
+
+// --------------------------------------------------------
+// Changes the grid - every dimension is at least 1
+// --------------------------------------------------------
+void LightClusters::Resize(unsigned int tilesX, unsigned int tilesY, unsigned int slices)
+{
+	this->tilesX = tilesX < 1 ? 1 : tilesX;
+	this->tilesY = tilesY < 1 ? 1 : tilesY;
+	this->slices = slices < 1 ? 1 : slices;
+
+	sliceDepths.resize(this->slices + 1);
+	tileSlopesX.resize(this->tilesX + 1);
+	tileSlopesY.resize(this->tilesY + 1);
+	ranges.assign(GetClusterCount(), { 0, 0 });
+	lightIndices.clear();
+}
+
+unsigned int LightClusters::GetMaxLightsPerCluster() const
+{
+	unsigned int most = 0;
+	for (auto& r : ranges)
+		if (r.Count > most)
+			most = r.Count;
+	return most;
+}
+
+// --------------------------------------------------------
+// Builds the grid for this frame's camera, and moves the
+// lights into view space along with the slices each one
+// could reach
+//
+// - Ranges of slices (and tiles, see TilesOf()) are a bit
+//   wider than they need to be, so rounding can't leave out
+//   a cluster that Reaches() would accept - that decides in
+//   the end
+// --------------------------------------------------------
+void LightClusters::SetupFrame(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	// Clip planes, from the projection's z row
+	nearZ = -projection._43 / projection._33;
+	farZ = projection._43 / (1.0f - projection._33);
+	projX = projection._11;
+	projY = projection._22;
+	offsetX = projection._31;
+	offsetY = projection._32;
+
+	// Slices are evenly spaced in log(depth)
+	float logRatio = logf(farZ / nearZ);
+	sliceScale = slices / logRatio;
+	sliceBias = -(slices * logf(nearZ)) / logRatio;
+	for (unsigned int i = 0; i < slices; i++)
+		sliceDepths[i] = nearZ * powf(farZ / nearZ, (float)i / slices);
+	sliceDepths[slices] = farZ;
+
+	for (unsigned int i = 0; i <= tilesX; i++)
+		tileSlopesX[i] = ((2.0f * i / tilesX - 1.0f) - offsetX) / projX;
+	for (unsigned int i = 0; i <= tilesY; i++)
+		tileSlopesY[i] = ((1.0f - 2.0f * i / tilesY) - offsetY) / projY;
+
+	viewLights.resize(lightCount);
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		const Light& light = lights[i];
+		ViewLight& v = viewLights[i];
+		const XMFLOAT3& p = light.Position;
+		const XMFLOAT3& d = light.Direction;
+
+		v.Type = light.Type;
+		v.Radius = light.Range;
+		v.Center = XMFLOAT3(
+			p.x * view._11 + p.y * view._21 + p.z * view._31 + view._41,
+			p.x * view._12 + p.y * view._22 + p.z * view._32 + view._42,
+			p.x * view._13 + p.y * view._23 + p.z * view._33 + view._43);
+		v.Direction = XMFLOAT3(
+			d.x * view._11 + d.y * view._21 + d.z * view._31,
+			d.x * view._12 + d.y * view._22 + d.z * view._32,
+			d.x * view._13 + d.y * view._23 + d.z * view._33);
+
+		// Directional lights reach everything
+		if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		{
+			v.MinSlice = 0;
+			v.MaxSlice = slices - 1;
+			continue;
+		}
+
+		// Nothing at all, for a light that's entirely in front
+		// of or behind the grid (or has no range)
+		float r = v.Radius;
+		float cz = v.Center.z;
+		if (!(r > 0.0f) || cz + r < nearZ || cz - r > farZ)
+		{
+			v.MinSlice = 1;
+			v.MaxSlice = 0;
+			continue;
+		}
+
+		float minSlice = logf(cz - r > nearZ ? cz - r : nearZ) * sliceScale + sliceBias;
+		float maxSlice = logf(cz + r < farZ ? cz + r : farZ) * sliceScale + sliceBias;
+		v.MinSlice = ClampIndex(minSlice - IndexPadding, slices);
+		v.MaxSlice = ClampIndex(maxSlice + IndexPadding, slices);
+	}
+}
+
+// --------------------------------------------------------
+// The tiles of a slice whose cluster boxes overlap the
+// light's box along x and y
+//
+// - Cluster boxes are wider than their part of the frustum:
+//   a tile's box reaches its edge slopes at one of the
+//   slice's depths, so the light's box is seen from both
+//   of them (as slopes, x / z and y / z) to match
+// --------------------------------------------------------
+LightClusters::TileRect LightClusters::TilesOf(const ViewLight& light, unsigned int slice) const
+{
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		return { 0, tilesX - 1, 0, tilesY - 1 };
+
+	float r = light.Radius;
+	float cx = light.Center.x, cy = light.Center.y;
+	float z0 = sliceDepths[slice];
+	float z1 = sliceDepths[slice + 1];
+	float minSlopeX = fminf((cx - r) / z0, (cx - r) / z1);
+	float maxSlopeX = fmaxf((cx + r) / z0, (cx + r) / z1);
+	float minSlopeY = fminf((cy - r) / z0, (cy - r) / z1);
+	float maxSlopeY = fmaxf((cy + r) / z0, (cy + r) / z1);
+
+	float minX = ((minSlopeX * projX + offsetX) * 0.5f + 0.5f) * tilesX;
+	float maxX = ((maxSlopeX * projX + offsetX) * 0.5f + 0.5f) * tilesX;
+	float minY = (0.5f - (maxSlopeY * projY + offsetY) * 0.5f) * tilesY;
+	float maxY = (0.5f - (minSlopeY * projY + offsetY) * 0.5f) * tilesY;
+
+	return {
+		ClampIndex(minX - IndexPadding, tilesX),
+		ClampIndex(maxX + IndexPadding, tilesX),
+		ClampIndex(minY - IndexPadding, tilesY),
+		ClampIndex(maxY + IndexPadding, tilesY) };
+}
+
+// --------------------------------------------------------
+// A cluster's view space box - the frustum's corners at
+// the slice's near and far depths
+// --------------------------------------------------------
+AABB LightClusters::ClusterBounds(unsigned int x, unsigned int y, unsigned int slice) const
+{
+	float z0 = sliceDepths[slice];
+	float z1 = sliceDepths[slice + 1];
+	float left = tileSlopesX[x];
+	float right = tileSlopesX[x + 1];
+	float top = tileSlopesY[y];
+	float bottom = tileSlopesY[y + 1];
+
+	return {
+		{ fminf(left * z0, left * z1), fminf(bottom * z0, bottom * z1), z0 },
+		{ fmaxf(right * z0, right * z1), fmaxf(top * z0, top * z1), z1 } };
+}
+
+// --------------------------------------------------------
+// Whether a light can light anything in a cluster
+//
+// - Point lights fade to nothing at their range
+// - Spot lights too, and are also zero behind the plane
+//   they face (their falloff is a power of the cosine, so
+//   it only truly reaches zero at 90 degrees)
+// --------------------------------------------------------
+bool LightClusters::Reaches(const ViewLight& light, const AABB& cluster) const
+{
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		return true;
+	if (light.MinSlice > light.MaxSlice)
+		return false;
+
+	if (!Bounds::OverlapsSphere(cluster, light.Center, light.Radius))
+		return false;
+
+	if (light.Type == LIGHT_TYPE_SPOT)
+	{
+		// Corner furthest along the light's direction
+		const XMFLOAT3& d = light.Direction;
+		float ahead =
+			(d.x >= 0 ? cluster.Max.x : cluster.Min.x) * d.x - light.Center.x * d.x +
+			(d.y >= 0 ? cluster.Max.y : cluster.Min.y) * d.y - light.Center.y * d.y +
+			(d.z >= 0 ? cluster.Max.z : cluster.Min.z) * d.z - light.Center.z * d.z;
+		if (ahead < 0)
+			return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Splits the slices among the pool's threads, each of which
+// makes the lists for its own slices, then joins those up
+// in order
+// --------------------------------------------------------
+void LightClusters::Build(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	SetupFrame(lights, lightCount, view, projection);
+
+	unsigned int workers = threadCount < slices ? threadCount : slices;
+	unsigned int perWorker = (slices + workers - 1) / workers;
+	if (work.size() < workers)
+		work.resize(workers);
+
+	pool->Run(workers, [&](size_t i)
+		{
+			unsigned int start = (unsigned int)i * perWorker;
+			unsigned int end = start + perWorker < slices ? start + perWorker : slices;
+			if (start < end)
+				BuildSlices(start, end, work[i]);
+		});
+
+	// Each thread's offsets start from zero
+	size_t total = 0;
+	for (unsigned int i = 0; i < workers && i * perWorker < slices; i++)
+		total += work[i].Indices.size();
+	lightIndices.resize(total);
+
+	uint32_t offset = 0;
+	unsigned int clustersPerSlice = tilesX * tilesY;
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		unsigned int start = i * perWorker;
+		unsigned int end = start + perWorker < slices ? start + perWorker : slices;
+		if (start >= end)
+			break;
+
+		for (unsigned int c = start * clustersPerSlice; c < end * clustersPerSlice; c++)
+			ranges[c].Offset += offset;
+
+		const std::vector<uint32_t>& indices = work[i].Indices;
+		if (!indices.empty())
+			memcpy(&lightIndices[offset], indices.data(), indices.size() * sizeof(uint32_t));
+		offset += (uint32_t)indices.size();
+	}
+}
+
+// --------------------------------------------------------
+// Makes the lists for a range of slices: the lights that
+// might reach each slice are tested against the clusters
+// in their tiles of it, then the hits are sorted by cluster
+// (stable, so each list stays in light order)
+// --------------------------------------------------------
+void LightClusters::BuildSlices(unsigned int firstSlice, unsigned int endSlice, SliceWork& w)
+{
+	unsigned int clustersPerSlice = tilesX * tilesY;
+	w.Indices.clear();
+
+	for (unsigned int s = firstSlice; s < endSlice; s++)
+	{
+		w.Candidates.clear();
+		for (unsigned int i = 0; i < (unsigned int)viewLights.size(); i++)
+			if (viewLights[i].MinSlice <= s && s <= viewLights[i].MaxSlice)
+				w.Candidates.push_back(i);
+
+		w.Hits.clear();
+		w.Counts.assign(clustersPerSlice, 0);
+		for (uint32_t l : w.Candidates)
+		{
+			const ViewLight& light = viewLights[l];
+			TileRect tiles = TilesOf(light, s);
+			for (unsigned int y = tiles.MinY; y <= tiles.MaxY; y++)
+			{
+				for (unsigned int x = tiles.MinX; x <= tiles.MaxX; x++)
+				{
+					if (!Reaches(light, ClusterBounds(x, y, s)))
+						continue;
+
+					uint32_t cluster = y * tilesX + x;
+					w.Hits.push_back({ cluster, l });
+					w.Counts[cluster]++;
+				}
+			}
+		}
+
+		// Counts become where each cluster's list goes
+		uint32_t offset = (uint32_t)w.Indices.size();
+		Range* sliceRanges = &ranges[s * clustersPerSlice];
+		for (unsigned int c = 0; c < clustersPerSlice; c++)
+		{
+			sliceRanges[c] = { offset, w.Counts[c] };
+			w.Counts[c] = offset;
+			offset += sliceRanges[c].Count;
+		}
+
+		w.Indices.resize(offset);
+		for (auto& hit : w.Hits)
+			w.Indices[w.Counts[hit.Cluster]++] = hit.Light;
+	}
+}
+
+void LightClusters::BuildReference(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view, const XMFLOAT4X4& projection)
+{
+	SetupFrame(lights, lightCount, view, projection);
+	lightIndices.clear();
+
+	for (unsigned int s = 0; s < slices; s++)
+	{
+		for (unsigned int y = 0; y < tilesY; y++)
+		{
+			for (unsigned int x = 0; x < tilesX; x++)
+			{
+				AABB cluster = ClusterBounds(x, y, s);
+				uint32_t offset = (uint32_t)lightIndices.size();
+				for (unsigned int l = 0; l < lightCount; l++)
+					if (Reaches(viewLights[l], cluster))
+						lightIndices.push_back(l);
+
+				ranges[x + (y + s * tilesY) * tilesX] = { offset, (uint32_t)lightIndices.size() - offset };
+			}
+		}
+	}
+}
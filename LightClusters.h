@@ -0,0 +1,124 @@
+#pragma once
+#include "Bounds.h"
+#include "Light.h"
+#include "WorkerPool.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------
+// Clustered light culling on the CPU
+//
+// - The view frustum is cut into a grid of clusters: tiles
+//   across the screen, and slices in depth that get thicker
+//   further away (so clusters stay roughly cube shaped)
+// - Each cluster gets the list of lights that can reach it,
+//   so a pixel only loops over its own cluster's lights
+// - Depth slices are split across threads.  The lists are
+//   the same whatever the thread count, and the same as
+//   BuildReference() makes by testing every light against
+//   every cluster
+//
+// Matrices are row vector (v * M), and the projection is a
+// D3D style perspective one (like XMMatrixPerspectiveFovLH)
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class LightClusters
+{
+public:
+	// Where a cluster's lights are in GetLightIndices()
+	struct Range
+	{
+		uint32_t Offset;
+		uint32_t Count;
+	};
+
+	// Without a pool, makes its own of up to 8 threads
+	LightClusters(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int slices = 24, std::shared_ptr<WorkerPool> pool = 0);
+
+	void Resize(unsigned int tilesX, unsigned int tilesY, unsigned int slices);
+
+	void Build(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+
+	// Single threaded, and tests every light against every
+	// cluster - for checking Build() against
+	void BuildReference(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+
+	// Cluster (x, y, slice) is at x + (y + slice * tilesY) * tilesX,
+	// with tile row 0 at the top of the screen
+	const std::vector<Range>& GetRanges() const { return ranges; }
+	const std::vector<uint32_t>& GetLightIndices() const { return lightIndices; }
+
+	unsigned int GetTilesX() const { return tilesX; }
+	unsigned int GetTilesY() const { return tilesY; }
+	unsigned int GetSlices() const { return slices; }
+	unsigned int GetClusterCount() const { return tilesX * tilesY * slices; }
+	unsigned int GetMaxLightsPerCluster() const;
+
+	// A view space depth's slice is log(depth) * scale + bias,
+	// rounded down - what the pixel shader uses to find it
+	float GetSliceScale() const { return sliceScale; }
+	float GetSliceBias() const { return sliceBias; }
+
+private:
+	// A light as seen from this frame's camera, and the slices
+	// it could possibly reach (none, if MinSlice > MaxSlice)
+	struct ViewLight
+	{
+		DirectX::XMFLOAT3 Center;
+		float Radius;
+		DirectX::XMFLOAT3 Direction;
+		int Type;
+		unsigned int MinSlice, MaxSlice;
+	};
+
+	// Tiles a light could possibly reach in one slice
+	struct TileRect
+	{
+		unsigned int MinX, MaxX, MinY, MaxY;
+	};
+
+	// What each thread collects for its slices - kept from
+	// frame to frame, so the vectors don't need to grow again
+	struct SliceWork
+	{
+		struct Hit { uint32_t Cluster; uint32_t Light; };
+
+		std::vector<uint32_t> Candidates;	// Lights that may reach the slice
+		std::vector<Hit> Hits;				// ...and the clusters they do reach
+		std::vector<uint32_t> Counts;		// Per cluster in the slice
+		std::vector<uint32_t> Indices;		// Every slice's lists, back to back
+	};
+
+	void SetupFrame(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection);
+	void BuildSlices(unsigned int firstSlice, unsigned int endSlice, SliceWork& work);
+
+	TileRect TilesOf(const ViewLight& light, unsigned int slice) const;
+	AABB ClusterBounds(unsigned int x, unsigned int y, unsigned int slice) const;
+	bool Reaches(const ViewLight& light, const AABB& cluster) const;
+
+	unsigned int tilesX;
+	unsigned int tilesY;
+	unsigned int slices;
+	std::shared_ptr<WorkerPool> pool;
+	unsigned int threadCount;
+
+	// This frame's camera
+	float nearZ = 0.1f;
+	float farZ = 1000.0f;
+	float sliceScale = 0.0f;
+	float sliceBias = 0.0f;
+	float projX = 1.0f, projY = 1.0f;			// _11 and _22
+	float offsetX = 0.0f, offsetY = 0.0f;		// _31 and _32
+	std::vector<float> sliceDepths;				// slices + 1 edges
+	std::vector<float> tileSlopesX;				// View space x / z at each tile edge
+	std::vector<float> tileSlopesY;				// ...and y / z, top edge first
+
+	std::vector<ViewLight> viewLights;
+	std::vector<SliceWork> work;
+
+	std::vector<Range> ranges;
+	std::vector<uint32_t> lightIndices;
+};
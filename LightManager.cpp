@@ -0,0 +1,84 @@
+#include "LightManager.h"
+
+LightHandle LightManager::Add(const Light& light)
+{
+	uint32_t slot;
+	if (!freeSlots.empty())
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		slot = (uint32_t)slots.size();
+		slots.push_back({ 0, 0 });
+	}
+
+	slots[slot].Index = (uint32_t)lights.size();
+	slots[slot].Generation++;
+	lights.push_back(light);
+	lightSlots.push_back(slot);
+
+	return { slot, slots[slot].Generation };
+}
+
+// --------------------------------------------------------
+// Removes a light by moving the last packed light into its
+// place - false if the handle was already stale
+// --------------------------------------------------------
+bool LightManager::Remove(LightHandle handle)
+{
+	if (!Contains(handle))
+		return false;
+
+	uint32_t index = slots[handle.Slot].Index;
+	uint32_t last = (uint32_t)lights.size() - 1;
+	if (index != last)
+	{
+		lights[index] = lights[last];
+		lightSlots[index] = lightSlots[last];
+		slots[lightSlots[index]].Index = index;
+	}
+	lights.pop_back();
+	lightSlots.pop_back();
+
+	slots[handle.Slot].Generation++;
+	freeSlots.push_back(handle.Slot);
+	return true;
+}
+
+void LightManager::Clear()
+{
+	for (uint32_t slot : lightSlots)
+	{
+		slots[slot].Generation++;
+		freeSlots.push_back(slot);
+	}
+	lights.clear();
+	lightSlots.clear();
+}
+
+Light* LightManager::Get(LightHandle handle)
+{
+	if (handle.Slot >= slots.size())
+		return 0;
+
+	const Slot& s = slots[handle.Slot];
+	if (s.Generation != handle.Generation || (s.Generation & 1) == 0)
+		return 0;
+	return &lights[s.Index];
+}
+
+const Light* LightManager::Get(LightHandle handle) const
+{
+	return const_cast<LightManager*>(this)->Get(handle);
+}
+
+LightHandle LightManager::GetHandle(unsigned int index) const
+{
+	if (index >= lightSlots.size())
+		return {};
+
+	uint32_t slot = lightSlots[index];
+	return { slot, slots[slot].Generation };
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "Light.h"
+#include <cstdint>
+#include <vector>
+
+// --------------------------------------------------------
+// Refers to a light in a LightManager - stays valid for as
+// long as the light exists, however many other lights are
+// added or removed.  Default handles are never valid.
+// --------------------------------------------------------
+struct LightHandle
+{
+	uint32_t Slot = 0;
+	uint32_t Generation = 0;	// Zero for a handle to nothing
+
+	bool IsValid() const { return Generation > 0; }
+};
+
+// --------------------------------------------------------
+// The scene's lights, with no limit on how many
+//
+// - Active lights are packed densely, in one array that can
+//   be uploaded as is - removing a light moves the last one
+//   into its place, so packed order isn't stable (handles
+//   are, through a table of slots)
+// - A removed light's slot is reused, with its generation
+//   bumped, so old handles to it stop working
+// --------------------------------------------------------
+class LightManager
+{
+public:
+	LightHandle Add(const Light& light);
+	bool Remove(LightHandle handle);
+	void Clear();
+
+	// Zero if the light has been removed
+	Light* Get(LightHandle handle);
+	const Light* Get(LightHandle handle) const;
+	bool Contains(LightHandle handle) const { return Get(handle) != 0; }
+
+	// Every active light, packed
+	Light* GetLights() { return lights.data(); }
+	const Light* GetLights() const { return lights.data(); }
+	unsigned int GetCount() const { return (unsigned int)lights.size(); }
+
+	// The handle of the light packed at the given index
+	LightHandle GetHandle(unsigned int index) const;
+
+private:
+	struct Slot
+	{
+		uint32_t Index;			// Where the light is packed
+		uint32_t Generation;	// Odd while in use
+	};
+
+	std::vector<Light> lights;
+	std::vector<uint32_t> lightSlots;	// Slot of each packed light
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+};
@@ -0,0 +1,172 @@
+#include "LightTiles.h"
+#include <cmath>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// How far (in tiles) each side of a light's rectangle is
+	// widened - far more than the rounding error in finding it
+	const float IndexPadding = 1.0f / 64.0f;
+
+	// Rounds down to an index in [0, count), NaN included
+	unsigned int ClampIndex(float v, unsigned int count)
+	{
+		if (!(v >= 0.0f))
+			return 0;
+		if (v >= (float)count)
+			return count - 1;
+		return (unsigned int)v;
+	}
+
+	// --------------------------------------------------------
+	// The range of slopes (a / z) a circle covers, seen from
+	// the origin - the slopes of its two tangents through it
+	//
+	// - Along x (or y) this is exact for a sphere too, as its
+	//   shadow on the xz (or yz) plane is a circle of the same
+	//   radius
+	// - A side stays open if its tangent doesn't point in front
+	//   of the eye, as does everything if the eye is inside
+	//   the circle or the circle's center is behind it
+	// --------------------------------------------------------
+	void SlopeRange(float a, float z, float r, float& minSlope, float& maxSlope)
+	{
+		minSlope = -INFINITY;
+		maxSlope = INFINITY;
+
+		float t2 = a * a + z * z - r * r;
+		if (!(z > 0.0f) || !(t2 > 0.0f))
+			return;
+
+		// The tangents are the direction to the center turned
+		// either way by asin(r / distance)
+		float t = sqrtf(t2);
+		float maxDenominator = z * t - a * r;
+		float minDenominator = z * t + a * r;
+		if (maxDenominator > 0.0f)
+			maxSlope = (a * t + z * r) / maxDenominator;
+		if (minDenominator > 0.0f)
+			minSlope = (a * t - z * r) / minDenominator;
+	}
+}
+
+LightTiles::LightTiles(unsigned int tileSize)
+	: tileSize(tileSize < 1 ? 1 : tileSize)
+{
+}
+
+unsigned int LightTiles::GetMaxLightsPerTile() const
+{
+	unsigned int most = 0;
+	for (auto& r : ranges)
+		if (r.Count > most)
+			most = r.Count;
+	return most;
+}
+
+// --------------------------------------------------------
+// The rectangle of tiles a light's sphere could cover
+//
+// - Directional lights cover everything
+// - Lights entirely in front of the near plane or past the
+//   far plane cover nothing, as do those with no range
+// --------------------------------------------------------
+LightTiles::TileRect LightTiles::RectOf(const Light& light, const XMFLOAT4X4& view, const XMFLOAT4X4& projection, float nearZ, float farZ) const
+{
+	const TileRect none = { 1, 0, 1, 0 };
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		return { 0, tilesX - 1, 0, tilesY - 1 };
+
+	float r = light.Range;
+	if (!(r > 0.0f))
+		return none;
+
+	const XMFLOAT3& p = light.Position;
+	float cx = p.x * view._11 + p.y * view._21 + p.z * view._31 + view._41;
+	float cy = p.x * view._12 + p.y * view._22 + p.z * view._32 + view._42;
+	float cz = p.x * view._13 + p.y * view._23 + p.z * view._33 + view._43;
+	if (cz + r < nearZ || cz - r > farZ)
+		return none;
+
+	float minSlopeX, maxSlopeX, minSlopeY, maxSlopeY;
+	SlopeRange(cx, cz, r, minSlopeX, maxSlopeX);
+	SlopeRange(cy, cz, r, minSlopeY, maxSlopeY);
+
+	// Slopes to pixels, with y going down the screen
+	float minX = ((minSlopeX * projection._11 + projection._31) * 0.5f + 0.5f) * width;
+	float maxX = ((maxSlopeX * projection._11 + projection._31) * 0.5f + 0.5f) * width;
+	float minY = (0.5f - (maxSlopeY * projection._22 + projection._32) * 0.5f) * height;
+	float maxY = (0.5f - (minSlopeY * projection._22 + projection._32) * 0.5f) * height;
+	if (maxX < 0.0f || minX > (float)width || maxY < 0.0f || minY > (float)height)
+		return none;
+
+	float scale = 1.0f / tileSize;
+	return {
+		ClampIndex(minX * scale - IndexPadding, tilesX),
+		ClampIndex(maxX * scale + IndexPadding, tilesX),
+		ClampIndex(minY * scale - IndexPadding, tilesY),
+		ClampIndex(maxY * scale + IndexPadding, tilesY) };
+}
+
+// --------------------------------------------------------
+// Finds every light's rectangle, counts the lights in each
+// tile, then places each light in its tiles' lists
+// --------------------------------------------------------
+void LightTiles::Build(const Light* lights, unsigned int lightCount, const XMFLOAT4X4& view, const XMFLOAT4X4& projection, unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+	unsigned int tileCount = tilesX * tilesY;
+
+	ranges.assign(tileCount, { 0, 0 });
+	lightIndices.clear();
+	lightRects.resize(lightCount);
+	if (tileCount == 0)
+	{
+		lightRects.assign(lightCount, { 1, 0, 1, 0 });
+		return;
+	}
+
+	// Clip planes, from the projection's z row
+	float nearZ = -projection._43 / projection._33;
+	float farZ = projection._43 / (1.0f - projection._33);
+
+	counts.assign(tileCount, 0);
+	for (unsigned int l = 0; l < lightCount; l++)
+	{
+		TileRect rect = RectOf(lights[l], view, projection, nearZ, farZ);
+		lightRects[l] = rect;
+		if (rect.MinX > rect.MaxX || rect.MinY > rect.MaxY)
+			continue;
+
+		for (unsigned int y = rect.MinY; y <= rect.MaxY; y++)
+			for (unsigned int x = rect.MinX; x <= rect.MaxX; x++)
+				counts[x + y * tilesX]++;
+	}
+
+	// Counts become where each tile's list goes
+	uint32_t offset = 0;
+	for (unsigned int t = 0; t < tileCount; t++)
+	{
+		ranges[t] = { offset, counts[t] };
+		counts[t] = offset;
+		offset += ranges[t].Count;
+	}
+
+	lightIndices.resize(offset);
+	for (unsigned int l = 0; l < lightCount; l++)
+	{
+		const TileRect& rect = lightRects[l];
+		if (rect.MinX > rect.MaxX || rect.MinY > rect.MaxY)
+			continue;
+
+		for (unsigned int y = rect.MinY; y <= rect.MaxY; y++)
+			for (unsigned int x = rect.MinX; x <= rect.MaxX; x++)
+				lightIndices[counts[x + y * tilesX]++] = l;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "Light.h"
+#include <cstdint>
+#include <vector>
+
+// --------------------------------------------------------
+// Screen space light tiles, for deferred shading
+//
+// - The screen is cut into square tiles of pixels, and each
+//   tile gets the list of lights whose spheres of influence
+//   can cover any of its pixels
+// - Each light is projected to a rectangle of tiles (the
+//   tightest rectangle around its sphere's projection, found
+//   one axis at a time from the tangents through the eye),
+//   then the lists are made with a counting sort, so each
+//   stays in light order
+// - Unlike LightClusters there's no depth - a light covers
+//   its tiles whatever depth their pixels are at
+//
+// Matrices are row vector (v * M), and the projection is a
+// D3D style perspective one (like XMMatrixPerspectiveFovLH)
+//
+// Has no graphics API dependencies, so it can be used and
+// checked outside of the renderer
+// --------------------------------------------------------
+class LightTiles
+{
+public:
+	// Where a tile's lights are in GetLightIndices()
+	struct Range
+	{
+		uint32_t Offset;
+		uint32_t Count;
+	};
+
+	// Tiles a light covers, inclusive - none if MinX > MaxX
+	struct TileRect
+	{
+		unsigned int MinX, MaxX, MinY, MaxY;
+	};
+
+	LightTiles(unsigned int tileSize = 16);
+
+	void Build(const Light* lights, unsigned int lightCount, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection, unsigned int width, unsigned int height);
+
+	// Tile (x, y) is at x + y * tilesX, with row 0 at the top
+	// of the screen - a pixel's tile is its position / size
+	const std::vector<Range>& GetRanges() const { return ranges; }
+	const std::vector<uint32_t>& GetLightIndices() const { return lightIndices; }
+
+	// The rectangle each light was given by the last Build()
+	const std::vector<TileRect>& GetLightRects() const { return lightRects; }
+
+	unsigned int GetTileSize() const { return tileSize; }
+	unsigned int GetTilesX() const { return tilesX; }
+	unsigned int GetTilesY() const { return tilesY; }
+	unsigned int GetTileCount() const { return tilesX * tilesY; }
+	unsigned int GetMaxLightsPerTile() const;
+
+private:
+	TileRect RectOf(const Light& light, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& projection, float nearZ, float farZ) const;
+
+	unsigned int tileSize;
+	unsigned int tilesX = 0;
+	unsigned int tilesY = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	std::vector<TileRect> lightRects;
+	std::vector<uint32_t> counts;		// Per tile, while sorting
+
+	std::vector<Range> ranges;
+	std::vector<uint32_t> lightIndices;
+};
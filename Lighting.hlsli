@@ -2,8 +2,6 @@
 #ifndef __GGP_LIGHTING__
 #define __GGP_LIGHTING__
 
-#define MAX_LIGHTS 128
-
 #define MAX_SPECULAR_EXPONENT 256.0f
 
 #define LIGHT_TYPE_DIRECTIONAL	0
@@ -73,6 +71,29 @@ float3 NormalMapping(Texture2D map, SamplerState samp, float2 uv, float3 normal,
     return normalize(mul(normalFromMap, TBN));
 }
 
+// Averages a taps x taps grid of shadow map comparisons
+// around uv - 1 where lit, 0 where in shadow
+float PCFSample(Texture2D shadowMap, SamplerComparisonState shadowSampler, float2 uv, float compareDepth, float2 texelSize, int taps)
+{
+    float shadow = 0.0f;
+    const int range = taps / 2;
+    
+    for (int y = -range; y <= range; y++)
+    {
+        for (int x = -range; x <= range; x++)
+        {
+            shadow += shadowMap.SampleCmpLevelZero(
+                shadowSampler,
+                uv + float2(x, y) * texelSize,
+                compareDepth).r;
+        }
+    }
+    
+    // Normalize by number of samples
+    float samples = (range * 2 + 1) * (range * 2 + 1);
+    return shadow / samples;
+}
+
 // Normal Distribution Function: GGX (Trowbridge-Reitz)
 //
 // a - Roughness
@@ -172,6 +193,35 @@ float3 MicrofacetBRDF(float3 n, float3 l, float3 v, float roughness, float3 f0,
     return specularResult * max(dot(n, l), 0);
 }
 
+// Diffuse light from the sky at a normal, from its spherical
+// harmonics (see SkyIrradiance.h) - already divided by pi,
+// so it only needs the surface color
+float3 SkyIrradiance(float4 sh[7], float3 normal)
+{
+    float4 linearTerms = float4(normal, 1.0f);
+    float4 quadraticTerms = normal.xyzz * normal.yzzx;
+    
+    float3 result;
+    result.r = dot(sh[0], linearTerms) + dot(sh[3], quadraticTerms);
+    result.g = dot(sh[1], linearTerms) + dot(sh[4], quadraticTerms);
+    result.b = dot(sh[2], linearTerms) + dot(sh[5], quadraticTerms);
+    result += sh[6].rgb * (normal.x * normal.x - normal.y * normal.y);
+    return max(result, 0.0f);
+}
+
+// Split sum image based specular (see SkyLighting.h): the
+// sky blurred for this roughness along the reflection, with
+// the BRDF's scale and bias for this view angle applied to f0
+float3 SplitSumSpecular(TextureCube specularMap, Texture2D brdfLookup, SamplerState clampSampler, float3 normal, float3 toCamera, float roughness, float3 f0, float mipCount)
+{
+    float NdotV = saturate(dot(normal, toCamera));
+    float3 reflected = reflect(-toCamera, normal);
+    
+    float3 prefiltered = specularMap.SampleLevel(clampSampler, reflected, roughness * (mipCount - 1)).rgb;
+    float2 brdf = brdfLookup.SampleLevel(clampSampler, float2(NdotV, roughness), 0).rg;
+    return prefiltered * (f0 * brdf.x + brdf.y);
+}
+
 float3 CalculateSpecular(float3 normal, float3 lightDir, float3 toCamera, float roughness, float3 diffuse)
 {
     float3 reflectDir = reflect(-lightDir, normal);
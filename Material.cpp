@@ -1,5 +1,9 @@
 #include "Material.h"
 #include "SimpleShader.h"
+#include "Graphics.h"
+#include "ShaderBuffers.h"
+#include "ConstantBufferRing.h"
+#include <cstring>
 
 
 Material::Material(
@@ -18,7 +22,10 @@ Material::Material(
 	uvOffset(uvOffset),
 	uvScale(uvScale)
 
-{}
+{
+	ResolveVertexHandles();
+	ResolvePixelHandles();
+}
 
 DirectX::XMFLOAT4 Material::GetColorTint() const { return colorTint; }
 std::shared_ptr<SimpleVertexShader> Material::GetVertexShader() { return vs; }
@@ -56,33 +63,282 @@ std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>
 std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11SamplerState>>& Material::GetSamplerMap(){ return samplers; }
 
 void Material::SetColorTint(DirectX::XMFLOAT4 newTint) { colorTint = newTint; }
-void Material::SetVertexShader(std::shared_ptr<SimpleVertexShader> newShader) { vs = newShader; }
-void Material::SetPixelShader(std::shared_ptr<SimplePixelShader> newShader) { ps = newShader; }
+void Material::SetVertexShader(std::shared_ptr<SimpleVertexShader> newShader) { vs = newShader; ResolveVertexHandles(); }
+void Material::SetPixelShader(std::shared_ptr<SimplePixelShader> newShader) { ps = newShader; ResolvePixelHandles(); }
 void Material::SetUVScale(DirectX::XMFLOAT2 scale) { uvScale = scale; }
 void Material::SetRoughness(float rough) { roughness = rough; }
 void Material::SetUVOffset(DirectX::XMFLOAT2 offset) { uvOffset = offset; }
 
-void Material::PrepareMaterial(std::shared_ptr<Transform> transform, std::shared_ptr<Camera> camera)
+void Material::PrepareMaterial(std::shared_ptr<Transform> transform, DirectX::XMUINT2 lightRange)
 {
 	vs->SetShader();
 	ps->SetShader();
 
-	vs->SetMatrix4x4("world", transform->GetWorldMatrix());
-	vs->SetMatrix4x4("worldInvTrans", transform->GetWorldInverseTransposeMatrix());
-	vs->SetMatrix4x4("view", camera->GetViewMatrix());
-	vs->SetMatrix4x4("projection", camera->GetProjectionMatrix());
+	PrepareVertexShader(*transform, lightRange);
+	PreparePixelShader();
+}
+
+// --------------------------------------------------------
+// Same as PrepareMaterial(), but uses a vertex shader that
+// reads world matrices from the per-instance buffer, so
+// there's nothing per-object to set here
+// --------------------------------------------------------
+void Material::PrepareMaterialInstanced(std::shared_ptr<SimpleVertexShader> instancedVS)
+{
+	instancedVS->SetShader();
+	ps->SetShader();
+
+	instancedVS->CopyAllBufferData();
+
+	PreparePixelShader();
+}
+
+// --------------------------------------------------------
+// The G-buffer pixel shader lays out its textures and
+// samplers like PixelShader.hlsl, so they go to the slots
+// already found in the material's own shader (which must
+// be PixelShader.hlsl, or one of its variants)
+// --------------------------------------------------------
+void Material::PrepareGBuffer(std::shared_ptr<Transform> transform, std::shared_ptr<SimplePixelShader> gbufferPS)
+{
+	vs->SetShader();
+	gbufferPS->SetShader();
+
+	PrepareVertexShader(*transform, DirectX::XMUINT2(0, 0));
+	PrepareGBufferPixelShader(gbufferPS.get());
+}
+
+void Material::PrepareGBufferInstanced(std::shared_ptr<SimpleVertexShader> instancedVS, std::shared_ptr<SimplePixelShader> gbufferPS)
+{
+	instancedVS->SetShader();
+	gbufferPS->SetShader();
+
+	instancedVS->CopyAllBufferData();
+
+	PrepareGBufferPixelShader(gbufferPS.get());
+}
+
+// --------------------------------------------------------
+// Recorded draws fill the vertex shader's PerObject buffer
+// from the struct, and bind the rest by location - which
+// all needs the struct layouts to match, and the ring
+// --------------------------------------------------------
+bool Material::CanRecord()
+{
+	return vs && ps &&
+		vsVars.PerObject.IsValid() &&
+		psVars.PerMaterial.IsValid() &&
+		ISimpleShader::UploadRing && ISimpleShader::UploadRing->IsValid();
+}
+
+// --------------------------------------------------------
+// Uploads everything but the per-object constants, and
+// notes where it all went, so RecordDraw() only has to
+// read from this material
+// - This material's constants get their own slice of the
+//   ring, as other materials share the pixel shader's copy
+// - False if something couldn't be uploaded
+// --------------------------------------------------------
+bool Material::PrepareRecording()
+{
+	recordedBuffers.clear();
+	if (!CanRecord())
+		return false;
+
+	PipelineDesc desc = PipelineDesc::Defaults();
+	desc.VertexShader = vs->GetDirectXShader().Get();
+	desc.PixelShader = ps->GetDirectXShader().Get();
+	desc.InputLayout = vs->GetInputLayout().Get();
+	recordedPipeline = Graphics::Pipelines->GetPipeline(desc);
+	if (!recordedPipeline)
+		return false;
+
+	vs->CopyAllBufferData();
+	ps->CopyAllBufferData();
+
+	auto capture = [&](ISimpleShader* shader, ShaderStage stage, const char* skip)
+		{
+			for (unsigned int i = 0; i < shader->GetBufferCount(); i++)
+			{
+				const SimpleConstantBuffer* cb = shader->GetBufferInfo(i);
+				if (cb->Type != D3D11_CT_CBUFFER || strcmp(cb->Name, skip) == 0)
+					continue;
+
+				if (cb->RingBuffer)
+					recordedBuffers.push_back({ stage, cb->BindIndex, cb->RingBuffer, cb->RingFirstConstant, cb->RingNumConstants });
+				else
+					recordedBuffers.push_back({ stage, cb->BindIndex, cb->ConstantBuffer.Get(), 0, 0 });
+			}
+		};
+	capture(vs.get(), StageVertex, VertexShaderPerObject::Layout.BufferName);
+	capture(ps.get(), StagePixel, PixelShaderPerMaterial::Layout.BufferName);
+	perObjectSlot = vs->GetBufferInfo(VertexShaderPerObject::Layout.BufferName)->BindIndex;
+
+	PixelShaderPerMaterial data = {};
+	data.colorTint = colorTint;
+	data.roughness = roughness;
+	data.uvScale = uvScale;
+	data.uvOffset = uvOffset;
+
+	RecordedBuffer perMaterial = { StagePixel, ps->GetBufferInfo(PixelShaderPerMaterial::Layout.BufferName)->BindIndex, ISimpleShader::UploadRing->GetBuffer() };
+	if (!ISimpleShader::UploadRing->Upload(&data, sizeof(data), &perMaterial.FirstConstant, &perMaterial.NumConstants))
+		return false;
+	recordedBuffers.push_back(perMaterial);
+	return true;
+}
+
+// --------------------------------------------------------
+// The recorded version of PrepareMaterial() - only reads
+// from the material, so it's safe on any thread
+// --------------------------------------------------------
+void Material::RecordDraw(CommandList& list, Transform& transform, DirectX::XMUINT2 lightRange, bool materialBound) const
+{
+	if (!materialBound)
+	{
+		list.SetPipeline(recordedPipeline);
+		for (auto& b : recordedBuffers)
+			list.SetConstantBuffer(b.Stage, b.Slot, b.Buffer, b.FirstConstant, b.NumConstants);
+		for (auto& r : srvRuns)
+			list.SetShaderResources(StagePixel, r.FirstSlot, r.Count, &srvTable[r.Offset]);
+		for (auto& r : samplerRuns)
+			list.SetSamplers(StagePixel, r.FirstSlot, r.Count, &samplerTable[r.Offset]);
+	}
+
+	VertexShaderPerObject data;
+	data.world = transform.GetWorldMatrix();
+	data.worldInvTrans = transform.GetWorldInverseTransposeMatrix();
+	data.lightRange = lightRange;
+	list.SetConstants(StageVertex, perObjectSlot, &data, sizeof(data));
+}
+
+void Material::PrepareVertexShader(Transform& transform, DirectX::XMUINT2 lightRange)
+{
+	if (vsVars.PerObject.IsValid())
+	{
+		VertexShaderPerObject data;
+		data.world = transform.GetWorldMatrix();
+		data.worldInvTrans = transform.GetWorldInverseTransposeMatrix();
+		data.lightRange = lightRange;
+		vs->SetData(vsVars.PerObject, &data, sizeof(data));
+	}
+	else
+	{
+		vs->SetMatrix4x4(vsVars.World, transform.GetWorldMatrix());
+		vs->SetMatrix4x4(vsVars.WorldInvTrans, transform.GetWorldInverseTransposeMatrix());
+		vs->SetData(vsVars.LightRange, &lightRange, sizeof(lightRange));
+	}
 	vs->CopyAllBufferData();
+}
 
-	ps->SetFloat4("colorTint", colorTint);
-	ps->SetFloat("roughness", roughness);
-	ps->SetFloat2("uvScale", uvScale);
-	ps->SetFloat2("uvOffset", uvOffset);
-	ps->SetFloat3("cameraPosition", camera->GetTransform().GetPosition());
+void Material::PreparePixelShader()
+{
+	if (psVars.PerMaterial.IsValid())
+	{
+		PixelShaderPerMaterial data = {};
+		data.colorTint = colorTint;
+		data.roughness = roughness;
+		data.uvScale = uvScale;
+		data.uvOffset = uvOffset;
+		ps->SetData(psVars.PerMaterial, &data, sizeof(data));
+	}
+	else
+	{
+		ps->SetFloat4(psVars.ColorTint, colorTint);
+		ps->SetFloat(psVars.Roughness, roughness);
+		ps->SetFloat2(psVars.UVScale, uvScale);
+		ps->SetFloat2(psVars.UVOffset, uvOffset);
+	}
 	ps->CopyAllBufferData();
 
-	for (auto& t : textureSRVs) { ps->SetShaderResourceView(t.first.c_str(), t.second); }
-	for (auto& s : samplers) { ps->SetSamplerState(s.first.c_str(), s.second); }
+	BindTextures();
+}
+
+void Material::PrepareGBufferPixelShader(SimplePixelShader* shader)
+{
+	if (shader != gbufferPS)
+	{
+		gbufferPS = shader;
+		gbufferPerMaterial = shader->GetBufferHandle(PixelShaderPerMaterial::Layout);
+	}
+
+	PixelShaderPerMaterial data = {};
+	data.colorTint = colorTint;
+	data.roughness = roughness;
+	data.uvScale = uvScale;
+	data.uvOffset = uvOffset;
+	shader->SetData(gbufferPerMaterial, &data, sizeof(data));
+	shader->CopyAllBufferData();
+
+	BindTextures();
+}
+
+void Material::BindTextures()
+{
+	for (auto& r : srvRuns)
+		Graphics::States->SetShaderResources(StagePixel, r.FirstSlot, r.Count, &srvTable[r.Offset]);
+	for (auto& r : samplerRuns)
+		Graphics::States->SetSamplers(StagePixel, r.FirstSlot, r.Count, &samplerTable[r.Offset]);
+}
+
+// --------------------------------------------------------
+// Looks up the variables set per draw once, rather than
+// hashing their names every time the material is prepared
+// --------------------------------------------------------
+void Material::ResolveVertexHandles()
+{
+	vsVars = {};
+	if (!vs) return;
+
+	vsVars.PerObject = vs->GetBufferHandle(VertexShaderPerObject::Layout);
+	vsVars.World = vs->GetVariableHandle("world");
+	vsVars.WorldInvTrans = vs->GetVariableHandle("worldInvTrans");
+	vsVars.LightRange = vs->GetVariableHandle("lightRange");
+}
+
+void Material::ResolvePixelHandles()
+{
+	psVars = {};
+	ResolveBindings();
+	if (!ps) return;
+
+	psVars.PerMaterial = ps->GetBufferHandle(PixelShaderPerMaterial::Layout);
+	psVars.ColorTint = ps->GetVariableHandle("colorTint");
+	psVars.Roughness = ps->GetVariableHandle("roughness");
+	psVars.UVScale = ps->GetVariableHandle("uvScale");
+	psVars.UVOffset = ps->GetVariableHandle("uvOffset");
+}
+
+// --------------------------------------------------------
+// Finds the register of every texture and sampler, so they
+// can be bound by slot - anything the pixel shader doesn't
+// declare is left out
+// --------------------------------------------------------
+void Material::ResolveBindings()
+{
+	std::vector<std::pair<unsigned int, ID3D11ShaderResourceView*>> boundSRVs;
+	std::vector<std::pair<unsigned int, ID3D11SamplerState*>> boundSamplers;
+	if (ps)
+	{
+		for (auto& t : textureSRVs)
+			if (const SimpleSRV* info = ps->GetShaderResourceViewInfo(t.first))
+				boundSRVs.push_back({ info->BindIndex, t.second.Get() });
+		for (auto& s : samplers)
+			if (const SimpleSampler* info = ps->GetSamplerInfo(s.first))
+				boundSamplers.push_back({ info->BindIndex, s.second.Get() });
+	}
+
+	BuildBindingRuns(boundSRVs, srvTable, srvRuns);
+	BuildBindingRuns(boundSamplers, samplerTable, samplerRuns);
+}
+
+uint32_t Material::GetVariantFeatures()
+{
+	uint32_t features = 0;
+	if (GetTextureSRV("NormalMap")) features |= ShaderFeatureNormalMap;
+	if (GetTextureSRV("RoughnessMap")) features |= ShaderFeatureRoughnessMap;
+	if (GetTextureSRV("MetalnessMap")) features |= ShaderFeatureMetalnessMap;
+	return features;
 }
 
-void Material::AddTextureSRV(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv){ textureSRVs.insert({ shaderVariableName, srv }); }
-void Material::AddSampler(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler) { samplers.insert({ shaderVariableName, sampler }); }
\ No newline at end of file
+void Material::AddTextureSRV(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv){ textureSRVs.insert({ shaderVariableName, srv }); ResolveBindings(); }
+void Material::AddSampler(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler) { samplers.insert({ shaderVariableName, sampler }); ResolveBindings(); }
\ No newline at end of file
@@ -1,10 +1,14 @@
 #pragma once
 #include "SimpleShader.h"
+#include "ShaderVariant.h"
+#include "CommandList.h"
+#include "BindingRuns.h"
 #include <DirectXMath.h>
 #include <memory>
 #include "Transform.h"
 #include "Camera.h"
 #include <unordered_map>
+#include <vector>
 
 class Material
 {
@@ -38,11 +42,42 @@ public:
     void SetRoughness(float rough);
     void SetUVOffset(DirectX::XMFLOAT2 offset);
 
-    void PrepareMaterial(std::shared_ptr<Transform> transform, std::shared_ptr<Camera> camera);
+    // Per-frame data (camera, lights, shadows) is set by the
+    // game once per frame - these only set what they own
+    // - lightRange is the object's place in the per entity
+    //   light lists, if they're in use
+    void PrepareMaterial(std::shared_ptr<Transform> transform, DirectX::XMUINT2 lightRange);
+    void PrepareMaterialInstanced(std::shared_ptr<SimpleVertexShader> instancedVS);
+
+    // The same, for the deferred path's G-buffer pass, with
+    // its pixel shader in place of the material's own
+    void PrepareGBuffer(std::shared_ptr<Transform> transform, std::shared_ptr<SimplePixelShader> gbufferPS);
+    void PrepareGBufferInstanced(std::shared_ptr<SimpleVertexShader> instancedVS, std::shared_ptr<SimplePixelShader> gbufferPS);
+
+    // Recording draws into a CommandList instead: prepare each
+    // material once per frame (after the per-frame data is set),
+    // then record from any number of threads at once
+    // - materialBound skips what's the same for every draw of
+    //   this material, when it was the last one recorded
+    bool CanRecord();
+    bool PrepareRecording();
+    void RecordDraw(CommandList& list, Transform& transform, DirectX::XMUINT2 lightRange, bool materialBound) const;
     void AddTextureSRV(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv);
     void AddSampler(const std::string& shaderVariableName, Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler);
 
+    // The optional shader features (see ShaderVariant.h)
+    // this material's textures call for
+    uint32_t GetVariantFeatures();
+
 private:
+    void PrepareVertexShader(Transform& transform, DirectX::XMUINT2 lightRange);
+    void PreparePixelShader();
+    void PrepareGBufferPixelShader(SimplePixelShader* gbufferPS);
+    void BindTextures();
+    void ResolveVertexHandles();
+    void ResolvePixelHandles();
+    void ResolveBindings();
+
     DirectX::XMFLOAT4 colorTint;
     std::shared_ptr<SimpleVertexShader> vs;
     std::shared_ptr<SimplePixelShader> ps;
@@ -53,5 +88,52 @@ private:
 
     std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>> textureSRVs;
     std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11SamplerState>> samplers;
+
+    // The maps above resolved against the pixel shader's registers
+    // (see BindingRuns.h)
+    // - Raw pointers, as the maps hold the references
+    std::vector<ID3D11ShaderResourceView*> srvTable;
+    std::vector<BindingRun> srvRuns;
+    std::vector<ID3D11SamplerState*> samplerTable;
+    std::vector<BindingRun> samplerRuns;
+
+    // Shader variables, resolved whenever a shader is set
+    // - The whole-buffer handles are only valid when the shader's
+    //   cbuffer matches ShaderBuffers.h, and are filled from the
+    //   struct in one go instead of variable by variable
+    struct
+    {
+        SimpleShaderVariableHandle PerObject;
+        SimpleShaderVariableHandle World;
+        SimpleShaderVariableHandle WorldInvTrans;
+        SimpleShaderVariableHandle LightRange;
+    } vsVars;
+
+    // Everything PrepareRecording() captures for RecordDraw()
+    struct RecordedBuffer
+    {
+        ShaderStage Stage;
+        unsigned int Slot;
+        ID3D11Buffer* Buffer;
+        UINT FirstConstant;
+        UINT NumConstants;
+    };
+    const PipelineState* recordedPipeline = 0;
+    std::vector<RecordedBuffer> recordedBuffers;    // Every cbuffer but PerObject
+    unsigned int perObjectSlot = 0;
+
+    struct
+    {
+        SimpleShaderVariableHandle PerMaterial;
+        SimpleShaderVariableHandle ColorTint;
+        SimpleShaderVariableHandle Roughness;
+        SimpleShaderVariableHandle UVScale;
+        SimpleShaderVariableHandle UVOffset;
+    } psVars;
+
+    // The G-buffer pixel shader's PerMaterial, looked up again
+    // whenever a different shader is used
+    SimplePixelShader* gbufferPS = 0;
+    SimpleShaderVariableHandle gbufferPerMaterial;
 };
 
@@ -1,4 +1,6 @@
 #include "Mesh.h"
+#include "FrameStats.h"
+#include "Graphics.h"
 #include <fstream>
 #include <vector>
 #include <stdexcept>
@@ -216,7 +218,7 @@ void Mesh::Initialize(Microsoft::WRL::ComPtr<ID3D11Device> device, Vertex* vertA
 
 const char* Mesh::GetName()
 {
-	return name;
+	return name.c_str();
 }
 
 Microsoft::WRL::ComPtr<ID3D11Buffer> Mesh::GetVertexBuffer()
@@ -252,8 +254,8 @@ void Mesh::Draw(ID3D11DeviceContext* context)
     UINT stride = sizeof(Vertex); 
     UINT offset = 0;
 
-    context->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &offset);
-    context->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+    Graphics::States->SetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &offset);
+    Graphics::States->SetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
 
 	// Tell Direct3D to draw
 	//  - Begins the rendering pipeline on the GPU
@@ -265,6 +267,42 @@ void Mesh::Draw(ID3D11DeviceContext* context)
 		indexCount,     // The number of indices to use (we could draw a subset if we wanted)
 		0,     // Offset to the first index we want to use
 		0);    // Offset to add to each index when looking up vertices
+	FrameStats::DrawCalls++;
+}
+
+// --------------------------------------------------------
+// Draws several copies of this mesh with one call
+// - instanceBuffer holds per-instance data and is bound to
+//   input slot 1, which is where SimpleShader puts any
+//   "_PER_INSTANCE" vertex shader inputs
+// - startInstance is the first element of instanceBuffer to use
+// --------------------------------------------------------
+void Mesh::DrawInstanced(ID3D11DeviceContext* context, ID3D11Buffer* instanceBuffer, unsigned int instanceStride, unsigned int instanceCount, unsigned int startInstance)
+{
+	ID3D11Buffer* buffers[2] = { vertexBuffer.Get(), instanceBuffer };
+	UINT strides[2] = { sizeof(Vertex), instanceStride };
+	UINT offsets[2] = { 0, 0 };
+
+	Graphics::States->SetVertexBuffers(0, 2, buffers, strides, offsets);
+	Graphics::States->SetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+
+	context->DrawIndexedInstanced(
+		indexCount,     // Indices per instance
+		instanceCount,  // How many copies to draw
+		0,              // First index
+		0,              // Offset added to each index
+		startInstance); // Offset added to the instance id before reading slot 1
+	FrameStats::DrawCalls++;
+}
+
+void Mesh::Record(CommandList& list, bool buffersBound)
+{
+	if (!buffersBound)
+	{
+		list.SetVertexBuffer(0, vertexBuffer.Get(), sizeof(Vertex), 0);
+		list.SetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+	}
+	list.DrawIndexed(indexCount, 0, 0);
 }
 
 // --------------------------------------------------------
@@ -361,6 +399,16 @@ void Mesh::CreateBuffers(Microsoft::WRL::ComPtr<ID3D11Device> device, Vertex* ve
 {
 	CalculateTangents(vertArray, vertexCount, indexArray, indexCount);
 
+	// Local bounds (for the scene BVH) and positions (for occlusion)
+	bounds = Bounds::Empty();
+	cpuPositions.resize(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		bounds = Bounds::Merge(bounds, vertArray[i].Position);
+		cpuPositions[i] = vertArray[i].Position;
+	}
+	cpuIndices.assign(indexArray, indexArray + indexCount);
+
 	D3D11_BUFFER_DESC vbd = {};
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
 	vbd.ByteWidth = sizeof(Vertex) * vertexCount;
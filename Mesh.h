@@ -1,5 +1,7 @@
 #pragma once
 #include "Vertex.h"
+#include "Bounds.h"
+#include "CommandList.h"
 
 #include <d3d11.h>
 #include <wrl/client.h>
@@ -22,7 +24,17 @@ public:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetIndexBuffer();
 	unsigned int GetIndexCount();
 	unsigned int GetVertexCount();
+	const AABB& GetBounds() const { return bounds; }
+
+	// CPU side copies of the geometry, for software occlusion
+	const std::vector<DirectX::XMFLOAT3>& GetPositions() const { return cpuPositions; }
+	const std::vector<unsigned int>& GetIndices() const { return cpuIndices; }
+
 	void Draw(ID3D11DeviceContext* context);
+	// Draw(), into a command list - buffersBound skips setting
+	// the buffers again when this mesh was the last one drawn
+	void Record(CommandList& list, bool buffersBound);
+	void DrawInstanced(ID3D11DeviceContext* context, ID3D11Buffer* instanceBuffer, unsigned int instanceStride, unsigned int instanceCount, unsigned int startInstance);
 	void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices);
 
 private:
@@ -30,7 +42,10 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> indexBuffer;
 	unsigned int indexCount;
 	unsigned int vertexCount;
-	const char* name;
+	AABB bounds = {};	// Local space bounds of the vertices
+	std::vector<DirectX::XMFLOAT3> cpuPositions;
+	std::vector<unsigned int> cpuIndices;
+	std::string name;
 	void CreateBuffers(Microsoft::WRL::ComPtr<ID3D11Device> device, Vertex* vertArray, unsigned int vertexCount, unsigned int* indexArray, unsigned int indexCount);
 };
 
@@ -0,0 +1,349 @@
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <emmintrin.h>
+#include <thread>
+
+using namespace DirectX;
+
+// Row vector matrix product (a * b)
+static XMFLOAT4X4 Multiply(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+{
+	XMFLOAT4X4 result;
+	for (int r = 0; r < 4; r++)
+		for (int c = 0; c < 4; c++)
+			result.m[r][c] =
+				a.m[r][0] * b.m[0][c] +
+				a.m[r][1] * b.m[1][c] +
+				a.m[r][2] * b.m[2][c] +
+				a.m[r][3] * b.m[3][c];
+	return result;
+}
+
+static XMFLOAT4 TransformPoint(float x, float y, float z, const XMFLOAT4X4& m)
+{
+	return XMFLOAT4(
+		x * m._11 + y * m._21 + z * m._31 + m._41,
+		x * m._12 + y * m._22 + z * m._32 + m._42,
+		x * m._13 + y * m._23 + z * m._33 + m._43,
+		x * m._14 + y * m._24 + z * m._34 + m._44);
+}
+
+// Point where the edge a -> b crosses the near plane (z == 0)
+static XMFLOAT4 ClipEdge(const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	float t = a.z / (a.z - b.z);
+	return XMFLOAT4(
+		a.x + (b.x - a.x) * t,
+		a.y + (b.y - a.y) * t,
+		0.0f,
+		a.w + (b.w - a.w) * t);
+}
+
+static float Clamp(float v, float low, float high)
+{
+	return v < low ? low : (v > high ? high : v);
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height, std::shared_ptr<WorkerPool> pool)
+	: width(0), height(0), pool(pool), viewProjection()
+{
+	if (!this->pool)
+	{
+		unsigned int threads = std::thread::hardware_concurrency();
+		this->pool = std::make_shared<WorkerPool>(threads < 8 ? threads : 8);
+	}
+	threadCount = this->pool->GetThreadCount();
+
+	Resize(width, height);
+}
+
+void OcclusionCuller::Resize(int width, int height)
+{
+	this->width = (width + 3) & ~3;
+	this->height = height;
+	depth.assign((size_t)this->width * height, 1.0f);
+}
+
+void OcclusionCuller::BeginFrame(const XMFLOAT4X4& viewProjection)
+{
+	this->viewProjection = viewProjection;
+	triangles.clear();
+}
+
+// --------------------------------------------------------
+// Moves an occluder's vertices to clip space, clips its
+// triangles against the near plane and sets up whatever
+// is left for rasterizing
+// --------------------------------------------------------
+void OcclusionCuller::AddOccluder(
+	const XMFLOAT3* positions,
+	const unsigned int* indices,
+	unsigned int indexCount,
+	const XMFLOAT4X4& world)
+{
+	XMFLOAT4X4 worldViewProj = Multiply(world, viewProjection);
+
+	// Transform each vertex once, no matter how many triangles use it
+	unsigned int vertexCount = 0;
+	for (unsigned int i = 0; i < indexCount; i++)
+		if (indices[i] + 1 > vertexCount)
+			vertexCount = indices[i] + 1;
+
+	clipVerts.resize(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+		clipVerts[i] = TransformPoint(positions[i].x, positions[i].y, positions[i].z, worldViewProj);
+
+	for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+	{
+		const XMFLOAT4* tri[3] = {
+			&clipVerts[indices[i]],
+			&clipVerts[indices[i + 1]],
+			&clipVerts[indices[i + 2]] };
+
+		// Sutherland-Hodgman against the near plane only - the
+		// other planes are handled by clamping to the screen
+		XMFLOAT4 poly[4];
+		int count = 0;
+		for (int v = 0; v < 3; v++)
+		{
+			const XMFLOAT4& a = *tri[v];
+			const XMFLOAT4& b = *tri[(v + 1) % 3];
+			bool aIn = a.z >= 0.0f;
+			bool bIn = b.z >= 0.0f;
+			if (aIn) poly[count++] = a;
+			if (aIn != bIn) poly[count++] = ClipEdge(a, b);
+		}
+
+		if (count >= 3) SetupTriangle(poly[0], poly[1], poly[2]);
+		if (count == 4) SetupTriangle(poly[0], poly[2], poly[3]);
+	}
+}
+
+void OcclusionCuller::SetupTriangle(const XMFLOAT4& c0, const XMFLOAT4& c1, const XMFLOAT4& c2)
+{
+	// To screen space, with (0,0) at the top left
+	float x[3], y[3], z[3];
+	const XMFLOAT4* c[3] = { &c0, &c1, &c2 };
+	for (int i = 0; i < 3; i++)
+	{
+		float invW = 1.0f / c[i]->w;
+		x[i] = (c[i]->x * invW * 0.5f + 0.5f) * width;
+		y[i] = (0.5f - c[i]->y * invW * 0.5f) * height;
+		z[i] = c[i]->z * invW;
+	}
+
+	// Pixels whose centers (x + 0.5) fall inside the triangle's bounds
+	float minX = fminf(x[0], fminf(x[1], x[2]));
+	float maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+	float minY = fminf(y[0], fminf(y[1], y[2]));
+	float maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+
+	ScreenTriangle t;
+	t.MinX = (int)ceilf(Clamp(minX - 0.5f, -1.0f, (float)width));
+	t.MaxX = (int)floorf(Clamp(maxX - 0.5f, -1.0f, (float)width - 1));
+	t.MinY = (int)ceilf(Clamp(minY - 0.5f, -1.0f, (float)height));
+	t.MaxY = (int)floorf(Clamp(maxY - 0.5f, -1.0f, (float)height - 1));
+	if (t.MinX < 0) t.MinX = 0;
+	if (t.MinY < 0) t.MinY = 0;
+	if (t.MinX > t.MaxX || t.MinY > t.MaxY)
+		return;
+
+	// Edge i is the one opposite vertex i
+	for (int i = 0; i < 3; i++)
+	{
+		int a = (i + 1) % 3;
+		int b = (i + 2) % 3;
+		t.EdgeA[i] = y[a] - y[b];
+		t.EdgeB[i] = x[b] - x[a];
+		t.EdgeC[i] = x[a] * y[b] - y[a] * x[b];
+	}
+
+	// Both windings are drawn, so flip the edges as needed to keep
+	// them positive inside - occluders with mirrored scales still work
+	float area = t.EdgeC[0] + t.EdgeA[0] * x[0] + t.EdgeB[0] * y[0];
+	if (fabsf(area) < 1e-6f)
+		return;
+	if (area < 0)
+	{
+		area = -area;
+		for (int i = 0; i < 3; i++)
+		{
+			t.EdgeA[i] = -t.EdgeA[i];
+			t.EdgeB[i] = -t.EdgeB[i];
+			t.EdgeC[i] = -t.EdgeC[i];
+		}
+	}
+
+	// Depth = sum of barycentric weights (edge / area) * vertex depth
+	float invArea = 1.0f / area;
+	t.DepthA = (t.EdgeA[0] * z[0] + t.EdgeA[1] * z[1] + t.EdgeA[2] * z[2]) * invArea;
+	t.DepthB = (t.EdgeB[0] * z[0] + t.EdgeB[1] * z[1] + t.EdgeB[2] * z[2]) * invArea;
+	t.DepthC = (t.EdgeC[0] * z[0] + t.EdgeC[1] * z[1] + t.EdgeC[2] * z[2]) * invArea;
+
+	triangles.push_back(t);
+}
+
+// --------------------------------------------------------
+// Rasterizes every occluder, with each of the pool's threads
+// owning its own band of rows so no synchronization is needed
+// --------------------------------------------------------
+void OcclusionCuller::Rasterize()
+{
+	if (height <= 0)
+		return;
+
+	int bandHeight = (height + threadCount - 1) / threadCount;
+	int bands = (height + bandHeight - 1) / bandHeight;
+
+	pool->Run(bands, [&](size_t band)
+		{
+			int start = (int)band * bandHeight;
+			int end = start + bandHeight < height ? start + bandHeight : height;
+			RasterizeBand(start, end);
+		});
+}
+
+void OcclusionCuller::RasterizeBand(int startRow, int endRow)
+{
+	std::fill(depth.begin() + (size_t)startRow * width, depth.begin() + (size_t)endRow * width, 1.0f);
+
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (const ScreenTriangle& t : triangles)
+	{
+		int minY = t.MinY > startRow ? t.MinY : startRow;
+		int maxY = t.MaxY < endRow - 1 ? t.MaxY : endRow - 1;
+		if (minY > maxY)
+			continue;
+
+		// Start on a multiple of 4 so a group never runs off the row
+		int minX = t.MinX & ~3;
+
+		__m128 a0 = _mm_set1_ps(t.EdgeA[0]), a1 = _mm_set1_ps(t.EdgeA[1]), a2 = _mm_set1_ps(t.EdgeA[2]);
+		__m128 za = _mm_set1_ps(t.DepthA);
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float py = y + 0.5f;
+			__m128 rowE0 = _mm_set1_ps(t.EdgeB[0] * py + t.EdgeC[0]);
+			__m128 rowE1 = _mm_set1_ps(t.EdgeB[1] * py + t.EdgeC[1]);
+			__m128 rowE2 = _mm_set1_ps(t.EdgeB[2] * py + t.EdgeC[2]);
+			__m128 rowZ = _mm_set1_ps(t.DepthB * py + t.DepthC);
+			float* row = &depth[(size_t)y * width];
+
+			for (int x = minX; x <= t.MaxX; x += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+
+				// Strictly inside all three edges - pixels exactly on an
+				// edge are skipped, which only ever under-covers
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), rowE0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), rowE1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), rowE2);
+				__m128 inside = _mm_and_ps(_mm_cmpgt_ps(e0, zero),
+					_mm_and_ps(_mm_cmpgt_ps(e1, zero), _mm_cmpgt_ps(e2, zero)));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(za, px), rowZ);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 closer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Projects the box and compares its nearest depth against
+// every pixel it could cover (plus a one pixel border, to
+// allow for the low resolution of the buffer)
+// --------------------------------------------------------
+bool OcclusionCuller::IsVisible(const AABB& box) const
+{
+	// Corners are the min corner plus any combination of the
+	// box's edges, so only one full transform is needed
+	const XMFLOAT4X4& m = viewProjection;
+	XMFLOAT4 base = TransformPoint(box.Min.x, box.Min.y, box.Min.z, m);
+	float sx = box.Max.x - box.Min.x;
+	float sy = box.Max.y - box.Min.y;
+	float sz = box.Max.z - box.Min.z;
+	XMFLOAT4 edgeX(m._11 * sx, m._12 * sx, m._13 * sx, m._14 * sx);
+	XMFLOAT4 edgeY(m._21 * sy, m._22 * sy, m._23 * sy, m._24 * sy);
+	XMFLOAT4 edgeZ(m._31 * sz, m._32 * sz, m._33 * sz, m._34 * sz);
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int i = 0; i < 8; i++)
+	{
+		XMFLOAT4 c = base;
+		if (i & 1) { c.x += edgeX.x; c.y += edgeX.y; c.z += edgeX.z; c.w += edgeX.w; }
+		if (i & 2) { c.x += edgeY.x; c.y += edgeY.y; c.z += edgeY.z; c.w += edgeY.w; }
+		if (i & 4) { c.x += edgeZ.x; c.y += edgeZ.y; c.z += edgeZ.z; c.w += edgeZ.w; }
+
+		// Crosses the near plane, so it's right in front of the camera
+		if (c.z < 0.0f || c.w <= 0.0f)
+			return true;
+
+		float invW = 1.0f / c.w;
+		float x = c.x * invW;
+		float y = c.y * invW;
+		minX = fminf(minX, x); maxX = fmaxf(maxX, x);
+		minY = fminf(minY, y); maxY = fmaxf(maxY, y);
+		minZ = fminf(minZ, c.z * invW);
+	}
+
+	// Screen rectangle, with y flipped
+	int x0 = (int)floorf(Clamp((minX * 0.5f + 0.5f) * width, -2.0f, (float)width + 1)) - 1;
+	int x1 = (int)floorf(Clamp((maxX * 0.5f + 0.5f) * width, -2.0f, (float)width + 1)) + 1;
+	int y0 = (int)floorf(Clamp((0.5f - maxY * 0.5f) * height, -2.0f, (float)height + 1)) - 1;
+	int y1 = (int)floorf(Clamp((0.5f - minY * 0.5f) * height, -2.0f, (float)height + 1)) + 1;
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > width - 1) x1 = width - 1;
+	if (y1 > height - 1) y1 = height - 1;
+	if (x0 > x1 || y0 > y1)
+		return false; // Entirely off screen
+
+	// Extra lanes from rounding x0 down can only make it "more visible"
+	x0 &= ~3;
+	__m128 boxZ = _mm_set1_ps(minZ);
+	for (int y = y0; y <= y1; y++)
+	{
+		const float* row = &depth[(size_t)y * width];
+		for (int x = x0; x <= x1; x += 4)
+		{
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxZ)) != 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+// --------------------------------------------------------
+// Tests many boxes, splitting them across threads when
+// there are enough to be worth it
+// --------------------------------------------------------
+void OcclusionCuller::TestVisibility(const AABB* boxes, unsigned int count, unsigned char* visible) const
+{
+	const unsigned int minPerThread = 1024;
+	unsigned int workers = count / minPerThread;
+	if (workers > threadCount) workers = threadCount;
+	if (workers < 1) workers = 1;
+
+	auto testRange = [this, boxes, visible](unsigned int start, unsigned int end)
+		{
+			for (unsigned int i = start; i < end; i++)
+				visible[i] = IsVisible(boxes[i]) ? 1 : 0;
+		};
+
+	unsigned int perWorker = (count + workers - 1) / workers;
+	pool->Run(workers, [&](size_t i)
+		{
+			unsigned int start = (unsigned int)i * perWorker;
+			unsigned int end = start + perWorker < count ? start + perWorker : count;
+			if (start < end)
+				testRange(start, end);
+		});
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "Bounds.h"
+#include "WorkerPool.h"
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------
+// Software occlusion culling on the CPU
+//
+// - A few large occluders are rasterized (depth only) into a
+//   small depth buffer, 4 pixels at a time with SSE, with the
+//   buffer split into horizontal bands across threads
+// - Boxes are then projected and tested against that buffer;
+//   a box is hidden if every pixel it could touch already has
+//   something closer in front of it
+//
+// Depth follows D3D conventions (0 at the near plane, 1 at
+// the far plane), and matrices are row vector (v * M)
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class OcclusionCuller
+{
+public:
+	// Without a pool, makes its own of up to 8 threads
+	OcclusionCuller(int width = 256, int height = 128, std::shared_ptr<WorkerPool> pool = 0);
+
+	// Width is rounded up to a multiple of 4 for the SIMD loops
+	void Resize(int width, int height);
+
+	// Starts a new frame - forgets the previous occluders
+	void BeginFrame(const DirectX::XMFLOAT4X4& viewProjection);
+
+	// Transforms and sets up an occluder's triangles
+	void AddOccluder(
+		const DirectX::XMFLOAT3* positions,
+		const unsigned int* indices,
+		unsigned int indexCount,
+		const DirectX::XMFLOAT4X4& world);
+
+	// Clears and fills the depth buffer with every occluder
+	void Rasterize();
+
+	// Must be called after Rasterize()
+	bool IsVisible(const AABB& box) const;
+	void TestVisibility(const AABB* boxes, unsigned int count, unsigned char* visible) const;
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	const float* GetDepthBuffer() const { return depth.data(); }
+	unsigned int GetTriangleCount() const { return (unsigned int)triangles.size(); }
+
+private:
+	// A triangle in screen space, ready for rasterizing
+	// - Edge functions are positive inside the triangle
+	// - Depth is a plane over screen space (z/w is linear there)
+	struct ScreenTriangle
+	{
+		float EdgeA[3], EdgeB[3], EdgeC[3];
+		float DepthA, DepthB, DepthC;
+		int MinX, MinY, MaxX, MaxY;
+	};
+
+	void SetupTriangle(const DirectX::XMFLOAT4& c0, const DirectX::XMFLOAT4& c1, const DirectX::XMFLOAT4& c2);
+	void RasterizeBand(int startRow, int endRow);
+
+	int width;
+	int height;
+	std::shared_ptr<WorkerPool> pool;
+	unsigned int threadCount;
+
+	DirectX::XMFLOAT4X4 viewProjection;
+	std::vector<float> depth;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<DirectX::XMFLOAT4> clipVerts;	// Reused per occluder
+};
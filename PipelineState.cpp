@@ -0,0 +1,175 @@
+#include "PipelineState.h"
+#include <cstddef>
+
+// --------------------------------------------------------
+// FNV-1a style, but a word at a time - descriptions are a
+// few hundred bytes, and only hashed when they're requested
+// --------------------------------------------------------
+uint64_t HashStateBytes(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t h = 0xCBF29CE484222325ull;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * 0x100000001B3ull;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++)
+		h = (h ^ bytes[i]) * 0x100000001B3ull;
+
+	// Final mix (splitmix64's), so every bit counts for buckets
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	return h;
+}
+
+void ClearStatePadding(D3D11_DEPTH_STENCIL_DESC* desc)
+{
+	// Between the 8 bit stencil masks and the face descriptions
+	size_t start = offsetof(D3D11_DEPTH_STENCIL_DESC, StencilWriteMask) + sizeof(desc->StencilWriteMask);
+	memset((unsigned char*)desc + start, 0, offsetof(D3D11_DEPTH_STENCIL_DESC, FrontFace) - start);
+}
+
+void ClearStatePadding(D3D11_BLEND_DESC* desc)
+{
+	// After each target's 8 bit write mask
+	size_t start = offsetof(D3D11_RENDER_TARGET_BLEND_DESC, RenderTargetWriteMask) + sizeof(desc->RenderTarget[0].RenderTargetWriteMask);
+	for (auto& rt : desc->RenderTarget)
+		memset((unsigned char*)&rt + start, 0, sizeof(rt) - start);
+}
+
+PipelineDesc PipelineDesc::Defaults()
+{
+	PipelineDesc desc;
+	memset(&desc, 0, sizeof(desc));
+
+	desc.Rasterizer.FillMode = D3D11_FILL_SOLID;
+	desc.Rasterizer.CullMode = D3D11_CULL_BACK;
+	desc.Rasterizer.DepthClipEnable = true;
+
+	desc.DepthStencil.DepthEnable = true;
+	desc.DepthStencil.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+	desc.DepthStencil.DepthFunc = D3D11_COMPARISON_LESS;
+	desc.DepthStencil.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+	desc.DepthStencil.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+	D3D11_DEPTH_STENCILOP_DESC face = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_COMPARISON_ALWAYS };
+	desc.DepthStencil.FrontFace = face;
+	desc.DepthStencil.BackFace = face;
+
+	for (auto& rt : desc.Blend.RenderTarget)
+	{
+		rt.SrcBlend = D3D11_BLEND_ONE;
+		rt.DestBlend = D3D11_BLEND_ZERO;
+		rt.BlendOp = D3D11_BLEND_OP_ADD;
+		rt.SrcBlendAlpha = D3D11_BLEND_ONE;
+		rt.DestBlendAlpha = D3D11_BLEND_ZERO;
+		rt.BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		rt.RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+
+	desc.Topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	return desc;
+}
+
+PipelineCache::PipelineCache(Microsoft::WRL::ComPtr<ID3D11Device> device) :
+	device(device)
+{
+}
+
+// --------------------------------------------------------
+// Each part of the pipeline's state is interned on its own
+// too, so pipelines that only differ in their shaders share
+// the same state objects
+// --------------------------------------------------------
+const PipelineState* PipelineCache::GetPipeline(const PipelineDesc& desc)
+{
+	PipelineDesc key = desc;
+	ClearStatePadding(&key.DepthStencil);
+	ClearStatePadding(&key.Blend);
+
+	auto entry = pipelines.Intern(key, [this](const PipelineDesc& d)
+		{
+			std::shared_ptr<PipelineState> pipeline = std::make_shared<PipelineState>();
+			pipeline->Desc = d;
+			pipeline->Hash = HashStateBytes(&d, sizeof(d));
+			pipeline->VertexShader = d.VertexShader;
+			pipeline->PixelShader = d.PixelShader;
+			pipeline->InputLayout = d.InputLayout;
+			pipeline->RasterizerState = GetRasterizerState(d.Rasterizer);
+			pipeline->DepthStencilState = GetDepthStencilState(d.DepthStencil);
+			pipeline->BlendState = GetBlendState(d.Blend);
+
+			if (!pipeline->RasterizerState || !pipeline->DepthStencilState || !pipeline->BlendState)
+				pipeline.reset();
+			return pipeline;
+		});
+
+	return entry ? entry->Object.get() : 0;
+}
+
+ID3D11RasterizerState* PipelineCache::GetRasterizerState(const D3D11_RASTERIZER_DESC& desc)
+{
+	auto entry = rasterizerStates.Intern(desc, [this](const D3D11_RASTERIZER_DESC& d)
+		{
+			Microsoft::WRL::ComPtr<ID3D11RasterizerState> state;
+			device->CreateRasterizerState(&d, state.GetAddressOf());
+			return state;
+		});
+	return entry ? entry->Object.Get() : 0;
+}
+
+ID3D11DepthStencilState* PipelineCache::GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	D3D11_DEPTH_STENCIL_DESC key = desc;
+	ClearStatePadding(&key);
+
+	auto entry = depthStencilStates.Intern(key, [this](const D3D11_DEPTH_STENCIL_DESC& d)
+		{
+			Microsoft::WRL::ComPtr<ID3D11DepthStencilState> state;
+			device->CreateDepthStencilState(&d, state.GetAddressOf());
+			return state;
+		});
+	return entry ? entry->Object.Get() : 0;
+}
+
+ID3D11BlendState* PipelineCache::GetBlendState(const D3D11_BLEND_DESC& desc)
+{
+	D3D11_BLEND_DESC key = desc;
+	ClearStatePadding(&key);
+
+	auto entry = blendStates.Intern(key, [this](const D3D11_BLEND_DESC& d)
+		{
+			Microsoft::WRL::ComPtr<ID3D11BlendState> state;
+			device->CreateBlendState(&d, state.GetAddressOf());
+			return state;
+		});
+	return entry ? entry->Object.Get() : 0;
+}
+
+ID3D11SamplerState* PipelineCache::GetSamplerState(const D3D11_SAMPLER_DESC& desc)
+{
+	auto entry = samplerStates.Intern(desc, [this](const D3D11_SAMPLER_DESC& d)
+		{
+			Microsoft::WRL::ComPtr<ID3D11SamplerState> state;
+			device->CreateSamplerState(&d, state.GetAddressOf());
+			return state;
+		});
+	return entry ? entry->Object.Get() : 0;
+}
+
+size_t PipelineCache::GetStateObjectCount() const
+{
+	return rasterizerStates.GetCount() + depthStencilStates.GetCount() + blendStates.GetCount() + samplerStates.GetCount();
+}
+
+size_t PipelineCache::GetHits() const
+{
+	return pipelines.GetHits() + rasterizerStates.GetHits() + depthStencilStates.GetHits() + blendStates.GetHits() + samplerStates.GetHits();
+}
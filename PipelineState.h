@@ -0,0 +1,161 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+// Hashes raw bytes, for descriptions compared byte for byte
+uint64_t HashStateBytes(const void* data, size_t size);
+
+// The padding D3D leaves in these descriptions is zeroed, so
+// two that were filled in field by field still match as bytes
+void ClearStatePadding(D3D11_DEPTH_STENCIL_DESC* desc);
+void ClearStatePadding(D3D11_BLEND_DESC* desc);
+
+// --------------------------------------------------------
+// Keeps a single object per unique description
+//
+// - Descriptions are hashed and compared as raw bytes, so
+//   they must not have stray padding (see above)
+// - Entries never move or go away, so comparing pointers
+//   to two entries is the same as comparing descriptions
+// - Has no graphics API dependencies of its own
+// --------------------------------------------------------
+template<typename TDesc, typename TObject>
+class StateInterner
+{
+public:
+	struct Entry
+	{
+		TDesc Desc;
+		uint64_t Hash;
+		TObject Object;
+	};
+
+	// The entry for a description, made by create(desc) if
+	// there isn't one yet - null if create() returns null
+	template<typename TCreate>
+	const Entry* Intern(const TDesc& desc, TCreate create)
+	{
+		uint64_t hash = HashStateBytes(&desc, sizeof(TDesc));
+
+		auto range = entries.equal_range(hash);
+		for (auto it = range.first; it != range.second; it++)
+		{
+			if (memcmp(&it->second->Desc, &desc, sizeof(TDesc)) == 0)
+			{
+				hits++;
+				return it->second.get();
+			}
+		}
+
+		TObject object = create(desc);
+		if (!object)
+			return 0;
+
+		std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+		memcpy(&entry->Desc, &desc, sizeof(TDesc));
+		entry->Hash = hash;
+		entry->Object = object;
+
+		const Entry* result = entry.get();
+		entries.emplace(hash, std::move(entry));
+		return result;
+	}
+
+	size_t GetCount() const { return entries.size(); }
+	size_t GetHits() const { return hits; }
+
+private:
+	std::unordered_multimap<uint64_t, std::unique_ptr<Entry>> entries;
+	size_t hits = 0;
+};
+
+// --------------------------------------------------------
+// Everything a draw needs bound besides its resources and
+// constants - the unit PipelineCache hashes and interns
+//
+// - Hashed and compared as raw bytes, so the trailing bytes
+//   a 64 bit build would pad with are an explicit, zeroed
+//   field instead (checked below)
+// - Start from Defaults(), which matches what D3D uses when
+//   a state is null
+// --------------------------------------------------------
+struct PipelineDesc
+{
+	ID3D11VertexShader* VertexShader;
+	ID3D11PixelShader* PixelShader;
+	ID3D11InputLayout* InputLayout;
+	D3D11_RASTERIZER_DESC Rasterizer;
+	D3D11_DEPTH_STENCIL_DESC DepthStencil;
+	D3D11_BLEND_DESC Blend;
+	D3D11_PRIMITIVE_TOPOLOGY Topology;
+	UINT StencilRef;
+	UINT Padding;	// Always zero
+
+	static PipelineDesc Defaults();
+};
+
+static_assert(sizeof(PipelineDesc) ==
+	3 * sizeof(void*) + sizeof(D3D11_RASTERIZER_DESC) + sizeof(D3D11_DEPTH_STENCIL_DESC) +
+	sizeof(D3D11_BLEND_DESC) + sizeof(D3D11_PRIMITIVE_TOPOLOGY) + 2 * sizeof(UINT),
+	"PipelineDesc can't have any padding - it's hashed as raw bytes");
+
+// --------------------------------------------------------
+// An interned PipelineDesc, with its state objects made
+//
+// - Holds references to its shaders and input layout, so
+//   their addresses can't be reused by something else while
+//   it exists
+// --------------------------------------------------------
+struct PipelineState
+{
+	PipelineDesc Desc;
+	uint64_t Hash;
+
+	Microsoft::WRL::ComPtr<ID3D11VertexShader> VertexShader;
+	Microsoft::WRL::ComPtr<ID3D11PixelShader> PixelShader;
+	Microsoft::WRL::ComPtr<ID3D11InputLayout> InputLayout;
+	Microsoft::WRL::ComPtr<ID3D11RasterizerState> RasterizerState;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> DepthStencilState;
+	Microsoft::WRL::ComPtr<ID3D11BlendState> BlendState;
+};
+
+// --------------------------------------------------------
+// Creates state objects and pipelines, one per unique
+// description - asking again for the same description
+// returns the same pointer, for StateCache::SetPipeline()
+// to compare
+//
+// - Nothing is ever released before the cache is, so this
+//   is for the states a renderer settles on, not ones that
+//   are generated every frame
+// --------------------------------------------------------
+class PipelineCache
+{
+public:
+	PipelineCache(Microsoft::WRL::ComPtr<ID3D11Device> device);
+
+	const PipelineState* GetPipeline(const PipelineDesc& desc);
+
+	ID3D11RasterizerState* GetRasterizerState(const D3D11_RASTERIZER_DESC& desc);
+	ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc);
+	ID3D11BlendState* GetBlendState(const D3D11_BLEND_DESC& desc);
+	ID3D11SamplerState* GetSamplerState(const D3D11_SAMPLER_DESC& desc);
+
+	size_t GetPipelineCount() const { return pipelines.GetCount(); }
+	size_t GetStateObjectCount() const;
+	// Requests answered by something that already existed
+	size_t GetHits() const;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+
+	StateInterner<PipelineDesc, std::shared_ptr<PipelineState>> pipelines;
+	StateInterner<D3D11_RASTERIZER_DESC, Microsoft::WRL::ComPtr<ID3D11RasterizerState>> rasterizerStates;
+	StateInterner<D3D11_DEPTH_STENCIL_DESC, Microsoft::WRL::ComPtr<ID3D11DepthStencilState>> depthStencilStates;
+	StateInterner<D3D11_BLEND_DESC, Microsoft::WRL::ComPtr<ID3D11BlendState>> blendStates;
+	StateInterner<D3D11_SAMPLER_DESC, Microsoft::WRL::ComPtr<ID3D11SamplerState>> samplerStates;
+};
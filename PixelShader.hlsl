@@ -1,50 +1,95 @@
 #include "ShaderStructs.hlsli"
 #include "Lighting.hlsli"
 
+// Variant keywords (see ShaderVariant.h) - the defaults are
+// what the build compiles, which includes everything
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 1
+#endif
+#ifndef ROUGHNESS_MAP
+#define ROUGHNESS_MAP 1
+#endif
+#ifndef METALNESS_MAP
+#define METALNESS_MAP 1
+#endif
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+#ifndef PCF_TAPS
+#define PCF_TAPS 5
+#endif
+#ifndef LIGHT_MASK
+#define LIGHT_MASK 7
+#endif
+
+// Whether a light type is handled at all, and whether it's
+// the only one (so its type never needs checking)
+#define HAS_LIGHT_TYPE(type) ((LIGHT_MASK >> (type)) & 1)
+#define ONLY_LIGHT_TYPE(type) (LIGHT_MASK == (1 << (type)))
+
 SamplerState BasicSampler : register(s0); // "s" registers for samplers
-SamplerComparisonState ShadowSampler : register(s1);
 Texture2D Albedo : register(t0);
+#if NORMAL_MAP
 Texture2D NormalMap : register(t1);
+#endif
+#if ROUGHNESS_MAP
 Texture2D RoughnessMap : register(t2);
+#endif
+#if METALNESS_MAP
 Texture2D MetalnessMap : register(t3);
+#endif
+#if SHADOWS
+SamplerComparisonState ShadowSampler : register(s1);
 Texture2D ShadowMap : register(t4);
+#endif
+
+// Clustered lighting (see LightClusters.h) - each cluster's
+// offset and count in the list of light indices, which
+// holds the per entity lists instead when they're in use
+Buffer<uint2> ClusterRanges : register(t5);
+Buffer<uint> LightIndices : register(t6);
+
+// Every light in the scene, only uploaded once per frame
+// (and only as many as there are)
+StructuredBuffer<Light> Lights : register(t7);
+
+// The sky's image based lighting (see SkyLighting.h)
+TextureCube SkySpecular : register(t8);
+Texture2D SkyBRDFLookup : register(t9);
+SamplerState ClampSampler : register(s2);
 
-cbuffer ExternalData : register(b0)
+// Constant buffers are split by how often they change
+cbuffer PerFrame : register(b0)
 {
-    Light lights[MAX_LIGHTS];
-    int lightCount;
     float3 ambientColor;
     
     float3 cameraPosition;
+    float2 shadowMapSize;
+    
+    // Finding a pixel's cluster: view depth is a dot with its
+    // world position, then tiles are in pixels and slices are
+    // log(depth) * scale + bias.  No clusters at all means the
+    // object's own list is used.
+    float4 viewDepth;
+    float2 clusterTileScale;
+    float2 clusterDepthScale;
+    uint3 clusterCounts;
     
+    // Mips in SkySpecular - none turns sky reflections off
+    float skySpecularMips;
+    
+    // The sky's diffuse light - all zero turns it off
+    float4 skyIrradiance[7];
+};
+
+cbuffer PerMaterial : register(b1)
+{
     float4 colorTint;
     float roughness;
     float2 uvScale;
     float2 uvOffset;
-    float2 shadowMapSize;
 };
 
-float PCFSample(float2 uv, float compareDepth, float2 texelSize)
-{
-    float shadow = 0.0f;
-    const int range = 2; 
-    
-    for (int y = -range; y <= range; y++)
-    {
-        for (int x = -range; x <= range; x++)
-        {
-            shadow += ShadowMap.SampleCmpLevelZero(
-                ShadowSampler,
-                uv + float2(x, y) * texelSize,
-                compareDepth).r;
-        }
-    }
-    
-    // Normalize by number of samples
-    float samples = (range * 2 + 1) * (range * 2 + 1);
-    return shadow / samples;
-}
-
 // --------------------------------------------------------
 // The entry point (main method) for our pixel shader
 // 
@@ -59,12 +104,23 @@ float4 main(VertexToPixel input) : SV_TARGET
     input.normal = normalize(input.normal);
     input.uv = input.uv * uvScale + uvOffset;
     
+#if NORMAL_MAP
     float3 normalMap = NormalMapping(NormalMap, BasicSampler, input.uv, input.normal, input.tangent);
     input.normal = normalMap;
+#endif
     
     float3 surfaceColor = pow(Albedo.Sample(BasicSampler, input.uv).rgb * colorTint.rgb, 2.2f);
+    
+    // Without maps, roughness is the material's own value
+    // and the surface isn't metal
+#if ROUGHNESS_MAP
     float roughness = RoughnessMap.Sample(BasicSampler, input.uv).r;
+#endif
+#if METALNESS_MAP
     float metalness = MetalnessMap.Sample(BasicSampler, input.uv).r;
+#else
+    float metalness = 0.0f;
+#endif
     
     // Specular color determination -----------------
     // Assume albedo texture is actually holding specular color where metalness == 1
@@ -72,37 +128,57 @@ float4 main(VertexToPixel input) : SV_TARGET
     // because of linear texture sampling, so we lerp the specular color to match
     float3 specularColor = lerp(F0_NON_METAL, surfaceColor.rgb, metalness);
     
+#if SHADOWS
     float2 shadowUV = input.shadowPos.xy / input.shadowPos.w * 0.5f + 0.5f;
     shadowUV.y = 1.0f - shadowUV.y;
     
     float depthFromLight = input.shadowPos.z / input.shadowPos.w;
 
     float2 texel = 1.0f / shadowMapSize;
-    float shadowAmount = PCFSample(shadowUV, depthFromLight, texel);
+    float shadowAmount = PCFSample(ShadowMap, ShadowSampler, shadowUV, depthFromLight, texel, PCF_TAPS);
+#else
+    float shadowAmount = 1.0f;
+#endif
     
-    float3 totalLight = ambientColor * surfaceColor;
+    // Ambient light is diffuse, which metals don't reflect
+    float3 ambient = ambientColor + SkyIrradiance(skyIrradiance, input.normal);
+    float3 totalLight = ambient * surfaceColor * (1.0f - metalness);
+    if (skySpecularMips > 0)
+        totalLight += SplitSumSpecular(SkySpecular, SkyBRDFLookup, ClampSampler, input.normal, normalize(cameraPosition - input.worldPos), roughness, specularColor, skySpecularMips);
     
-    // Process each light
-    for (int i = 0; i < lightCount; i++)
+    // Only the lights that can reach this pixel's cluster, or
+    // this object
+    uint2 range = input.lightRange;
+    if (clusterCounts.x > 0)
     {
-        Light light = lights[i];
-        float3 lightDir = normalize(light.Direction);
+        uint3 cluster;
+        cluster.xy = min(uint2(input.screenPosition.xy * clusterTileScale), clusterCounts.xy - 1);
+        float depth = dot(float4(input.worldPos, 1.0f), viewDepth);
+        cluster.z = min(uint(max(log(depth) * clusterDepthScale.x + clusterDepthScale.y, 0.0f)), clusterCounts.z - 1);
+        range = ClusterRanges[cluster.x + (cluster.y + cluster.z * clusterCounts.y) * clusterCounts.x];
+    }
+    
+    // Process each light - only the types this variant
+    // handles are compiled in
+    for (uint i = 0; i < range.y; i++)
+    {
+        Light light = Lights[LightIndices[range.x + i]];
         
-        switch (lights[i].Type)
+#if HAS_LIGHT_TYPE(LIGHT_TYPE_DIRECTIONAL)
+        if (ONLY_LIGHT_TYPE(LIGHT_TYPE_DIRECTIONAL) || light.Type == LIGHT_TYPE_DIRECTIONAL)
         {
-            case LIGHT_TYPE_DIRECTIONAL:
-                float3 dirLight = CalculateDirectionalLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
-                totalLight += (dirLight * shadowAmount);
-                break;
-
-            case LIGHT_TYPE_POINT:
-                totalLight += CalculatePointLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
-                break;
-
-            case LIGHT_TYPE_SPOT:
-                totalLight += CalculateSpotLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
-                break;
+            float3 dirLight = CalculateDirectionalLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+            totalLight += (dirLight * shadowAmount);
         }
+#endif
+#if HAS_LIGHT_TYPE(LIGHT_TYPE_POINT)
+        if (ONLY_LIGHT_TYPE(LIGHT_TYPE_POINT) || light.Type == LIGHT_TYPE_POINT)
+            totalLight += CalculatePointLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+#endif
+#if HAS_LIGHT_TYPE(LIGHT_TYPE_SPOT)
+        if (ONLY_LIGHT_TYPE(LIGHT_TYPE_SPOT) || light.Type == LIGHT_TYPE_SPOT)
+            totalLight += CalculateSpotLight(light, input.normal, input.worldPos, cameraPosition, roughness, metalness, surfaceColor, specularColor);
+#endif
     }
 
     return float4(pow(totalLight, 1.0f / 2.2f), 1);
@@ -0,0 +1,57 @@
+#include "RingAllocator.h"
+
+// --------------------------------------------------------
+// Alignment must be a power of two.  The capacity is
+// rounded down to a whole number of aligned slices.
+// --------------------------------------------------------
+RingAllocator::RingAllocator(unsigned int capacity, unsigned int alignment) :
+	capacity(capacity & ~(alignment - 1)),
+	alignment(alignment)
+{
+}
+
+// --------------------------------------------------------
+// Starts a new frame - every slice handed out before this
+// is considered gone, and the next one starts at the front
+// --------------------------------------------------------
+void RingAllocator::BeginFrame()
+{
+	if (head > peakUsed) peakUsed = head;
+	lastFrameUsed = head;
+	lastFrameAllocations = allocations;
+	lastFrameOverflows = overflows;
+
+	epoch++;
+	head = 0;
+	discardNext = true;
+	allocations = 0;
+	overflows = 0;
+}
+
+// --------------------------------------------------------
+// Reserves an aligned slice of at least the given size
+//
+// Returns false (and counts an overflow) if the rest of
+// this frame's space can't fit it
+// --------------------------------------------------------
+bool RingAllocator::Allocate(unsigned int size, Allocation* allocation)
+{
+	if (size == 0)
+		return false;
+
+	unsigned int alignedSize = (size + alignment - 1) & ~(alignment - 1);
+	if (alignedSize > capacity - head)
+	{
+		overflows++;
+		return false;
+	}
+
+	allocation->Offset = head;
+	allocation->Size = alignedSize;
+	allocation->Discard = discardNext;
+
+	head += alignedSize;
+	discardNext = false;
+	allocations++;
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// --------------------------------------------------------
+// Hands out aligned slices of a fixed size ring, one frame
+// at a time
+//
+// - The whole ring is discarded at the start of each frame
+//   (BeginFrame) and filled front to back during the frame,
+//   so nothing written this frame is ever overwritten
+// - When a frame runs out of space, Allocate() fails rather
+//   than wrapping mid-frame, and the caller falls back to
+//   its own storage - these are counted as overflows
+// - The epoch changes every frame, which lets callers tell
+//   whether an old slice still holds their data
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class RingAllocator
+{
+public:
+	struct Allocation
+	{
+		unsigned int Offset;
+		unsigned int Size;		// Rounded up to the alignment
+		bool Discard;			// First slice since BeginFrame()
+	};
+
+	RingAllocator(unsigned int capacity, unsigned int alignment = 256);
+
+	void BeginFrame();
+	bool Allocate(unsigned int size, Allocation* allocation);
+
+	unsigned int GetCapacity() const { return capacity; }
+	unsigned int GetAlignment() const { return alignment; }
+	unsigned int GetEpoch() const { return epoch; }
+
+	// Stats for the current frame so far
+	unsigned int GetUsed() const { return head; }
+	unsigned int GetAllocations() const { return allocations; }
+	unsigned int GetOverflows() const { return overflows; }
+
+	// Stats for the last finished frame, and the most
+	// space any frame has needed
+	unsigned int GetLastFrameUsed() const { return lastFrameUsed; }
+	unsigned int GetLastFrameAllocations() const { return lastFrameAllocations; }
+	unsigned int GetLastFrameOverflows() const { return lastFrameOverflows; }
+	unsigned int GetPeakUsed() const { return peakUsed; }
+
+private:
+	unsigned int capacity;
+	unsigned int alignment;
+	unsigned int epoch = 0;
+	unsigned int head = 0;
+	bool discardNext = true;
+
+	unsigned int allocations = 0;
+	unsigned int overflows = 0;
+	unsigned int lastFrameUsed = 0;
+	unsigned int lastFrameAllocations = 0;
+	unsigned int lastFrameOverflows = 0;
+	unsigned int peakUsed = 0;
+};
@@ -0,0 +1,350 @@
+#include "SceneFile.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Splits a line into whitespace separated tokens, where
+// "quoted strings" may contain spaces
+// --------------------------------------------------------
+static std::vector<std::string> Tokenize(const std::string& line)
+{
+	std::vector<std::string> tokens;
+	size_t i = 0;
+	while (i < line.size())
+	{
+		while (i < line.size() && isspace((unsigned char)line[i])) i++;
+		if (i >= line.size() || line[i] == '#')
+			break;
+
+		if (line[i] == '"')
+		{
+			size_t end = line.find('"', i + 1);
+			if (end == std::string::npos) end = line.size();
+			tokens.push_back(line.substr(i + 1, end - i - 1));
+			i = end + 1;
+		}
+		else
+		{
+			size_t start = i;
+			while (i < line.size() && !isspace((unsigned char)line[i])) i++;
+			tokens.push_back(line.substr(start, i - start));
+		}
+	}
+	return tokens;
+}
+
+// --------------------------------------------------------
+// Reads a text scene.  Each line is one of:
+//
+//   mesh <name> <path>
+//   material <name> <pixel shader> <texture set or -> <r g b a> [roughness] [unlisted]
+//   entity <mesh> <material> <x y z> [<pitch yaw roll> [<sx sy sz>]]
+//
+// Rotations are in radians, like Transform.  Unlisted
+// materials are left out of the game's material list (the UI
+// and the stress scene), but entities can still use them.
+// Everything after a # is a comment.
+// --------------------------------------------------------
+SceneDesc ParseSceneText(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+		throw std::invalid_argument("Error opening scene file: " + path);
+
+	SceneDesc scene;
+	std::unordered_map<std::string, uint32_t> meshLookup;
+	std::unordered_map<std::string, uint32_t> materialLookup;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		std::vector<std::string> t = Tokenize(line);
+		if (t.empty())
+			continue;
+
+		auto fail = [&](const std::string& reason)
+			{
+				throw std::invalid_argument(path + "(" + std::to_string(lineNumber) + "): " + reason);
+			};
+		// The whole token has to be a number that fits in a float
+		auto number = [&](size_t index)
+			{
+				size_t used = 0;
+				float value = 0.0f;
+				try { value = std::stof(t[index], &used); }
+				catch (...) { used = 0; }
+				if (used == 0 || used != t[index].size())
+					fail("expected a number, got \"" + t[index] + "\"");
+				return value;
+			};
+
+		if (t[0] == "mesh")
+		{
+			if (t.size() != 3) fail("mesh needs a name and a path");
+			meshLookup[t[1]] = (uint32_t)scene.Meshes.size();
+			scene.Meshes.push_back({ t[1], t[2] });
+		}
+		else if (t[0] == "material")
+		{
+			SceneMaterialDesc mat;
+			mat.Unlisted = t.back() == "unlisted";
+			if (mat.Unlisted)
+				t.pop_back();
+			if (t.size() != 8 && t.size() != 9) fail("material needs a name, shader, texture set and tint");
+			mat.Name = t[1];
+			mat.PixelShader = t[2];
+			mat.TextureSet = t[3] == "-" ? "" : t[3];
+			mat.ColorTint = XMFLOAT4(number(4), number(5), number(6), number(7));
+			mat.Roughness = t.size() == 9 ? number(8) : 0.0f;
+			materialLookup[mat.Name] = (uint32_t)scene.Materials.size();
+			scene.Materials.push_back(mat);
+		}
+		else if (t[0] == "entity")
+		{
+			if (t.size() != 6 && t.size() != 9 && t.size() != 12) fail("entity needs a mesh, material and position");
+
+			auto mesh = meshLookup.find(t[1]);
+			if (mesh == meshLookup.end()) fail("unknown mesh \"" + t[1] + "\"");
+			auto material = materialLookup.find(t[2]);
+			if (material == materialLookup.end()) fail("unknown material \"" + t[2] + "\"");
+
+			scene.EntityMeshes.push_back(mesh->second);
+			scene.EntityMaterials.push_back(material->second);
+			scene.Positions.push_back(XMFLOAT3(number(3), number(4), number(5)));
+			scene.Rotations.push_back(t.size() >= 9 ? XMFLOAT3(number(6), number(7), number(8)) : XMFLOAT3(0, 0, 0));
+			scene.Scales.push_back(t.size() == 12 ? XMFLOAT3(number(9), number(10), number(11)) : XMFLOAT3(1, 1, 1));
+		}
+		else
+		{
+			fail("unknown keyword \"" + t[0] + "\"");
+		}
+	}
+
+	return scene;
+}
+
+// --------------------------------------------------------
+// Writes the binary form of a scene - see SceneFileHeader
+// --------------------------------------------------------
+bool CookScene(const SceneDesc& scene, const std::string& path)
+{
+	// Gather strings, storing each unique one once
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> stringLookup;
+	auto addString = [&](const std::string& s)
+		{
+			auto it = stringLookup.find(s);
+			if (it != stringLookup.end())
+				return it->second;
+			uint32_t offset = (uint32_t)strings.size();
+			strings.append(s);
+			strings.push_back('\0');
+			stringLookup[s] = offset;
+			return offset;
+		};
+
+	addString(""); // Offset 0 is always the empty string
+
+	std::vector<SceneFileMesh> meshes;
+	for (auto& m : scene.Meshes)
+		meshes.push_back({ addString(m.Name), addString(m.Path) });
+
+	std::vector<SceneFileMaterial> materials;
+	for (auto& m : scene.Materials)
+	{
+		SceneFileMaterial fm = {};
+		fm.Name = addString(m.Name);
+		fm.PixelShader = addString(m.PixelShader);
+		fm.TextureSet = addString(m.TextureSet);
+		fm.ColorTint[0] = m.ColorTint.x;
+		fm.ColorTint[1] = m.ColorTint.y;
+		fm.ColorTint[2] = m.ColorTint.z;
+		fm.ColorTint[3] = m.ColorTint.w;
+		fm.Roughness = m.Roughness;
+		fm.Unlisted = m.Unlisted ? 1 : 0;
+		materials.push_back(fm);
+	}
+
+	// Lay out the sections one after another
+	uint32_t entityCount = (uint32_t)scene.EntityMeshes.size();
+	SceneFileHeader header = {};
+	memcpy(header.Magic, "SCNB", 4);
+	header.Version = SceneFileVersion;
+	header.MeshCount = (uint32_t)meshes.size();
+	header.MaterialCount = (uint32_t)materials.size();
+	header.EntityCount = entityCount;
+
+	uint32_t offset = sizeof(SceneFileHeader);
+	auto place = [&](uint32_t& field, size_t bytes)
+		{
+			field = offset;
+			offset += (uint32_t)((bytes + 3) & ~(size_t)3);
+		};
+	place(header.MeshOffset, sizeof(SceneFileMesh) * meshes.size());
+	place(header.MaterialOffset, sizeof(SceneFileMaterial) * materials.size());
+	place(header.EntityMeshOffset, sizeof(uint32_t) * entityCount);
+	place(header.EntityMaterialOffset, sizeof(uint32_t) * entityCount);
+	place(header.PositionOffset, sizeof(XMFLOAT3) * entityCount);
+	place(header.RotationOffset, sizeof(XMFLOAT3) * entityCount);
+	place(header.ScaleOffset, sizeof(XMFLOAT3) * entityCount);
+	place(header.StringOffset, strings.size());
+	header.StringSize = (uint32_t)strings.size();
+
+	std::vector<unsigned char> bytes(offset, 0);
+	auto write = [&](uint32_t at, const void* src, size_t size)
+		{
+			if (size > 0) memcpy(&bytes[at], src, size);
+		};
+	write(0, &header, sizeof(header));
+	write(header.MeshOffset, meshes.data(), sizeof(SceneFileMesh) * meshes.size());
+	write(header.MaterialOffset, materials.data(), sizeof(SceneFileMaterial) * materials.size());
+	write(header.EntityMeshOffset, scene.EntityMeshes.data(), sizeof(uint32_t) * entityCount);
+	write(header.EntityMaterialOffset, scene.EntityMaterials.data(), sizeof(uint32_t) * entityCount);
+	write(header.PositionOffset, scene.Positions.data(), sizeof(XMFLOAT3) * entityCount);
+	write(header.RotationOffset, scene.Rotations.data(), sizeof(XMFLOAT3) * entityCount);
+	write(header.ScaleOffset, scene.Scales.data(), sizeof(XMFLOAT3) * entityCount);
+	write(header.StringOffset, strings.data(), strings.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+	file.write((const char*)bytes.data(), bytes.size());
+	return file.good();
+}
+
+SceneFile::~SceneFile()
+{
+	Close();
+}
+
+// --------------------------------------------------------
+// Maps a cooked scene into memory and checks that every
+// section (and every index and string) is in bounds
+// --------------------------------------------------------
+bool SceneFile::Open(const std::string& path)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+	file = f;
+
+	LARGE_INTEGER fileSize = {};
+	GetFileSizeEx(f, &fileSize);
+	size = (size_t)fileSize.QuadPart;
+	if (size > 0)
+	{
+		mapping = CreateFileMappingA(f, 0, PAGE_READONLY, 0, 0, 0);
+		if (mapping)
+			data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info = {};
+	fstat(fd, &info);
+	size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		void* view = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			data = (const unsigned char*)view;
+			madvise(view, size, MADV_SEQUENTIAL);
+		}
+	}
+	close(fd); // The mapping keeps the file alive
+#endif
+
+	header = (const SceneFileHeader*)data;
+	if (!data || !Validate())
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SceneFile::Close()
+{
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+	mapping = 0;
+	file = 0;
+#else
+	if (data) munmap((void*)data, size);
+#endif
+	data = 0;
+	header = 0;
+	size = 0;
+}
+
+bool SceneFile::Validate() const
+{
+	if (size < sizeof(SceneFileHeader) ||
+		memcmp(header->Magic, "SCNB", 4) != 0 ||
+		header->Version != SceneFileVersion)
+		return false;
+
+	auto inBounds = [&](uint32_t offset, uint64_t count, uint64_t stride)
+		{
+			return offset % 4 == 0 && (uint64_t)offset + count * stride <= size;
+		};
+
+	uint32_t n = header->EntityCount;
+	if (!inBounds(header->MeshOffset, header->MeshCount, sizeof(SceneFileMesh)) ||
+		!inBounds(header->MaterialOffset, header->MaterialCount, sizeof(SceneFileMaterial)) ||
+		!inBounds(header->EntityMeshOffset, n, sizeof(uint32_t)) ||
+		!inBounds(header->EntityMaterialOffset, n, sizeof(uint32_t)) ||
+		!inBounds(header->PositionOffset, n, sizeof(XMFLOAT3)) ||
+		!inBounds(header->RotationOffset, n, sizeof(XMFLOAT3)) ||
+		!inBounds(header->ScaleOffset, n, sizeof(XMFLOAT3)) ||
+		!inBounds(header->StringOffset, header->StringSize, 1))
+		return false;
+
+	// Strings must all be terminated inside the block
+	const char* strings = GetString(0);
+	if (header->StringSize == 0 || strings[header->StringSize - 1] != '\0')
+		return false;
+	auto validString = [&](uint32_t offset) { return offset < header->StringSize; };
+
+	for (uint32_t i = 0; i < header->MeshCount; i++)
+		if (!validString(GetMeshes()[i].Name) || !validString(GetMeshes()[i].Path))
+			return false;
+	for (uint32_t i = 0; i < header->MaterialCount; i++)
+	{
+		const SceneFileMaterial& m = GetMaterials()[i];
+		if (!validString(m.Name) || !validString(m.PixelShader) || !validString(m.TextureSet))
+			return false;
+	}
+
+	const uint32_t* meshes = GetEntityMeshes();
+	const uint32_t* materials = GetEntityMaterials();
+	for (uint32_t i = 0; i < n; i++)
+		if (meshes[i] >= header->MeshCount || materials[i] >= header->MaterialCount)
+			return false;
+
+	return true;
+}
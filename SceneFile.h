@@ -0,0 +1,137 @@
+#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Scene description
+//
+// Scenes are written as text (see Assets/Scenes/*.scene)
+// and cooked into a compact binary file, which is loaded
+// with a single memory mapping.  Entities are stored as
+// parallel arrays, so loading is a walk over flat memory.
+// --------------------------------------------------------
+
+struct SceneMeshDesc
+{
+	std::string Name;
+	std::string Path;			// Relative to the executable
+};
+
+struct SceneMaterialDesc
+{
+	std::string Name;
+	std::string PixelShader;	// Name the game registered the shader under
+	std::string TextureSet;		// PBR texture set, or empty for none
+	DirectX::XMFLOAT4 ColorTint;
+	float Roughness;
+	bool Unlisted;				// Only for the scene's own entities
+};
+
+// The parsed (text) form of a scene
+struct SceneDesc
+{
+	std::vector<SceneMeshDesc> Meshes;
+	std::vector<SceneMaterialDesc> Materials;
+
+	// One element per entity in each
+	std::vector<uint32_t> EntityMeshes;
+	std::vector<uint32_t> EntityMaterials;
+	std::vector<DirectX::XMFLOAT3> Positions;
+	std::vector<DirectX::XMFLOAT3> Rotations;
+	std::vector<DirectX::XMFLOAT3> Scales;
+};
+
+// --------------------------------------------------------
+// Binary layout - every section is 4 byte aligned and
+// located by an offset from the start of the file
+// --------------------------------------------------------
+const uint32_t SceneFileVersion = 2;
+
+struct SceneFileHeader
+{
+	char Magic[4];				// "SCNB"
+	uint32_t Version;
+	uint32_t MeshCount;
+	uint32_t MaterialCount;
+	uint32_t EntityCount;
+	uint32_t MeshOffset;		// SceneFileMesh[MeshCount]
+	uint32_t MaterialOffset;	// SceneFileMaterial[MaterialCount]
+	uint32_t EntityMeshOffset;	// uint32_t[EntityCount]
+	uint32_t EntityMaterialOffset;
+	uint32_t PositionOffset;	// XMFLOAT3[EntityCount]
+	uint32_t RotationOffset;
+	uint32_t ScaleOffset;
+	uint32_t StringOffset;		// Null terminated strings
+	uint32_t StringSize;
+};
+
+// Strings are offsets into the string block
+struct SceneFileMesh
+{
+	uint32_t Name;
+	uint32_t Path;
+};
+
+struct SceneFileMaterial
+{
+	uint32_t Name;
+	uint32_t PixelShader;
+	uint32_t TextureSet;
+	float ColorTint[4];
+	float Roughness;
+	uint32_t Unlisted;
+};
+
+// Text <-> binary
+// - Parsing throws std::invalid_argument (with the line number)
+//   on a malformed file, like the OBJ loader in Mesh
+SceneDesc ParseSceneText(const std::string& path);
+bool CookScene(const SceneDesc& scene, const std::string& path);
+
+// --------------------------------------------------------
+// A cooked scene file, mapped into memory
+// - Everything returned points straight into the mapping,
+//   so it's only valid until Close()
+// --------------------------------------------------------
+class SceneFile
+{
+public:
+	SceneFile() = default;
+	~SceneFile();
+	SceneFile(const SceneFile&) = delete;
+	SceneFile& operator=(const SceneFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	uint32_t GetMeshCount() const { return header->MeshCount; }
+	uint32_t GetMaterialCount() const { return header->MaterialCount; }
+	uint32_t GetEntityCount() const { return header->EntityCount; }
+
+	const SceneFileMesh* GetMeshes() const { return Section<SceneFileMesh>(header->MeshOffset); }
+	const SceneFileMaterial* GetMaterials() const { return Section<SceneFileMaterial>(header->MaterialOffset); }
+	const uint32_t* GetEntityMeshes() const { return Section<uint32_t>(header->EntityMeshOffset); }
+	const uint32_t* GetEntityMaterials() const { return Section<uint32_t>(header->EntityMaterialOffset); }
+	const DirectX::XMFLOAT3* GetPositions() const { return Section<DirectX::XMFLOAT3>(header->PositionOffset); }
+	const DirectX::XMFLOAT3* GetRotations() const { return Section<DirectX::XMFLOAT3>(header->RotationOffset); }
+	const DirectX::XMFLOAT3* GetScales() const { return Section<DirectX::XMFLOAT3>(header->ScaleOffset); }
+	const char* GetString(uint32_t offset) const { return Section<char>(header->StringOffset) + offset; }
+
+private:
+	template<typename T>
+	const T* Section(uint32_t offset) const { return reinterpret_cast<const T*>(data + offset); }
+
+	bool Validate() const;
+
+	const unsigned char* data = 0;
+	size_t size = 0;
+	const SceneFileHeader* header = 0;
+
+	// Platform handles for the mapping
+#ifdef _WIN32
+	void* file = 0;
+	void* mapping = 0;
+#endif
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+// --------------------------------------------------------
+// Generated by GenerateCBufferStructs() from the compiled
+// shaders - don't edit by hand.  Debug builds check these
+// at start up, and write out a fresh copy if they differ.
+// --------------------------------------------------------
+
+#include <cstddef>
+#include <DirectXMath.h>
+#include "CBufferLayout.h"
+#include "Light.h"
+
+// PerFrame in VertexShader.cso
+inline constexpr CBufferField VertexShaderPerFrameFields[] =
+{
+	{ "view", 0, 64 },
+	{ "projection", 64, 64 },
+	{ "shadowView", 128, 64 },
+	{ "shadowProjection", 192, 64 },
+};
+
+struct VertexShaderPerFrame
+{
+	DirectX::XMFLOAT4X4 view;
+	DirectX::XMFLOAT4X4 projection;
+	DirectX::XMFLOAT4X4 shadowView;
+	DirectX::XMFLOAT4X4 shadowProjection;
+
+	static constexpr CBufferLayout Layout = { "PerFrame", 256, VertexShaderPerFrameFields, 4 };
+};
+static_assert(sizeof(VertexShaderPerFrame) == 256, "VertexShaderPerFrame size");
+static_assert(offsetof(VertexShaderPerFrame, view) == 0 && sizeof(VertexShaderPerFrame::view) == 64, "VertexShaderPerFrame::view");
+static_assert(offsetof(VertexShaderPerFrame, projection) == 64 && sizeof(VertexShaderPerFrame::projection) == 64, "VertexShaderPerFrame::projection");
+static_assert(offsetof(VertexShaderPerFrame, shadowView) == 128 && sizeof(VertexShaderPerFrame::shadowView) == 64, "VertexShaderPerFrame::shadowView");
+static_assert(offsetof(VertexShaderPerFrame, shadowProjection) == 192 && sizeof(VertexShaderPerFrame::shadowProjection) == 64, "VertexShaderPerFrame::shadowProjection");
+
+// PerObject in VertexShader.cso
+inline constexpr CBufferField VertexShaderPerObjectFields[] =
+{
+	{ "world", 0, 64 },
+	{ "worldInvTrans", 64, 64 },
+	{ "lightRange", 128, 8 },
+};
+
+struct VertexShaderPerObject
+{
+	DirectX::XMFLOAT4X4 world;
+	DirectX::XMFLOAT4X4 worldInvTrans;
+	DirectX::XMUINT2 lightRange;
+	float pad0[2];
+
+	static constexpr CBufferLayout Layout = { "PerObject", 144, VertexShaderPerObjectFields, 3 };
+};
+static_assert(sizeof(VertexShaderPerObject) == 144, "VertexShaderPerObject size");
+static_assert(offsetof(VertexShaderPerObject, world) == 0 && sizeof(VertexShaderPerObject::world) == 64, "VertexShaderPerObject::world");
+static_assert(offsetof(VertexShaderPerObject, worldInvTrans) == 64 && sizeof(VertexShaderPerObject::worldInvTrans) == 64, "VertexShaderPerObject::worldInvTrans");
+static_assert(offsetof(VertexShaderPerObject, lightRange) == 128 && sizeof(VertexShaderPerObject::lightRange) == 8, "VertexShaderPerObject::lightRange");
+
+// PerFrame in PixelShader.cso
+inline constexpr CBufferField PixelShaderPerFrameFields[] =
+{
+	{ "ambientColor", 0, 12 },
+	{ "cameraPosition", 16, 12 },
+	{ "shadowMapSize", 32, 8 },
+	{ "viewDepth", 48, 16 },
+	{ "clusterTileScale", 64, 8 },
+	{ "clusterDepthScale", 72, 8 },
+	{ "clusterCounts", 80, 12 },
+	{ "skySpecularMips", 92, 4 },
+	{ "skyIrradiance", 96, 112 },
+};
+
+struct PixelShaderPerFrame
+{
+	DirectX::XMFLOAT3 ambientColor;
+	float pad0[1];
+	DirectX::XMFLOAT3 cameraPosition;
+	float pad1[1];
+	DirectX::XMFLOAT2 shadowMapSize;
+	float pad2[2];
+	DirectX::XMFLOAT4 viewDepth;
+	DirectX::XMFLOAT2 clusterTileScale;
+	DirectX::XMFLOAT2 clusterDepthScale;
+	DirectX::XMUINT3 clusterCounts;
+	float skySpecularMips;
+	DirectX::XMFLOAT4 skyIrradiance[7];
+
+	static constexpr CBufferLayout Layout = { "PerFrame", 208, PixelShaderPerFrameFields, 9 };
+};
+static_assert(sizeof(PixelShaderPerFrame) == 208, "PixelShaderPerFrame size");
+static_assert(offsetof(PixelShaderPerFrame, ambientColor) == 0 && sizeof(PixelShaderPerFrame::ambientColor) == 12, "PixelShaderPerFrame::ambientColor");
+static_assert(offsetof(PixelShaderPerFrame, cameraPosition) == 16 && sizeof(PixelShaderPerFrame::cameraPosition) == 12, "PixelShaderPerFrame::cameraPosition");
+static_assert(offsetof(PixelShaderPerFrame, shadowMapSize) == 32 && sizeof(PixelShaderPerFrame::shadowMapSize) == 8, "PixelShaderPerFrame::shadowMapSize");
+static_assert(offsetof(PixelShaderPerFrame, viewDepth) == 48 && sizeof(PixelShaderPerFrame::viewDepth) == 16, "PixelShaderPerFrame::viewDepth");
+static_assert(offsetof(PixelShaderPerFrame, clusterTileScale) == 64 && sizeof(PixelShaderPerFrame::clusterTileScale) == 8, "PixelShaderPerFrame::clusterTileScale");
+static_assert(offsetof(PixelShaderPerFrame, clusterDepthScale) == 72 && sizeof(PixelShaderPerFrame::clusterDepthScale) == 8, "PixelShaderPerFrame::clusterDepthScale");
+static_assert(offsetof(PixelShaderPerFrame, clusterCounts) == 80 && sizeof(PixelShaderPerFrame::clusterCounts) == 12, "PixelShaderPerFrame::clusterCounts");
+static_assert(offsetof(PixelShaderPerFrame, skySpecularMips) == 92 && sizeof(PixelShaderPerFrame::skySpecularMips) == 4, "PixelShaderPerFrame::skySpecularMips");
+static_assert(offsetof(PixelShaderPerFrame, skyIrradiance) == 96 && sizeof(PixelShaderPerFrame::skyIrradiance) == 112, "PixelShaderPerFrame::skyIrradiance");
+
+// PerMaterial in PixelShader.cso
+inline constexpr CBufferField PixelShaderPerMaterialFields[] =
+{
+	{ "colorTint", 0, 16 },
+	{ "roughness", 16, 4 },
+	{ "uvScale", 20, 8 },
+	{ "uvOffset", 32, 8 },
+};
+
+struct PixelShaderPerMaterial
+{
+	DirectX::XMFLOAT4 colorTint;
+	float roughness;
+	DirectX::XMFLOAT2 uvScale;
+	float pad0[1];
+	DirectX::XMFLOAT2 uvOffset;
+	float pad1[2];
+
+	static constexpr CBufferLayout Layout = { "PerMaterial", 48, PixelShaderPerMaterialFields, 4 };
+};
+static_assert(sizeof(PixelShaderPerMaterial) == 48, "PixelShaderPerMaterial size");
+static_assert(offsetof(PixelShaderPerMaterial, colorTint) == 0 && sizeof(PixelShaderPerMaterial::colorTint) == 16, "PixelShaderPerMaterial::colorTint");
+static_assert(offsetof(PixelShaderPerMaterial, roughness) == 16 && sizeof(PixelShaderPerMaterial::roughness) == 4, "PixelShaderPerMaterial::roughness");
+static_assert(offsetof(PixelShaderPerMaterial, uvScale) == 20 && sizeof(PixelShaderPerMaterial::uvScale) == 8, "PixelShaderPerMaterial::uvScale");
+static_assert(offsetof(PixelShaderPerMaterial, uvOffset) == 32 && sizeof(PixelShaderPerMaterial::uvOffset) == 8, "PixelShaderPerMaterial::uvOffset");
+
@@ -0,0 +1,265 @@
+#include "ShaderCache.h"
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Bump whenever the layout below (or DXBCReflection) changes
+	const uint32_t ShaderCacheVersion = 2;
+
+	// --------------------------------------------------------
+	// File layout - all little endian:
+	//  "SHDC", version, entry count, then per entry:
+	//  key (8 bytes), then the cbuffers (each with their
+	//  variables), resources and inputs, every list led by
+	//  its count and every string by its length
+	// --------------------------------------------------------
+	struct Writer
+	{
+		std::vector<char> Data;
+
+		void Bytes(const void* data, size_t size) { Data.insert(Data.end(), (const char*)data, (const char*)data + size); }
+		void U64(uint64_t v) { Bytes(&v, 8); }
+		void U32(uint32_t v) { Bytes(&v, 4); }
+		void U16(uint16_t v) { Bytes(&v, 2); }
+		void U8(uint8_t v) { Bytes(&v, 1); }
+		void String(const std::string& s) { U32((uint32_t)s.size()); Bytes(s.data(), s.size()); }
+	};
+
+	// Every read fails rather than running off the end
+	struct Reader
+	{
+		const char* Data;
+		size_t Size;
+		size_t Position = 0;
+
+		bool Bytes(void* out, size_t size)
+		{
+			if (Size - Position < size) return false;
+			memcpy(out, Data + Position, size);
+			Position += size;
+			return true;
+		}
+		bool U64(uint64_t* v) { return Bytes(v, 8); }
+		bool U32(uint32_t* v) { return Bytes(v, 4); }
+		bool U16(uint16_t* v) { return Bytes(v, 2); }
+		bool U8(uint8_t* v) { return Bytes(v, 1); }
+		bool String(std::string* s)
+		{
+			uint32_t length;
+			if (!U32(&length) || Size - Position < length) return false;
+			s->assign(Data + Position, length);
+			Position += length;
+			return true;
+		}
+
+		// Guards against absurd counts before resizing
+		bool Count(uint32_t* count)
+		{
+			return U32(count) && *count <= Size - Position;
+		}
+	};
+
+	void WriteReflection(Writer& w, const DXBCReflection& r)
+	{
+		w.U32((uint32_t)r.ConstantBuffers.size());
+		for (auto& cb : r.ConstantBuffers)
+		{
+			w.String(cb.Name);
+			w.U32(cb.Type);
+			w.U32(cb.Size);
+			w.U32(cb.BindPoint);
+			w.U32((uint32_t)cb.Variables.size());
+			for (auto& v : cb.Variables)
+			{
+				w.String(v.Name);
+				w.U32(v.StartOffset);
+				w.U32(v.Size);
+				w.U16(v.Class);
+				w.U16(v.Type);
+				w.U16(v.Rows);
+				w.U16(v.Columns);
+				w.U16(v.Elements);
+				w.String(v.TypeName);
+			}
+		}
+
+		w.U32((uint32_t)r.Resources.size());
+		for (auto& res : r.Resources)
+		{
+			w.String(res.Name);
+			w.U32(res.Type);
+			w.U32(res.BindPoint);
+			w.U32(res.BindCount);
+		}
+
+		w.U32((uint32_t)r.Inputs.size());
+		for (auto& e : r.Inputs)
+		{
+			w.String(e.SemanticName);
+			w.U32(e.SemanticIndex);
+			w.U32(e.Register);
+			w.U32(e.SystemValue);
+			w.U32(e.ComponentType);
+			w.U8(e.Mask);
+		}
+	}
+
+	bool ReadReflection(Reader& r, DXBCReflection* out)
+	{
+		uint32_t count;
+		if (!r.Count(&count)) return false;
+		out->ConstantBuffers.resize(count);
+		for (auto& cb : out->ConstantBuffers)
+		{
+			uint32_t varCount;
+			if (!r.String(&cb.Name) || !r.U32(&cb.Type) || !r.U32(&cb.Size) || !r.U32(&cb.BindPoint) || !r.Count(&varCount))
+				return false;
+
+			cb.Variables.resize(varCount);
+			for (auto& v : cb.Variables)
+			{
+				if (!r.String(&v.Name) || !r.U32(&v.StartOffset) || !r.U32(&v.Size) ||
+					!r.U16(&v.Class) || !r.U16(&v.Type) || !r.U16(&v.Rows) || !r.U16(&v.Columns) || !r.U16(&v.Elements) ||
+					!r.String(&v.TypeName))
+					return false;
+			}
+		}
+
+		if (!r.Count(&count)) return false;
+		out->Resources.resize(count);
+		for (auto& res : out->Resources)
+		{
+			if (!r.String(&res.Name) || !r.U32(&res.Type) || !r.U32(&res.BindPoint) || !r.U32(&res.BindCount))
+				return false;
+		}
+
+		if (!r.Count(&count)) return false;
+		out->Inputs.resize(count);
+		for (auto& e : out->Inputs)
+		{
+			if (!r.String(&e.SemanticName) || !r.U32(&e.SemanticIndex) || !r.U32(&e.Register) ||
+				!r.U32(&e.SystemValue) || !r.U32(&e.ComponentType) || !r.U8(&e.Mask))
+				return false;
+		}
+
+		return true;
+	}
+}
+
+// --------------------------------------------------------
+// Reads the whole cache file in one go
+//
+// A missing, old or damaged file just leaves the cache
+// empty - it'll be filled (and rewritten) as shaders load
+// --------------------------------------------------------
+bool ShaderCache::Load(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	dirty = false;
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::vector<char> data((size_t)file.tellg());
+	file.seekg(0);
+	if (!file.read(data.data(), data.size()))
+		return false;
+
+	Reader r = { data.data(), data.size() };
+	char magic[4];
+	uint32_t version, count;
+	if (!r.Bytes(magic, 4) || memcmp(magic, "SHDC", 4) != 0 ||
+		!r.U32(&version) || version != ShaderCacheVersion ||
+		!r.U32(&count))
+		return false;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t key;
+		DXBCReflection reflection;
+		if (!r.U64(&key) || !ReadReflection(r, &reflection))
+		{
+			entries.clear();
+			return false;
+		}
+		entries[key] = std::move(reflection);
+	}
+
+	return true;
+}
+
+bool ShaderCache::Save(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Writer w;
+	w.Bytes("SHDC", 4);
+	w.U32(ShaderCacheVersion);
+	w.U32((uint32_t)entries.size());
+	for (auto& e : entries)
+	{
+		w.U64(e.first);
+		WriteReflection(w, e.second);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open() || !file.write(w.Data.data(), w.Data.size()))
+		return false;
+
+	dirty = false;
+	return true;
+}
+
+bool ShaderCache::Find(uint64_t key, DXBCReflection* reflection)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = entries.find(key);
+	if (it == entries.end())
+	{
+		misses++;
+		return false;
+	}
+
+	*reflection = it->second;
+	hits++;
+	return true;
+}
+
+void ShaderCache::Add(uint64_t key, const DXBCReflection& reflection)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries[key] = reflection;
+	dirty = true;
+}
+
+// --------------------------------------------------------
+// DXBC containers start with "DXBC" and a 16 byte checksum
+// of everything after it - folded to 64 bits along with the
+// size.  Anything else gets a 64 bit FNV-1a of every byte.
+// --------------------------------------------------------
+uint64_t ShaderCache::HashBytecode(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (size >= 20 && memcmp(bytes, "DXBC", 4) == 0)
+	{
+		uint64_t a, b;
+		memcpy(&a, bytes + 4, 8);
+		memcpy(&b, bytes + 12, 8);
+		return a ^ (b * 0x9E3779B97F4A7C15ull) ^ size;
+	}
+
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "DXBCReflection.h"
+
+// --------------------------------------------------------
+// Remembers the reflection data of every shader seen, keyed
+// by a hash of its bytecode, and keeps it on disk between
+// runs so shader start up can skip reflection entirely
+//
+// - The whole file is read with a single read, and only
+//   written back if something new was added
+// - Entries for shaders that changed are simply never hit
+//   again, since their bytecode hash is different
+// - Safe to use from several loading threads at once
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class ShaderCache
+{
+public:
+	bool Load(const std::string& path);
+	bool Save(const std::string& path);
+
+	bool Find(uint64_t key, DXBCReflection* reflection);
+	void Add(uint64_t key, const DXBCReflection& reflection);
+
+	// DXBC containers already carry a checksum of their
+	// contents, which is used when present
+	static uint64_t HashBytecode(const void* data, size_t size);
+
+	bool IsDirty() const { return dirty; }
+	size_t GetEntryCount() const { return entries.size(); }
+	unsigned int GetHits() const { return hits; }
+	unsigned int GetMisses() const { return misses; }
+
+private:
+	std::mutex mutex;
+	std::unordered_map<uint64_t, DXBCReflection> entries;
+	bool dirty = false;
+
+	std::atomic<unsigned int> hits = 0;
+	std::atomic<unsigned int> misses = 0;
+};
@@ -12,6 +12,19 @@ struct VertexShaderInput
     float3 tangent : TANGENT;
 };
 
+// VS input for hardware instancing - the "_PER_INSTANCE" semantics
+// are picked up by SimpleShader and read from input slot 1
+struct VertexShaderInput_Instanced
+{
+    float3 localPosition : POSITION;
+    float2 uv : TEXCOORD;
+    float3 normal : NORMAL;
+    float3 tangent : TANGENT;
+    
+    float4x4 world : WORLD_PER_INSTANCE;
+    float4x4 worldInvTrans : WORLDINVTRANS_PER_INSTANCE;
+    uint2 lightRange : LIGHTRANGE_PER_INSTANCE;
+};
 
 
 // VS Output / PS Input struct for basic lighting
@@ -23,6 +36,10 @@ struct VertexToPixel
     float3 tangent : TANGENT;
     float3 worldPos : POSITION;
     float4 shadowPos : SHADOW_POSITION;
+    
+    // The object's offset and count in the per entity light
+    // lists (see EntityLightLists.h), when they're in use
+    nointerpolation uint2 lightRange : LIGHT_RANGE;
 };
 
 struct VertexToPixel_Sky
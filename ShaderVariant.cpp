@@ -0,0 +1,78 @@
+#include "ShaderVariant.h"
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const char* featureNames[] = { "NORMAL_MAP", "ROUGHNESS_MAP", "METALNESS_MAP", "SHADOWS" };
+	const char lightTypeLetters[] = { 'D', 'P', 'S' };
+}
+
+ShaderVariantKey NormalizeVariantKey(ShaderVariantKey key)
+{
+	key.Features &= ShaderFeatureAll;
+	key.LightTypes &= ShaderLightTypesAll;
+
+	// The filter is centered, so widths are odd - and it
+	// only exists at all when shadows are on
+	if (key.Features & ShaderFeatureShadows)
+	{
+		if (key.PCFTaps < 1) key.PCFTaps = 1;
+		if (key.PCFTaps > ShaderMaxPCFTaps) key.PCFTaps = ShaderMaxPCFTaps;
+		key.PCFTaps |= 1;
+	}
+	else
+		key.PCFTaps = 0;
+
+	return key;
+}
+
+// --------------------------------------------------------
+// Packs the normalized fields (which all fit in a byte),
+// then mixes the bits (splitmix64's finalizer) so the
+// keys spread across hash table buckets
+// --------------------------------------------------------
+uint64_t HashVariantKey(const ShaderVariantKey& key)
+{
+	ShaderVariantKey k = NormalizeVariantKey(key);
+	uint64_t h = (uint64_t)k.Features | ((uint64_t)k.PCFTaps << 8) | ((uint64_t)k.LightTypes << 16);
+
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	return h;
+}
+
+std::vector<std::pair<std::string, std::string>> GetVariantDefines(const ShaderVariantKey& key)
+{
+	ShaderVariantKey k = NormalizeVariantKey(key);
+
+	std::vector<std::pair<std::string, std::string>> defines;
+	for (uint32_t f = 0; f < sizeof(featureNames) / sizeof(featureNames[0]); f++)
+		defines.push_back({ featureNames[f], (k.Features & (1 << f)) ? "1" : "0" });
+	defines.push_back({ "PCF_TAPS", std::to_string(k.PCFTaps) });
+	defines.push_back({ "LIGHT_MASK", std::to_string(k.LightTypes) });
+	return defines;
+}
+
+std::string DescribeVariant(const ShaderVariantKey& key)
+{
+	ShaderVariantKey k = NormalizeVariantKey(key);
+
+	std::string description;
+	for (uint32_t f = 0; f < sizeof(featureNames) / sizeof(featureNames[0]); f++)
+		if (k.Features & (1 << f))
+			description += std::string(featureNames[f]) + " ";
+	if (k.Features & ShaderFeatureShadows)
+		description += "PCF_TAPS=" + std::to_string(k.PCFTaps) + " ";
+
+	description += "LIGHTS=";
+	for (uint32_t t = 0; t < sizeof(lightTypeLetters); t++)
+		if (k.LightTypes & (1 << t))
+			description += lightTypeLetters[t];
+	if (k.LightTypes == 0)
+		description += "none";
+	return description;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --------------------------------------------------------
+// Describes one compiled variant of an uber shader (like
+// PixelShader.hlsl) - which of its optional features are
+// compiled in.  Each becomes a preprocessor define.
+//
+// Has no graphics API dependencies, so keys can be built,
+// hashed and turned into defines outside of the renderer
+// --------------------------------------------------------
+
+// Features that are simply on or off
+enum ShaderFeature : uint32_t
+{
+	ShaderFeatureNormalMap		= 1 << 0,	// NORMAL_MAP
+	ShaderFeatureRoughnessMap	= 1 << 1,	// ROUGHNESS_MAP
+	ShaderFeatureMetalnessMap	= 1 << 2,	// METALNESS_MAP
+	ShaderFeatureShadows		= 1 << 3,	// SHADOWS
+};
+
+const uint32_t ShaderFeatureAll = (1 << 4) - 1;
+const uint32_t ShaderLightTypesAll = (1 << 3) - 1;
+const uint32_t ShaderMaxPCFTaps = 7;
+
+struct ShaderVariantKey
+{
+	uint32_t Features = 0;		// ShaderFeature bits
+	uint32_t PCFTaps = 1;		// PCF_TAPS - shadow filter width, odd
+	uint32_t LightTypes = 0;	// LIGHT_MASK - bit (1 << LIGHT_TYPE_*) per type handled
+
+	bool operator==(const ShaderVariantKey& other) const
+	{
+		return Features == other.Features && PCFTaps == other.PCFTaps && LightTypes == other.LightTypes;
+	}
+};
+
+// Clears out anything that doesn't change the compiled code,
+// so equivalent keys end up sharing a single variant
+ShaderVariantKey NormalizeVariantKey(ShaderVariantKey key);
+
+// Unique for every normalized key
+uint64_t HashVariantKey(const ShaderVariantKey& key);
+
+// Every keyword with its value - all of them, so the shader's
+// own defaults never apply to a variant
+std::vector<std::pair<std::string, std::string>> GetVariantDefines(const ShaderVariantKey& key);
+
+// For display, like "NORMAL_MAP SHADOWS PCF_TAPS=5 LIGHTS=DP"
+std::string DescribeVariant(const ShaderVariantKey& key);
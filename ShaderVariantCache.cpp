@@ -0,0 +1,85 @@
+#include "ShaderVariantCache.h"
+#include "SimpleShader.h"
+#include <chrono>
+#include <cstdio>
+#include <d3dcompiler.h>
+
+ShaderVariantCache::ShaderVariantCache(
+	Microsoft::WRL::ComPtr<ID3D11Device> device,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	const std::wstring& sourceFile,
+	std::shared_ptr<SimplePixelShader> fallback)
+	:
+	device(device),
+	context(context),
+	sourceFile(sourceFile),
+	fallback(fallback)
+{
+}
+
+// --------------------------------------------------------
+// Finds (or compiles) the variant for a key - a hash and a
+// lookup once it exists, so this is cheap at bind time
+// --------------------------------------------------------
+std::shared_ptr<SimplePixelShader> ShaderVariantCache::GetVariant(const ShaderVariantKey& key)
+{
+	ShaderVariantKey normalized = NormalizeVariantKey(key);
+	uint64_t hash = HashVariantKey(normalized);
+
+	auto it = variants.find(hash);
+	if (it != variants.end())
+		return it->second.Shader;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::shared_ptr<SimplePixelShader> shader = Compile(normalized);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	Variant v;
+	v.Key = normalized;
+	v.Shader = shader ? shader : fallback;
+	v.Description = DescribeVariant(normalized);
+	v.CompileMs = std::chrono::duration<float, std::milli>(end - start).count();
+	v.Compiled = shader != 0;
+	variants[hash] = v;
+
+	totalCompileMs += v.CompileMs;
+	return v.Shader;
+}
+
+std::shared_ptr<SimplePixelShader> ShaderVariantCache::Compile(const ShaderVariantKey& key)
+{
+	// D3D wants the defines as a null terminated array
+	std::vector<std::pair<std::string, std::string>> defines = GetVariantDefines(key);
+	std::vector<D3D_SHADER_MACRO> macros;
+	for (auto& d : defines)
+		macros.push_back({ d.first.c_str(), d.second.c_str() });
+	macros.push_back({ 0, 0 });
+
+	UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
+#if defined(DEBUG) | defined(_DEBUG)
+	flags |= D3DCOMPILE_DEBUG;
+#endif
+
+	Microsoft::WRL::ComPtr<ID3DBlob> blob;
+	Microsoft::WRL::ComPtr<ID3DBlob> errors;
+	HRESULT hr = D3DCompileFromFile(
+		sourceFile.c_str(),
+		macros.data(),
+		D3D_COMPILE_STANDARD_FILE_INCLUDE,
+		"main",
+		"ps_5_0",
+		flags,
+		0,
+		blob.GetAddressOf(),
+		errors.GetAddressOf());
+
+	if (FAILED(hr))
+	{
+		if (errors)
+			printf("ShaderVariantCache - %s failed to compile:\n%s\n", DescribeVariant(key).c_str(), (const char*)errors->GetBufferPointer());
+		return 0;
+	}
+
+	std::shared_ptr<SimplePixelShader> shader = std::make_shared<SimplePixelShader>(device, context, blob);
+	return shader->IsShaderValid() ? shader : 0;
+}
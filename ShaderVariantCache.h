@@ -0,0 +1,54 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ShaderVariant.h"
+
+class SimplePixelShader;
+
+// --------------------------------------------------------
+// Compiles variants of an uber pixel shader on first use
+// and keeps them, keyed by HashVariantKey()
+//
+// - Compiles from the .hlsl source with D3DCompileFromFile,
+//   so it's only available when the source is - anything
+//   that fails to compile gets the fallback shader instead
+//   (normally the same source compiled with its defaults)
+// --------------------------------------------------------
+class ShaderVariantCache
+{
+public:
+	ShaderVariantCache(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		const std::wstring& sourceFile,
+		std::shared_ptr<SimplePixelShader> fallback);
+
+	std::shared_ptr<SimplePixelShader> GetVariant(const ShaderVariantKey& key);
+	std::shared_ptr<SimplePixelShader> GetFallback() const { return fallback; }
+
+	struct Variant
+	{
+		ShaderVariantKey Key;
+		std::shared_ptr<SimplePixelShader> Shader;
+		std::string Description;
+		float CompileMs;
+		bool Compiled;		// False if this is the fallback
+	};
+	const std::unordered_map<uint64_t, Variant>& GetVariants() const { return variants; }
+	float GetTotalCompileMs() const { return totalCompileMs; }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	std::wstring sourceFile;
+	std::shared_ptr<SimplePixelShader> fallback;
+
+	std::unordered_map<uint64_t, Variant> variants;
+	float totalCompileMs = 0.0f;
+
+	std::shared_ptr<SimplePixelShader> Compile(const ShaderVariantKey& key);
+};
@@ -0,0 +1,17 @@
+#include "ShaderStructs.hlsli"
+
+// Constant Buffer for external (C++) data
+cbuffer externalData : register(b0)
+{
+    matrix view;
+    matrix projection;
+};
+// --------------------------------------------------------
+// Instanced version of ShadowVS.hlsl - world matrix comes
+// from the per-instance vertex buffer
+// --------------------------------------------------------
+float4 main(VertexShaderInput_Instanced input) : SV_POSITION
+{
+    float4 worldPos = mul(float4(input.localPosition, 1.0f), input.world);
+    return mul(projection, mul(view, worldPos));
+}
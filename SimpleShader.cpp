@@ -1,9 +1,20 @@
 #include "SimpleShader.h"
+#include "ConstantBufferRing.h"
+#include "FrameStats.h"
+#include "Graphics.h"
+#include "ShaderCache.h"
+#include <chrono>
+#include <cstring>
+#include <new>
 
 // Default error reporting state
 bool ISimpleShader::ReportErrors = false;
 bool ISimpleShader::ReportWarnings = false;
 
+// No upload ring or metadata cache unless the game provides them
+std::shared_ptr<ConstantBufferRing> ISimpleShader::UploadRing;
+std::shared_ptr<ShaderCache> ISimpleShader::MetadataCache;
+
 // To enable error reporting, use either or both 
 // of the following lines somewhere in your program, 
 // preferably before loading/using any shaders.
@@ -12,6 +23,140 @@ bool ISimpleShader::ReportWarnings = false;
 // ISimpleShader::ReportWarnings = true;
 
 
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Reserves room for count T's in a block that's being laid
+	// out, returning where they start
+	template<typename T>
+	size_t Reserve(size_t* size, size_t count, size_t alignment = alignof(T))
+	{
+		size_t offset = (*size + alignment - 1) & ~(alignment - 1);
+		*size = offset + sizeof(T) * count;
+		return offset;
+	}
+
+	// Points a table at its slots in the block being filled in
+	void PlaceTable(SimpleNameTable* table, SimpleNameEntry** slots, unsigned int count)
+	{
+		unsigned int slotCount = SimpleNameTable::SlotsFor(count);
+		table->Slots = *slots;
+		table->Mask = count > SimpleNameTable::LinearCount ? slotCount - 1 : 0;
+		table->Count = 0;
+		*slots += slotCount;
+	}
+
+	// Copies a name to the block and adds it to a table
+	const char* AddName(SimpleNameTable* table, char** names, const std::string& name, unsigned int index)
+	{
+		char* copy = *names;
+		memcpy(copy, name.c_str(), name.size() + 1);
+		*names += name.size() + 1;
+
+		table->Add(copy, name.size(), index);
+		return copy;
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ NAME TABLE -----------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+// --------------------------------------------------------
+// FNV-1a style, but four bytes at a time - every lookup by
+// name hashes it, so this is most of a lookup's cost
+// --------------------------------------------------------
+uint32_t SimpleNameTable::Hash(const char* name, size_t length)
+{
+	uint32_t h = 2166136261u;
+
+	size_t i = 0;
+	for (; i + 4 <= length; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, name + i, 4);
+		h = (h ^ word) * 16777619u;
+		h ^= h >> 15;
+	}
+	for (; i < length; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+
+	// Final mix, as only the low bits pick a slot
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	return h;
+}
+
+// --------------------------------------------------------
+// A slot per name for a list, otherwise at least twice as
+// many as names, so there's always an empty one to end a
+// search
+// --------------------------------------------------------
+unsigned int SimpleNameTable::SlotsFor(unsigned int count)
+{
+	if (count <= LinearCount)
+		return count;
+
+	unsigned int slots = 2;
+	while (slots < count * 2)
+		slots *= 2;
+	return slots;
+}
+
+void SimpleNameTable::Add(const char* name, size_t length, unsigned int index)
+{
+	if (Mask == 0)
+	{
+		if (Find(name, length) < 0)
+			Slots[Count++] = { 0, (uint16_t)index, (uint16_t)length, name };
+		return;
+	}
+
+	uint32_t hash = Hash(name, length);
+	for (unsigned int i = hash & Mask; ; i = (i + 1) & Mask)
+	{
+		SimpleNameEntry& slot = Slots[i];
+		if (!slot.Name)
+		{
+			slot = { hash, (uint16_t)index, (uint16_t)length, name };
+			Count++;
+			return;
+		}
+
+		// Already here
+		if (slot.Hash == hash && slot.Length == length && memcmp(slot.Name, name, length) == 0)
+			return;
+	}
+}
+
+int SimpleNameTable::Find(const char* name, size_t length) const
+{
+	if (Mask == 0)
+	{
+		for (unsigned int i = 0; i < Count; i++)
+		{
+			if (Slots[i].Length == length && memcmp(Slots[i].Name, name, length) == 0)
+				return (int)Slots[i].Index;
+		}
+		return -1;
+	}
+
+	uint32_t hash = Hash(name, length);
+	for (unsigned int i = hash & Mask; ; i = (i + 1) & Mask)
+	{
+		const SimpleNameEntry& slot = Slots[i];
+		if (!slot.Name)
+			return -1;
+
+		if (slot.Hash == hash && slot.Length == length && memcmp(slot.Name, name, length) == 0)
+			return (int)slot.Index;
+	}
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // ------ BASE SIMPLE SHADER --------------------------------------------------
 ///////////////////////////////////////////////////////////////////////////////
@@ -29,6 +174,15 @@ ISimpleShader::ISimpleShader(Microsoft::WRL::ComPtr<ID3D11Device> device, Micros
 	this->constantBufferCount = 0;
 	this->constantBuffers = 0;
 	this->shaderValid = false;
+
+	// Partial constant buffer updates need D3D 11.1
+	context.As(&deviceContext1);
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (deviceContext1 &&
+		SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+	{
+		partialUpdates = options.ConstantBufferPartialUpdate;
+	}
 }
 
 // --------------------------------------------------------
@@ -45,29 +199,29 @@ ISimpleShader::~ISimpleShader()
 // --------------------------------------------------------
 void ISimpleShader::CleanUp()
 {
-	// Handle constant buffers and local data buffers
+	// Constant buffers hold references to their D3D buffers,
+	// everything else in the block is plain data
 	for (unsigned int i = 0; i < constantBufferCount; i++)
-	{
-		delete[] constantBuffers[i].LocalDataBuffer;
-	}
+		constantBuffers[i].~SimpleConstantBuffer();
 
-	if (constantBuffers)
-	{
-		delete[] constantBuffers;
-		constantBufferCount = 0;
-	}
+	delete[] metadata;
+	metadata = 0;
+	metadataBytes = 0;
 
-	for (unsigned int i = 0; i < shaderResourceViews.size(); i++)
-		delete shaderResourceViews[i];
-	
-	for (unsigned int i = 0; i < samplerStates.size(); i++)
-		delete samplerStates[i];
+	constantBuffers = 0;
+	variables = 0;
+	shaderResourceViews = 0;
+	samplerStates = 0;
+	constantBufferCount = 0;
+	variableCount = 0;
+	shaderResourceViewCount = 0;
+	samplerCount = 0;
 
 	// Clean up tables
-	varTable.clear();
-	cbTable.clear();
-	samplerTable.clear();
-	textureTable.clear();
+	varTable = {};
+	cbTable = {};
+	samplerTable = {};
+	textureTable = {};
 }
 
 // --------------------------------------------------------
@@ -80,8 +234,11 @@ void ISimpleShader::CleanUp()
 // --------------------------------------------------------
 bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 {
+	auto start = std::chrono::high_resolution_clock::now();
+
 	// Load the shader to a blob and ensure it worked
-	HRESULT hr = D3DReadFileToBlob(shaderFile, shaderBlob.GetAddressOf());
+	Microsoft::WRL::ComPtr<ID3DBlob> blob;
+	HRESULT hr = D3DReadFileToBlob(shaderFile, blob.GetAddressOf());
 	if (hr != S_OK)
 	{
 		if (ReportErrors)
@@ -94,6 +251,42 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		return false;
 	}
 
+	bool loaded = LoadShaderBlob(blob, shaderFile);
+
+	// Include reading the file in the load time
+	auto end = std::chrono::high_resolution_clock::now();
+	loadMs = std::chrono::duration<float, std::milli>(end - start).count();
+	return loaded;
+}
+
+// --------------------------------------------------------
+// Creates the shader from already compiled bytecode (like a
+// shader compiled at run time) and builds the variable table
+//
+// shaderBlob - The compiled shader
+// name - What to call the shader in error messages
+//
+// Returns true if shader is loaded properly, false otherwise
+// --------------------------------------------------------
+bool ISimpleShader::LoadShaderBlob(Microsoft::WRL::ComPtr<ID3DBlob> blob, LPCWSTR name)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	shaderBlob = blob;
+
+	// Read this shader's variables, buffers, etc. - from the
+	// metadata cache if it has seen this bytecode before
+	if (!Reflect(shaderBlob, &reflection, &metadataCached))
+	{
+		if (ReportErrors)
+		{
+			LogError("SimpleShader::LoadShaderBlob() - Error reading reflection data from '");
+			LogW(name);
+			LogError("'.\n");
+		}
+
+		return false;
+	}
+
 	// Create the shader - Calls an overloaded version of this abstract
 	// method in the appropriate child class
 	shaderValid = CreateShader(shaderBlob);
@@ -101,92 +294,130 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 	{
 		if (ReportErrors)
 		{
-			LogError("SimpleShader::LoadShaderFile() - Error creating shader from file '");
-			LogW(shaderFile);
+			LogError("SimpleShader::LoadShaderBlob() - Error creating shader from '");
+			LogW(name);
 			LogError("'. Ensure the type of shader (vertex, pixel, etc.) matches the SimpleShader type (SimpleVertexShader, SimplePixelShader, etc.) you're using.\n");
 		}
 
 		return false;
 	}
 
-	// Set up shader reflection to get information about
-	// this shader and its variables,  buffers, etc.
-	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
-	
-	// Get the description of the shader
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
+	// Lay out the buffers, variables and resources
+	BuildMetadata();
 
-	// Create resource arrays
-	constantBufferCount = shaderDesc.ConstantBuffers;
-	constantBuffers = new SimpleConstantBuffer[constantBufferCount];
-	
-	// Handle bound resources (like shaders and samplers)
-	unsigned int resourceCount = shaderDesc.BoundResources;
-	for (unsigned int r = 0; r < resourceCount; r++)
+	auto end = std::chrono::high_resolution_clock::now();
+	loadMs = std::chrono::duration<float, std::milli>(end - start).count();
+
+	// All set
+	return true;
+}
+
+// --------------------------------------------------------
+// Builds the constant buffers, variables, resources and the
+// tables to find them by name from the reflection data - in
+// a single block, rather than an allocation for each
+//
+// - Two passes: everything is counted and placed, then the
+//   block is allocated and filled in
+// - Local data buffers come first, 16 byte aligned like the
+//   constants they're uploaded to
+// --------------------------------------------------------
+void ISimpleShader::BuildMetadata()
+{
+	// Count everything
+	constantBufferCount = (unsigned int)reflection.ConstantBuffers.size();
+	size_t nameBytes = 0;
+	for (const DXBCResource& resource : reflection.Resources)
 	{
-		// Get this resource's description
-		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
-		refl->GetResourceBindingDesc(r, &resourceDesc);
+		switch ((D3D_SHADER_INPUT_TYPE)resource.Type)
+		{
+		case D3D_SIT_STRUCTURED: // Treat structured buffers as texture resources
+		case D3D_SIT_TEXTURE: shaderResourceViewCount++; break;
+		case D3D_SIT_SAMPLER: samplerCount++; break;
+		default: continue;
+		}
+		nameBytes += resource.Name.size() + 1;
+	}
 
+	size_t dataBytes = 0;
+	for (const DXBCConstantBuffer& bufferDesc : reflection.ConstantBuffers)
+	{
+		dataBytes += (bufferDesc.Size + 15) / 16 * 16;
+		nameBytes += bufferDesc.Name.size() + 1;
+		variableCount += (unsigned int)bufferDesc.Variables.size();
+		for (const DXBCVariable& varDesc : bufferDesc.Variables)
+			nameBytes += varDesc.Name.size() + 1;
+	}
+	unsigned int slotCount =
+		SimpleNameTable::SlotsFor(constantBufferCount) +
+		SimpleNameTable::SlotsFor(variableCount) +
+		SimpleNameTable::SlotsFor(shaderResourceViewCount) +
+		SimpleNameTable::SlotsFor(samplerCount);
+
+	// Place it all
+	size_t size = 0;
+	size_t dataAt = Reserve<unsigned char>(&size, dataBytes, 16);
+	size_t cbAt = Reserve<SimpleConstantBuffer>(&size, constantBufferCount);
+	size_t varAt = Reserve<SimpleShaderVariable>(&size, variableCount);
+	size_t srvAt = Reserve<SimpleSRV>(&size, shaderResourceViewCount);
+	size_t samplerAt = Reserve<SimpleSampler>(&size, samplerCount);
+	size_t slotAt = Reserve<SimpleNameEntry>(&size, slotCount);
+	size_t nameAt = Reserve<char>(&size, nameBytes);
+
+	metadata = new unsigned char[size];
+	metadataBytes = size;
+	memset(metadata, 0, size);
+
+	unsigned char* data = metadata + dataAt;
+	constantBuffers = (SimpleConstantBuffer*)(metadata + cbAt);
+	variables = (SimpleShaderVariable*)(metadata + varAt);
+	shaderResourceViews = (SimpleSRV*)(metadata + srvAt);
+	samplerStates = (SimpleSampler*)(metadata + samplerAt);
+	char* names = (char*)(metadata + nameAt);
+
+	// Each table's slots follow the previous table's
+	SimpleNameEntry* slots = (SimpleNameEntry*)(metadata + slotAt);
+	PlaceTable(&cbTable, &slots, constantBufferCount);
+	PlaceTable(&varTable, &slots, variableCount);
+	PlaceTable(&textureTable, &slots, shaderResourceViewCount);
+	PlaceTable(&samplerTable, &slots, samplerCount);
+
+	// Handle bound resources (like shaders and samplers)
+	unsigned int srvIndex = 0;
+	unsigned int samplerIndex = 0;
+	for (const DXBCResource& resource : reflection.Resources)
+	{
 		// Check the type
-		switch (resourceDesc.Type)
+		switch ((D3D_SHADER_INPUT_TYPE)resource.Type)
 		{
 		case D3D_SIT_STRUCTURED: // Treat structured buffers as texture resources
 		case D3D_SIT_TEXTURE: // A texture resource
-		{
-			// Create the SRV wrapper
-			SimpleSRV* srv = new SimpleSRV();
-			srv->BindIndex = resourceDesc.BindPoint;				// Shader bind point
-			srv->Index = (unsigned int)shaderResourceViews.size();	// Raw index
-
-			textureTable.insert(std::pair<std::string, SimpleSRV*>(resourceDesc.Name, srv));
-			shaderResourceViews.push_back(srv);
-		}
+			shaderResourceViews[srvIndex].BindIndex = resource.BindPoint;	// Shader bind point
+			shaderResourceViews[srvIndex].Index = srvIndex;					// Raw index
+			AddName(&textureTable, &names, resource.Name, srvIndex);
+			srvIndex++;
 			break;
 
 		case D3D_SIT_SAMPLER: // A sampler resource
-		{
-			// Create the sampler wrapper
-			SimpleSampler* samp = new SimpleSampler();
-			samp->BindIndex = resourceDesc.BindPoint;			// Shader bind point
-			samp->Index = (unsigned int)samplerStates.size();	// Raw index
-
-			samplerTable.insert(std::pair<std::string, SimpleSampler*>(resourceDesc.Name, samp));
-			samplerStates.push_back(samp);
-		}
+			samplerStates[samplerIndex].BindIndex = resource.BindPoint;	// Shader bind point
+			samplerStates[samplerIndex].Index = samplerIndex;				// Raw index
+			AddName(&samplerTable, &names, resource.Name, samplerIndex);
+			samplerIndex++;
 			break;
 		}
 	}
 
 	// Loop through all constant buffers
+	unsigned int varIndex = 0;
 	for (unsigned int b = 0; b < constantBufferCount; b++)
 	{
-		// Get this buffer
-		ID3D11ShaderReflectionConstantBuffer* cb =
-			refl->GetConstantBufferByIndex(b);
-		
-		// Get the description of this buffer
-		D3D11_SHADER_BUFFER_DESC bufferDesc;
-		cb->GetDesc(&bufferDesc);
+		const DXBCConstantBuffer& bufferDesc = reflection.ConstantBuffers[b];
+		SimpleConstantBuffer* cb = new (&constantBuffers[b]) SimpleConstantBuffer();
 
 		// Save the type, which we reference when setting these buffers
-		constantBuffers[b].Type = bufferDesc.Type;
-		
-		// Get the description of the resource binding, so
-		// we know exactly how it's bound in the shader
-		D3D11_SHADER_INPUT_BIND_DESC bindDesc;
-		refl->GetResourceBindingDescByName(bufferDesc.Name, &bindDesc);
-		
-		// Set up the buffer and put its pointer in the table
-		constantBuffers[b].BindIndex = bindDesc.BindPoint;
-		constantBuffers[b].Name = bufferDesc.Name;
-		cbTable.insert(std::pair<std::string, SimpleConstantBuffer*>(bufferDesc.Name, &constantBuffers[b]));
+		cb->Type = (D3D_CBUFFER_TYPE)bufferDesc.Type;
+		cb->BindIndex = bufferDesc.BindPoint;
+		cb->Name = AddName(&cbTable, &names, bufferDesc.Name, b);
 
 		// Create this constant buffer
 		D3D11_BUFFER_DESC newBuffDesc = {};
@@ -196,40 +427,123 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		newBuffDesc.CPUAccessFlags = 0;
 		newBuffDesc.MiscFlags = 0;
 		newBuffDesc.StructureByteStride = 0;
-		device->CreateBuffer(&newBuffDesc, 0, constantBuffers[b].ConstantBuffer.GetAddressOf());
+		device->CreateBuffer(&newBuffDesc, 0, cb->ConstantBuffer.GetAddressOf());
 
-		// Set up the data buffer for this constant buffer
-		constantBuffers[b].Size = bufferDesc.Size;
-		constantBuffers[b].LocalDataBuffer = new unsigned char[bufferDesc.Size];
-		ZeroMemory(constantBuffers[b].LocalDataBuffer, bufferDesc.Size);
+		// Its data buffer, already zeroed with the rest
+		cb->Size = bufferDesc.Size;
+		cb->LocalDataBuffer = data;
+		data += newBuffDesc.ByteWidth;
+		cb->Dirty = true;
+		cb->DirtyStart = 0;
+		cb->DirtyEnd = bufferDesc.Size;
 
 		// Loop through all variables in this buffer
+		cb->Variables = &variables[varIndex];
+		cb->VariableCount = (unsigned int)bufferDesc.Variables.size();
+		for (const DXBCVariable& varDesc : bufferDesc.Variables)
+		{
+			SimpleShaderVariable& var = variables[varIndex];
+			var.ConstantBufferIndex = b;
+			var.ByteOffset = varDesc.StartOffset;
+			var.Size = varDesc.Size;
+
+			AddName(&varTable, &names, varDesc.Name, varIndex);
+			varIndex++;
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Reads the reflection data SimpleShader needs from a
+// compiled shader
+//
+// The bytecode is parsed directly (see DXBCReflection.h),
+// which is much cheaper than D3DReflect.  D3DReflect is
+// only used for containers the parser doesn't understand.
+// Either way, the result is remembered in MetadataCache.
+//
+// Safe to call from several threads at once
+// --------------------------------------------------------
+bool ISimpleShader::Reflect(Microsoft::WRL::ComPtr<ID3DBlob> blob, DXBCReflection* reflection, bool* fromCache)
+{
+	if (fromCache) *fromCache = false;
+
+	uint64_t key = 0;
+	if (MetadataCache)
+	{
+		key = ShaderCache::HashBytecode(blob->GetBufferPointer(), blob->GetBufferSize());
+		if (MetadataCache->Find(key, reflection))
+		{
+			if (fromCache) *fromCache = true;
+			return true;
+		}
+	}
+
+	if (!ParseDXBC(blob->GetBufferPointer(), blob->GetBufferSize(), reflection) &&
+		!ReflectWithD3D(blob, reflection))
+		return false;
+
+	if (MetadataCache)
+		MetadataCache->Add(key, *reflection);
+	return true;
+}
+
+bool ISimpleShader::ReflectWithD3D(Microsoft::WRL::ComPtr<ID3DBlob> blob, DXBCReflection* reflection)
+{
+	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
+	HRESULT hr = D3DReflect(
+		blob->GetBufferPointer(),
+		blob->GetBufferSize(),
+		IID_ID3D11ShaderReflection,
+		(void**)refl.GetAddressOf());
+	if (FAILED(hr))
+		return false;
+
+	D3D11_SHADER_DESC shaderDesc;
+	refl->GetDesc(&shaderDesc);
+	*reflection = {};
+
+	for (unsigned int r = 0; r < shaderDesc.BoundResources; r++)
+	{
+		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
+		refl->GetResourceBindingDesc(r, &resourceDesc);
+		reflection->Resources.push_back({ resourceDesc.Name, (uint32_t)resourceDesc.Type, resourceDesc.BindPoint, resourceDesc.BindCount });
+	}
+
+	for (unsigned int b = 0; b < shaderDesc.ConstantBuffers; b++)
+	{
+		ID3D11ShaderReflectionConstantBuffer* cb = refl->GetConstantBufferByIndex(b);
+		D3D11_SHADER_BUFFER_DESC bufferDesc;
+		cb->GetDesc(&bufferDesc);
+
+		D3D11_SHADER_INPUT_BIND_DESC bindDesc = {};
+		refl->GetResourceBindingDescByName(bufferDesc.Name, &bindDesc);
+
+		DXBCConstantBuffer buffer = { bufferDesc.Name, (uint32_t)bufferDesc.Type, bufferDesc.Size, bindDesc.BindPoint };
 		for (unsigned int v = 0; v < bufferDesc.Variables; v++)
 		{
-			// Get this variable
-			ID3D11ShaderReflectionVariable* var =
-				cb->GetVariableByIndex(v);
-			
-			// Get the description of the variable and its type
+			ID3D11ShaderReflectionVariable* var = cb->GetVariableByIndex(v);
 			D3D11_SHADER_VARIABLE_DESC varDesc;
 			var->GetDesc(&varDesc);
+			D3D11_SHADER_TYPE_DESC typeDesc;
+			var->GetType()->GetDesc(&typeDesc);
 
-			// Create the variable struct
-			SimpleShaderVariable varStruct = {};
-			varStruct.ConstantBufferIndex = b;
-			varStruct.ByteOffset = varDesc.StartOffset;
-			varStruct.Size = varDesc.Size;
-			
-			// Get a string version
-			std::string varName(varDesc.Name);
-
-			// Add this variable to the table and the constant buffer
-			varTable.insert(std::pair<std::string, SimpleShaderVariable>(varName, varStruct));
-			constantBuffers[b].Variables.push_back(varStruct);
+			buffer.Variables.push_back({ varDesc.Name, varDesc.StartOffset, varDesc.Size,
+				(uint16_t)typeDesc.Class, (uint16_t)typeDesc.Type,
+				(uint16_t)typeDesc.Rows, (uint16_t)typeDesc.Columns, (uint16_t)typeDesc.Elements,
+				typeDesc.Name ? typeDesc.Name : "" });
 		}
+		reflection->ConstantBuffers.push_back(buffer);
+	}
+
+	for (unsigned int i = 0; i < shaderDesc.InputParameters; i++)
+	{
+		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
+		refl->GetInputParameterDesc(i, &paramDesc);
+		reflection->Inputs.push_back({ paramDesc.SemanticName, paramDesc.SemanticIndex, paramDesc.Register,
+			(uint32_t)paramDesc.SystemValueType, (uint32_t)paramDesc.ComponentType, paramDesc.Mask });
 	}
 
-	// All set
 	return true;
 }
 
@@ -240,18 +554,14 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 // name - the name of the variable to look for
 // size - the size of the variable (for verification), or -1 to bypass
 // --------------------------------------------------------
-SimpleShaderVariable* ISimpleShader::FindVariable(std::string name, int size)
+SimpleShaderVariable* ISimpleShader::FindVariable(const std::string& name, int size)
 {
 	// Look for the key
-	std::unordered_map<std::string, SimpleShaderVariable>::iterator result =
-		varTable.find(name);
-
-	// Did we find the key?
-	if (result == varTable.end())
+	int index = varTable.Find(name);
+	if (index < 0)
 		return 0;
 
-	// Grab the result from the iterator
-	SimpleShaderVariable* var = &(result->second);
+	SimpleShaderVariable* var = &variables[index];
 
 	// Is the data size correct ?
 	if (size > 0 && var->Size != size)
@@ -267,15 +577,12 @@ SimpleShaderVariable* ISimpleShader::FindVariable(std::string name, int size)
 SimpleConstantBuffer* ISimpleShader::FindConstantBuffer(std::string name)
 {
 	// Look for the key
-	std::unordered_map<std::string, SimpleConstantBuffer*>::iterator result =
-		cbTable.find(name);
-
-	// Did we find the key?
-	if (result == cbTable.end())
+	int index = cbTable.Find(name);
+	if (index < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return &constantBuffers[index];
 }
 
 // --------------------------------------------------------
@@ -333,6 +640,7 @@ void ISimpleShader::SetShader()
 	// Set the shader and any relevant constant buffers, which
 	// is an overloaded method in a subclass
 	SetShaderAndCBs();
+	FrameStats::ShaderBinds++;
 }
 
 // --------------------------------------------------------
@@ -345,14 +653,9 @@ void ISimpleShader::CopyAllBufferData()
 	// Ensure the shader is valid
 	if (!shaderValid) return;
 
-	// Loop through the constant buffers and copy all data
+	// Loop through the constant buffers and copy any changes
 	for (unsigned int i = 0; i < constantBufferCount; i++)
-	{
-		// Copy the entire local data buffer
-		deviceContext->UpdateSubresource(
-			constantBuffers[i].ConstantBuffer.Get(), 0, 0,
-			constantBuffers[i].LocalDataBuffer, 0, 0);
-	}
+		UploadBuffer(&constantBuffers[i]);
 }
 
 // --------------------------------------------------------
@@ -380,9 +683,7 @@ void ISimpleShader::CopyBufferData(unsigned int index)
 	if (!cb) return;
 
 	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0, 
-		cb->LocalDataBuffer, 0, 0);
+	UploadBuffer(cb);
 }
 
 // --------------------------------------------------------
@@ -402,9 +703,126 @@ void ISimpleShader::CopyBufferData(std::string bufferName)
 	if (!cb) return;
 
 	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0, 
-		cb->LocalDataBuffer, 0, 0);
+	UploadBuffer(cb);
+}
+
+// --------------------------------------------------------
+// Copies a constant buffer's local data to the GPU, but
+// only if something in it changed since the last copy
+//
+// - With partial update support, a small dirty range is
+//   sent on its own rather than re-sending the whole buffer
+// --------------------------------------------------------
+void ISimpleShader::UploadBuffer(SimpleConstantBuffer* cb)
+{
+	// A slice from an earlier frame is gone, even if nothing changed
+	bool ringStale = cb->RingBuffer && !RingSliceValid(cb);
+	if (!cb->Dirty && !ringStale)
+	{
+		FrameStats::BufferUploadsSkipped++;
+		return;
+	}
+
+	// Try the shared ring first - it takes the whole buffer
+	if (UploadRing && UploadRing->IsValid() && deviceContext1 &&
+		cb->Type == D3D11_CT_CBUFFER &&
+		UploadRing->Upload(cb->LocalDataBuffer, cb->Size, &cb->RingFirstConstant, &cb->RingNumConstants))
+	{
+		cb->RingBuffer = UploadRing->GetBuffer();
+		cb->RingEpoch = UploadRing->GetEpoch();
+		cb->Dirty = false;
+		RebindIfBound(*cb);
+		return;
+	}
+
+	// Back to this buffer's own storage, which hasn't seen
+	// anything written to the ring, so it needs all of it
+	if (cb->RingBuffer)
+	{
+		cb->RingBuffer = 0;
+		cb->DirtyStart = 0;
+		cb->DirtyEnd = cb->Size;
+		RebindIfBound(*cb);
+	}
+
+	// Partial updates must be in whole constants (16 bytes)
+	unsigned int start = cb->DirtyStart & ~15u;
+	unsigned int end = (cb->DirtyEnd + 15) & ~15u;
+	if (end > cb->Size) end = cb->Size;
+
+	if (partialUpdates && (end - start) * 2 <= cb->Size)
+	{
+		D3D11_BOX box = {};
+		box.left = start;
+		box.right = end;
+		box.bottom = 1;
+		box.back = 1;
+		deviceContext1->UpdateSubresource1(
+			cb->ConstantBuffer.Get(), 0, &box,
+			cb->LocalDataBuffer + start, 0, 0, 0);
+		FrameStats::BufferBytesUploaded += end - start;
+	}
+	else
+	{
+		deviceContext->UpdateSubresource(
+			cb->ConstantBuffer.Get(), 0, 0,
+			cb->LocalDataBuffer, 0, 0);
+		FrameStats::BufferBytesUploaded += cb->Size;
+	}
+
+	FrameStats::BufferUploads++;
+	cb->Dirty = false;
+}
+
+// --------------------------------------------------------
+// Binds one of this shader's constant buffers - used when
+// the shader is set
+// --------------------------------------------------------
+void ISimpleShader::SetConstantBuffer(SimpleConstantBuffer* cb)
+{
+	// The ring is discarded every frame, so binding an old slice
+	// would read garbage - upload the local copy again instead
+	// (which binds the new slice, or falls back to our own buffer)
+	if (cb->RingBuffer && !RingSliceValid(cb))
+		UploadBuffer(cb);
+	else
+		BindConstantBuffer(*cb);
+}
+
+// --------------------------------------------------------
+// A buffer that moved (to a new ring slice, or back to its
+// own storage) only replaces what's in its slot if this is
+// the stage's current shader - otherwise it'd clobber the
+// bound shader's buffer, and is bound when it's set instead
+// --------------------------------------------------------
+void ISimpleShader::RebindIfBound(const SimpleConstantBuffer& cb)
+{
+	if (Graphics::States->IsShaderBound(GetStage(), GetStageShader()))
+		BindConstantBuffer(cb);
+}
+
+bool ISimpleShader::RingSliceValid(const SimpleConstantBuffer* cb)
+{
+	return UploadRing &&
+		cb->RingBuffer == UploadRing->GetBuffer() &&
+		cb->RingEpoch == UploadRing->GetEpoch();
+}
+
+// --------------------------------------------------------
+// Binds a single constant buffer to this shader's stage,
+// either its own storage or its slice of the upload ring
+// --------------------------------------------------------
+void ISimpleShader::BindConstantBuffer(const SimpleConstantBuffer& cb)
+{
+	if (cb.RingBuffer)
+	{
+		Graphics::States->SetConstantBuffers(GetStage(), cb.BindIndex, 1, &cb.RingBuffer, &cb.RingFirstConstant, &cb.RingNumConstants);
+	}
+	else
+	{
+		ID3D11Buffer* buffer = cb.ConstantBuffer.Get();
+		Graphics::States->SetConstantBuffers(GetStage(), cb.BindIndex, 1, &buffer);
+	}
 }
 
 
@@ -417,7 +835,7 @@ void ISimpleShader::CopyBufferData(std::string bufferName)
 //
 // Returns true if data is copied, false if variable doesn't exist
 // --------------------------------------------------------
-bool ISimpleShader::SetData(std::string name, const void* data, unsigned int size)
+bool ISimpleShader::SetData(const std::string& name, const void* data, unsigned int size)
 {
 	// Look for the variable and verify
 	SimpleShaderVariable* var = FindVariable(name, -1);
@@ -446,19 +864,14 @@ bool ISimpleShader::SetData(std::string name, const void* data, unsigned int siz
 	}
 
 	// Set the data in the local data buffer
-	memcpy(
-		constantBuffers[var->ConstantBufferIndex].LocalDataBuffer + var->ByteOffset,
-		data,
-		size);
-
-	// Success
-	return true;
+	SimpleShaderVariableHandle handle = { var->ConstantBufferIndex, var->ByteOffset, var->Size };
+	return SetData(handle, data, size);
 }
 
 // --------------------------------------------------------
 // Sets INTEGER data
 // --------------------------------------------------------
-bool ISimpleShader::SetInt(std::string name, int data)
+bool ISimpleShader::SetInt(const std::string& name, int data)
 {
 	return this->SetData(name, (void*)(&data), sizeof(int));
 }
@@ -466,7 +879,7 @@ bool ISimpleShader::SetInt(std::string name, int data)
 // --------------------------------------------------------
 // Sets a FLOAT variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat(std::string name, float data)
+bool ISimpleShader::SetFloat(const std::string& name, float data)
 {
 	return this->SetData(name, (void*)(&data), sizeof(float));
 }
@@ -474,7 +887,7 @@ bool ISimpleShader::SetFloat(std::string name, float data)
 // --------------------------------------------------------
 // Sets a FLOAT2 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat2(std::string name, const float data[2])
+bool ISimpleShader::SetFloat2(const std::string& name, const float data[2])
 {
 	return this->SetData(name, (void*)data, sizeof(float) * 2);
 }
@@ -482,7 +895,7 @@ bool ISimpleShader::SetFloat2(std::string name, const float data[2])
 // --------------------------------------------------------
 // Sets a FLOAT2 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat2(std::string name, const DirectX::XMFLOAT2 data)
+bool ISimpleShader::SetFloat2(const std::string& name, const DirectX::XMFLOAT2 data)
 {
 	return this->SetData(name, &data, sizeof(float) * 2);
 }
@@ -490,7 +903,7 @@ bool ISimpleShader::SetFloat2(std::string name, const DirectX::XMFLOAT2 data)
 // --------------------------------------------------------
 // Sets a FLOAT3 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat3(std::string name, const float data[3])
+bool ISimpleShader::SetFloat3(const std::string& name, const float data[3])
 {
 	return this->SetData(name, (void*)data, sizeof(float) * 3);
 }
@@ -498,7 +911,7 @@ bool ISimpleShader::SetFloat3(std::string name, const float data[3])
 // --------------------------------------------------------
 // Sets a FLOAT3 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat3(std::string name, const DirectX::XMFLOAT3 data)
+bool ISimpleShader::SetFloat3(const std::string& name, const DirectX::XMFLOAT3 data)
 {
 	return this->SetData(name, &data, sizeof(float) * 3);
 }
@@ -506,7 +919,7 @@ bool ISimpleShader::SetFloat3(std::string name, const DirectX::XMFLOAT3 data)
 // --------------------------------------------------------
 // Sets a FLOAT4 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat4(std::string name, const float data[4])
+bool ISimpleShader::SetFloat4(const std::string& name, const float data[4])
 {
 	return this->SetData(name, (void*)data, sizeof(float) * 4);
 }
@@ -514,7 +927,7 @@ bool ISimpleShader::SetFloat4(std::string name, const float data[4])
 // --------------------------------------------------------
 // Sets a FLOAT4 variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetFloat4(std::string name, const DirectX::XMFLOAT4 data)
+bool ISimpleShader::SetFloat4(const std::string& name, const DirectX::XMFLOAT4 data)
 {
 	return this->SetData(name, &data, sizeof(float) * 4);
 }
@@ -522,7 +935,7 @@ bool ISimpleShader::SetFloat4(std::string name, const DirectX::XMFLOAT4 data)
 // --------------------------------------------------------
 // Sets a MATRIX (4x4) variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetMatrix4x4(std::string name, const float data[16])
+bool ISimpleShader::SetMatrix4x4(const std::string& name, const float data[16])
 {
 	return this->SetData(name, (void*)data, sizeof(float) * 16);
 }
@@ -530,16 +943,126 @@ bool ISimpleShader::SetMatrix4x4(std::string name, const float data[16])
 // --------------------------------------------------------
 // Sets a MATRIX (4x4) variable by name in the local data buffer
 // --------------------------------------------------------
-bool ISimpleShader::SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 data)
+bool ISimpleShader::SetMatrix4x4(const std::string& name, const DirectX::XMFLOAT4X4 data)
 {
 	return this->SetData(name, &data, sizeof(float) * 16);
 }
 
+// --------------------------------------------------------
+// Resolves a variable name to a handle, so that hot code
+// can set it every frame without hashing the name
+//
+// name - The name of the shader variable
+//
+// Returns an invalid handle (see IsValid()) if the
+// variable doesn't exist
+// --------------------------------------------------------
+SimpleShaderVariableHandle ISimpleShader::GetVariableHandle(const std::string& name)
+{
+	SimpleShaderVariableHandle handle;
+	SimpleShaderVariable* var = FindVariable(name, -1);
+	if (var == 0)
+		return handle;
+
+	handle.ConstantBufferIndex = var->ConstantBufferIndex;
+	handle.ByteOffset = var->ByteOffset;
+	handle.Size = var->Size;
+	return handle;
+}
+
+// --------------------------------------------------------
+// Sets a variable through a handle with arbitrary data
+// of the specified size
+//
+// handle - A handle from this shader's GetVariableHandle()
+// data - The data to set in the buffer
+// size - The size of the data (this must be less than or equal to the variable's size)
+//
+// Returns true if data is copied, false if the handle is
+// invalid or the data is too large
+// --------------------------------------------------------
+bool ISimpleShader::SetData(SimpleShaderVariableHandle handle, const void* data, unsigned int size)
+{
+	// Invalid handles are silently ignored, so a variable the
+	// compiler optimized out doesn't need special casing
+	if (!handle.IsValid() || size > handle.Size || handle.ConstantBufferIndex >= constantBufferCount)
+		return false;
+
+	// Compare against the local copy first, so setting a value
+	// that hasn't changed doesn't cause another upload
+	SimpleConstantBuffer* cb = &constantBuffers[handle.ConstantBufferIndex];
+	unsigned char* dest = cb->LocalDataBuffer + handle.ByteOffset;
+	if (memcmp(dest, data, size) == 0)
+		return true;
+
+	memcpy(dest, data, size);
+
+	// Grow the dirty range to cover this variable
+	unsigned int end = handle.ByteOffset + size;
+	if (!cb->Dirty)
+	{
+		cb->Dirty = true;
+		cb->DirtyStart = handle.ByteOffset;
+		cb->DirtyEnd = end;
+	}
+	else
+	{
+		if (handle.ByteOffset < cb->DirtyStart) cb->DirtyStart = handle.ByteOffset;
+		if (end > cb->DirtyEnd) cb->DirtyEnd = end;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Gets a handle to a whole constant buffer, after checking
+// the struct it'll be filled from against the reflected
+// layout (see CBufferLayout.h)
+//
+// Returns an invalid handle if the buffer doesn't exist or
+// doesn't match, logging the differences as warnings
+// --------------------------------------------------------
+SimpleShaderVariableHandle ISimpleShader::GetBufferHandle(const CBufferLayout& layout)
+{
+	SimpleShaderVariableHandle handle;
+	for (auto& cb : reflection.ConstantBuffers)
+	{
+		if (cb.Name != layout.BufferName)
+			continue;
+
+		std::string mismatches = FindCBufferMismatches(layout, cb);
+		if (!mismatches.empty())
+		{
+			if (ReportWarnings)
+				LogWarning("SimpleShader::GetBufferHandle() - C++ struct doesn't match the shader:\n" + mismatches);
+			return handle;
+		}
+		break;
+	}
+
+	for (unsigned int b = 0; b < constantBufferCount; b++)
+	{
+		if (strcmp(constantBuffers[b].Name, layout.BufferName) == 0 && constantBuffers[b].Size == layout.Size)
+		{
+			handle.ConstantBufferIndex = b;
+			handle.Size = layout.Size;
+			break;
+		}
+	}
+	return handle;
+}
+
+bool ISimpleShader::SetInt(SimpleShaderVariableHandle handle, int data) { return SetData(handle, &data, sizeof(int)); }
+bool ISimpleShader::SetFloat(SimpleShaderVariableHandle handle, float data) { return SetData(handle, &data, sizeof(float)); }
+bool ISimpleShader::SetFloat2(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT2& data) { return SetData(handle, &data, sizeof(float) * 2); }
+bool ISimpleShader::SetFloat3(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT3& data) { return SetData(handle, &data, sizeof(float) * 3); }
+bool ISimpleShader::SetFloat4(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT4& data) { return SetData(handle, &data, sizeof(float) * 4); }
+bool ISimpleShader::SetMatrix4x4(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT4X4& data) { return SetData(handle, &data, sizeof(float) * 16); }
+
 // --------------------------------------------------------
 // Determines if the shader contains the specified
 // variable within one of its constant buffers
 // --------------------------------------------------------
-bool ISimpleShader::HasVariable(std::string name)
+bool ISimpleShader::HasVariable(const std::string& name)
 {
 	return FindVariable(name, -1) != 0;
 }
@@ -563,7 +1086,7 @@ bool ISimpleShader::HasSamplerState(std::string name)
 // --------------------------------------------------------
 // Gets info about a shader variable, if it exists
 // --------------------------------------------------------
-const SimpleShaderVariable* ISimpleShader::GetVariableInfo(std::string name)
+const SimpleShaderVariable* ISimpleShader::GetVariableInfo(const std::string& name)
 {
 	return FindVariable(name, -1);
 }
@@ -576,15 +1099,12 @@ const SimpleShaderVariable* ISimpleShader::GetVariableInfo(std::string name)
 const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(std::string name)
 {
 	// Look for the key
-	std::unordered_map<std::string, SimpleSRV*>::iterator result =
-		textureTable.find(name);
-
-	// Did we find the key?
-	if (result == textureTable.end())
+	int index = textureTable.Find(name);
+	if (index < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return &shaderResourceViews[index];
 }
 
 
@@ -596,10 +1116,10 @@ const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(std::string name)
 const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(unsigned int index)
 {
 	// Valid index?
-	if (index >= shaderResourceViews.size()) return 0;
+	if (index >= shaderResourceViewCount) return 0;
 
 	// Grab the bind index
-	return shaderResourceViews[index];
+	return &shaderResourceViews[index];
 }
 
 
@@ -611,15 +1131,12 @@ const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(unsigned int index)
 const SimpleSampler* ISimpleShader::GetSamplerInfo(std::string name)
 {
 	// Look for the key
-	std::unordered_map<std::string, SimpleSampler*>::iterator result =
-		samplerTable.find(name);
-
-	// Did we find the key?
-	if (result == samplerTable.end())
+	int index = samplerTable.Find(name);
+	if (index < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return &samplerStates[index];
 }
 
 // --------------------------------------------------------
@@ -630,10 +1147,10 @@ const SimpleSampler* ISimpleShader::GetSamplerInfo(std::string name)
 const SimpleSampler* ISimpleShader::GetSamplerInfo(unsigned int index)
 {
 	// Valid index?
-	if (index >= samplerStates.size()) return 0;
+	if (index >= samplerCount) return 0;
 
 	// Grab the bind index
-	return samplerStates[index];
+	return &samplerStates[index];
 }
 
 
@@ -771,28 +1288,14 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 	// matches what the vertex shader expects.  Code adapted from:
 	// https://takinginitiative.wordpress.com/2011/12/11/directx-1011-basic-shader-reflection-automatic-input-layout-creation/
 
-	// Reflect shader info
-	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
-	
-	// Get shader info
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
-	// Read input layout description from shader info
+	// Read input layout description from the reflection
+	// data LoadShaderFile() has already read
 	std::vector<D3D11_INPUT_ELEMENT_DESC> inputLayoutDesc;
-	for (unsigned int i = 0; i< shaderDesc.InputParameters; i++)
+	for (const DXBCInputElement& paramDesc : reflection.Inputs)
 	{
-		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-		refl->GetInputParameterDesc(i, &paramDesc);
-
 		// Check the semantic name for "_PER_INSTANCE"
 		std::string perInstanceStr = "_PER_INSTANCE";
-		std::string sem = paramDesc.SemanticName;
+		const std::string& sem = paramDesc.SemanticName;
 		int lenDiff = (int)sem.size() - (int)perInstanceStr.size();
 		bool isPerInstance = 
 			lenDiff >= 0 &&
@@ -800,7 +1303,7 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 
 		// Fill out input element desc
 		D3D11_INPUT_ELEMENT_DESC elementDesc = {};
-		elementDesc.SemanticName = paramDesc.SemanticName;
+		elementDesc.SemanticName = paramDesc.SemanticName.c_str();
 		elementDesc.SemanticIndex = paramDesc.SemanticIndex;
 		elementDesc.InputSlot = 0;
 		elementDesc.AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
@@ -869,8 +1372,8 @@ void SimpleVertexShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader and input layout
-	deviceContext->IASetInputLayout(inputLayout.Get());
-	deviceContext->VSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetInputLayout(inputLayout.Get());
+	Graphics::States->SetShader(StageVertex, shader.Get());
 
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -880,10 +1383,7 @@ void SimpleVertexShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->VSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -911,7 +1411,7 @@ bool SimpleVertexShader::SetShaderResourceView(std::string name, Microsoft::WRL:
 	}
 
 	// Set the shader resource view
-	deviceContext->VSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StageVertex, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -941,7 +1441,7 @@ bool SimpleVertexShader::SetSamplerState(std::string name, Microsoft::WRL::ComPt
 	}
 
 	// Set the shader resource view
-	deviceContext->VSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StageVertex, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -962,6 +1462,15 @@ SimplePixelShader::SimplePixelShader(Microsoft::WRL::ComPtr<ID3D11Device> device
 	this->LoadShaderFile(shaderFile);
 }
 
+// --------------------------------------------------------
+// Constructor for a pixel shader compiled at run time
+// --------------------------------------------------------
+SimplePixelShader::SimplePixelShader(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob)
+	: ISimpleShader(device, context)
+{
+	this->LoadShaderBlob(shaderBlob, L"(compiled at run time)");
+}
+
 // --------------------------------------------------------
 // Destructor - Clean up actual shader (base will be called automatically)
 // --------------------------------------------------------
@@ -1012,7 +1521,7 @@ void SimplePixelShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 	
 	// Set the shader
-	deviceContext->PSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetShader(StagePixel, shader.Get());
 
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -1022,10 +1531,7 @@ void SimplePixelShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->PSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -1053,7 +1559,7 @@ bool SimplePixelShader::SetShaderResourceView(std::string name, Microsoft::WRL::
 	}
 
 	// Set the shader resource view
-	deviceContext->PSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StagePixel, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1083,7 +1589,7 @@ bool SimplePixelShader::SetSamplerState(std::string name, Microsoft::WRL::ComPtr
 	}
 
 	// Set the shader resource view
-	deviceContext->PSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StagePixel, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1156,7 +1662,7 @@ void SimpleDomainShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader
-	deviceContext->DSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetShader(StageDomain, shader.Get());
 
 	// Set the constant buffers
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -1166,10 +1672,7 @@ void SimpleDomainShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->DSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -1197,7 +1700,7 @@ bool SimpleDomainShader::SetShaderResourceView(std::string name, Microsoft::WRL:
 	}
 
 	// Set the shader resource view
-	deviceContext->DSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StageDomain, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1227,7 +1730,7 @@ bool SimpleDomainShader::SetSamplerState(std::string name, Microsoft::WRL::ComPt
 	}
 
 	// Set the shader resource view
-	deviceContext->DSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StageDomain, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1299,7 +1802,7 @@ void SimpleHullShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader
-	deviceContext->HSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetShader(StageHull, shader.Get());
 
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -1309,10 +1812,7 @@ void SimpleHullShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->HSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -1340,7 +1840,7 @@ bool SimpleHullShader::SetShaderResourceView(std::string name, Microsoft::WRL::C
 	}
 
 	// Set the shader resource view
-	deviceContext->HSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StageHull, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1370,7 +1870,7 @@ bool SimpleHullShader::SetSamplerState(std::string name, Microsoft::WRL::ComPtr<
 	}
 
 	// Set the shader resource view
-	deviceContext->HSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StageHull, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1573,7 +2073,7 @@ void SimpleGeometryShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader
-	deviceContext->GSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetShader(StageGeometry, shader.Get());
 
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -1583,10 +2083,7 @@ void SimpleGeometryShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->GSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -1614,7 +2111,7 @@ bool SimpleGeometryShader::SetShaderResourceView(std::string name, Microsoft::WR
 	}
 
 	// Set the shader resource view
-	deviceContext->GSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StageGeometry, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1644,7 +2141,7 @@ bool SimpleGeometryShader::SetSamplerState(std::string name, Microsoft::WRL::Com
 	}
 
 	// Set the shader resource view
-	deviceContext->GSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StageGeometry, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -1783,7 +2280,7 @@ void SimpleComputeShader::SetShaderAndCBs()
 	if (!shaderValid) return;
 
 	// Set the shader
-	deviceContext->CSSetShader(shader.Get(), 0, 0);
+	Graphics::States->SetShader(StageCompute, shader.Get());
 
 	// Set the constant buffers?
 	for (unsigned int i = 0; i < constantBufferCount; i++)
@@ -1793,10 +2290,7 @@ void SimpleComputeShader::SetShaderAndCBs()
 			continue;
 
 		// This is a real constant buffer, so set it
-		deviceContext->CSSetConstantBuffers(
-			constantBuffers[i].BindIndex,
-			1,
-			constantBuffers[i].ConstantBuffer.GetAddressOf());
+		SetConstantBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -1885,7 +2379,7 @@ bool SimpleComputeShader::SetShaderResourceView(std::string name, Microsoft::WRL
 	}
 
 	// Set the shader resource view
-	deviceContext->CSSetShaderResources(srvInfo->BindIndex, 1, srv.GetAddressOf());
+	Graphics::States->SetShaderResources(StageCompute, srvInfo->BindIndex, 1, srv.GetAddressOf());
 
 	// Success
 	return true;
@@ -1915,7 +2409,7 @@ bool SimpleComputeShader::SetSamplerState(std::string name, Microsoft::WRL::ComP
 	}
 
 	// Set the shader resource view
-	deviceContext->CSSetSamplers(sampInfo->BindIndex, 1, samplerState.GetAddressOf());
+	Graphics::States->SetSamplers(StageCompute, sampInfo->BindIndex, 1, samplerState.GetAddressOf());
 
 	// Success
 	return true;
@@ -2,15 +2,23 @@
 #pragma comment(lib, "dxguid.lib")
 #pragma comment(lib, "d3dcompiler.lib")
 
-#include <d3d11.h>
+#include <d3d11_1.h>
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
 #include <wrl/client.h>
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <string>
 
+#include "CBufferLayout.h"
+#include "DXBCReflection.h"
+#include "StateCache.h"
+
+class ConstantBufferRing;
+class ShaderCache;
+
 
 // --------------------------------------------------------
 // Used by simple shaders to store information about
@@ -23,6 +31,20 @@ struct SimpleShaderVariable
 	unsigned int ConstantBufferIndex;
 };
 
+// --------------------------------------------------------
+// A variable resolved ahead of time with
+// GetVariableHandle(), so it can be set without a
+// name lookup.  Only valid for the shader it came from.
+// --------------------------------------------------------
+struct SimpleShaderVariableHandle
+{
+	unsigned int ConstantBufferIndex = 0;
+	unsigned int ByteOffset = 0;
+	unsigned int Size = 0;		// Zero if the variable wasn't found
+
+	bool IsValid() const { return Size > 0; }
+};
+
 // --------------------------------------------------------
 // Contains information about a specific
 // constant buffer in a shader, as well as
@@ -30,13 +52,27 @@ struct SimpleShaderVariable
 // --------------------------------------------------------
 struct SimpleConstantBuffer
 {
-	std::string Name;
+	const char* Name = "";
 	D3D_CBUFFER_TYPE Type = D3D_CBUFFER_TYPE::D3D11_CT_CBUFFER;
 	unsigned int Size = 0;
 	unsigned int BindIndex = 0;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> ConstantBuffer = 0;
 	unsigned char* LocalDataBuffer = 0;
-	std::vector<SimpleShaderVariable> Variables;
+	const SimpleShaderVariable* Variables = 0;
+	unsigned int VariableCount = 0;
+
+	// Byte range of the local data that differs from what
+	// was last uploaded - everything, until the first upload
+	bool Dirty = true;
+	unsigned int DirtyStart = 0;
+	unsigned int DirtyEnd = 0;
+
+	// Where the data was last uploaded, when using the
+	// shared ring (see ISimpleShader::UploadRing)
+	ID3D11Buffer* RingBuffer = 0;
+	UINT RingFirstConstant = 0;
+	UINT RingNumConstants = 0;
+	unsigned int RingEpoch = 0;
 };
 
 // --------------------------------------------------------
@@ -57,6 +93,44 @@ struct SimpleSampler
 	unsigned int BindIndex; // The register of the Sampler
 };
 
+// --------------------------------------------------------
+// Name lookup over one kind of shader metadata - an open
+// addressed hash table that's at most half full, so a lookup
+// is usually a single probe and string compare
+//
+// - Tables of up to LinearCount names are just a list, and
+//   searched in order - cheaper than hashing the name
+// - Slots and names are in the shader's metadata block,
+//   so this is only a view - it owns nothing
+// --------------------------------------------------------
+struct SimpleNameEntry
+{
+	uint32_t Hash;
+	uint16_t Index;			// Into the matching metadata array
+	uint16_t Length;
+	const char* Name;		// Null for an empty slot
+};
+
+struct SimpleNameTable
+{
+	static const unsigned int LinearCount = 16;
+
+	SimpleNameEntry* Slots = 0;	// Zeroed (empty) to start with
+	unsigned int Mask = 0;		// Slot count - 1, or zero for a list
+	unsigned int Count = 0;
+
+	// Adds a name, which must outlive the table - the first of
+	// any repeated names is the one that's kept
+	void Add(const char* name, size_t length, unsigned int index);
+
+	// The index stored with this name, or -1
+	int Find(const char* name, size_t length) const;
+	int Find(const std::string& name) const { return Find(name.c_str(), name.size()); }
+
+	static unsigned int SlotsFor(unsigned int count);
+	static uint32_t Hash(const char* name, size_t length);
+};
+
 // --------------------------------------------------------
 // Base abstract class for simplifying shader handling
 // --------------------------------------------------------
@@ -76,38 +150,55 @@ public:
 	void CopyBufferData(std::string bufferName);
 
 	// Sets arbitrary shader data
-	bool SetData(std::string name, const void* data, unsigned int size);
-
-	bool SetInt(std::string name, int data);
-	bool SetFloat(std::string name, float data);
-	bool SetFloat2(std::string name, const float data[2]);
-	bool SetFloat2(std::string name, const DirectX::XMFLOAT2 data);
-	bool SetFloat3(std::string name, const float data[3]);
-	bool SetFloat3(std::string name, const DirectX::XMFLOAT3 data);
-	bool SetFloat4(std::string name, const float data[4]);
-	bool SetFloat4(std::string name, const DirectX::XMFLOAT4 data);
-	bool SetMatrix4x4(std::string name, const float data[16]);
-	bool SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 data);
+	bool SetData(const std::string& name, const void* data, unsigned int size);
+
+	bool SetInt(const std::string& name, int data);
+	bool SetFloat(const std::string& name, float data);
+	bool SetFloat2(const std::string& name, const float data[2]);
+	bool SetFloat2(const std::string& name, const DirectX::XMFLOAT2 data);
+	bool SetFloat3(const std::string& name, const float data[3]);
+	bool SetFloat3(const std::string& name, const DirectX::XMFLOAT3 data);
+	bool SetFloat4(const std::string& name, const float data[4]);
+	bool SetFloat4(const std::string& name, const DirectX::XMFLOAT4 data);
+	bool SetMatrix4x4(const std::string& name, const float data[16]);
+	bool SetMatrix4x4(const std::string& name, const DirectX::XMFLOAT4X4 data);
+
+	// Sets shader data through a handle from GetVariableHandle()
+	// - No hashing or allocation, just a bounds check and a copy
+	SimpleShaderVariableHandle GetVariableHandle(const std::string& name);
+	bool SetData(SimpleShaderVariableHandle handle, const void* data, unsigned int size);
+
+	bool SetInt(SimpleShaderVariableHandle handle, int data);
+	bool SetFloat(SimpleShaderVariableHandle handle, float data);
+	bool SetFloat2(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT2& data);
+	bool SetFloat3(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT3& data);
+	bool SetFloat4(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT4& data);
+	bool SetMatrix4x4(SimpleShaderVariableHandle handle, const DirectX::XMFLOAT4X4& data);
+
+	// A handle covering an entire cbuffer, for filling it from
+	// one of the structs in ShaderBuffers.h - invalid if the
+	// buffer is missing or its layout doesn't match the struct
+	SimpleShaderVariableHandle GetBufferHandle(const CBufferLayout& layout);
 
 	// Setting shader resources
 	virtual bool SetShaderResourceView(std::string name, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) = 0;
 	virtual bool SetSamplerState(std::string name, Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState) = 0;
 
 	// Simple resource checking
-	bool HasVariable(std::string name);
+	bool HasVariable(const std::string& name);
 	bool HasShaderResourceView(std::string name);
 	bool HasSamplerState(std::string name);
 
 	// Getting data about variables and resources
-	const SimpleShaderVariable* GetVariableInfo(std::string name);
+	const SimpleShaderVariable* GetVariableInfo(const std::string& name);
 	
 	const SimpleSRV* GetShaderResourceViewInfo(std::string name);
 	const SimpleSRV* GetShaderResourceViewInfo(unsigned int index);
-	size_t GetShaderResourceViewCount() { return textureTable.size(); }
+	size_t GetShaderResourceViewCount() { return shaderResourceViewCount; }
 	
 	const SimpleSampler* GetSamplerInfo(std::string name);
 	const SimpleSampler* GetSamplerInfo(unsigned int index);
-	size_t GetSamplerCount() { return samplerTable.size(); }
+	size_t GetSamplerCount() { return samplerCount; }
 
 	// Get data about constant buffers
 	unsigned int GetBufferCount();
@@ -117,11 +208,29 @@ public:
 	
 	// Misc getters
 	Microsoft::WRL::ComPtr<ID3DBlob> GetShaderBlob() { return shaderBlob; }
+	const DXBCReflection& GetReflection() const { return reflection; }
 
 	// Error reporting
 	static bool ReportErrors;
 	static bool ReportWarnings;
 
+	// When set (and valid), constant buffer data is uploaded
+	// into slices of this shared ring rather than each buffer's
+	// own storage - CopyAllBufferData() then also binds the
+	// new slices, so it must come after SetShader()
+	static std::shared_ptr<ConstantBufferRing> UploadRing;
+
+	// When set, reflection data is looked up here by bytecode
+	// hash before reading it from the shader (and added after)
+	static std::shared_ptr<ShaderCache> MetadataCache;
+
+	// How long loading took, and whether reflection was skipped
+	float GetLoadMs() const { return loadMs; }
+	bool WasMetadataCached() const { return metadataCached; }
+
+	// Size of the block holding all of the above
+	size_t GetMetadataBytes() const { return metadataBytes; }
+
 protected:
 	
 	bool shaderValid;
@@ -129,20 +238,43 @@ protected:
 	Microsoft::WRL::ComPtr<ID3D11Device> device;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext;
 
+	// D3D 11.1 context, for offset binding and (when the driver
+	// supports it) uploading just the dirty range of a buffer
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> deviceContext1;
+	bool partialUpdates = false;
+
 	// Resource counts
 	unsigned int constantBufferCount;
+	unsigned int variableCount = 0;
+	unsigned int shaderResourceViewCount = 0;
+	unsigned int samplerCount = 0;
 	
-	// Maps for variables and buffers
-	SimpleConstantBuffer*		constantBuffers; // For index-based lookup
-	std::vector<SimpleSRV*>		shaderResourceViews;
-	std::vector<SimpleSampler*>	samplerStates;
-	std::unordered_map<std::string, SimpleConstantBuffer*> cbTable;
-	std::unordered_map<std::string, SimpleShaderVariable> varTable;
-	std::unordered_map<std::string, SimpleSRV*> textureTable;
-	std::unordered_map<std::string, SimpleSampler*> samplerTable;
-
-	// Initialization method
+	// Arrays for variables and buffers, and tables to find them
+	// by name - all in one block, along with the names and the
+	// local data buffers (see BuildMetadata())
+	unsigned char*			metadata = 0;
+	size_t					metadataBytes = 0;
+	SimpleConstantBuffer*	constantBuffers; // For index-based lookup
+	SimpleShaderVariable*	variables = 0;
+	SimpleSRV*				shaderResourceViews = 0;
+	SimpleSampler*			samplerStates = 0;
+	SimpleNameTable cbTable;
+	SimpleNameTable varTable;
+	SimpleNameTable textureTable;
+	SimpleNameTable samplerTable;
+
+	// Everything read from the shader's bytecode, which the
+	// tables above are built from
+	DXBCReflection reflection;
+	bool metadataCached = false;
+	float loadMs = 0.0f;
+
+	// Initialization methods
 	bool LoadShaderFile(LPCWSTR shaderFile);
+	bool LoadShaderBlob(Microsoft::WRL::ComPtr<ID3DBlob> blob, LPCWSTR name);
+	static bool Reflect(Microsoft::WRL::ComPtr<ID3DBlob> blob, DXBCReflection* reflection, bool* fromCache = 0);
+	static bool ReflectWithD3D(Microsoft::WRL::ComPtr<ID3DBlob> blob, DXBCReflection* reflection);
+	void BuildMetadata();
 
 	// Pure virtual functions for dealing with shader types
 	virtual bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob) = 0;
@@ -150,8 +282,20 @@ protected:
 
 	virtual void CleanUp();
 
+	// Uploads a constant buffer, if anything in it changed
+	void UploadBuffer(SimpleConstantBuffer* cb);
+
+	// Binds a constant buffer to this shader's stage, first
+	// re-uploading it if its ring slice is from an old frame
+	void SetConstantBuffer(SimpleConstantBuffer* cb);
+	bool RingSliceValid(const SimpleConstantBuffer* cb);
+	void BindConstantBuffer(const SimpleConstantBuffer& cb);
+	void RebindIfBound(const SimpleConstantBuffer& cb);
+	virtual ShaderStage GetStage() = 0;
+	virtual ID3D11DeviceChild* GetStageShader() = 0;
+
 	// Helpers for finding data by name
-	SimpleShaderVariable* FindVariable(std::string name, int size);
+	SimpleShaderVariable* FindVariable(const std::string& name, int size);
 	SimpleConstantBuffer* FindConstantBuffer(std::string name);
 
 	// Error logging
@@ -187,6 +331,8 @@ protected:
 	 Microsoft::WRL::ComPtr<ID3D11VertexShader> shader;
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StageVertex; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 };
 
@@ -198,6 +344,7 @@ class SimplePixelShader : public ISimpleShader
 {
 public:
 	SimplePixelShader(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, LPCWSTR shaderFile);
+	SimplePixelShader(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	~SimplePixelShader();
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> GetDirectXShader() { return shader; }
 
@@ -208,6 +355,8 @@ protected:
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> shader;
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StagePixel; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 };
 
@@ -228,6 +377,8 @@ protected:
 	Microsoft::WRL::ComPtr<ID3D11DomainShader> shader;
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StageDomain; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 };
 
@@ -248,6 +399,8 @@ protected:
 	Microsoft::WRL::ComPtr<ID3D11HullShader> shader;
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StageHull; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 };
 
@@ -280,6 +433,8 @@ protected:
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	bool CreateShaderWithStreamOut(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StageGeometry; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 
 	// Helpers
@@ -319,5 +474,7 @@ protected:
 
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
 	void SetShaderAndCBs();
+	ShaderStage GetStage() { return StageCompute; }
+	ID3D11DeviceChild* GetStageShader() { return shader.Get(); }
 	void CleanUp();
 };
\ No newline at end of file
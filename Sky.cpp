@@ -132,19 +132,18 @@ Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Sky::CreateCubemap(
 
 void Sky::InitRenderStates()
 {
-	// Rasterizer to reverse the cull mode
-	D3D11_RASTERIZER_DESC rastDesc = {};
-	rastDesc.CullMode = D3D11_CULL_FRONT; // Draw the inside instead of the outside!
-	rastDesc.FillMode = D3D11_FILL_SOLID;
-	rastDesc.DepthClipEnable = true;
-	Graphics::Device->CreateRasterizerState(&rastDesc, rasterState.GetAddressOf());
-
-	// Depth state so that we ACCEPT pixels with a depth == 1
-	D3D11_DEPTH_STENCIL_DESC depthDesc = {};
-	depthDesc.DepthEnable = true;
-	depthDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
-	depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-	Graphics::Device->CreateDepthStencilState(&depthDesc, depthState.GetAddressOf());
+	PipelineDesc desc = PipelineDesc::Defaults();
+	desc.VertexShader = skyVS->GetDirectXShader().Get();
+	desc.PixelShader = skyPS->GetDirectXShader().Get();
+	desc.InputLayout = skyVS->GetInputLayout().Get();
+
+	// Reverse the cull mode
+	desc.Rasterizer.CullMode = D3D11_CULL_FRONT; // Draw the inside instead of the outside!
+
+	// ACCEPT pixels with a depth == 1
+	desc.DepthStencil.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+
+	pipeline = Graphics::Pipelines->GetPipeline(desc);
 }
 
 
@@ -152,8 +151,8 @@ void Sky::InitRenderStates()
 
 void Sky::Draw(std::shared_ptr<Camera> camera)
 {
-	Graphics::Context->RSSetState(rasterState.Get());
-	Graphics::Context->OMSetDepthStencilState(depthState.Get(), 0);
+	// Shaders are part of the pipeline, so these only add their constant buffers
+	Graphics::States->SetPipeline(pipeline);
 	skyVS->SetShader();
 	skyPS->SetShader();
 
@@ -165,7 +164,7 @@ void Sky::Draw(std::shared_ptr<Camera> camera)
 	skyPS->SetSamplerState("BasicSampler", samplerOptions);
 	skyMesh->Draw(Graphics::Context.Get());
 
-	Graphics::Context->RSSetState(0); 
-	Graphics::Context->OMSetDepthStencilState(0, 0);
+	Graphics::States->SetRasterizerState(0); 
+	Graphics::States->SetDepthStencilState(0, 0);
 }
 
@@ -2,6 +2,7 @@
 #include "Mesh.h"
 #include "SimpleShader.h"
 #include "Camera.h"
+#include "PipelineState.h"
 #include <memory>
 #include <wrl/client.h>
 
@@ -37,8 +38,7 @@ public:
 private:
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerOptions;
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> skySRV;
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> depthState;
-	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterState;
+	const PipelineState* pipeline = 0;
 	std::shared_ptr<Mesh> skyMesh;
 	std::shared_ptr<SimpleVertexShader> skyVS;
 	std::shared_ptr<SimplePixelShader> skyPS;
@@ -0,0 +1,324 @@
+#include "SkyIrradiance.h"
+#include <cmath>
+#include <emmintrin.h>
+#include <thread>
+#include <vector>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// The basis functions' constant factors
+	const float Y00 = 0.282095f;
+	const float Y1 = 0.488603f;
+	const float Y2 = 1.092548f;
+	const float Y20 = 0.315392f;
+	const float Y22 = 0.546274f;
+
+	// --------------------------------------------------------
+	// Each face as a center and the directions u and v run
+	// across it (v going down) - D3D's cube layout, so the
+	// direction through (u, v) is Center + u * U + v * V
+	// --------------------------------------------------------
+	struct FaceAxes
+	{
+		float Center[3];
+		float U[3];
+		float V[3];
+	};
+
+	const FaceAxes Faces[6] =
+	{
+		{ {  1,  0,  0 }, {  0,  0, -1 }, { 0, -1,  0 } },
+		{ { -1,  0,  0 }, {  0,  0,  1 }, { 0, -1,  0 } },
+		{ {  0,  1,  0 }, {  1,  0,  0 }, { 0,  0,  1 } },
+		{ {  0, -1,  0 }, {  1,  0,  0 }, { 0,  0, -1 } },
+		{ {  0,  0,  1 }, {  1,  0,  0 }, { 0, -1,  0 } },
+		{ {  0,  0, -1 }, { -1,  0,  0 }, { 0, -1,  0 } },
+	};
+
+	// The nine basis functions at a unit direction
+	void Basis(double x, double y, double z, double out[9])
+	{
+		out[0] = Y00;
+		out[1] = Y1 * y;
+		out[2] = Y1 * z;
+		out[3] = Y1 * x;
+		out[4] = Y2 * x * y;
+		out[5] = Y2 * y * z;
+		out[6] = Y20 * (3.0 * z * z - 1.0);
+		out[7] = Y2 * x * z;
+		out[8] = Y22 * (x * x - y * y);
+	}
+
+	void LinearTable(float table[256])
+	{
+		for (int i = 0; i < 256; i++)
+			table[i] = powf(i / 255.0f, 2.2f);
+	}
+
+	// Adds three basis functions' products with a row's
+	// weighted colors to their 9 sums
+	template<typename BasisFn>
+	void AccumulateRow(const float* rows, unsigned int count, BasisFn basis, __m128 acc[9])
+	{
+		const float* red = rows;
+		const float* green = rows + count;
+		const float* blue = rows + count * 2;
+		const float* dirX = rows + count * 3;
+		const float* dirY = rows + count * 4;
+		const float* dirZ = rows + count * 5;
+		for (unsigned int x = 0; x < count; x += 4)
+		{
+			__m128 b[3];
+			basis(_mm_loadu_ps(dirX + x), _mm_loadu_ps(dirY + x), _mm_loadu_ps(dirZ + x), b);
+			__m128 r = _mm_loadu_ps(red + x);
+			__m128 g = _mm_loadu_ps(green + x);
+			__m128 bl = _mm_loadu_ps(blue + x);
+			for (int i = 0; i < 3; i++)
+			{
+				acc[i * 3 + 0] = _mm_add_ps(acc[i * 3 + 0], _mm_mul_ps(b[i], r));
+				acc[i * 3 + 1] = _mm_add_ps(acc[i * 3 + 1], _mm_mul_ps(b[i], g));
+				acc[i * 3 + 2] = _mm_add_ps(acc[i * 3 + 2], _mm_mul_ps(b[i], bl));
+			}
+		}
+	}
+
+	// --------------------------------------------------------
+	// Sums one tile's rows into sums, 4 texels at a time
+	//
+	// - Each row's directions and weighted colors are worked
+	//   out once, then the nine basis functions go over them
+	//   three at a time, so each pass's sums stay in registers
+	// - A texel at (u, v) covers a solid angle of its area over
+	//   (1 + u^2 + v^2)^(3/2), which is also the cube of the
+	//   length that normalizes its direction
+	// - Rows are summed in floats, then added to the doubles,
+	//   so long rows don't lose precision
+	// --------------------------------------------------------
+	void ProjectTile(const uint8_t* face, const FaceAxes& axes, unsigned int size, unsigned int rowPitch, unsigned int firstRow, unsigned int endRow, const float* toLinear, double sums[27])
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 texelArea = _mm_set1_ps(4.0f / ((float)size * size));
+		const __m128 step = _mm_set1_ps(2.0f / size);
+		const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+		// Red, green, blue, then x, y, z - padded to whole groups
+		// of 4, with the padding's colors left at zero
+		unsigned int count = (size + 3) / 4 * 4;
+		std::vector<float> rows((size_t)count * 6, 0.0f);
+		float* red = rows.data();
+		float* green = red + count;
+		float* blue = green + count;
+		float* dirX = blue + count;
+		float* dirY = dirX + count;
+		float* dirZ = dirY + count;
+
+		for (unsigned int y = firstRow; y < endRow; y++)
+		{
+			const uint8_t* row = face + (size_t)y * rowPitch;
+			float v = (y + 0.5f) * 2.0f / size - 1.0f;
+			__m128 baseX = _mm_set1_ps(axes.Center[0] + v * axes.V[0]);
+			__m128 baseY = _mm_set1_ps(axes.Center[1] + v * axes.V[1]);
+			__m128 baseZ = _mm_set1_ps(axes.Center[2] + v * axes.V[2]);
+			__m128 vv = _mm_set1_ps(1.0f + v * v);
+
+			for (unsigned int x = 0; x < size; x++)
+			{
+				red[x] = toLinear[row[x * 4 + 0]];
+				green[x] = toLinear[row[x * 4 + 1]];
+				blue[x] = toLinear[row[x * 4 + 2]];
+			}
+
+			for (unsigned int x = 0; x < count; x += 4)
+			{
+				__m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), laneOffsets), step), one);
+				__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), vv)));
+				__m128 weight = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(invLength, invLength), invLength), texelArea);
+
+				_mm_storeu_ps(red + x, _mm_mul_ps(_mm_loadu_ps(red + x), weight));
+				_mm_storeu_ps(green + x, _mm_mul_ps(_mm_loadu_ps(green + x), weight));
+				_mm_storeu_ps(blue + x, _mm_mul_ps(_mm_loadu_ps(blue + x), weight));
+				_mm_storeu_ps(dirX + x, _mm_mul_ps(_mm_add_ps(baseX, _mm_mul_ps(u, _mm_set1_ps(axes.U[0]))), invLength));
+				_mm_storeu_ps(dirY + x, _mm_mul_ps(_mm_add_ps(baseY, _mm_mul_ps(u, _mm_set1_ps(axes.U[1]))), invLength));
+				_mm_storeu_ps(dirZ + x, _mm_mul_ps(_mm_add_ps(baseZ, _mm_mul_ps(u, _mm_set1_ps(axes.U[2]))), invLength));
+			}
+
+			__m128 acc[27];
+			for (int i = 0; i < 27; i++)
+				acc[i] = _mm_setzero_ps();
+
+			AccumulateRow(red, count, [](__m128, __m128 y, __m128 z, __m128* b)
+			{
+				b[0] = _mm_set1_ps(Y00);
+				b[1] = _mm_mul_ps(_mm_set1_ps(Y1), y);
+				b[2] = _mm_mul_ps(_mm_set1_ps(Y1), z);
+			}, acc);
+			AccumulateRow(red, count, [](__m128 x, __m128 y, __m128 z, __m128* b)
+			{
+				b[0] = _mm_mul_ps(_mm_set1_ps(Y1), x);
+				b[1] = _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(x, y));
+				b[2] = _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(y, z));
+			}, acc + 9);
+			AccumulateRow(red, count, [](__m128 x, __m128 y, __m128 z, __m128* b)
+			{
+				b[0] = _mm_mul_ps(_mm_set1_ps(Y20), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f)));
+				b[1] = _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(x, z));
+				b[2] = _mm_mul_ps(_mm_set1_ps(Y22), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+			}, acc + 18);
+
+			alignas(16) float lanes[4];
+			for (int i = 0; i < 27; i++)
+			{
+				_mm_store_ps(lanes, acc[i]);
+				sums[i] += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			}
+		}
+	}
+}
+
+SkyIrradiance::SkyIrradiance(unsigned int threadCount)
+	: threadCount(threadCount)
+{
+	if (this->threadCount == 0)
+		this->threadCount = std::thread::hardware_concurrency();
+	if (this->threadCount == 0)
+		this->threadCount = 1;
+	if (this->threadCount > 8)
+		this->threadCount = 8;
+}
+
+// --------------------------------------------------------
+// Splits every face into tiles of rows, hands each thread
+// a run of them, then adds the tiles up in order
+// --------------------------------------------------------
+void SkyIrradiance::Project(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch)
+{
+	float toLinear[256];
+	LinearTable(toLinear);
+
+	unsigned int tilesPerFace = (size + TileRows - 1) / TileRows;
+	unsigned int tiles = tilesPerFace * 6;
+	std::vector<double> tileSums((size_t)tiles * 27, 0.0);
+
+	auto work = [&](unsigned int first, unsigned int end)
+	{
+		for (unsigned int t = first; t < end; t++)
+		{
+			unsigned int face = t / tilesPerFace;
+			unsigned int firstRow = (t % tilesPerFace) * TileRows;
+			unsigned int endRow = firstRow + TileRows < size ? firstRow + TileRows : size;
+			ProjectTile(faces[face], Faces[face], size, rowPitch, firstRow, endRow, toLinear, &tileSums[(size_t)t * 27]);
+		}
+	};
+
+	unsigned int workers = threadCount < tiles ? threadCount : tiles;
+	unsigned int perWorker = workers > 0 ? (tiles + workers - 1) / workers : 0;
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < workers; i++)
+	{
+		unsigned int start = i * perWorker;
+		unsigned int end = start + perWorker < tiles ? start + perWorker : tiles;
+		if (start < end)
+			threads.emplace_back(work, start, end);
+	}
+
+	work(0, perWorker < tiles ? perWorker : tiles);
+
+	for (auto& t : threads)
+		t.join();
+
+	double sums[27] = {};
+	for (unsigned int t = 0; t < tiles; t++)
+		for (int i = 0; i < 27; i++)
+			sums[i] += tileSums[(size_t)t * 27 + i];
+	SetCoefficients(sums);
+}
+
+void SkyIrradiance::ProjectReference(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch)
+{
+	double sums[27] = {};
+	for (unsigned int f = 0; f < 6; f++)
+	{
+		const FaceAxes& axes = Faces[f];
+		for (unsigned int y = 0; y < size; y++)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				double u = (x + 0.5) * 2.0 / size - 1.0;
+				double v = (y + 0.5) * 2.0 / size - 1.0;
+				double dx = axes.Center[0] + u * axes.U[0] + v * axes.V[0];
+				double dy = axes.Center[1] + u * axes.U[1] + v * axes.V[1];
+				double dz = axes.Center[2] + u * axes.U[2] + v * axes.V[2];
+				double length = sqrt(dx * dx + dy * dy + dz * dz);
+				double weight = 4.0 / ((double)size * size) / (length * length * length);
+
+				double basis[9];
+				Basis(dx / length, dy / length, dz / length, basis);
+
+				const uint8_t* texel = faces[f] + (size_t)y * rowPitch + x * 4;
+				for (int c = 0; c < 3; c++)
+				{
+					double radiance = pow(texel[c] / 255.0, 2.2);
+					for (int i = 0; i < 9; i++)
+						sums[i * 3 + c] += basis[i] * radiance * weight;
+				}
+			}
+		}
+	}
+	SetCoefficients(sums);
+}
+
+// --------------------------------------------------------
+// Keeps the radiance coefficients, and packs them for the
+// shader with each band scaled by its share of the cosine
+// lobe (pi, 2pi / 3, pi / 4), then divided by pi
+// --------------------------------------------------------
+void SkyIrradiance::SetCoefficients(const double sums[CoefficientCount * 3])
+{
+	const double band[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+
+	float c[9][3];
+	for (int i = 0; i < 9; i++)
+	{
+		for (int ch = 0; ch < 3; ch++)
+		{
+			coefficients[i * 3 + ch] = (float)sums[i * 3 + ch];
+			c[i][ch] = (float)(sums[i * 3 + ch] * band[i]);
+		}
+	}
+
+	// Per channel: (x, y, z, 1) and (xy, yz, zz, xz) terms
+	for (int ch = 0; ch < 3; ch++)
+	{
+		float* linear = &constants[ch * 4];
+		linear[0] = Y1 * c[3][ch];
+		linear[1] = Y1 * c[1][ch];
+		linear[2] = Y1 * c[2][ch];
+		linear[3] = Y00 * c[0][ch] - Y20 * c[6][ch];
+
+		float* quadratic = &constants[12 + ch * 4];
+		quadratic[0] = Y2 * c[4][ch];
+		quadratic[1] = Y2 * c[5][ch];
+		quadratic[2] = 3.0f * Y20 * c[6][ch];
+		quadratic[3] = Y2 * c[7][ch];
+
+		constants[24 + ch] = Y22 * c[8][ch];
+	}
+	constants[27] = 0.0f;
+}
+
+void SkyIrradiance::Evaluate(float x, float y, float z, float rgb[3]) const
+{
+	float quadratic[4] = { x * y, y * z, z * z, z * x };
+	for (int ch = 0; ch < 3; ch++)
+	{
+		const float* linear = &constants[ch * 4];
+		const float* quad = &constants[12 + ch * 4];
+		float result =
+			linear[0] * x + linear[1] * y + linear[2] * z + linear[3] +
+			quad[0] * quadratic[0] + quad[1] * quadratic[1] + quad[2] * quadratic[2] + quad[3] * quadratic[3] +
+			constants[24 + ch] * (x * x - y * y);
+		rgb[ch] = result > 0.0f ? result : 0.0f;
+	}
+}
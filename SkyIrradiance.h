@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+
+// --------------------------------------------------------
+// Diffuse light from the sky's cube map, as 9 spherical
+// harmonics coefficients per color channel (Ramamoorthi and
+// Hanrahan, "An Efficient Representation for Irradiance
+// Environment Maps")
+//
+// - Every texel of every face is projected, weighted by the
+//   solid angle it covers
+// - Faces are cut into tiles of rows, which are shared out
+//   among threads.  Each tile sums 4 texels at a time with
+//   SSE, then its totals are kept in doubles and added up in
+//   tile order - so the result doesn't depend on the thread
+//   count
+// - The shader constants have the cosine lobe and 1 / pi
+//   folded in, so evaluating them at a normal gives what a
+//   white diffuse surface facing that way reflects (see
+//   SkyIrradiance() in Lighting.hlsli)
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class SkyIrradiance
+{
+public:
+	static const unsigned int CoefficientCount = 9;
+
+	// Rows per tile of a face
+	static const unsigned int TileRows = 32;
+
+	SkyIrradiance(unsigned int threadCount = 0);
+
+	// Six square faces (+X, -X, +Y, -Y, +Z, -Z) of 8 bit RGBA
+	// texels in gamma space, like the sky's textures
+	void Project(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch);
+
+	// Single threaded, in doubles, one texel at a time - for
+	// checking Project() against
+	void ProjectReference(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch);
+
+	// The sky's radiance, RGB per coefficient, in the usual
+	// order: l = 0, then l = 1 (m = -1, 0, 1), then l = 2
+	const float* GetCoefficients() const { return coefficients; }
+
+	// Seven float4s - red, green and blue for the linear and
+	// constant terms, then for the quadratic terms, then the
+	// x^2 - y^2 term for all three
+	const float* GetShaderConstants() const { return constants; }
+
+	// What the shader works out for a (unit) normal
+	void Evaluate(float x, float y, float z, float rgb[3]) const;
+
+private:
+	void SetCoefficients(const double sums[CoefficientCount * 3]);
+
+	unsigned int threadCount;
+	float coefficients[CoefficientCount * 3] = {};
+	float constants[7 * 4] = {};
+};
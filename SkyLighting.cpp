@@ -0,0 +1,657 @@
+#include "SkyLighting.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Bump whenever the file layout or the results change
+	const uint32_t SkyLightingVersion = 1;
+
+	const float Pi = 3.14159265359f;
+
+	// --------------------------------------------------------
+	// Runs work(begin, end) over [0, count), split into one
+	// chunk per thread - this thread does the first
+	// --------------------------------------------------------
+	void ParallelFor(unsigned int threadCount, unsigned int count, const std::function<void(unsigned int, unsigned int)>& work)
+	{
+		unsigned int workers = threadCount < count ? threadCount : count;
+		if (workers == 0)
+			return;
+		unsigned int perWorker = (count + workers - 1) / workers;
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < workers; i++)
+		{
+			unsigned int start = i * perWorker;
+			unsigned int end = start + perWorker < count ? start + perWorker : count;
+			if (start < end)
+				threads.emplace_back(work, start, end);
+		}
+
+		work(0, perWorker < count ? perWorker : count);
+
+		for (auto& t : threads)
+			t.join();
+	}
+
+	// Rounded to nearest - anything too small for a normal
+	// half is flushed to zero, and anything too big clamped
+	uint16_t ToHalf(float f)
+	{
+		uint32_t bits;
+		memcpy(&bits, &f, 4);
+		uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+		int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+		uint32_t mantissa = bits & 0x7FFFFF;
+
+		if (exponent <= 0)
+			return sign;
+		if (exponent >= 31)
+			return sign | 0x7BFF;
+
+		// A carry out of the mantissa correctly bumps the exponent
+		uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+		if ((mantissa & 0x1000) && half < 0x7BFF)
+			half++;
+		return sign | (uint16_t)half;
+	}
+
+	// Van der Corput sequence - with i / count, the points of
+	// a Hammersley set
+	float RadicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return (float)bits * 2.3283064365386963e-10f;
+	}
+
+	// The cosine of a GGX half vector's angle from the normal,
+	// for a = roughness squared
+	float GGXCosTheta(float a, float xi)
+	{
+		return sqrtf((1.0f - xi) / (1.0f + (a * a - 1.0f) * xi));
+	}
+
+	// --------------------------------------------------------
+	// The direction through a point on a cube face, with u and
+	// v from -1 to 1 across it (v going down) - D3D's layout,
+	// which DirectionToFace() undoes
+	// --------------------------------------------------------
+	void FaceToDirection(unsigned int face, float u, float v, float& x, float& y, float& z)
+	{
+		switch (face)
+		{
+		case 0: x = 1.0f; y = -v; z = -u; break;
+		case 1: x = -1.0f; y = -v; z = u; break;
+		case 2: x = u; y = 1.0f; z = v; break;
+		case 3: x = u; y = -1.0f; z = -v; break;
+		case 4: x = u; y = -v; z = 1.0f; break;
+		default: x = -u; y = -v; z = -1.0f; break;
+		}
+	}
+
+	__m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	// --------------------------------------------------------
+	// Four directions to the faces they point at and where on
+	// them, as texel coordinates on faces size texels across
+	// (texel centers at whole numbers)
+	// --------------------------------------------------------
+	void DirectionToFace(__m128 x, __m128 y, __m128 z, __m128 size, int* faces, float* texelX, float* texelY)
+	{
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		__m128 ax = _mm_and_ps(x, absMask);
+		__m128 ay = _mm_and_ps(y, absMask);
+		__m128 az = _mm_and_ps(z, absMask);
+		__m128 isX = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+		__m128 isY = _mm_andnot_ps(isX, _mm_cmpge_ps(ay, az));
+
+		__m128 major = Select(isX, x, Select(isY, y, z));
+		__m128 negative = _mm_cmplt_ps(major, zero);
+		__m128 sign = Select(negative, _mm_set1_ps(-1.0f), one);
+		__m128 scale = _mm_div_ps(half, _mm_and_ps(major, absMask));
+
+		// +-X: (-sz, -y), +-Y: (x, sz), +-Z: (sx, -y)
+		__m128 negY = _mm_sub_ps(zero, y);
+		__m128 sz = _mm_mul_ps(sign, z);
+		__m128 u = Select(isX, _mm_sub_ps(zero, sz), Select(isY, x, _mm_mul_ps(sign, x)));
+		__m128 v = Select(isX, negY, Select(isY, sz, negY));
+
+		__m128 face = Select(isX, zero, Select(isY, _mm_set1_ps(2.0f), _mm_set1_ps(4.0f)));
+		face = _mm_add_ps(face, _mm_and_ps(negative, one));
+
+		_mm_storeu_si128((__m128i*)faces, _mm_cvttps_epi32(face));
+		_mm_storeu_ps(texelX, _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(u, scale), half), size), half));
+		_mm_storeu_ps(texelY, _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(v, scale), half), size), half));
+	}
+
+	// Bilinear, clamped to the face's edges
+	__m128 SampleFace(const float* level, unsigned int size, int face, float texelX, float texelY)
+	{
+		float fx = floorf(texelX);
+		float fy = floorf(texelY);
+		__m128 wx = _mm_set1_ps(texelX - fx);
+		__m128 wy = _mm_set1_ps(texelY - fy);
+
+		int last = (int)size - 1;
+		int x0 = (int)fx, y0 = (int)fy;
+		int x1 = x0 + 1, y1 = y0 + 1;
+		x0 = x0 < 0 ? 0 : (x0 > last ? last : x0);
+		x1 = x1 < 0 ? 0 : (x1 > last ? last : x1);
+		y0 = y0 < 0 ? 0 : (y0 > last ? last : y0);
+		y1 = y1 < 0 ? 0 : (y1 > last ? last : y1);
+
+		const float* faceTexels = level + (size_t)face * size * size * 4;
+		const float* row0 = faceTexels + (size_t)y0 * size * 4;
+		const float* row1 = faceTexels + (size_t)y1 * size * 4;
+		__m128 c00 = _mm_loadu_ps(row0 + x0 * 4);
+		__m128 c10 = _mm_loadu_ps(row0 + x1 * 4);
+		__m128 c01 = _mm_loadu_ps(row1 + x0 * 4);
+		__m128 c11 = _mm_loadu_ps(row1 + x1 * 4);
+
+		__m128 top = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), wx));
+		__m128 bottom = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), wx));
+		return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wy));
+	}
+
+	// Mips past the one that's 1 x 1 are dropped
+	unsigned int SpecularMipCount(const SkyLighting::Settings& s)
+	{
+		unsigned int mips = 1;
+		while ((s.SpecularSize >> mips) > 0 && mips < s.SpecularMips)
+			mips++;
+		return mips;
+	}
+
+	size_t SpecularFaceHalves(const SkyLighting::Settings& s)
+	{
+		size_t halves = 0;
+		for (unsigned int m = 0; m < SpecularMipCount(s); m++)
+			halves += (size_t)(s.SpecularSize >> m) * (s.SpecularSize >> m) * 4;
+		return halves;
+	}
+}
+
+SkyLighting::SkyLighting(unsigned int threadCount)
+	: threadCount(threadCount)
+{
+	if (this->threadCount == 0)
+		this->threadCount = std::thread::hardware_concurrency();
+	if (this->threadCount == 0)
+		this->threadCount = 1;
+	if (this->threadCount > 8)
+		this->threadCount = 8;
+}
+
+unsigned int SkyLighting::GetSpecularMips() const
+{
+	return SpecularMipCount(settings);
+}
+
+size_t SkyLighting::GetSpecularOffset(unsigned int face, unsigned int mip) const
+{
+	size_t offset = face * SpecularFaceHalves(settings);
+	for (unsigned int m = 0; m < mip; m++)
+		offset += (size_t)(settings.SpecularSize >> m) * (settings.SpecularSize >> m) * 4;
+	return offset;
+}
+
+// --------------------------------------------------------
+// Hashes the faces, then makes the linear pyramid: the
+// first level averages blocks of the source down to at most
+// MaxSourceSize, and each after that averages 2 x 2 blocks
+// of the one before
+// --------------------------------------------------------
+void SkyLighting::SetSource(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch)
+{
+	unsigned int baseSize = size;
+	unsigned int factor = 1;
+	while (baseSize > MaxSourceSize && baseSize % 2 == 0)
+	{
+		baseSize /= 2;
+		factor *= 2;
+	}
+
+	float toLinear[256];
+	for (int i = 0; i < 256; i++)
+		toLinear[i] = powf(i / 255.0f, 2.2f);
+
+	pyramid.clear();
+	pyramidSizes.clear();
+	pyramid.emplace_back((size_t)6 * baseSize * baseSize * 4);
+	pyramidSizes.push_back(baseSize);
+
+	// Each source row gets its own hash, so they can be made
+	// alongside the first level and folded together after
+	std::vector<uint64_t> rowHashes((size_t)6 * size);
+	ParallelFor(threadCount, 6 * baseSize, [&](unsigned int first, unsigned int end)
+	{
+		std::vector<float> sums((size_t)baseSize * 4);
+		float scale = 1.0f / (factor * factor);
+		for (unsigned int row = first; row < end; row++)
+		{
+			unsigned int face = row / baseSize;
+			unsigned int y = row % baseSize;
+			std::fill(sums.begin(), sums.end(), 0.0f);
+
+			for (unsigned int sy = y * factor; sy < (y + 1) * factor; sy++)
+			{
+				const uint8_t* source = faces[face] + (size_t)sy * rowPitch;
+
+				uint64_t hash = 0xCBF29CE484222325ull;
+				for (unsigned int i = 0; i < size; i++)
+				{
+					uint32_t texel;
+					memcpy(&texel, source + i * 4, 4);
+					hash = (hash ^ texel) * 0x100000001B3ull;
+				}
+				rowHashes[(size_t)face * size + sy] = hash;
+
+				for (unsigned int sx = 0; sx < size; sx++)
+				{
+					float* sum = &sums[(sx / factor) * 4];
+					sum[0] += toLinear[source[sx * 4 + 0]];
+					sum[1] += toLinear[source[sx * 4 + 1]];
+					sum[2] += toLinear[source[sx * 4 + 2]];
+				}
+			}
+
+			float* out = &pyramid[0][((size_t)face * baseSize + y) * baseSize * 4];
+			for (unsigned int x = 0; x < baseSize; x++)
+			{
+				out[x * 4 + 0] = sums[x * 4 + 0] * scale;
+				out[x * 4 + 1] = sums[x * 4 + 1] * scale;
+				out[x * 4 + 2] = sums[x * 4 + 2] * scale;
+				out[x * 4 + 3] = 1.0f;
+			}
+		}
+	});
+
+	sourceHash = 0xCBF29CE484222325ull ^ size;
+	for (uint64_t h : rowHashes)
+		sourceHash = (sourceHash ^ h) * 0x100000001B3ull;
+
+	while (pyramidSizes.back() > 1)
+	{
+		unsigned int from = pyramidSizes.back();
+		unsigned int to = from / 2;
+		const std::vector<float>& above = pyramid.back();
+		std::vector<float> level((size_t)6 * to * to * 4);
+
+		ParallelFor(threadCount, 6 * to, [&](unsigned int first, unsigned int end)
+		{
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (unsigned int row = first; row < end; row++)
+			{
+				unsigned int face = row / to;
+				unsigned int y = row % to;
+				const float* top = &above[((size_t)face * from + y * 2) * from * 4];
+				const float* bottom = top + (size_t)from * 4;
+				float* out = &level[((size_t)face * to + y) * to * 4];
+				for (unsigned int x = 0; x < to; x++)
+				{
+					__m128 sum = _mm_add_ps(
+						_mm_add_ps(_mm_loadu_ps(top + x * 8), _mm_loadu_ps(top + x * 8 + 4)),
+						_mm_add_ps(_mm_loadu_ps(bottom + x * 8), _mm_loadu_ps(bottom + x * 8 + 4)));
+					_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+				}
+			}
+		});
+
+		pyramid.push_back(std::move(level));
+		pyramidSizes.push_back(to);
+	}
+}
+
+void SkyLighting::Build(const Settings& settings)
+{
+	BuildSpecular(settings);
+	BuildLookup(settings);
+}
+
+// --------------------------------------------------------
+// Works out each mip's lobe once - its samples around +Z,
+// and the pyramid level each is read from - then turns it
+// to face every texel of the mip
+//
+// - The level is picked by comparing the solid angle the
+//   sample stands for (1 / (count * pdf)) with a texel's,
+//   biased up one level, as in "GPU-Based Importance
+//   Sampling" (GPU Gems 3) - and never finer than the mip
+// --------------------------------------------------------
+void SkyLighting::BuildSpecular(const Settings& settings)
+{
+	this->settings.SpecularSize = settings.SpecularSize;
+	this->settings.SpecularMips = settings.SpecularMips;
+	this->settings.SpecularSamples = settings.SpecularSamples;
+
+	unsigned int mips = GetSpecularMips();
+	specular.assign(SpecularFaceHalves(this->settings) * 6, 0);
+	if (pyramid.empty() || settings.SpecularSize == 0)
+		return;
+
+	unsigned int levels = (unsigned int)pyramidSizes.size();
+	float baseSize = (float)pyramidSizes[0];
+	float texelSolidAngle = 4.0f * Pi / (6.0f * baseSize * baseSize);
+
+	for (unsigned int m = 0; m < mips; m++)
+	{
+		unsigned int mipSize = settings.SpecularSize >> m;
+		float roughness = mips > 1 ? (float)m / (mips - 1) : 0.0f;
+		float finest = log2f(baseSize / mipSize);
+		if (finest < 0.0f)
+			finest = 0.0f;
+
+		std::vector<LobeSample> lobe;
+		if (m == 0)
+			lobe.push_back({ 0.0f, 0.0f, 1.0f, 1.0f, (unsigned int)(finest + 0.5f) });
+		else
+		{
+			float a = roughness * roughness;
+			float a2 = a * a;
+			unsigned int count = settings.SpecularSamples > 0 ? settings.SpecularSamples : 1;
+			for (unsigned int i = 0; i < count; i++)
+			{
+				float phi = 2.0f * Pi * i / count;
+				float cosTheta = GGXCosTheta(a, RadicalInverse(i));
+				float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+				// Reflect the view (the normal, here) about the half vector
+				float hx = sinTheta * cosf(phi);
+				float hy = sinTheta * sinf(phi);
+				float lz = 2.0f * cosTheta * cosTheta - 1.0f;
+				if (lz <= 0.0f)
+					continue;
+
+				// With the view along the normal, pdf = D / 4
+				float d = cosTheta * cosTheta * (a2 - 1.0f) + 1.0f;
+				float pdf = a2 / (Pi * d * d) / 4.0f;
+				float level = 0.5f * log2f(1.0f / (count * pdf) / texelSolidAngle) + 1.0f;
+				if (level < finest) level = finest;
+				if (level > levels - 1) level = (float)(levels - 1);
+
+				lobe.push_back({ 2.0f * cosTheta * hx, 2.0f * cosTheta * hy, lz, lz, (unsigned int)(level + 0.5f) });
+			}
+		}
+
+		// Padded to whole groups of 4 with samples that add nothing
+		while (lobe.size() % 4 != 0)
+			lobe.push_back({ 0.0f, 0.0f, 1.0f, 0.0f, levels - 1 });
+
+		ParallelFor(threadCount, 6 * mipSize, [&](unsigned int first, unsigned int end)
+		{
+			BuildSpecularRows(m, lobe, first, end, specular.data());
+		});
+	}
+}
+
+void SkyLighting::BuildSpecularRows(unsigned int mip, const std::vector<LobeSample>& lobe, unsigned int firstRow, unsigned int endRow, uint16_t* out) const
+{
+	unsigned int size = settings.SpecularSize >> mip;
+
+	// The lobe as arrays, for SSE
+	size_t groups = lobe.size() / 4;
+	std::vector<float> lx(lobe.size()), ly(lobe.size()), lz(lobe.size()), levelSizes(lobe.size());
+	float weightSum = 0.0f;
+	for (size_t i = 0; i < lobe.size(); i++)
+	{
+		lx[i] = lobe[i].X;
+		ly[i] = lobe[i].Y;
+		lz[i] = lobe[i].Z;
+		levelSizes[i] = (float)pyramidSizes[lobe[i].Level];
+		weightSum += lobe[i].Weight;
+	}
+	float normalize = weightSum > 0.0f ? 1.0f / weightSum : 0.0f;
+
+	for (unsigned int row = firstRow; row < endRow; row++)
+	{
+		unsigned int face = row / size;
+		unsigned int y = row % size;
+		uint16_t* texel = out + GetSpecularOffset(face, mip) + (size_t)y * size * 4;
+
+		for (unsigned int x = 0; x < size; x++)
+		{
+			float nx, ny, nz;
+			FaceToDirection(face, (x + 0.5f) * 2.0f / size - 1.0f, (y + 0.5f) * 2.0f / size - 1.0f, nx, ny, nz);
+			float length = sqrtf(nx * nx + ny * ny + nz * nz);
+			nx /= length; ny /= length; nz /= length;
+
+			// Tangent and bitangent - the lobe is round, so
+			// which way around them doesn't matter
+			float upX = fabsf(nz) < 0.999f ? 0.0f : 1.0f;
+			float upZ = 1.0f - upX;
+			float tx = -upZ * ny;
+			float ty = upZ * nx - upX * nz;
+			float tz = upX * ny;
+			float tLength = sqrtf(tx * tx + ty * ty + tz * tz);
+			tx /= tLength; ty /= tLength; tz /= tLength;
+			float bx = ny * tz - nz * ty;
+			float by = nz * tx - nx * tz;
+			float bz = nx * ty - ny * tx;
+
+			__m128 sum = _mm_setzero_ps();
+			alignas(16) int faces[4];
+			alignas(16) float texelX[4];
+			alignas(16) float texelY[4];
+			for (size_t g = 0; g < groups; g++)
+			{
+				__m128 sx = _mm_loadu_ps(&lx[g * 4]);
+				__m128 sy = _mm_loadu_ps(&ly[g * 4]);
+				__m128 sz = _mm_loadu_ps(&lz[g * 4]);
+				__m128 dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tx), sx), _mm_mul_ps(_mm_set1_ps(bx), sy)), _mm_mul_ps(_mm_set1_ps(nx), sz));
+				__m128 dy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(ty), sx), _mm_mul_ps(_mm_set1_ps(by), sy)), _mm_mul_ps(_mm_set1_ps(ny), sz));
+				__m128 dz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tz), sx), _mm_mul_ps(_mm_set1_ps(bz), sy)), _mm_mul_ps(_mm_set1_ps(nz), sz));
+				DirectionToFace(dx, dy, dz, _mm_loadu_ps(&levelSizes[g * 4]), faces, texelX, texelY);
+
+				for (unsigned int lane = 0; lane < 4; lane++)
+				{
+					const LobeSample& s = lobe[g * 4 + lane];
+					if (s.Weight <= 0.0f)
+						continue;
+					__m128 color = SampleFace(pyramid[s.Level].data(), pyramidSizes[s.Level], faces[lane], texelX[lane], texelY[lane]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(s.Weight)));
+				}
+			}
+
+			alignas(16) float color[4];
+			_mm_store_ps(color, _mm_mul_ps(sum, _mm_set1_ps(normalize)));
+			texel[x * 4 + 0] = ToHalf(color[0]);
+			texel[x * 4 + 1] = ToHalf(color[1]);
+			texel[x * 4 + 2] = ToHalf(color[2]);
+			texel[x * 4 + 3] = ToHalf(1.0f);
+		}
+	}
+}
+
+// --------------------------------------------------------
+// The integral of the specular BRDF over the hemisphere,
+// split into the parts that multiply F0 and that add to it
+//
+// - Geometry is Schlick-GGX with k = roughness^2 / 2, the
+//   remap for image based lighting (the direct lights'
+//   (r + 1)^2 / 8 is only meant for analytic lights)
+// --------------------------------------------------------
+void SkyLighting::BuildLookup(const Settings& settings)
+{
+	this->settings.LookupSize = settings.LookupSize;
+	this->settings.LookupSamples = settings.LookupSamples;
+
+	lookup.assign((size_t)settings.LookupSize * settings.LookupSize * 2, 0);
+	ParallelFor(threadCount, settings.LookupSize, [&](unsigned int first, unsigned int end)
+	{
+		BuildLookupRows(first, end);
+	});
+}
+
+void SkyLighting::BuildLookupRows(unsigned int firstRow, unsigned int endRow)
+{
+	unsigned int size = settings.LookupSize;
+	unsigned int count = settings.LookupSamples > 0 ? settings.LookupSamples : 1;
+	unsigned int padded = (count + 3) / 4 * 4;
+
+	// The half vectors' angles around the normal don't change
+	// with roughness
+	std::vector<float> cosPhi(padded, 1.0f), sinPhi(padded, 0.0f), xi(padded, 0.0f), valid(padded, 0.0f);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float phi = 2.0f * Pi * i / count;
+		cosPhi[i] = cosf(phi);
+		sinPhi[i] = sinf(phi);
+		xi[i] = RadicalInverse(i);
+		valid[i] = 1.0f;
+	}
+
+	std::vector<float> hx(padded), hz(padded);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	for (unsigned int row = firstRow; row < endRow; row++)
+	{
+		float roughness = (row + 0.5f) / size;
+		float a = roughness * roughness;
+		float k = a / 2.0f;
+
+		// Only x and z matter, with the view in the xz plane
+		for (unsigned int i = 0; i < padded; i++)
+		{
+			float cosTheta = i < count ? GGXCosTheta(a, xi[i]) : 1.0f;
+			hx[i] = sqrtf(1.0f - cosTheta * cosTheta) * cosPhi[i];
+			hz[i] = cosTheta;
+		}
+
+		for (unsigned int x = 0; x < size; x++)
+		{
+			float NdotV = (x + 0.5f) / size;
+			__m128 vx = _mm_set1_ps(sqrtf(1.0f - NdotV * NdotV));
+			__m128 vz = _mm_set1_ps(NdotV);
+			__m128 kv = _mm_set1_ps(k);
+			__m128 gv = _mm_set1_ps(NdotV / (NdotV * (1.0f - k) + k));
+
+			__m128 scale = zero;
+			__m128 bias = zero;
+			for (unsigned int i = 0; i < padded; i += 4)
+			{
+				__m128 sx = _mm_loadu_ps(&hx[i]);
+				__m128 sz = _mm_loadu_ps(&hz[i]);
+				__m128 VdotH = _mm_max_ps(_mm_add_ps(_mm_mul_ps(vx, sx), _mm_mul_ps(vz, sz)), zero);
+				__m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, VdotH), sz), vz);
+				__m128 use = _mm_and_ps(_mm_cmpgt_ps(NdotL, zero), _mm_cmpgt_ps(_mm_loadu_ps(&valid[i]), zero));
+
+				__m128 gl = _mm_div_ps(NdotL, _mm_add_ps(_mm_mul_ps(NdotL, _mm_sub_ps(one, kv)), kv));
+				__m128 visibility = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(gv, gl), VdotH), _mm_mul_ps(sz, vz));
+
+				__m128 f = _mm_sub_ps(one, VdotH);
+				__m128 f2 = _mm_mul_ps(f, f);
+				__m128 fresnel = _mm_mul_ps(_mm_mul_ps(f2, f2), f);
+
+				scale = _mm_add_ps(scale, _mm_and_ps(use, _mm_mul_ps(_mm_sub_ps(one, fresnel), visibility)));
+				bias = _mm_add_ps(bias, _mm_and_ps(use, _mm_mul_ps(fresnel, visibility)));
+			}
+
+			alignas(16) float scales[4];
+			alignas(16) float biases[4];
+			_mm_store_ps(scales, scale);
+			_mm_store_ps(biases, bias);
+			uint16_t* texel = &lookup[((size_t)row * size + x) * 2];
+			texel[0] = ToHalf((scales[0] + scales[1] + scales[2] + scales[3]) / count);
+			texel[1] = ToHalf((biases[0] + biases[1] + biases[2] + biases[3]) / count);
+		}
+	}
+}
+
+// --------------------------------------------------------
+// File layout - all little endian:
+//  "SKYL", version, source hash (8 bytes), the five
+//  settings, then the specular and lookup halves, each led
+//  by its count
+// --------------------------------------------------------
+bool SkyLighting::Load(const std::string& path, const Settings& wanted)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::vector<char> data((size_t)file.tellg());
+	file.seekg(0);
+	if (!file.read(data.data(), data.size()))
+		return false;
+
+	const size_t headerSize = 4 + 4 + 8 + 5 * 4;
+	if (data.size() < headerSize + 4)
+		return false;
+
+	const char* p = data.data();
+	uint32_t version;
+	uint64_t hash;
+	uint32_t values[5];
+	memcpy(&version, p + 4, 4);
+	memcpy(&hash, p + 8, 8);
+	memcpy(values, p + 16, sizeof(values));
+	if (memcmp(p, "SKYL", 4) != 0 || version != SkyLightingVersion || hash != sourceHash)
+		return false;
+
+	Settings read;
+	read.SpecularSize = values[0];
+	read.SpecularMips = values[1];
+	read.SpecularSamples = values[2];
+	read.LookupSize = values[3];
+	read.LookupSamples = values[4];
+	if (!(read == wanted))
+		return false;
+
+	size_t specularCount = SpecularFaceHalves(read) * 6;
+	size_t lookupCount = (size_t)read.LookupSize * read.LookupSize * 2;
+	if (data.size() != headerSize + 8 + (specularCount + lookupCount) * 2)
+		return false;
+
+	uint32_t counts[2];
+	memcpy(counts, p + headerSize, 8);
+	if (counts[0] != specularCount || counts[1] != lookupCount)
+		return false;
+
+	settings = read;
+	specular.resize(specularCount);
+	lookup.resize(lookupCount);
+	memcpy(specular.data(), p + headerSize + 8, specularCount * 2);
+	memcpy(lookup.data(), p + headerSize + 8 + specularCount * 2, lookupCount * 2);
+	return true;
+}
+
+bool SkyLighting::Save(const std::string& path) const
+{
+	uint32_t version = SkyLightingVersion;
+	uint32_t values[5] = { settings.SpecularSize, settings.SpecularMips, settings.SpecularSamples, settings.LookupSize, settings.LookupSamples };
+	uint32_t counts[2] = { (uint32_t)specular.size(), (uint32_t)lookup.size() };
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	file.write("SKYL", 4);
+	file.write((const char*)&version, 4);
+	file.write((const char*)&sourceHash, 8);
+	file.write((const char*)values, sizeof(values));
+	file.write((const char*)counts, sizeof(counts));
+	file.write((const char*)specular.data(), specular.size() * 2);
+	file.write((const char*)lookup.data(), lookup.size() * 2);
+	return file.good();
+}
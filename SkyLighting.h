@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Image based lighting from the sky's cube map, worked out
+// on the CPU for split sum specular (Karis, "Real Shading
+// in Unreal Engine 4")
+//
+// - The specular cube's mips hold the sky blurred by the
+//   GGX lobe of one roughness each, from 0 (mip 0, just the
+//   sky) to 1 (the last mip).  As the split sum assumes,
+//   each texel is seen straight on, along its own direction
+// - The BRDF lookup holds the scale and bias the specular
+//   color gets, by NdotV (across) and roughness (down)
+// - The sky is first turned into a linear pyramid, and each
+//   sample is read from the level that matches how much of
+//   the sphere it stands for, so a few hundred samples are
+//   enough without the result getting noisy
+// - Rows are split across threads, and sample directions
+//   are turned into cube texels 4 at a time with SSE
+// - Both results are half floats, ready to upload, and can
+//   be saved to and loaded from disk - a file is only used
+//   if it was made from the same sky with the same settings
+//
+// Has no graphics API dependencies, so it can be used and
+// measured outside of the renderer
+// --------------------------------------------------------
+class SkyLighting
+{
+public:
+	struct Settings
+	{
+		unsigned int SpecularSize = 128;		// Mip 0's width and height
+		unsigned int SpecularMips = 6;			// Down to 4 x 4
+		unsigned int SpecularSamples = 256;		// Per texel, for mips past 0
+		unsigned int LookupSize = 128;
+		unsigned int LookupSamples = 512;
+
+		bool operator==(const Settings& other) const
+		{
+			return SpecularSize == other.SpecularSize && SpecularMips == other.SpecularMips &&
+				SpecularSamples == other.SpecularSamples && LookupSize == other.LookupSize &&
+				LookupSamples == other.LookupSamples;
+		}
+	};
+
+	// The largest the sky is kept at - bigger faces are
+	// averaged down to this first
+	static const unsigned int MaxSourceSize = 512;
+
+	SkyLighting(unsigned int threadCount = 0);
+
+	// Six square faces (+X, -X, +Y, -Y, +Z, -Z) of 8 bit RGBA
+	// texels in gamma space, like the sky's textures
+	void SetSource(const uint8_t* const faces[6], unsigned int size, unsigned int rowPitch);
+	uint64_t GetSourceHash() const { return sourceHash; }
+
+	// Both of these, or each on its own
+	void Build(const Settings& settings);
+	void BuildSpecular(const Settings& settings);
+	void BuildLookup(const Settings& settings);
+
+	// Only succeeds if the file was made from the current
+	// source with the same settings
+	bool Load(const std::string& path, const Settings& settings);
+	bool Save(const std::string& path) const;
+
+	// RGBA halves, face by face with each face's mips in order
+	// (the order of a cube texture's subresources)
+	const std::vector<uint16_t>& GetSpecular() const { return specular; }
+	size_t GetSpecularOffset(unsigned int face, unsigned int mip) const;
+	unsigned int GetSpecularMips() const;
+
+	// RG halves, LookupSize x LookupSize
+	const std::vector<uint16_t>& GetLookup() const { return lookup; }
+
+	const Settings& GetSettings() const { return settings; }
+
+private:
+	// One sample of a mip's lobe, around +Z
+	struct LobeSample
+	{
+		float X, Y, Z;
+		float Weight;
+		unsigned int Level;
+	};
+
+	void BuildSpecularRows(unsigned int mip, const std::vector<LobeSample>& lobe, unsigned int firstRow, unsigned int endRow, uint16_t* out) const;
+	void BuildLookupRows(unsigned int firstRow, unsigned int endRow);
+
+	unsigned int threadCount;
+	Settings settings;
+	uint64_t sourceHash = 0;
+
+	// Linear RGBA, every level a face after another, halving
+	// in size each time down to 1 x 1
+	std::vector<std::vector<float>> pyramid;
+	std::vector<unsigned int> pyramidSizes;
+
+	std::vector<uint16_t> specular;
+	std::vector<uint16_t> lookup;
+};
@@ -0,0 +1,336 @@
+#include "StateCache.h"
+#include "FrameStats.h"
+#include "PipelineState.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ D3D11 SINK -----------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+D3D11StateSink::D3D11StateSink(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context) :
+	context(context)
+{
+	context.As(&context1);
+}
+
+void D3D11StateSink::SetShader(ShaderStage stage, ID3D11DeviceChild* shader)
+{
+	switch (stage)
+	{
+	case StageVertex: context->VSSetShader(static_cast<ID3D11VertexShader*>(shader), 0, 0); break;
+	case StageHull: context->HSSetShader(static_cast<ID3D11HullShader*>(shader), 0, 0); break;
+	case StageDomain: context->DSSetShader(static_cast<ID3D11DomainShader*>(shader), 0, 0); break;
+	case StageGeometry: context->GSSetShader(static_cast<ID3D11GeometryShader*>(shader), 0, 0); break;
+	case StagePixel: context->PSSetShader(static_cast<ID3D11PixelShader*>(shader), 0, 0); break;
+	case StageCompute: context->CSSetShader(static_cast<ID3D11ComputeShader*>(shader), 0, 0); break;
+	case StageCount: break;
+	}
+}
+
+void D3D11StateSink::SetConstantBuffers(ShaderStage stage, UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants)
+{
+	if (firstConstants && context1)
+	{
+		switch (stage)
+		{
+		case StageVertex: context1->VSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StageHull: context1->HSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StageDomain: context1->DSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StageGeometry: context1->GSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StagePixel: context1->PSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StageCompute: context1->CSSetConstantBuffers1(slot, count, buffers, firstConstants, numConstants); break;
+		case StageCount: break;
+		}
+		return;
+	}
+
+	switch (stage)
+	{
+	case StageVertex: context->VSSetConstantBuffers(slot, count, buffers); break;
+	case StageHull: context->HSSetConstantBuffers(slot, count, buffers); break;
+	case StageDomain: context->DSSetConstantBuffers(slot, count, buffers); break;
+	case StageGeometry: context->GSSetConstantBuffers(slot, count, buffers); break;
+	case StagePixel: context->PSSetConstantBuffers(slot, count, buffers); break;
+	case StageCompute: context->CSSetConstantBuffers(slot, count, buffers); break;
+	case StageCount: break;
+	}
+}
+
+void D3D11StateSink::SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	switch (stage)
+	{
+	case StageVertex: context->VSSetShaderResources(slot, count, views); break;
+	case StageHull: context->HSSetShaderResources(slot, count, views); break;
+	case StageDomain: context->DSSetShaderResources(slot, count, views); break;
+	case StageGeometry: context->GSSetShaderResources(slot, count, views); break;
+	case StagePixel: context->PSSetShaderResources(slot, count, views); break;
+	case StageCompute: context->CSSetShaderResources(slot, count, views); break;
+	case StageCount: break;
+	}
+}
+
+void D3D11StateSink::SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	switch (stage)
+	{
+	case StageVertex: context->VSSetSamplers(slot, count, samplers); break;
+	case StageHull: context->HSSetSamplers(slot, count, samplers); break;
+	case StageDomain: context->DSSetSamplers(slot, count, samplers); break;
+	case StageGeometry: context->GSSetSamplers(slot, count, samplers); break;
+	case StagePixel: context->PSSetSamplers(slot, count, samplers); break;
+	case StageCompute: context->CSSetSamplers(slot, count, samplers); break;
+	case StageCount: break;
+	}
+}
+
+void D3D11StateSink::SetInputLayout(ID3D11InputLayout* layout) { context->IASetInputLayout(layout); }
+void D3D11StateSink::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) { context->IASetPrimitiveTopology(topology); }
+void D3D11StateSink::SetVertexBuffers(UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) { context->IASetVertexBuffers(slot, count, buffers, strides, offsets); }
+void D3D11StateSink::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) { context->IASetIndexBuffer(buffer, format, offset); }
+void D3D11StateSink::SetRasterizerState(ID3D11RasterizerState* state) { context->RSSetState(state); }
+void D3D11StateSink::SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) { context->OMSetDepthStencilState(state, stencilRef); }
+void D3D11StateSink::SetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) { context->OMSetBlendState(state, blendFactor, sampleMask); }
+void D3D11StateSink::SetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView) { context->OMSetRenderTargets(count, views, depthView); }
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ STATE CACHE ----------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+StateCache::StateCache(std::shared_ptr<IStateSink> sink) :
+	sink(sink)
+{
+}
+
+void StateCache::Invalidate()
+{
+	for (int s = 0; s < StageCount; s++)
+	{
+		shaders[s].Known = false;
+		for (UINT i = 0; i < ConstantBufferSlots; i++) constantBuffers[s][i].Known = false;
+		for (UINT i = 0; i < ShaderResourceSlots; i++) shaderResources[s][i].Known = false;
+		for (UINT i = 0; i < SamplerSlots; i++) samplers[s][i].Known = false;
+	}
+
+	inputLayout.Known = false;
+	topology.Known = false;
+	for (UINT i = 0; i < VertexBufferSlots; i++) vertexBuffers[i].Known = false;
+	indexBuffer.Known = false;
+
+	rasterizerState.Known = false;
+	depthStencilState.Known = false;
+	blendState.Known = false;
+
+	currentPipeline = 0;
+}
+
+void StateCache::SetFilteringEnabled(bool enabled)
+{
+	filteringEnabled = enabled;
+	Invalidate();
+}
+
+template<typename T>
+bool StateCache::Update(Cached<T>& cache, const T& value)
+{
+	if (filteringEnabled && cache.Known && cache.Value == value)
+		return false;
+
+	cache.Value = value;
+	cache.Known = true;
+	return true;
+}
+
+template<typename T>
+bool StateCache::UpdateRange(Cached<T>* cache, UINT cacheSlots, UINT slot, UINT count, const T* values, UINT* first, UINT* last)
+{
+	// Runs past the end of the cache always go through whole,
+	// after making sure nothing we cache is trusted afterwards
+	if (slot + count > cacheSlots)
+	{
+		for (UINT s = slot; s < cacheSlots; s++)
+			cache[s].Known = false;
+		*first = slot;
+		*last = slot + count;
+		return true;
+	}
+
+	bool changed = false;
+	for (UINT i = 0; i < count; i++)
+	{
+		if (!Update(cache[slot + i], values[i]))
+			continue;
+
+		if (!changed) *first = slot + i;
+		*last = slot + i + 1;
+		changed = true;
+	}
+	return changed;
+}
+
+void StateCache::CountIssued() { FrameStats::StateCallsIssued++; }
+void StateCache::CountFiltered() { FrameStats::StateCallsFiltered++; }
+
+void StateCache::SetShader(ShaderStage stage, ID3D11DeviceChild* shader)
+{
+	if (!Update(shaders[stage], shader)) { CountFiltered(); return; }
+	LeavePipeline(stage == StageVertex || stage == StagePixel);
+	sink->SetShader(stage, shader);
+	CountIssued();
+}
+
+void StateCache::SetConstantBuffers(ShaderStage stage, UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants)
+{
+	if (slot + count > ConstantBufferSlots)
+	{
+		sink->SetConstantBuffers(stage, slot, count, buffers, firstConstants, numConstants);
+		CountIssued();
+		return;
+	}
+
+	// A plain bind is stored as an empty offset range
+	ConstantBufferBinding bindings[ConstantBufferSlots];
+	for (UINT i = 0; i < count; i++)
+	{
+		bindings[i].Buffer = buffers[i];
+		bindings[i].FirstConstant = firstConstants ? firstConstants[i] : 0;
+		bindings[i].NumConstants = numConstants ? numConstants[i] : 0;
+	}
+
+	UINT first, last;
+	if (!UpdateRange(constantBuffers[stage], ConstantBufferSlots, slot, count, bindings, &first, &last)) { CountFiltered(); return; }
+
+	UINT skip = first - slot;
+	sink->SetConstantBuffers(stage, first, last - first, buffers + skip,
+		firstConstants ? firstConstants + skip : 0,
+		numConstants ? numConstants + skip : 0);
+	CountIssued();
+}
+
+void StateCache::SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	UINT first, last;
+	if (!UpdateRange(shaderResources[stage], ShaderResourceSlots, slot, count, views, &first, &last)) { CountFiltered(); return; }
+	sink->SetShaderResources(stage, first, last - first, views + (first - slot));
+	CountIssued();
+}
+
+void StateCache::SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplerStates)
+{
+	UINT first, last;
+	if (!UpdateRange(samplers[stage], SamplerSlots, slot, count, samplerStates, &first, &last)) { CountFiltered(); return; }
+	sink->SetSamplers(stage, first, last - first, samplerStates + (first - slot));
+	CountIssued();
+}
+
+void StateCache::SetInputLayout(ID3D11InputLayout* layout)
+{
+	if (!Update(inputLayout, layout)) { CountFiltered(); return; }
+	LeavePipeline(true);
+	sink->SetInputLayout(layout);
+	CountIssued();
+}
+
+void StateCache::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY newTopology)
+{
+	if (!Update(topology, newTopology)) { CountFiltered(); return; }
+	LeavePipeline(true);
+	sink->SetPrimitiveTopology(newTopology);
+	CountIssued();
+}
+
+void StateCache::SetVertexBuffers(UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	if (slot + count > VertexBufferSlots)
+	{
+		for (UINT s = slot; s < VertexBufferSlots; s++)
+			vertexBuffers[s].Known = false;
+		sink->SetVertexBuffers(slot, count, buffers, strides, offsets);
+		CountIssued();
+		return;
+	}
+
+	VertexBufferBinding bindings[VertexBufferSlots];
+	for (UINT i = 0; i < count; i++)
+		bindings[i] = { buffers[i], strides[i], offsets[i] };
+
+	UINT first, last;
+	if (!UpdateRange(vertexBuffers, VertexBufferSlots, slot, count, bindings, &first, &last)) { CountFiltered(); return; }
+
+	UINT skip = first - slot;
+	sink->SetVertexBuffers(first, last - first, buffers + skip, strides + skip, offsets + skip);
+	CountIssued();
+}
+
+void StateCache::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	if (!Update(indexBuffer, IndexBufferBinding{ buffer, format, offset })) { CountFiltered(); return; }
+	sink->SetIndexBuffer(buffer, format, offset);
+	CountIssued();
+}
+
+void StateCache::SetRasterizerState(ID3D11RasterizerState* state)
+{
+	if (!Update(rasterizerState, state)) { CountFiltered(); return; }
+	LeavePipeline(true);
+	sink->SetRasterizerState(state);
+	CountIssued();
+}
+
+void StateCache::SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+	if (!Update(depthStencilState, DepthStencilBinding{ state, stencilRef })) { CountFiltered(); return; }
+	LeavePipeline(true);
+	sink->SetDepthStencilState(state, stencilRef);
+	CountIssued();
+}
+
+void StateCache::SetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	// D3D treats a null factor as all ones
+	BlendBinding binding = { state, { 1.0f, 1.0f, 1.0f, 1.0f }, sampleMask };
+	if (blendFactor)
+	{
+		for (int i = 0; i < 4; i++)
+			binding.Factor[i] = blendFactor[i];
+	}
+
+	if (!Update(blendState, binding)) { CountFiltered(); return; }
+	LeavePipeline(true);
+	sink->SetBlendState(state, binding.Factor, sampleMask);
+	CountIssued();
+}
+
+// --------------------------------------------------------
+// Always passed on - render targets change rarely, and
+// binding them can unbind SRVs behind our back
+// --------------------------------------------------------
+void StateCache::SetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView)
+{
+	for (int s = 0; s < StageCount; s++)
+		for (UINT i = 0; i < ShaderResourceSlots; i++)
+			shaderResources[s][i].Known = false;
+
+	sink->SetRenderTargets(count, views, depthView);
+	CountIssued();
+}
+
+// --------------------------------------------------------
+// Each part still goes through its own filter, so switching
+// between pipelines only sends what actually differs
+// --------------------------------------------------------
+void StateCache::SetPipeline(const PipelineState* pipeline)
+{
+	if (!pipeline) return;
+	if (filteringEnabled && pipeline == currentPipeline) { CountFiltered(); return; }
+
+	SetShader(StageVertex, pipeline->VertexShader.Get());
+	SetShader(StagePixel, pipeline->PixelShader.Get());
+	SetInputLayout(pipeline->InputLayout.Get());
+	SetPrimitiveTopology(pipeline->Desc.Topology);
+	SetRasterizerState(pipeline->RasterizerState.Get());
+	SetDepthStencilState(pipeline->DepthStencilState.Get(), pipeline->Desc.StencilRef);
+	SetBlendState(pipeline->BlendState.Get(), 0, 0xFFFFFFFF);
+
+	currentPipeline = pipeline;
+}
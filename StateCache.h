@@ -0,0 +1,215 @@
+#pragma once
+#include <d3d11_1.h>
+#include <wrl/client.h>
+#include <memory>
+
+struct PipelineState;
+
+// --------------------------------------------------------
+// Pipeline stages that take shaders, constant buffers,
+// shader resources and samplers
+// --------------------------------------------------------
+enum ShaderStage
+{
+	StageVertex,
+	StageHull,
+	StageDomain,
+	StageGeometry,
+	StagePixel,
+	StageCompute,
+	StageCount
+};
+
+// --------------------------------------------------------
+// Where the state cache sends the calls it doesn't filter
+//
+// - The D3D11 version below forwards to a device context;
+//   a recording version can stand in for it when testing
+// --------------------------------------------------------
+class IStateSink
+{
+public:
+	virtual ~IStateSink() = default;
+
+	virtual void SetShader(ShaderStage stage, ID3D11DeviceChild* shader) = 0;
+	// firstConstants/numConstants are null for a plain (non-offset) bind
+	virtual void SetConstantBuffers(ShaderStage stage, UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants) = 0;
+	virtual void SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+
+	virtual void SetInputLayout(ID3D11InputLayout* layout) = 0;
+	virtual void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) = 0;
+	virtual void SetVertexBuffers(UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) = 0;
+	virtual void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) = 0;
+
+	virtual void SetRasterizerState(ID3D11RasterizerState* state) = 0;
+	virtual void SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) = 0;
+	virtual void SetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) = 0;
+	virtual void SetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView) = 0;
+};
+
+class D3D11StateSink : public IStateSink
+{
+public:
+	D3D11StateSink(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+
+	void SetShader(ShaderStage stage, ID3D11DeviceChild* shader) override;
+	void SetConstantBuffers(ShaderStage stage, UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants) override;
+	void SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void SetInputLayout(ID3D11InputLayout* layout) override;
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override;
+	void SetVertexBuffers(UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override;
+
+	void SetRasterizerState(ID3D11RasterizerState* state) override;
+	void SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) override;
+	void SetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void SetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView) override;
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> context1;	// For offset constant buffer binds
+};
+
+// --------------------------------------------------------
+// Shadows what's currently bound to the pipeline and drops
+// calls that wouldn't change anything
+//
+// - Only covers what goes through it: anything that talks to
+//   the context directly (ImGui, for instance) must be
+//   followed by Invalidate()
+// - Setting render targets forgets the bound SRVs, since D3D
+//   silently unbinds any that alias the new targets
+// - Issued and filtered calls are counted in FrameStats
+// - A whole pipeline can be bound at once, which is skipped
+//   outright if it's the same one as last time
+// --------------------------------------------------------
+class StateCache
+{
+public:
+	StateCache(std::shared_ptr<IStateSink> sink);
+
+	// Forget everything, so the next call of each kind goes through
+	void Invalidate();
+
+	// With filtering off every call is passed on (for comparison)
+	void SetFilteringEnabled(bool enabled);
+	bool GetFilteringEnabled() const { return filteringEnabled; }
+
+	void SetShader(ShaderStage stage, ID3D11DeviceChild* shader);
+	bool IsShaderBound(ShaderStage stage, ID3D11DeviceChild* shader) const { return shaders[stage].Known && shaders[stage].Value == shader; }
+	void SetConstantBuffers(ShaderStage stage, UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* firstConstants = 0, const UINT* numConstants = 0);
+	void SetShaderResources(ShaderStage stage, UINT slot, UINT count, ID3D11ShaderResourceView* const* views);
+	void SetSamplers(ShaderStage stage, UINT slot, UINT count, ID3D11SamplerState* const* samplers);
+
+	void SetInputLayout(ID3D11InputLayout* layout);
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void SetVertexBuffers(UINT slot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets);
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+
+	void SetRasterizerState(ID3D11RasterizerState* state);
+	void SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef);
+	void SetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask);
+	void SetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView);
+
+	// Shaders, input layout, topology, rasterizer, depth and
+	// blend state in one go - pipelines are interned, so
+	// comparing pointers is enough to know nothing changed
+	void SetPipeline(const PipelineState* pipeline);
+
+	// Slots past these are passed straight on, uncached
+	static const UINT ConstantBufferSlots = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT;
+	static const UINT ShaderResourceSlots = 32;
+	static const UINT SamplerSlots = D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT;
+	static const UINT VertexBufferSlots = 4;
+
+private:
+	// Every cached value has a known flag, so that after
+	// Invalidate() the first call always goes through
+	template<typename T>
+	struct Cached
+	{
+		T Value = {};
+		bool Known = false;
+	};
+
+	struct ConstantBufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		UINT FirstConstant;
+		UINT NumConstants;
+		bool operator==(const ConstantBufferBinding& o) const { return Buffer == o.Buffer && FirstConstant == o.FirstConstant && NumConstants == o.NumConstants; }
+	};
+
+	struct VertexBufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		UINT Stride;
+		UINT Offset;
+		bool operator==(const VertexBufferBinding& o) const { return Buffer == o.Buffer && Stride == o.Stride && Offset == o.Offset; }
+	};
+
+	struct IndexBufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		DXGI_FORMAT Format;
+		UINT Offset;
+		bool operator==(const IndexBufferBinding& o) const { return Buffer == o.Buffer && Format == o.Format && Offset == o.Offset; }
+	};
+
+	struct DepthStencilBinding
+	{
+		ID3D11DepthStencilState* State;
+		UINT StencilRef;
+		bool operator==(const DepthStencilBinding& o) const { return State == o.State && StencilRef == o.StencilRef; }
+	};
+
+	struct BlendBinding
+	{
+		ID3D11BlendState* State;
+		FLOAT Factor[4];
+		UINT SampleMask;
+		bool operator==(const BlendBinding& o) const
+		{
+			return State == o.State && SampleMask == o.SampleMask &&
+				Factor[0] == o.Factor[0] && Factor[1] == o.Factor[1] && Factor[2] == o.Factor[2] && Factor[3] == o.Factor[3];
+		}
+	};
+
+	// Updates a run of cached slots, and narrows [first, last)
+	// down to the slots that actually changed
+	template<typename T>
+	bool UpdateRange(Cached<T>* cache, UINT cacheSlots, UINT slot, UINT count, const T* values, UINT* first, UINT* last);
+
+	// Updates a single cached value - true if it changed
+	template<typename T>
+	bool Update(Cached<T>& cache, const T& value);
+
+	void CountIssued();
+	void CountFiltered();
+
+	// Any change to the state a pipeline covers means it's no
+	// longer (known to be) the bound one
+	void LeavePipeline(bool changed) { if (changed) currentPipeline = 0; }
+
+	std::shared_ptr<IStateSink> sink;
+	bool filteringEnabled = true;
+
+	Cached<ID3D11DeviceChild*> shaders[StageCount];
+	Cached<ConstantBufferBinding> constantBuffers[StageCount][ConstantBufferSlots];
+	Cached<ID3D11ShaderResourceView*> shaderResources[StageCount][ShaderResourceSlots];
+	Cached<ID3D11SamplerState*> samplers[StageCount][SamplerSlots];
+
+	Cached<ID3D11InputLayout*> inputLayout;
+	Cached<D3D11_PRIMITIVE_TOPOLOGY> topology;
+	Cached<VertexBufferBinding> vertexBuffers[VertexBufferSlots];
+	Cached<IndexBufferBinding> indexBuffer;
+
+	Cached<ID3D11RasterizerState*> rasterizerState;
+	Cached<DepthStencilBinding> depthStencilState;
+	Cached<BlendBinding> blendState;
+
+	const PipelineState* currentPipeline = 0;
+};
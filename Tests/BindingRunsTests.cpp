@@ -0,0 +1,57 @@
+// cl /std:c++17 /EHsc /I.. BindingRunsTests.cpp
+#include "TestCheck.h"
+#include "BindingRuns.h"
+
+struct Resource { int Id; };
+
+// --------------------------------------------------------
+// Registers come in the order a map hands them out, so they
+// have to be sorted before runs are split
+// --------------------------------------------------------
+static void TestRuns()
+{
+	Resource r[6];
+	std::vector<std::pair<unsigned int, Resource*>> bound =
+	{
+		{ 3, &r[3] }, { 0, &r[0] }, { 7, &r[5] }, { 1, &r[1] }, { 4, &r[4] }, { 2, &r[2] }
+	};
+	std::vector<Resource*> table;
+	std::vector<BindingRun> runs;
+	BuildBindingRuns(bound, table, runs);
+
+	// 0-4 in one call, 7 on its own
+	CHECK(runs.size() == 2);
+	CHECK(runs[0].FirstSlot == 0 && runs[0].Count == 5 && runs[0].Offset == 0);
+	CHECK(runs[1].FirstSlot == 7 && runs[1].Count == 1 && runs[1].Offset == 5);
+
+	CHECK(table.size() == 6);
+	for (int i = 0; i < 5; i++)
+		CHECK(table[i] == &r[i]);
+	CHECK(table[5] == &r[5]);
+}
+
+// --------------------------------------------------------
+// Rebuilding replaces what was there, and nothing bound
+// leaves nothing to bind
+// --------------------------------------------------------
+static void TestRebuild()
+{
+	Resource r[2];
+	std::vector<std::pair<unsigned int, Resource*>> bound = { { 5, &r[0] }, { 9, &r[1] } };
+	std::vector<Resource*> table;
+	std::vector<BindingRun> runs;
+	BuildBindingRuns(bound, table, runs);
+	CHECK(runs.size() == 2 && table.size() == 2);
+	CHECK(runs[1].FirstSlot == 9 && runs[1].Offset == 1);
+
+	bound.clear();
+	BuildBindingRuns(bound, table, runs);
+	CHECK(runs.empty() && table.empty());
+}
+
+int main()
+{
+	TestRuns();
+	TestRebuild();
+	return TestsPassed("BindingRuns");
+}
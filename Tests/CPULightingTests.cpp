@@ -0,0 +1,171 @@
+// cl /std:c++17 /EHsc /I.. CPULightingTests.cpp ..\CPULighting.cpp
+#include "TestCheck.h"
+#include "CPULighting.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+using namespace CPULighting;
+
+namespace
+{
+	const float Pi = 3.14159265359f;
+
+	bool Near(float got, float want, float tolerance)
+	{
+		return fabsf(got - want) <= tolerance * fmaxf(1.0f, fabsf(want));
+	}
+
+	Light MakeLight(int type, XMFLOAT3 position, XMFLOAT3 direction, float range)
+	{
+		Light light;
+		memset(&light, 0, sizeof(light));
+		light.Type = type;
+		light.Position = position;
+		light.Direction = direction;
+		light.Range = range;
+		light.Intensity = 1.0f;
+		light.Color = XMFLOAT3(1, 1, 1);
+		light.SpotFalloff = 4.0f;
+		return light;
+	}
+}
+
+// --------------------------------------------------------
+// Values worked out by hand, for a surface lit and seen
+// straight on - what the shader gives in the same spot
+// --------------------------------------------------------
+static void TestGoldens()
+{
+	XMFLOAT3 up(0, 1, 0);
+	XMFLOAT3 side(1, 0, 0);
+	XMFLOAT3 f0(F0NonMetal, F0NonMetal, F0NonMetal);
+
+	// Roughness 0.5 is an alpha of 0.25
+	CHECK(Near(D_GGX(up, up, 0.5f), 1.0f / (Pi * 0.0625f), 1e-5f));
+	CHECK(Near(F_Schlick(up, up, f0).x, F0NonMetal, 1e-6f));
+	CHECK(Near(F_Schlick(up, side, f0).x, 1.0f, 1e-6f));
+	CHECK(Near(G_SchlickGGX(up, up, 0.5f), 1.0f, 1e-6f));
+	CHECK(Near(G_SchlickGGX(up, side, 0.5f), 8.0f / 2.25f, 1e-5f));
+
+	Light point = MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 5, 0), XMFLOAT3(0, -1, 0), 10.0f);
+	CHECK(Near(Attenuate(point, XMFLOAT3(0, 5, 0)), 1.0f, 1e-6f));
+	CHECK(Near(Attenuate(point, XMFLOAT3(0, 0, 0)), 0.5625f, 1e-6f));
+	CHECK(Attenuate(point, XMFLOAT3(0, -6, 0)) == 0.0f);
+
+	// specular = F * D * G / 4, diffuse takes what's left
+	float specular = F0NonMetal / (Pi * 0.0625f) / 4.0f;
+	float expected = (1.0f - specular) * 0.5f + specular;
+	XMFLOAT3 grey(0.5f, 0.5f, 0.5f);
+	XMFLOAT3 origin(0, 0, 0);
+	XMFLOAT3 camera(0, 10, 0);
+
+	Light directional = MakeLight(LIGHT_TYPE_DIRECTIONAL, origin, XMFLOAT3(0, -1, 0), 0.0f);
+	XMFLOAT3 c = CalculateLight(directional, up, origin, camera, 0.5f, 0.0f, grey, f0);
+	CHECK(Near(c.x, expected, 1e-5f) && Near(c.y, expected, 1e-5f) && Near(c.z, expected, 1e-5f));
+
+	c = CalculateLight(point, up, origin, camera, 0.5f, 0.0f, grey, f0);
+	CHECK(Near(c.x, expected * 0.5625f, 1e-5f));
+
+	// Pointing straight at the surface, a spot is a point light
+	Light spot = point;
+	spot.Type = LIGHT_TYPE_SPOT;
+	c = CalculateLight(spot, up, origin, camera, 0.5f, 0.0f, grey, f0);
+	CHECK(Near(c.x, expected * 0.5625f, 1e-5f));
+
+	// Metals have no diffuse at all
+	c = CalculateLight(directional, up, origin, camera, 0.5f, 1.0f, grey, f0);
+	CHECK(Near(c.x, specular, 1e-5f));
+
+	// Lit from behind (and seen from off to the side, as a light
+	// and camera directly opposite have no half vector)
+	Light below = MakeLight(LIGHT_TYPE_DIRECTIONAL, origin, XMFLOAT3(0, 1, 0), 0.0f);
+	c = CalculateLight(below, up, origin, XMFLOAT3(5, 10, 0), 0.5f, 0.0f, grey, f0);
+	CHECK(c.x == 0.0f && c.y == 0.0f && c.z == 0.0f);
+}
+
+// --------------------------------------------------------
+// Batches give what the scalar functions do, sample by
+// sample, for every type of light
+// --------------------------------------------------------
+static void TestBatches()
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	auto unitVector = [&]()
+	{
+		float x, y, z, lengthSq;
+		do
+		{
+			x = u(rng) * 2 - 1;
+			y = u(rng) * 2 - 1;
+			z = u(rng) * 2 - 1;
+			lengthSq = x * x + y * y + z * z;
+		} while (lengthSq < 0.01f || lengthSq > 1.0f);
+		float length = sqrtf(lengthSq);
+		return XMFLOAT3(x / length, y / length, z / length);
+	};
+
+	std::vector<SampleBatch> batches(2000);
+	for (auto& b : batches)
+		for (int i = 0; i < BatchSize; i++)
+		{
+			XMFLOAT3 n = unitVector();
+			b.NormalX[i] = n.x; b.NormalY[i] = n.y; b.NormalZ[i] = n.z;
+			b.PositionX[i] = u(rng) * 20 - 10; b.PositionY[i] = u(rng) * 4; b.PositionZ[i] = u(rng) * 20 - 10;
+			b.Roughness[i] = u(rng);
+			b.Metalness[i] = u(rng) > 0.5f ? 1.0f : 0.0f;
+			b.SurfaceR[i] = u(rng); b.SurfaceG[i] = u(rng); b.SurfaceB[i] = u(rng);
+			b.SpecularR[i] = b.Metalness[i] ? b.SurfaceR[i] : F0NonMetal;
+			b.SpecularG[i] = b.Metalness[i] ? b.SurfaceG[i] : F0NonMetal;
+			b.SpecularB[i] = b.Metalness[i] ? b.SurfaceB[i] : F0NonMetal;
+		}
+
+	XMFLOAT3 camera(0, 5, -15);
+	for (int type = LIGHT_TYPE_DIRECTIONAL; type <= LIGHT_TYPE_SPOT; type++)
+	{
+		std::vector<Light> lights;
+		for (int k = 0; k < 4; k++)
+		{
+			Light light = MakeLight(type, XMFLOAT3(u(rng) * 20 - 10, u(rng) * 6, u(rng) * 20 - 10), unitVector(), 5 + u(rng) * 15);
+			light.Intensity = 0.5f + u(rng) * 3;
+			light.Color = XMFLOAT3(u(rng), u(rng), u(rng));
+			light.SpotFalloff = 0.5f + u(rng) * 20;
+			lights.push_back(light);
+		}
+
+		for (auto& b : batches)
+		{
+			ColorBatch color = {};
+			AddLights(lights.data(), (unsigned int)lights.size(), camera, b, color);
+			for (int i = 0; i < BatchSize; i++)
+			{
+				XMFLOAT3 want(0, 0, 0);
+				for (auto& light : lights)
+				{
+					XMFLOAT3 c = CalculateLight(light,
+						XMFLOAT3(b.NormalX[i], b.NormalY[i], b.NormalZ[i]),
+						XMFLOAT3(b.PositionX[i], b.PositionY[i], b.PositionZ[i]),
+						camera, b.Roughness[i], b.Metalness[i],
+						XMFLOAT3(b.SurfaceR[i], b.SurfaceG[i], b.SurfaceB[i]),
+						XMFLOAT3(b.SpecularR[i], b.SpecularG[i], b.SpecularB[i]));
+					want.x += c.x;
+					want.y += c.y;
+					want.z += c.z;
+				}
+				CHECK(Near(color.R[i], want.x, 1e-5f));
+				CHECK(Near(color.G[i], want.y, 1e-5f));
+				CHECK(Near(color.B[i], want.z, 1e-5f));
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestGoldens();
+	TestBatches();
+	return TestsPassed("CPULighting");
+}
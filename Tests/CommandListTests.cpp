@@ -0,0 +1,187 @@
+// cl /std:c++17 /EHsc /I.. CommandListTests.cpp ..\CommandList.cpp ..\ConstantBufferRing.cpp ..\RingAllocator.cpp ..\PipelineState.cpp ..\StateCache.cpp ..\FrameStats.cpp
+#include "TestCheck.h"
+#include "CommandList.h"
+#include "PipelineState.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Remembers which calls made it through the cache
+struct RecordingSink : IStateSink
+{
+	std::vector<std::string> Calls;
+
+	void SetShader(ShaderStage, ID3D11DeviceChild*) override { Calls.push_back("shader"); }
+	void SetConstantBuffers(ShaderStage, UINT slot, UINT, ID3D11Buffer* const*, const UINT* first, const UINT*) override
+	{
+		Calls.push_back((first ? "cb1 " : "cb ") + std::to_string(slot));
+	}
+	void SetShaderResources(ShaderStage, UINT, UINT, ID3D11ShaderResourceView* const*) override { Calls.push_back("srv"); }
+	void SetSamplers(ShaderStage, UINT, UINT, ID3D11SamplerState* const*) override { Calls.push_back("sampler"); }
+	void SetInputLayout(ID3D11InputLayout*) override { Calls.push_back("layout"); }
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY) override { Calls.push_back("topology"); }
+	void SetVertexBuffers(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override { Calls.push_back("vb"); }
+	void SetIndexBuffer(ID3D11Buffer*, DXGI_FORMAT, UINT) override { Calls.push_back("ib"); }
+	void SetRasterizerState(ID3D11RasterizerState*) override { Calls.push_back("rasterizer"); }
+	void SetDepthStencilState(ID3D11DepthStencilState*, UINT) override { Calls.push_back("depth"); }
+	void SetBlendState(ID3D11BlendState*, const FLOAT*, UINT) override { Calls.push_back("blend"); }
+	void SetRenderTargets(UINT, ID3D11RenderTargetView* const*, ID3D11DepthStencilView*) override { Calls.push_back("targets"); }
+};
+
+// Keeps the constants each draw saw, and what it drew
+struct CapturingBackend : ICommandBackend
+{
+	std::vector<float> Constants;
+	std::vector<UINT> IndexCounts;
+
+	bool UploadConstants(const void* data, UINT size, ID3D11Buffer** buffer, UINT* firstConstant, UINT* numConstants) override
+	{
+		const float* values = (const float*)data;
+		Constants.insert(Constants.end(), values, values + size / sizeof(float));
+		*buffer = 0;
+		*firstConstant = 0;
+		*numConstants = (size + 255) / 256 * 16;
+		return true;
+	}
+	void DrawIndexed(UINT indexCount, UINT, INT) override { IndexCounts.push_back(indexCount); }
+	void DrawIndexedInstanced(UINT indexCount, UINT, UINT, INT, UINT) override { IndexCounts.push_back(indexCount); }
+};
+
+namespace
+{
+	struct Draw
+	{
+		unsigned int Material;
+		unsigned int Mesh;
+		float World[16];
+	};
+
+	const unsigned int materialCount = 8;
+	const unsigned int meshCount = 4;
+	PipelineState pipelines[materialCount];
+
+	// The same shape as Material::RecordDraw() and Mesh::Record()
+	void Record(CommandList& list, const std::vector<Draw>& draws, size_t begin, size_t end)
+	{
+		list.Reset();
+		const Draw* previous = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			const Draw& d = draws[i];
+			if (!previous || previous->Material != d.Material)
+			{
+				ID3D11Buffer* perFrame = FakeObject<ID3D11Buffer>(1);
+				list.SetPipeline(&pipelines[d.Material]);
+				list.SetConstantBuffer(StageVertex, 0, perFrame, 0, 16);
+				list.SetConstantBuffer(StagePixel, 1, perFrame, 16 + d.Material * 16, 16);
+
+				ID3D11ShaderResourceView* views[2] = { FakeObject<ID3D11ShaderResourceView>(10 + d.Material * 2), FakeObject<ID3D11ShaderResourceView>(11 + d.Material * 2) };
+				ID3D11SamplerState* sampler = FakeObject<ID3D11SamplerState>(2);
+				list.SetShaderResources(StagePixel, 0, 2, views);
+				list.SetSamplers(StagePixel, 0, 1, &sampler);
+			}
+			list.SetConstants(StageVertex, 1, d.World, sizeof(d.World));
+			if (!previous || previous->Mesh != d.Mesh)
+			{
+				list.SetVertexBuffer(0, FakeObject<ID3D11Buffer>(100 + d.Mesh), 48, 0);
+				list.SetIndexBuffer(FakeObject<ID3D11Buffer>(200 + d.Mesh), DXGI_FORMAT_R32_UINT, 0);
+			}
+			list.DrawIndexed(36 + d.Mesh, 0, 0);
+			previous = &d;
+		}
+	}
+
+	std::vector<Draw> MakeDraws(size_t count)
+	{
+		std::vector<Draw> draws(count);
+		unsigned int seed = 1;
+		for (size_t i = 0; i < count; i++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			draws[i].Material = (seed >> 8) % materialCount;
+			draws[i].Mesh = (seed >> 16) % meshCount;
+			for (int k = 0; k < 16; k++)
+				draws[i].World[k] = (float)(i * 16 + k);
+		}
+		return draws;
+	}
+}
+
+// --------------------------------------------------------
+// Recording in chunks and replaying them in order does the
+// same as recording everything into one list - the binds
+// repeated at chunk boundaries are dropped by the cache
+// --------------------------------------------------------
+static void TestChunkedReplay()
+{
+	std::vector<Draw> draws = MakeDraws(5000);
+
+	auto wholeSink = std::make_shared<RecordingSink>();
+	StateCache wholeStates(wholeSink);
+	CapturingBackend wholeBackend;
+	CommandList whole;
+	Record(whole, draws, 0, draws.size());
+	CHECK(whole.GetDrawCount() == draws.size());
+	whole.Replay(&wholeStates, &wholeBackend);
+
+	auto chunkSink = std::make_shared<RecordingSink>();
+	StateCache chunkStates(chunkSink);
+	CapturingBackend chunkBackend;
+	std::vector<CommandList> chunks(7);
+	size_t chunkSize = (draws.size() + chunks.size() - 1) / chunks.size();
+	for (size_t c = 0; c < chunks.size(); c++)
+		Record(chunks[c], draws, c * chunkSize, std::min(draws.size(), (c + 1) * chunkSize));
+	for (auto& c : chunks)
+		c.Replay(&chunkStates, &chunkBackend);
+
+	CHECK(wholeBackend.IndexCounts.size() == draws.size());
+	CHECK(wholeBackend.IndexCounts == chunkBackend.IndexCounts);
+	CHECK(wholeBackend.Constants == chunkBackend.Constants);
+	CHECK(wholeSink->Calls == chunkSink->Calls);
+
+	for (size_t i = 0; i < draws.size(); i++)
+		CHECK(wholeBackend.IndexCounts[i] == 36 + draws[i].Mesh);
+}
+
+// --------------------------------------------------------
+// Constants are copied when recorded, so changing them
+// afterwards doesn't change what's replayed
+// --------------------------------------------------------
+static void TestConstantsCopied()
+{
+	std::vector<Draw> draws = MakeDraws(3);
+	CommandList list;
+	Record(list, draws, 0, draws.size());
+	for (auto& d : draws)
+		std::fill(d.World, d.World + 16, -1.0f);
+
+	StateCache states(std::make_shared<RecordingSink>());
+	CapturingBackend backend;
+	list.Replay(&states, &backend);
+	CHECK(backend.Constants.size() == 3 * 16);
+	for (size_t i = 0; i < backend.Constants.size(); i++)
+		CHECK(backend.Constants[i] == (float)i);
+
+	// Reset lists can be recorded again from scratch
+	list.Reset();
+	CHECK(list.GetCommandCount() == 0 && list.GetDrawCount() == 0);
+	NullCommandBackend none;
+	list.Replay(&states, &none);
+	CHECK(none.GetDraws() == 0 && none.GetBytesUploaded() == 0);
+}
+
+int main()
+{
+	for (unsigned int m = 0; m < materialCount; m++)
+	{
+		pipelines[m].Desc = PipelineDesc::Defaults();
+		pipelines[m].VertexShader.Attach(FakeObject<ID3D11VertexShader>(300 + m));
+	}
+
+	TestChunkedReplay();
+	TestConstantsCopied();
+
+	for (auto& p : pipelines)
+		p.VertexShader.Detach();
+	return TestsPassed("CommandList");
+}
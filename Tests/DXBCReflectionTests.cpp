@@ -0,0 +1,256 @@
+// cl /std:c++17 /EHsc /I.. DXBCReflectionTests.cpp ..\DXBCReflection.cpp
+#include "TestCheck.h"
+#include "DXBCReflection.h"
+#include <cstring>
+#include <random>
+#include <string>
+
+// --------------------------------------------------------
+// Writes containers the way fxc lays them out, so the tests
+// don't depend on a compiler being around
+// --------------------------------------------------------
+namespace
+{
+	typedef std::vector<unsigned char> Bytes;
+
+	struct Writer
+	{
+		Bytes Data;
+
+		size_t U32(uint32_t v) { size_t at = Data.size(); Data.resize(at + 4); memcpy(&Data[at], &v, 4); return at; }
+		void U16(uint16_t v) { size_t at = Data.size(); Data.resize(at + 2); memcpy(&Data[at], &v, 2); }
+		void U8(uint8_t v) { Data.push_back(v); }
+		void Patch(size_t at, uint32_t v) { memcpy(&Data[at], &v, 4); }
+		uint32_t String(const std::string& s)
+		{
+			uint32_t at = (uint32_t)Data.size();
+			Data.insert(Data.end(), s.begin(), s.end());
+			Data.push_back(0);
+			return at;
+		}
+		void Align() { while (Data.size() % 4) Data.push_back(0xAB); }
+	};
+
+	struct Variable { std::string Name; uint32_t Offset, Size; uint16_t Class, Type, Rows, Columns, Elements; };
+	struct Buffer { std::string Name; uint32_t Size; std::vector<Variable> Variables; };
+	struct Resource { std::string Name; uint32_t Type, BindPoint, BindCount; };
+	struct Input { std::string Semantic; uint32_t Index, Register, SystemValue, ComponentType; uint8_t Mask; };
+
+	Bytes WriteRDEF(const std::vector<Buffer>& buffers, const std::vector<Resource>& resources, uint8_t major, uint8_t minor)
+	{
+		Writer w;
+		w.U32((uint32_t)buffers.size());
+		size_t bufferOffset = w.U32(0);
+		w.U32((uint32_t)resources.size());
+		size_t bindOffset = w.U32(0);
+		w.U8(minor); w.U8(major); w.U16(0xFFFF); w.U32(0x100);
+		size_t creator = w.U32(0);
+		if (major >= 5)
+		{
+			w.Data.insert(w.Data.end(), { 'R', 'D', '1', '1' });
+			for (uint32_t v : { 60u, 24u, 32u, 40u, 36u, 12u, 0u })
+				w.U32(v);
+		}
+
+		// 5.1 adds a space and an id to each binding
+		bool wideBindings = major == 5 && minor >= 1;
+		w.Patch(bindOffset, (uint32_t)w.Data.size());
+		std::vector<size_t> bindNames;
+		for (auto& r : resources)
+		{
+			bindNames.push_back(w.U32(0));
+			w.U32(r.Type); w.U32(0); w.U32(0); w.U32(0); w.U32(r.BindPoint); w.U32(r.BindCount); w.U32(0);
+			if (wideBindings) { w.U32(0); w.U32(0); }
+		}
+
+		w.Patch(bufferOffset, (uint32_t)w.Data.size());
+		std::vector<size_t> bufferNames, variableOffsets;
+		for (auto& b : buffers)
+		{
+			bufferNames.push_back(w.U32(0));
+			w.U32((uint32_t)b.Variables.size());
+			variableOffsets.push_back(w.U32(0));
+			w.U32(b.Size); w.U32(0); w.U32(0);
+		}
+
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			w.Patch(variableOffsets[i], (uint32_t)w.Data.size());
+			std::vector<size_t> names, types;
+			for (auto& v : buffers[i].Variables)
+			{
+				names.push_back(w.U32(0));
+				w.U32(v.Offset); w.U32(v.Size); w.U32(2);
+				types.push_back(w.U32(0));
+				w.U32(0);
+				if (major >= 5) { w.U32(~0u); w.U32(0); w.U32(~0u); w.U32(0); }
+			}
+			for (size_t v = 0; v < buffers[i].Variables.size(); v++)
+			{
+				const Variable& var = buffers[i].Variables[v];
+				w.Patch(types[v], (uint32_t)w.Data.size());
+				w.U16(var.Class); w.U16(var.Type); w.U16(var.Rows); w.U16(var.Columns); w.U16(var.Elements); w.U16(0); w.U32(0);
+				size_t typeName = 0;
+				if (major >= 5) { w.U32(0); w.U32(0); w.U32(0); w.U32(0); typeName = w.U32(0); }
+				w.Patch(names[v], w.String(var.Name));
+				w.Align();
+				if (major >= 5) { w.Patch(typeName, w.String(var.Name + "_type")); w.Align(); }
+			}
+		}
+
+		for (size_t i = 0; i < resources.size(); i++) w.Patch(bindNames[i], w.String(resources[i].Name));
+		for (size_t i = 0; i < buffers.size(); i++) w.Patch(bufferNames[i], w.String(buffers[i].Name));
+		w.Patch(creator, w.String("Microsoft (R) HLSL Shader Compiler 10.1"));
+		w.Align();
+		return w.Data;
+	}
+
+	// ISG1 adds a stream before each element and a precision after
+	Bytes WriteSignature(const std::vector<Input>& inputs, bool isg1)
+	{
+		Writer w;
+		w.U32((uint32_t)inputs.size());
+		w.U32(8);
+		std::vector<size_t> names;
+		for (auto& e : inputs)
+		{
+			if (isg1) w.U32(0);
+			names.push_back(w.U32(0));
+			w.U32(e.Index); w.U32(e.SystemValue); w.U32(e.ComponentType); w.U32(e.Register);
+			w.U8(e.Mask); w.U8(e.Mask); w.U16(0);
+			if (isg1) w.U32(0);
+		}
+		for (size_t i = 0; i < inputs.size(); i++) w.Patch(names[i], w.String(inputs[i].Semantic));
+		w.Align();
+		return w.Data;
+	}
+
+	Bytes WriteContainer(const std::vector<std::pair<std::string, Bytes>>& chunks)
+	{
+		Writer w;
+		w.Data.insert(w.Data.end(), { 'D', 'X', 'B', 'C' });
+		for (int i = 0; i < 16; i++) w.U8((uint8_t)i);	// Checksum, which isn't checked
+		w.U32(1);
+		size_t total = w.U32(0);
+		w.U32((uint32_t)chunks.size());
+		std::vector<size_t> offsets;
+		for (size_t i = 0; i < chunks.size(); i++) offsets.push_back(w.U32(0));
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			w.Patch(offsets[i], (uint32_t)w.Data.size());
+			w.Data.insert(w.Data.end(), chunks[i].first.begin(), chunks[i].first.end());
+			w.U32((uint32_t)chunks[i].second.size());
+			w.Data.insert(w.Data.end(), chunks[i].second.begin(), chunks[i].second.end());
+		}
+		w.Patch(total, (uint32_t)w.Data.size());
+		return w.Data;
+	}
+
+	// Shaped like PixelShader.hlsl's
+	const std::vector<Buffer> buffers =
+	{
+		{ "PerFrame", 8240, {
+			{ "lights", 0, 8192, 5, 0, 1, 1, 128 },
+			{ "lightCount", 8192, 4, 0, 2, 1, 1, 0 },
+			{ "ambientColor", 8196, 12, 1, 3, 1, 3, 0 },
+			{ "cameraPosition", 8208, 12, 1, 3, 1, 3, 0 },
+			{ "shadowMapSize", 8224, 4, 0, 3, 1, 1, 0 } } },
+		{ "PerMaterial", 48, {
+			{ "colorTint", 0, 16, 1, 3, 1, 4, 0 },
+			{ "roughness", 16, 4, 0, 3, 1, 1, 0 },
+			{ "uvScale", 20, 8, 1, 3, 1, 2, 0 },
+			{ "uvOffset", 32, 8, 1, 3, 1, 2, 0 } } }
+	};
+	const std::vector<Resource> resources =
+	{
+		{ "BasicSampler", 3, 0, 1 }, { "ShadowSampler", 3, 1, 1 },
+		{ "Albedo", 2, 0, 1 }, { "NormalMap", 2, 1, 1 }, { "RoughnessMap", 2, 2, 1 }, { "MetalnessMap", 2, 3, 1 }, { "ShadowMap", 2, 4, 1 },
+		{ "PerFrame", 0, 0, 1 }, { "PerMaterial", 0, 1, 1 }
+	};
+	const std::vector<Input> inputs =
+	{
+		{ "SV_POSITION", 0, 0, 1, 3, 15 }, { "NORMAL", 0, 1, 0, 3, 7 }, { "TEXCOORD", 0, 2, 0, 3, 3 },
+		{ "WORLD_PER_INSTANCE", 3, 6, 0, 3, 15 }, { "ID", 0, 7, 0, 1, 1 }
+	};
+
+	Bytes WriteShader(uint8_t major, uint8_t minor)
+	{
+		bool isg1 = major == 5 && minor >= 1;
+		return WriteContainer({
+			{ "RDEF", WriteRDEF(buffers, resources, major, minor) },
+			{ isg1 ? "ISG1" : "ISGN", WriteSignature(inputs, isg1) },
+			{ "SHEX", Bytes(64, 0) } });
+	}
+}
+
+// --------------------------------------------------------
+// Everything SimpleShader reads comes back out, for shader
+// model 4, 5 and 5.1 layouts
+// --------------------------------------------------------
+static void TestParse(uint8_t major, uint8_t minor)
+{
+	Bytes shader = WriteShader(major, minor);
+	DXBCReflection r;
+	CHECK(ParseDXBC(shader.data(), shader.size(), &r));
+	CHECK(r.ConstantBuffers.size() == 2 && r.Resources.size() == 9 && r.Inputs.size() == 5);
+
+	const DXBCConstantBuffer& perFrame = r.ConstantBuffers[0];
+	CHECK(perFrame.Name == "PerFrame" && perFrame.Size == 8240 && perFrame.BindPoint == 0);
+	CHECK(perFrame.Variables[0].Name == "lights" && perFrame.Variables[0].Elements == 128 && perFrame.Variables[0].Class == 5);
+	CHECK(perFrame.Variables[0].TypeName == (major >= 5 ? "lights_type" : ""));
+
+	const DXBCConstantBuffer& perMaterial = r.ConstantBuffers[1];
+	CHECK(perMaterial.Name == "PerMaterial" && perMaterial.BindPoint == 1);
+	CHECK(perMaterial.Variables[2].Name == "uvScale" && perMaterial.Variables[2].StartOffset == 20 && perMaterial.Variables[2].Columns == 2);
+
+	CHECK(r.Resources[6].Name == "ShadowMap" && r.Resources[6].BindPoint == 4 && r.Resources[6].Type == 2);
+	CHECK(r.Inputs[3].SemanticName == "WORLD_PER_INSTANCE" && r.Inputs[3].SemanticIndex == 3);
+	CHECK(r.Inputs[3].Register == 6 && r.Inputs[3].Mask == 15);
+	CHECK(r.Inputs[4].ComponentType == 1 && r.Inputs[0].SystemValue == 1);
+
+	std::vector<DXBCInputElement> only;
+	CHECK(ParseDXBCInputs(shader.data(), shader.size(), &only));
+	CHECK(only.size() == 5 && only[2].SemanticName == "TEXCOORD");
+}
+
+// --------------------------------------------------------
+// Cut short or scribbled on containers fail (or parse) but
+// never read past the end - best run with a sanitizer on
+// --------------------------------------------------------
+static void TestMalformed(uint8_t major, uint8_t minor)
+{
+	Bytes shader = WriteShader(major, minor);
+	for (size_t n = 0; n < shader.size(); n++)
+	{
+		Bytes cut(shader.begin(), shader.begin() + n);	// Its own allocation, so overreads show up
+		DXBCReflection r;
+		CHECK(!ParseDXBC(cut.data(), cut.size(), &r));
+	}
+
+	std::mt19937 rng(major * 10 + minor);
+	for (int i = 0; i < 20000; i++)
+	{
+		Bytes bad = shader;
+		int flips = 1 + rng() % 4;
+		for (int f = 0; f < flips; f++)
+			bad[rng() % bad.size()] = (unsigned char)rng();
+		DXBCReflection r;
+		ParseDXBC(bad.data(), bad.size(), &r);
+	}
+
+	// DXIL has no RDEF
+	Bytes dxil = WriteContainer({ { "DXIL", Bytes(32, 0) } });
+	DXBCReflection r;
+	CHECK(!ParseDXBC(dxil.data(), dxil.size(), &r));
+}
+
+int main()
+{
+	TestParse(4, 0);
+	TestParse(5, 0);
+	TestParse(5, 1);
+	TestMalformed(4, 0);
+	TestMalformed(5, 0);
+	TestMalformed(5, 1);
+	return TestsPassed("DXBCReflection");
+}
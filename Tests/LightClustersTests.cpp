@@ -0,0 +1,180 @@
+// cl /std:c++17 /EHsc /I.. LightClustersTests.cpp ..\LightClusters.cpp ..\WorkerPool.cpp
+#include "TestCheck.h"
+#include "LightClusters.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	const float nearZ = 0.1f;
+	const float farZ = 1000.0f;
+
+	// Left handed, like Camera's, built by hand so nothing
+	// here depends on the math library's implementation
+	XMFLOAT4X4 Projection(float fov, float aspect)
+	{
+		XMFLOAT4X4 p;
+		memset(&p, 0, sizeof(p));
+		float h = 1.0f / tanf(fov * 0.5f);
+		p._11 = h / aspect;
+		p._22 = h;
+		p._33 = farZ / (farZ - nearZ);
+		p._34 = 1.0f;
+		p._43 = -nearZ * farZ / (farZ - nearZ);
+		return p;
+	}
+
+	// Turned about y by yaw, from the given position
+	XMFLOAT4X4 View(float yaw, XMFLOAT3 eye)
+	{
+		float c = cosf(yaw), s = sinf(yaw);
+		XMFLOAT4X4 v;
+		memset(&v, 0, sizeof(v));
+		v._11 = c;	v._13 = s;
+		v._22 = 1.0f;
+		v._31 = -s;	v._33 = c;
+		v._41 = -(eye.x * c - eye.z * s);
+		v._42 = -eye.y;
+		v._43 = -(eye.x * s + eye.z * c);
+		v._44 = 1.0f;
+		return v;
+	}
+
+	Light MakeLight(int type, XMFLOAT3 position, float range, XMFLOAT3 direction = XMFLOAT3(0, 0, 1))
+	{
+		Light light;
+		memset(&light, 0, sizeof(light));
+		light.Type = type;
+		light.Position = position;
+		light.Range = range;
+		light.Direction = direction;
+		light.Intensity = 1.0f;
+		light.Color = XMFLOAT3(1, 1, 1);
+		light.SpotFalloff = 8.0f;
+		return light;
+	}
+
+	bool ClusterHas(const LightClusters& clusters, unsigned int x, unsigned int y, unsigned int slice, uint32_t light)
+	{
+		const LightClusters::Range& r = clusters.GetRanges()[x + (y + slice * clusters.GetTilesY()) * clusters.GetTilesX()];
+		for (uint32_t i = 0; i < r.Count; i++)
+			if (clusters.GetLightIndices()[r.Offset + i] == light)
+				return true;
+		return false;
+	}
+}
+
+// --------------------------------------------------------
+// The threaded build finds exactly what testing every light
+// against every cluster does, however many threads it has
+// --------------------------------------------------------
+static void TestMatchesReference()
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+	std::vector<Light> lights;
+	for (int i = 0; i < 2000; i++)
+	{
+		int type = i == 0 ? LIGHT_TYPE_DIRECTIONAL : (i % 3 == 0 ? LIGHT_TYPE_SPOT : LIGHT_TYPE_POINT);
+		float dx = u(rng), dy = u(rng) - 0.5f, dz = u(rng);
+		float length = sqrtf(dx * dx + dy * dy + dz * dz);
+		lights.push_back(MakeLight(type,
+			XMFLOAT3(u(rng) * 200.0f, u(rng) * 20.0f, u(rng) * 200.0f),
+			2.0f + (u(rng) + 1.0f) * 6.0f,
+			XMFLOAT3(dx / length, dy / length, dz / length)));
+	}
+	XMFLOAT4X4 view = View(0.3f, XMFLOAT3(0, 5, -50));
+	XMFLOAT4X4 proj = Projection(1.0f, 16.0f / 9.0f);
+
+	LightClusters reference(16, 9, 24, std::make_shared<WorkerPool>(1));
+	reference.BuildReference(lights.data(), (unsigned int)lights.size(), view, proj);
+	CHECK(!reference.GetLightIndices().empty());
+
+	for (unsigned int threads : { 1u, 3u, 8u })
+	{
+		LightClusters clusters(16, 9, 24, std::make_shared<WorkerPool>(threads));
+		for (int frame = 0; frame < 2; frame++)
+		{
+			clusters.Build(lights.data(), (unsigned int)lights.size(), view, proj);
+			CHECK(clusters.GetLightIndices() == reference.GetLightIndices());
+			for (unsigned int c = 0; c < clusters.GetClusterCount(); c++)
+			{
+				CHECK(clusters.GetRanges()[c].Offset == reference.GetRanges()[c].Offset);
+				CHECK(clusters.GetRanges()[c].Count == reference.GetRanges()[c].Count);
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Lights land where the camera sees them, and nowhere when
+// they're behind it
+// --------------------------------------------------------
+static void TestPlacement()
+{
+	std::vector<Light> lights =
+	{
+		MakeLight(LIGHT_TYPE_DIRECTIONAL, XMFLOAT3(0, 0, 0), 0.0f),
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, 10), 1.0f),
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, -10), 1.0f),
+		MakeLight(LIGHT_TYPE_SPOT, XMFLOAT3(0, 0, 20), 5.0f, XMFLOAT3(0, 0, -1)),
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, 20), 5.0f),
+	};
+	XMFLOAT4X4 view = View(0.0f, XMFLOAT3(0, 0, 0));
+	XMFLOAT4X4 proj = Projection(1.0f, 16.0f / 9.0f);
+
+	LightClusters clusters(16, 9, 24, std::make_shared<WorkerPool>(2));
+	clusters.Build(lights.data(), (unsigned int)lights.size(), view, proj);
+
+	// Slices are even in log(depth), from the near plane
+	float scale = clusters.GetSliceScale();
+	float bias = clusters.GetSliceBias();
+	CHECK(fabsf(logf(nearZ) * scale + bias) < 1e-3f);
+	CHECK(fabsf(logf(farZ) * scale + bias - 24.0f) < 1e-3f);
+	unsigned int slice = (unsigned int)(logf(10.0f) * scale + bias);
+
+	for (unsigned int c = 0; c < clusters.GetClusterCount(); c++)
+		CHECK(clusters.GetRanges()[c].Count >= 1 && clusters.GetLightIndices()[clusters.GetRanges()[c].Offset] == 0);
+
+	// Dead ahead, so in the middle of the screen
+	CHECK(ClusterHas(clusters, 7, 4, slice, 1) && ClusterHas(clusters, 8, 4, slice, 1));
+	CHECK(!ClusterHas(clusters, 0, 0, slice, 1));
+	CHECK(!ClusterHas(clusters, 8, 4, 0, 1) && !ClusterHas(clusters, 8, 4, 23, 1));
+
+	for (unsigned int c = 0; c < clusters.GetClusterCount(); c++)
+	{
+		const LightClusters::Range& r = clusters.GetRanges()[c];
+		for (uint32_t i = 0; i < r.Count; i++)
+			CHECK(clusters.GetLightIndices()[r.Offset + i] != 2);
+	}
+
+	// Facing the camera, so unlike a point light in the same
+	// place it doesn't reach the slice behind its own
+	unsigned int spotSlice = (unsigned int)(logf(20.0f) * scale + bias);
+	CHECK(ClusterHas(clusters, 8, 4, spotSlice, 3) && ClusterHas(clusters, 8, 4, spotSlice, 4));
+	CHECK(!ClusterHas(clusters, 8, 4, spotSlice + 1, 3) && ClusterHas(clusters, 8, 4, spotSlice + 1, 4));
+}
+
+// Every dimension stays at least 1
+static void TestResize()
+{
+	LightClusters clusters(16, 9, 24, std::make_shared<WorkerPool>(1));
+	clusters.Resize(0, 0, 0);
+	CHECK(clusters.GetTilesX() == 1 && clusters.GetTilesY() == 1 && clusters.GetSlices() == 1);
+	CHECK(clusters.GetRanges().size() == 1);
+
+	Light light = MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, 10), 1.0f);
+	clusters.Build(&light, 1, View(0.0f, XMFLOAT3(0, 0, 0)), Projection(1.0f, 1.0f));
+	CHECK(ClusterHas(clusters, 0, 0, 0, 0));
+}
+
+int main()
+{
+	TestMatchesReference();
+	TestPlacement();
+	TestResize();
+	return TestsPassed("LightClusters");
+}
@@ -0,0 +1,187 @@
+// cl /std:c++17 /EHsc /I.. LightTilesTests.cpp ..\LightTiles.cpp
+#include "TestCheck.h"
+#include "LightTiles.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <set>
+
+using namespace DirectX;
+
+namespace
+{
+	const float nearZ = 0.1f;
+	const float farZ = 500.0f;
+
+	struct Camera
+	{
+		XMFLOAT4X4 View;
+		XMFLOAT4X4 Projection;
+	};
+
+	// Left handed and row vector, like Camera's, built by hand
+	// so nothing here depends on the math library
+	Camera MakeCamera(float yaw, float pitch, XMFLOAT3 eye, float aspect)
+	{
+		float cy = cosf(yaw), sy = sinf(yaw), cp = cosf(pitch), sp = sinf(pitch);
+		XMFLOAT3 f(sy * cp, -sp, cy * cp);
+		XMFLOAT3 r(cy, 0, -sy);
+		XMFLOAT3 u(r.y * f.z - r.z * f.y, r.z * f.x - r.x * f.z, r.x * f.y - r.y * f.x);
+
+		Camera c;
+		memset(&c, 0, sizeof(c));
+		XMFLOAT4X4& v = c.View;
+		v._11 = r.x; v._21 = r.y; v._31 = r.z;
+		v._12 = u.x; v._22 = u.y; v._32 = u.z;
+		v._13 = f.x; v._23 = f.y; v._33 = f.z;
+		v._41 = -(eye.x * r.x + eye.y * r.y + eye.z * r.z);
+		v._42 = -(eye.x * u.x + eye.y * u.y + eye.z * u.z);
+		v._43 = -(eye.x * f.x + eye.y * f.y + eye.z * f.z);
+		v._44 = 1.0f;
+
+		float h = 1.0f / tanf(0.5f);
+		c.Projection._11 = h / aspect;
+		c.Projection._22 = h;
+		c.Projection._33 = farZ / (farZ - nearZ);
+		c.Projection._34 = 1.0f;
+		c.Projection._43 = -nearZ * farZ / (farZ - nearZ);
+		return c;
+	}
+
+	Light MakeLight(int type, XMFLOAT3 position, float range)
+	{
+		Light light;
+		memset(&light, 0, sizeof(light));
+		light.Type = type;
+		light.Position = position;
+		light.Range = range;
+		light.Direction = XMFLOAT3(0, -1, 0);
+		light.Intensity = 1.0f;
+		light.Color = XMFLOAT3(1, 1, 1);
+		return light;
+	}
+}
+
+// --------------------------------------------------------
+// Every pixel a light's sphere covers is in a tile that
+// lists the light - checked by projecting points in and on
+// the spheres of random scenes
+// --------------------------------------------------------
+static void TestConservative()
+{
+	const unsigned int width = 1920, height = 1080;
+	for (unsigned int seed = 1; seed <= 8; seed++)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+
+		std::vector<Light> lights;
+		for (unsigned int i = 0; i < 200; i++)
+		{
+			int type = i == 0 ? LIGHT_TYPE_DIRECTIONAL : (i % 3 == 0 ? LIGHT_TYPE_SPOT : LIGHT_TYPE_POINT);
+			float range = (i % 50 == 7) ? 40.0f : 1.0f + (u(rng) + 1.0f) * 5.0f;
+			lights.push_back(MakeLight(type, XMFLOAT3(u(rng) * 60, u(rng) * 10, u(rng) * 60), range));
+		}
+		Camera c = MakeCamera(u(rng) * 3.14f, u(rng) * 0.6f, XMFLOAT3(u(rng) * 20, u(rng) * 3, u(rng) * 20), (float)width / height);
+
+		LightTiles tiles(16);
+		tiles.Build(lights.data(), (unsigned int)lights.size(), c.View, c.Projection, width, height);
+
+		// Lists are in light order
+		std::vector<std::set<uint32_t>> lists(tiles.GetTileCount());
+		for (unsigned int t = 0; t < tiles.GetTileCount(); t++)
+		{
+			const LightTiles::Range& r = tiles.GetRanges()[t];
+			for (uint32_t k = 0; k < r.Count; k++)
+			{
+				uint32_t light = tiles.GetLightIndices()[r.Offset + k];
+				CHECK(k == 0 || light > tiles.GetLightIndices()[r.Offset + k - 1]);
+				lists[t].insert(light);
+			}
+			CHECK(lists[t].count(0) == 1);	// The directional light
+		}
+
+		const XMFLOAT4X4& v = c.View;
+		for (unsigned int l = 1; l < lights.size(); l++)
+		{
+			for (int s = 0; s < 2000; s++)
+			{
+				// Inside the ball, with half of them on its surface
+				float x, y, z;
+				do
+				{
+					x = u(rng);
+					y = u(rng);
+					z = u(rng);
+				} while (x * x + y * y + z * z > 1.0f);
+				if (s & 1)
+				{
+					float length = sqrtf(x * x + y * y + z * z);
+					x /= length;
+					y /= length;
+					z /= length;
+				}
+
+				float range = lights[l].Range;
+				XMFLOAT3 p(lights[l].Position.x + x * range, lights[l].Position.y + y * range, lights[l].Position.z + z * range);
+				float vx = p.x * v._11 + p.y * v._21 + p.z * v._31 + v._41;
+				float vy = p.x * v._12 + p.y * v._22 + p.z * v._32 + v._42;
+				float vz = p.x * v._13 + p.y * v._23 + p.z * v._33 + v._43;
+				if (vz < nearZ || vz > farZ)
+					continue;
+
+				float px = ((vx / vz) * c.Projection._11 * 0.5f + 0.5f) * width;
+				float py = (0.5f - (vy / vz) * c.Projection._22 * 0.5f) * height;
+				if (px < 0 || py < 0 || px >= width || py >= height)
+					continue;
+
+				unsigned int tile = (unsigned int)px / 16 + ((unsigned int)py / 16) * tiles.GetTilesX();
+				CHECK(lists[tile].count(l) == 1);
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Partial tiles at the edges are still tiles, and lights
+// entirely behind the camera land nowhere
+// --------------------------------------------------------
+static void TestEdges()
+{
+	std::vector<Light> lights =
+	{
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, 10), 1.0f),
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, -10), 1.0f),
+		MakeLight(LIGHT_TYPE_POINT, XMFLOAT3(0, 0, 0), 2.0f),	// Around the eye
+	};
+	Camera c = MakeCamera(0.0f, 0.0f, XMFLOAT3(0, 0, 0), 1000.0f / 500.0f);
+
+	LightTiles tiles(16);
+	tiles.Build(lights.data(), (unsigned int)lights.size(), c.View, c.Projection, 1000, 500);
+	CHECK(tiles.GetTilesX() == 63 && tiles.GetTilesY() == 32);
+	CHECK(tiles.GetRanges().size() == tiles.GetTileCount());
+
+	// Dead ahead is the middle of the screen, and not the corner
+	const LightTiles::TileRect& ahead = tiles.GetLightRects()[0];
+	CHECK(ahead.MinX <= 31 && 31 <= ahead.MaxX && ahead.MinY <= 15 && 15 <= ahead.MaxY);
+	CHECK(ahead.MinX > 0 && ahead.MaxX < 62);
+
+	const LightTiles::TileRect& behind = tiles.GetLightRects()[1];
+	CHECK(behind.MinX > behind.MaxX);
+
+	const LightTiles::TileRect& around = tiles.GetLightRects()[2];
+	CHECK(around.MinX == 0 && around.MaxX == 62 && around.MinY == 0 && around.MaxY == 31);
+
+	unsigned int total = 0;
+	for (auto& r : tiles.GetRanges())
+		total += r.Count;
+	CHECK(total == tiles.GetLightIndices().size());
+	CHECK(tiles.GetMaxLightsPerTile() == 2);
+}
+
+int main()
+{
+	TestConservative();
+	TestEdges();
+	return TestsPassed("LightTiles");
+}
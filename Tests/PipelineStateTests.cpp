@@ -0,0 +1,187 @@
+// cl /std:c++17 /EHsc /I.. PipelineStateTests.cpp ..\PipelineState.cpp ..\StateCache.cpp ..\FrameStats.cpp
+#include "TestCheck.h"
+#include "PipelineState.h"
+#include "StateCache.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Remembers which calls made it through the cache
+struct RecordingSink : IStateSink
+{
+	std::vector<std::string> Calls;
+
+	void SetShader(ShaderStage stage, ID3D11DeviceChild*) override { Calls.push_back(stage == StageVertex ? "vs" : "ps"); }
+	void SetConstantBuffers(ShaderStage, UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override { Calls.push_back("cb"); }
+	void SetShaderResources(ShaderStage, UINT, UINT, ID3D11ShaderResourceView* const*) override { Calls.push_back("srv"); }
+	void SetSamplers(ShaderStage, UINT, UINT, ID3D11SamplerState* const*) override { Calls.push_back("sampler"); }
+	void SetInputLayout(ID3D11InputLayout*) override { Calls.push_back("layout"); }
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY) override { Calls.push_back("topology"); }
+	void SetVertexBuffers(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override { Calls.push_back("vb"); }
+	void SetIndexBuffer(ID3D11Buffer*, DXGI_FORMAT, UINT) override { Calls.push_back("ib"); }
+	void SetRasterizerState(ID3D11RasterizerState*) override { Calls.push_back("rasterizer"); }
+	void SetDepthStencilState(ID3D11DepthStencilState*, UINT) override { Calls.push_back("depth"); }
+	void SetBlendState(ID3D11BlendState*, const FLOAT*, UINT) override { Calls.push_back("blend"); }
+	void SetRenderTargets(UINT, ID3D11RenderTargetView* const*, ID3D11DepthStencilView*) override { Calls.push_back("targets"); }
+};
+
+// --------------------------------------------------------
+// Descriptions filled in field by field over different
+// garbage match once their padding is cleared
+// --------------------------------------------------------
+static void TestPadding()
+{
+	D3D11_DEPTH_STENCIL_DESC a, b;
+	memset(&a, 0xAB, sizeof(a));
+	memset(&b, 0xCD, sizeof(b));
+	for (D3D11_DEPTH_STENCIL_DESC* d : { &a, &b })
+	{
+		d->DepthEnable = true;
+		d->DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+		d->DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+		d->StencilEnable = false;
+		d->StencilReadMask = 0xFF;
+		d->StencilWriteMask = 0xFF;
+		d->FrontFace = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_COMPARISON_ALWAYS };
+		d->BackFace = d->FrontFace;
+	}
+	CHECK(memcmp(&a, &b, sizeof(a)) != 0);
+	ClearStatePadding(&a);
+	ClearStatePadding(&b);
+	CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+	CHECK(HashStateBytes(&a, sizeof(a)) == HashStateBytes(&b, sizeof(b)));
+
+	D3D11_BLEND_DESC c, d;
+	memset(&c, 0x11, sizeof(c));
+	memset(&d, 0x77, sizeof(d));
+	for (D3D11_BLEND_DESC* desc : { &c, &d })
+	{
+		desc->AlphaToCoverageEnable = false;
+		desc->IndependentBlendEnable = false;
+		for (auto& rt : desc->RenderTarget)
+			rt = { false, D3D11_BLEND_ONE, D3D11_BLEND_ZERO, D3D11_BLEND_OP_ADD, D3D11_BLEND_ONE, D3D11_BLEND_ZERO, D3D11_BLEND_OP_ADD, D3D11_COLOR_WRITE_ENABLE_ALL };
+	}
+	ClearStatePadding(&c);
+	ClearStatePadding(&d);
+	CHECK(memcmp(&c, &d, sizeof(c)) == 0);
+}
+
+// --------------------------------------------------------
+// One object per unique description, and the same entry
+// every time it's asked for again
+// --------------------------------------------------------
+static void TestInterning()
+{
+	int created = 0;
+	auto create = [&](const D3D11_RASTERIZER_DESC&) { return FakeObject<ID3D11RasterizerState>(++created); };
+
+	StateInterner<D3D11_RASTERIZER_DESC, ID3D11RasterizerState*> interner;
+	std::vector<const void*> first;
+	for (int pass = 0; pass < 3; pass++)
+		for (int i = 0; i < 32; i++)
+		{
+			D3D11_RASTERIZER_DESC desc = {};
+			desc.FillMode = D3D11_FILL_SOLID;
+			desc.CullMode = (D3D11_CULL_MODE)(D3D11_CULL_NONE + i % 3);
+			desc.DepthBias = i;
+			desc.DepthClipEnable = true;
+
+			const void* entry = interner.Intern(desc, create);
+			if (pass == 0)
+				first.push_back(entry);
+			else
+				CHECK(entry == first[i]);
+		}
+	CHECK(created == 32);
+	CHECK(interner.GetCount() == 32 && interner.GetHits() == 64);
+
+	// Failing to create isn't remembered
+	StateInterner<D3D11_SAMPLER_DESC, ID3D11SamplerState*> failing;
+	D3D11_SAMPLER_DESC sampler = {};
+	CHECK(!failing.Intern(sampler, [](const D3D11_SAMPLER_DESC&) { return (ID3D11SamplerState*)0; }));
+	CHECK(failing.GetCount() == 0);
+}
+
+// Pipelines that differ in a single field all hash apart
+static void TestPipelineHashes()
+{
+	std::vector<uint64_t> hashes;
+	PipelineDesc desc = PipelineDesc::Defaults();
+	for (int i = 0; i < 10000; i++)
+	{
+		desc.VertexShader = FakeObject<ID3D11VertexShader>(1 + i % 100);
+		desc.Rasterizer.DepthBias = i / 100;
+		hashes.push_back(HashStateBytes(&desc, sizeof(desc)));
+	}
+	std::sort(hashes.begin(), hashes.end());
+	CHECK(std::unique(hashes.begin(), hashes.end()) == hashes.end());
+
+	CHECK(PipelineDesc::Defaults().Padding == 0);
+}
+
+// --------------------------------------------------------
+// Binding the bound pipeline does nothing, and switching
+// only sends what differs
+// --------------------------------------------------------
+static void TestSetPipeline()
+{
+	auto sink = std::make_shared<RecordingSink>();
+	StateCache cache(sink);
+
+	PipelineState a;
+	a.Desc = PipelineDesc::Defaults();
+	a.VertexShader.Attach(FakeObject<ID3D11VertexShader>(1));
+	a.InputLayout.Attach(FakeObject<ID3D11InputLayout>(2));
+	a.RasterizerState.Attach(FakeObject<ID3D11RasterizerState>(3));
+	a.DepthStencilState.Attach(FakeObject<ID3D11DepthStencilState>(4));
+	a.BlendState.Attach(FakeObject<ID3D11BlendState>(5));
+
+	PipelineState b;
+	b.Desc = a.Desc;
+	b.VertexShader.Attach(FakeObject<ID3D11VertexShader>(6));
+	b.InputLayout.Attach(a.InputLayout.Get());
+	b.RasterizerState.Attach(FakeObject<ID3D11RasterizerState>(7));
+	b.DepthStencilState.Attach(a.DepthStencilState.Get());
+	b.BlendState.Attach(a.BlendState.Get());
+
+	cache.SetPipeline(&a);
+	CHECK(sink->Calls.size() == 7);
+	cache.SetPipeline(&a);
+	CHECK(sink->Calls.size() == 7);
+
+	cache.SetPipeline(&b);
+	CHECK(sink->Calls.size() == 9);	// Vertex shader and rasterizer
+	cache.SetShader(StageVertex, b.VertexShader.Get());
+	cache.SetPipeline(&b);
+	CHECK(sink->Calls.size() == 9);
+
+	// Changing one piece by hand has to be undone
+	cache.SetRasterizerState(0);
+	CHECK(sink->Calls.size() == 10);
+	cache.SetPipeline(&b);
+	CHECK(sink->Calls.size() == 11 && sink->Calls.back() == "rasterizer");
+
+	cache.Invalidate();
+	cache.SetPipeline(&b);
+	CHECK(sink->Calls.size() == 18);
+	cache.SetPipeline(0);
+	CHECK(sink->Calls.size() == 18);
+
+	for (PipelineState* p : { &a, &b })
+	{
+		p->VertexShader.Detach();
+		p->InputLayout.Detach();
+		p->RasterizerState.Detach();
+		p->DepthStencilState.Detach();
+		p->BlendState.Detach();
+	}
+}
+
+int main()
+{
+	TestPadding();
+	TestInterning();
+	TestPipelineHashes();
+	TestSetPipeline();
+	return TestsPassed("PipelineState");
+}
@@ -0,0 +1,67 @@
+// cl /std:c++17 /EHsc /I.. RingAllocatorTests.cpp ..\RingAllocator.cpp
+#include "TestCheck.h"
+#include "RingAllocator.h"
+
+// --------------------------------------------------------
+// Slices come out aligned and in order, the first one each
+// frame asks for a discard, and running out fails instead
+// of wrapping
+// --------------------------------------------------------
+static void TestAllocate()
+{
+	RingAllocator ring(1000, 256);
+	CHECK(ring.GetCapacity() == 768);	// Rounded down to whole slices
+
+	RingAllocator::Allocation a;
+	ring.BeginFrame();
+	CHECK(ring.Allocate(1, &a));
+	CHECK(a.Offset == 0 && a.Size == 256 && a.Discard);
+	CHECK(ring.Allocate(300, &a));
+	CHECK(a.Offset == 256 && a.Size == 512 && !a.Discard);
+
+	CHECK(!ring.Allocate(1, &a));
+	CHECK(ring.GetOverflows() == 1);
+	CHECK(!ring.Allocate(0, &a));		// Zero sized requests fail, but aren't overflows
+	CHECK(ring.GetOverflows() == 1);
+}
+
+// --------------------------------------------------------
+// BeginFrame() moves the epoch, keeps last frame's stats and
+// starts again from the front with a discard
+// --------------------------------------------------------
+static void TestFrames()
+{
+	RingAllocator ring(768, 256);
+	RingAllocator::Allocation a;
+
+	ring.BeginFrame();
+	unsigned int epoch = ring.GetEpoch();
+	CHECK(ring.Allocate(256, &a));
+	CHECK(ring.Allocate(512, &a));
+	CHECK(!ring.Allocate(1, &a));
+
+	ring.BeginFrame();
+	CHECK(ring.GetEpoch() != epoch);
+	CHECK(ring.GetLastFrameUsed() == 768);
+	CHECK(ring.GetLastFrameAllocations() == 2);
+	CHECK(ring.GetLastFrameOverflows() == 1);
+	CHECK(ring.GetPeakUsed() == 768);
+	CHECK(ring.GetUsed() == 0 && ring.GetOverflows() == 0);
+
+	CHECK(ring.Allocate(768, &a));
+	CHECK(a.Offset == 0 && a.Discard);
+	CHECK(!ring.Allocate(1, &a));
+
+	// A quieter frame doesn't lower the peak
+	ring.BeginFrame();
+	CHECK(ring.Allocate(16, &a));
+	ring.BeginFrame();
+	CHECK(ring.GetLastFrameUsed() == 256 && ring.GetPeakUsed() == 768);
+}
+
+int main()
+{
+	TestAllocate();
+	TestFrames();
+	return TestsPassed("RingAllocator");
+}
@@ -0,0 +1,73 @@
+// cl /std:c++17 /EHsc /I.. ShaderVariantTests.cpp ..\ShaderVariant.cpp
+#include "TestCheck.h"
+#include "ShaderVariant.h"
+#include <map>
+#include <set>
+
+// --------------------------------------------------------
+// Normalizing keeps only what changes the compiled code
+// --------------------------------------------------------
+static void TestNormalize()
+{
+	ShaderVariantKey k = NormalizeVariantKey({ ShaderFeatureNormalMap | (1 << 10), 5, 0xFF });
+	CHECK(k.Features == ShaderFeatureNormalMap);
+	CHECK(k.PCFTaps == 0);		// No shadows, no filter
+	CHECK(k.LightTypes == ShaderLightTypesAll);
+
+	CHECK(NormalizeVariantKey({ ShaderFeatureShadows, 0, 1 }).PCFTaps == 1);
+	CHECK(NormalizeVariantKey({ ShaderFeatureShadows, 4, 1 }).PCFTaps == 5);
+	CHECK(NormalizeVariantKey({ ShaderFeatureShadows, 99, 1 }).PCFTaps == ShaderMaxPCFTaps);
+}
+
+// --------------------------------------------------------
+// Over every key: equivalent keys hash alike, different
+// variants never collide, and every keyword is defined
+// --------------------------------------------------------
+static void TestAllKeys()
+{
+	std::map<uint64_t, ShaderVariantKey> variants;
+	for (uint32_t f = 0; f <= ShaderFeatureAll; f++)
+		for (uint32_t taps = 0; taps <= 9; taps++)
+			for (uint32_t l = 0; l <= ShaderLightTypesAll; l++)
+			{
+				ShaderVariantKey key = { f, taps, l };
+				ShaderVariantKey n = NormalizeVariantKey(key);
+				CHECK(NormalizeVariantKey(n) == n);
+
+				uint64_t hash = HashVariantKey(key);
+				CHECK(hash == HashVariantKey(n));
+				auto it = variants.find(hash);
+				if (it != variants.end())
+					CHECK(it->second == n);
+				else
+					variants[hash] = n;
+
+				auto defines = GetVariantDefines(key);
+				CHECK(defines.size() == 6);
+				CHECK(defines[3].first == "SHADOWS" && defines[3].second == ((f & ShaderFeatureShadows) ? "1" : "0"));
+				CHECK(defines[4].first == "PCF_TAPS" && defines[4].second == std::to_string(n.PCFTaps));
+				CHECK(defines[5].first == "LIGHT_MASK" && defines[5].second == std::to_string(l));
+			}
+
+	// 8 without shadows, 8 with each of 4 filter widths, by 8 light masks
+	CHECK(variants.size() == (8 + 8 * 4) * 8);
+
+	std::set<std::string> descriptions;
+	for (auto& v : variants)
+		descriptions.insert(DescribeVariant(v.second));
+	CHECK(descriptions.size() == variants.size());
+}
+
+static void TestDescribe()
+{
+	CHECK(DescribeVariant({ ShaderFeatureNormalMap | ShaderFeatureShadows, 5, 3 }) == "NORMAL_MAP SHADOWS PCF_TAPS=5 LIGHTS=DP");
+	CHECK(DescribeVariant({ 0, 1, 0 }) == "LIGHTS=none");
+}
+
+int main()
+{
+	TestNormalize();
+	TestAllKeys();
+	TestDescribe();
+	return TestsPassed("ShaderVariant");
+}
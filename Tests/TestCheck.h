@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// --------------------------------------------------------
+// Checks for the CPU-only tests in this folder
+//
+// - Each test is its own program with its own main(), built
+//   outside of the project against the files it tests, e.g.
+//     cl /std:c++17 /EHsc /I.. RingAllocatorTests.cpp ..\RingAllocator.cpp
+//   (the command for each is at the top of its file)
+// - None of them need a device, a window or any assets
+// - CHECK stays on in release builds, unlike assert()
+// --------------------------------------------------------
+#define CHECK(condition) \
+	do { if (!(condition)) { std::printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); std::exit(1); } } while (0)
+
+// A stand-in for a graphics object that's only compared and
+// passed along, never called - no device needed.  Keep them
+// out of reference counting (ComPtr::Attach and Detach).
+template<typename T>
+T* FakeObject(uintptr_t id)
+{
+	return reinterpret_cast<T*>(id * 64);
+}
+
+// Prints the pass line, for the end of main()
+inline int TestsPassed(const char* name)
+{
+	std::printf("%s: all checks passed\n", name);
+	return 0;
+}
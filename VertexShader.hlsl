@@ -2,16 +2,21 @@
 
 
 
-cbuffer ExternalData : register(b0)
+cbuffer PerFrame : register(b0)
 {
-    matrix world;
-    matrix worldInvTrans;
     matrix view;
     matrix projection;
     
     matrix shadowView;
     matrix shadowProjection;
 };
+
+cbuffer PerObject : register(b1)
+{
+    matrix world;
+    matrix worldInvTrans;
+    uint2 lightRange;
+};
 // --------------------------------------------------------
 // The entry point (main method) for our vertex shader
 // 
@@ -38,6 +43,7 @@ VertexToPixel main( VertexShaderInput input )
 	
     matrix shadowWVP = mul(shadowProjection, mul(shadowView, world));
     output.shadowPos = mul(shadowWVP, float4(input.localPosition, 1.0f));
+    output.lightRange = lightRange;
 	// Whatever we return will make its way through the pipeline to the
 	// next programmable stage we're using (the pixel shader for now)
 	return output;
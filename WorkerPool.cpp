@@ -0,0 +1,84 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+
+	for (unsigned int i = 1; i < threadCount; i++)
+		threads.emplace_back(&WorkerPool::WorkerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto& t : threads)
+		t.join();
+}
+
+// --------------------------------------------------------
+// Runs job(0) to job(jobCount - 1), each exactly once
+// - Small runs (or a pool of one) stay on this thread
+// --------------------------------------------------------
+void WorkerPool::Run(size_t jobCount, const std::function<void(size_t)>& job)
+{
+	if (jobCount == 0)
+		return;
+
+	if (threads.empty() || jobCount == 1)
+	{
+		for (size_t i = 0; i < jobCount; i++)
+			job(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->job = &job;
+		this->jobCount = jobCount;
+		nextJob = 0;
+		busyWorkers = (unsigned int)threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	DoJobs();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&]() { return busyWorkers == 0; });
+	this->job = 0;
+	this->jobCount = 0;
+}
+
+void WorkerPool::WorkerLoop()
+{
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+		}
+
+		DoJobs();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0)
+			finished.notify_one();
+	}
+}
+
+void WorkerPool::DoJobs()
+{
+	for (size_t i = nextJob++; i < jobCount; i = nextJob++)
+		(*job)(i);
+}
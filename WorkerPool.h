@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------
+// A fixed set of threads that stay asleep between jobs, for
+// work that runs every frame
+//
+// - Run() hands out job indices to the workers and to the
+//   calling thread, which counts as one of the threads, and
+//   returns once every job is done
+// - One Run() at a time, from one thread
+// --------------------------------------------------------
+class WorkerPool
+{
+public:
+	// 0 for one per hardware thread
+	WorkerPool(unsigned int threadCount = 0);
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Run(size_t jobCount, const std::function<void(size_t)>& job);
+
+	// Including the calling thread
+	unsigned int GetThreadCount() const { return (unsigned int)threads.size() + 1; }
+
+private:
+	void WorkerLoop();
+	void DoJobs();
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	uint64_t generation = 0;	// Bumped by each Run()
+	unsigned int busyWorkers = 0;
+	bool quit = false;
+
+	// The current Run()'s jobs
+	const std::function<void(size_t)>* job = 0;
+	size_t jobCount = 0;
+	std::atomic<size_t> nextJob = 0;
+};